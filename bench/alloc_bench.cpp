@@ -0,0 +1,148 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+/**
+ * global heap allocations per server connection lifecycle (accept, echo of
+ * one message, close) with the default heap, a monotonic arena per
+ * connection and a shared pool, and with handlers shared by the server
+ * instead of set on every socket. Clients use plain blocking sockets, so
+ * only the server allocates.
+ * */
+
+#include "bench.hpp"
+
+#include <tepsoc.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+std::atomic<long> heap_allocations(0);
+}
+
+void *operator new(std::size_t size) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  std::size_t a = std::max<std::size_t>((std::size_t)alignment, sizeof(void *));
+  if (void *p = std::aligned_alloc(a, (size + a - 1) / a * a))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+using namespace tp::net;
+using namespace tp::bench;
+
+namespace {
+
+/**
+ * arena with its first block, so a short connection takes one allocation
+ * */
+struct arena {
+  char buffer[4096];
+  std::pmr::monotonic_buffer_resource resource{buffer, sizeof(buffer)};
+};
+
+void lifecycles(const std::string &variant,
+                std::function<std::shared_ptr<std::pmr::memory_resource>()>
+                    factory,
+                bool shared_handlers = false) {
+  const int connections = 2000;
+  const unsigned int port = 9331;
+  event_loop loop(loop_backend::EPOLL);
+  loop.start();
+  server srv(loop, [shared_handlers](tp::net::socket &s) {
+    if (!shared_handlers)
+      s.on(DATA, [&s](std::vector<char> data) { s.write(std::move(data)); });
+  });
+  srv.on(LISTENING, []() {});
+  if (shared_handlers) {
+    connection_handlers handlers;
+    handlers.data = [](tp::net::socket &s, std::string_view data) {
+      s.write(data.data(), data.size());
+    };
+    srv.set_connection_handlers(handlers);
+  }
+  if (factory)
+    srv.set_memory_resource(factory);
+  srv.listen(port, "127.0.0.1");
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  char message[64] = {}, reply[64];
+  long before = heap_allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < connections; i++) {
+    int c = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (::connect(c, (sockaddr *)&addr, sizeof(addr)) != 0)
+      throw std::runtime_error("connect failed");
+    if ((::send(c, message, sizeof(message), 0) != sizeof(message)) ||
+        (::recv(c, reply, sizeof(reply), MSG_WAITALL) != sizeof(reply)))
+      throw std::runtime_error("echo failed");
+    ::close(c);
+  }
+  while (srv.get_stats().active)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  double t = seconds_since(start);
+  long allocations = heap_allocations - before;
+  report("alloc_per_connection", variant, (double)allocations / connections,
+         "heap allocations");
+  report("alloc_lifecycle", variant, connections / t, "connections/s");
+}
+
+TEPSOC_BENCH("alloc", []() {
+  lifecycles("heap", nullptr);
+  lifecycles("arena",
+             []() -> std::shared_ptr<std::pmr::memory_resource> {
+               auto a = std::make_shared<arena>();
+               return std::shared_ptr<std::pmr::memory_resource>(
+                   a, &a->resource);
+             });
+  auto pool = std::make_shared<std::pmr::synchronized_pool_resource>();
+  lifecycles("pool", [pool]() { return pool; });
+  lifecycles("shared_handlers", nullptr, true);
+});
+
+} // namespace
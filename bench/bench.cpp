@@ -0,0 +1,73 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include "bench.hpp"
+
+#include <tepsoc_trace.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace tp {
+namespace bench {
+
+std::vector<bench_case> &registry() {
+  static std::vector<bench_case> cases;
+  return cases;
+}
+
+void report(const std::string &name, const std::string &variant, double value,
+            const std::string &unit) {
+  std::cout << std::left << std::setw(24) << name << std::setw(12) << variant
+            << std::right << std::setw(16) << std::fixed
+            << std::setprecision(1) << value << " " << unit << std::endl;
+}
+
+} // namespace bench
+} // namespace tp
+
+/**
+ * run all benchmarks, or only these whose name contains one of arguments.
+ * When the library records the trace, it is written to the file given in
+ * TEPSOC_BENCH_TRACE.
+ * */
+int main(int argc, char **argv) {
+  for (auto &c : tp::bench::registry()) {
+    bool selected = argc < 2;
+    for (int i = 1; i < argc; i++)
+      if (c.name.find(argv[i]) != std::string::npos)
+        selected = true;
+    if (selected)
+      c.run();
+  }
+  if (const char *path = std::getenv("TEPSOC_BENCH_TRACE");
+      path && tp::net::trace_enabled()) {
+    std::ofstream out(path);
+    tp::net::write_chrome_trace(out);
+  }
+  return 0;
+}
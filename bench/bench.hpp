@@ -0,0 +1,75 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__BENCH__HPP___
+#define __TP__NET__BENCH__HPP___
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace tp {
+namespace bench {
+
+/**
+ * registered benchmark. Every *_bench.cpp registers its cases with
+ * TEPSOC_BENCH, bench.cpp runs them.
+ * */
+struct bench_case {
+  std::string name;
+  std::function<void()> run;
+};
+
+std::vector<bench_case> &registry();
+
+struct registrar {
+  registrar(std::string name, std::function<void()> run) {
+    registry().push_back({std::move(name), std::move(run)});
+  }
+};
+
+/**
+ * print one result line
+ * */
+void report(const std::string &name, const std::string &variant, double value,
+            const std::string &unit);
+
+inline double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace bench
+} // namespace tp
+
+#define TEPSOC_BENCH_CAT2(a, b) a##b
+#define TEPSOC_BENCH_CAT(a, b) TEPSOC_BENCH_CAT2(a, b)
+#define TEPSOC_BENCH(name, fn)                                                 \
+  static tp::bench::registrar TEPSOC_BENCH_CAT(bench_registrar_,              \
+                                                __LINE__)(name, fn)
+
+#endif
@@ -0,0 +1,122 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+/**
+ * request/reply of small length prefixed messages over socketpair adopted by
+ * the server. The string path frames the DATA string by hand and writes
+ * every reply as its own string; the codec path decodes views of the
+ * received data and writes the replies to one read as one encode_buffer.
+ * The client is a blocking thread that keeps a window of messages in flight.
+ * */
+
+#include "bench.hpp"
+
+#include <tepsoc_codec.hpp>
+
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace tp::net;
+using namespace tp::bench;
+
+namespace {
+
+const long messages = 400000;
+const int window = 64;
+const std::size_t payload = 32;
+
+std::string frame(const std::string &m) {
+  std::string f(4, '\0');
+  f[0] = m.size() >> 24;
+  f[1] = m.size() >> 16;
+  f[2] = m.size() >> 8;
+  f[3] = m.size();
+  return f + m;
+}
+
+void string_path(tp::net::socket &s) {
+  auto pending = std::make_shared<std::string>();
+  s.on(DATA, [&s, pending](std::string data) {
+    *pending += data;
+    std::size_t pos = 0;
+    while (pending->size() - pos >= 4) {
+      auto *b = (const unsigned char *)pending->data() + pos;
+      std::size_t length = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+      if (pending->size() - pos - 4 < length)
+        break;
+      std::string message = pending->substr(pos + 4, length);
+      s.write(frame(message));
+      pos += 4 + length;
+    }
+    pending->erase(0, pos);
+  });
+}
+
+void codec_path(tp::net::socket &s) {
+  on_messages<length_prefixed_codec>(
+      s, [](std::string_view m, encode_buffer &out) {
+        length_prefixed_codec().encode(m, out);
+      });
+}
+
+void request_reply(const std::string &variant,
+                   std::function<void(tp::net::socket &)> handler) {
+  event_loop loop(loop_backend::EPOLL);
+  loop.start();
+  server srv(loop, handler);
+  std::array<int, 2> pair;
+  ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair.data());
+  srv.adopt(pair[1]);
+
+  std::string batch;
+  for (int i = 0; i < window; i++)
+    batch += frame(std::string(payload, 'm'));
+  std::vector<char> replies(batch.size());
+  auto start = std::chrono::steady_clock::now();
+  for (long sent = 0; sent < messages; sent += window) {
+    if (::send(pair[0], batch.data(), batch.size(), 0) != (long)batch.size())
+      throw std::runtime_error("send failed");
+    if (::recv(pair[0], replies.data(), replies.size(), MSG_WAITALL) !=
+        (long)replies.size())
+      throw std::runtime_error("recv failed");
+  }
+  double t = seconds_since(start);
+  ::close(pair[0]);
+  while (srv.get_stats().active)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  report("codec_messages", variant, messages / t, "messages/s");
+}
+
+TEPSOC_BENCH("codec", []() {
+  request_reply("string", string_path);
+  request_reply("codec", codec_path);
+});
+
+} // namespace
@@ -0,0 +1,87 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+/**
+ * small datagrams over loopback: batched sendmmsg and recvmmsg, and the same
+ * with GSO and GRO
+ * */
+
+#include "bench.hpp"
+
+#include <tepsoc_dgram.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+using namespace tp::net;
+using namespace tp::bench;
+
+namespace {
+
+void datagrams(const std::string &variant, bool offload) {
+  const long total = 1000000;
+  const long window = 4096; // datagrams in flight, so the receiver keeps up
+  const std::string message(64, 'd');
+
+  event_loop receiver_loop(loop_backend::EPOLL), sender_loop(loop_backend::EPOLL);
+  receiver_loop.start();
+  sender_loop.start();
+  dgram_socket receiver(receiver_loop), sender(sender_loop);
+  std::atomic<long> received(0);
+  receiver.set_gro(offload)
+      .on(MESSAGE, [&received](const dgram_message &) { received++; })
+      .bind(0, "127.0.0.1");
+  sender.set_gso(offload);
+  auto to = receiver.local_address();
+
+  auto start = std::chrono::steady_clock::now();
+  long sent = 0;
+  while (sent < total) {
+    if (sent - received > window) {
+      std::this_thread::yield();
+      continue;
+    }
+    sender_loop.synchronized([&]() {
+      for (int i = 0; i < 256; i++, sent++)
+        sender.send_to(to, message);
+    });
+  }
+  // datagrams can be lost, so wait until nothing more arrives
+  long last = -1;
+  while (received != last) {
+    last = received;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  double t = seconds_since(start) - 0.02;
+  report("dgram_64b", variant, received / t, "datagrams/s");
+  report("dgram_64b_lost", variant, 100.0 * (total - received) / total, "%");
+}
+
+TEPSOC_BENCH("dgram", []() {
+  datagrams("sendmmsg", false);
+  datagrams("gso_gro", true);
+});
+
+} // namespace
@@ -0,0 +1,150 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+/**
+ * echo over loopback on every available event loop backend: round trips of
+ * small messages and bulk throughput
+ * */
+
+#include "bench.hpp"
+
+#include <tepsoc.hpp>
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace tp::net;
+using namespace tp::bench;
+
+namespace {
+
+std::vector<std::pair<std::string, loop_backend>> backends() {
+  std::vector<std::pair<std::string, loop_backend>> ret = {
+      {"epoll", loop_backend::EPOLL}};
+  if (event_loop::io_uring_available())
+    ret.push_back({"io_uring", loop_backend::IO_URING});
+  return ret;
+}
+
+void echo(socket &s) {
+  s.on(DATA, [&s](std::vector<char> data) { s.write(std::move(data)); });
+}
+
+void ping_pong(const std::string &variant, loop_backend backend,
+               unsigned int port) {
+  const int connections = 16;
+  const long round_trips = 20000;
+  const std::string message(64, 'x');
+
+  event_loop server_loop(backend), client_loop(backend);
+  server_loop.start();
+  client_loop.start();
+  server srv(server_loop, echo);
+  srv.on(LISTENING, [](unsigned int, std::string) {});
+  srv.listen(port, "127.0.0.1");
+
+  std::atomic<long> remaining(round_trips);
+  std::promise<void> done;
+  std::atomic<bool> done_set(false);
+  std::vector<socket_p> clients;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < connections; i++) {
+    auto c = std::make_shared<socket>(client_loop);
+    socket *raw = c.get();
+    auto received = std::make_shared<std::size_t>(0);
+    c->on(CONNECT, [raw, &message]() { raw->write(message); });
+    c->on(DATA, [raw, received, &message, &remaining, &done,
+                 &done_set](std::vector<char> data) {
+      *received += data.size();
+      while (*received >= message.size()) {
+        *received -= message.size();
+        long left = --remaining;
+        if (left > 0) {
+          raw->write(message);
+        } else if ((left <= 0) && !done_set.exchange(true)) {
+          done.set_value();
+        }
+      }
+    });
+    c->connect(port, "127.0.0.1");
+    clients.push_back(c);
+  }
+  done.get_future().wait();
+  double t = seconds_since(start);
+  report("echo_ping_pong", variant, round_trips / t, "round trips/s");
+  clients.clear();
+}
+
+void throughput(const std::string &variant, loop_backend backend,
+                unsigned int port) {
+  const std::size_t chunk = 64 * 1024;
+  const std::size_t total = 256 * chunk;
+
+  event_loop server_loop(backend), client_loop(backend);
+  server_loop.start();
+  client_loop.start();
+  server srv(server_loop, echo);
+  srv.on(LISTENING, [](unsigned int, std::string) {});
+  srv.listen(port, "127.0.0.1");
+
+  std::promise<void> done;
+  auto c = std::make_shared<socket>(client_loop);
+  socket *raw = c.get();
+  auto received = std::make_shared<std::size_t>(0);
+  auto start = std::chrono::steady_clock::now();
+  c->on(CONNECT, [raw, chunk, total]() {
+    std::vector<char> data(chunk, 'y');
+    for (std::size_t sent = 0; sent < total; sent += chunk)
+      raw->write(data);
+  });
+  c->on(DATA, [received, total, &done](std::vector<char> data) {
+    std::size_t before = *received;
+    *received += data.size();
+    if ((before < total) && (*received >= total))
+      done.set_value();
+  });
+  c->connect(port, "127.0.0.1");
+  done.get_future().wait();
+  double t = seconds_since(start);
+  report("echo_throughput", variant, total / t / (1024 * 1024), "MiB/s");
+  c.reset();
+}
+
+TEPSOC_BENCH("echo_ping_pong", []() {
+  unsigned int port = 9301;
+  for (auto &[name, backend] : backends())
+    ping_pong(name, backend, port++);
+});
+
+TEPSOC_BENCH("echo_throughput", []() {
+  unsigned int port = 9311;
+  for (auto &[name, backend] : backends())
+    throughput(name, backend, port++);
+});
+
+} // namespace
@@ -0,0 +1,172 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+/**
+ * memory of idle connections. Clients are plain blocking descriptors in this
+ * process, bound to 127.0.0.2, 127.0.0.3, ... with IP_BIND_ADDRESS_NO_PORT,
+ * so every source address has its own range of ephemeral ports towards the
+ * listening port. The heap in use (mallinfo2) and the resident size
+ * are compared before the connections, when all are accepted and idle, and
+ * after every connection echoed one message and went idle again.
+ *
+ * The number of connections is TEPSOC_BENCH_CONNECTIONS (1000000 by
+ * default), limited by the descriptors the process may open: two per
+ * connection. Raise the hard RLIMIT_NOFILE (and fs.nr_open) for a million.
+ * */
+
+#include "bench.hpp"
+
+#include <tepsoc.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace tp::net;
+using namespace tp::bench;
+
+namespace {
+
+const unsigned int port = 9351;
+// connections from one source address, below the ephemeral port range
+const long per_address = 20000;
+// connects between waits for the server, below the listen backlog, so
+// the accept queue does not overflow
+const long batch = 1000;
+const int backlog = 4096;
+
+long target_connections() {
+  rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  long wanted = 1000000;
+  if (const char *env = std::getenv("TEPSOC_BENCH_CONNECTIONS"))
+    wanted = std::atol(env);
+  long possible = ((long)limit.rlim_cur - 64) / 2;
+  return std::max(1L, std::min(wanted, possible));
+}
+
+struct memory_use {
+  std::size_t heap;
+  std::size_t resident;
+};
+
+memory_use measure() {
+  memory_use m;
+  m.heap = mallinfo2().uordblks;
+  std::ifstream statm("/proc/self/statm");
+  std::size_t size = 0, resident = 0;
+  statm >> size >> resident;
+  m.resident = resident * sysconf(_SC_PAGESIZE);
+  return m;
+}
+
+void wait_active(server &srv, std::size_t n) {
+  while (srv.get_stats().active != n)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+void idle() {
+  long connections = target_connections();
+  event_loop loop(loop_backend::EPOLL);
+  loop.start();
+  server srv(loop, [](tp::net::socket &s) {
+    s.on(DATA, [&s](std::string data) { s.write(std::move(data)); });
+  });
+  admission_limits limits;
+  limits.backlog = backlog;
+  srv.on(LISTENING, []() {}).set_limits(limits).listen(port, "127.0.0.1");
+  wait_active(srv, 0);
+  malloc_trim(0);
+  auto before = measure();
+
+  std::vector<int> clients;
+  clients.reserve(connections);
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < connections; i++) {
+    int c = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(c, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+    sockaddr_in from = {};
+    from.sin_family = AF_INET;
+    from.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + i / per_address);
+    sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((c < 0) || (::bind(c, (sockaddr *)&from, sizeof(from)) != 0) ||
+        (::connect(c, (sockaddr *)&to, sizeof(to)) != 0))
+      throw std::runtime_error("connection " + std::to_string(i) +
+                               " failed: " + strerror(errno));
+    clients.push_back(c);
+    if ((i + 1) % batch == 0)
+      wait_active(srv, i + 1);
+  }
+  wait_active(srv, connections);
+  double t = seconds_since(start);
+  auto accepted = measure();
+
+  char message[512] = {}, reply[512];
+  for (int c : clients)
+    if ((::send(c, message, sizeof(message), 0) != sizeof(message)) ||
+        (::recv(c, reply, sizeof(reply), MSG_WAITALL) != sizeof(reply)))
+      throw std::runtime_error("echo failed");
+  auto used = measure();
+
+  report("idle_connections", "count", connections, "connections");
+  report("idle_connect", "rate", connections / t, "connections/s");
+  report("idle_heap", "accepted",
+         (double)(accepted.heap - before.heap) / connections,
+         "bytes/connection");
+  report("idle_heap", "after_echo",
+         (double)(used.heap - before.heap) / connections, "bytes/connection");
+  report("idle_resident", "accepted",
+         (double)(accepted.resident - before.resident) / connections,
+         "bytes/connection");
+  report("idle_resident", "after_echo",
+         (double)(used.resident - before.resident) / connections,
+         "bytes/connection");
+
+  for (int c : clients)
+    ::close(c);
+  wait_active(srv, 0);
+}
+
+TEPSOC_BENCH("idle", idle);
+
+} // namespace
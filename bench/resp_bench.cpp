@@ -0,0 +1,146 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+/**
+ * SET and GET on resp_server over loopback TCP, like redis-benchmark -t
+ * set,get: several client connections, each keeping pipeline commands in
+ * flight (-P). Clients are blocking threads.
+ * */
+
+#include "bench.hpp"
+
+#include <tepsoc_resp.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace tp::net;
+using namespace tp::bench;
+
+namespace {
+
+const unsigned int port = 9341;
+const int clients = 4;
+const long requests = 200000;
+
+struct key_hash {
+  using is_transparent = void;
+  std::size_t operator()(std::string_view k) const {
+    return std::hash<std::string_view>()(k);
+  }
+};
+
+int connect_client() {
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int c = ::socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (::connect(c, (sockaddr *)&addr, sizeof(addr)) != 0)
+    throw std::runtime_error("connect failed");
+  return c;
+}
+
+/**
+ * every client sends pipeline copies of command and reads the replies, of
+ * known size, until all requests are done
+ * */
+void run(const std::string &name, const std::string &command,
+         std::size_t reply_size, int pipeline) {
+  std::vector<int> connections;
+  for (int i = 0; i < clients; i++)
+    connections.push_back(connect_client());
+  std::string batch;
+  for (int i = 0; i < pipeline; i++)
+    batch += command;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int c : connections)
+    threads.emplace_back([c, &batch, reply_size, pipeline]() {
+      std::vector<char> replies(reply_size * pipeline);
+      for (long done = 0; done < requests / clients; done += pipeline) {
+        if ((::send(c, batch.data(), batch.size(), 0) != (long)batch.size()) ||
+            (::recv(c, replies.data(), replies.size(), MSG_WAITALL) !=
+             (long)replies.size()))
+          throw std::runtime_error("request failed");
+      }
+      ::close(c);
+    });
+  for (auto &t : threads)
+    t.join();
+  double t = seconds_since(start);
+  std::string variant = "P";
+  variant += std::to_string(pipeline);
+  report(name, variant, requests / t, "requests/s");
+}
+
+void set_get() {
+  std::unordered_map<std::string, std::string, key_hash, std::equal_to<>> db;
+  event_loop loop;
+  loop.start();
+  resp_server srv(loop);
+  srv.command("SET", 3,
+              [&db](const std::vector<resp_value> &args, encode_buffer &out) {
+                auto found = db.find(args[1].text);
+                if (found == db.end())
+                  db.emplace(args[1].text, args[2].text);
+                else
+                  found->second.assign(args[2].text);
+                resp_codec::simple(out, "OK");
+              })
+      .command("GET", 2,
+               [&db](const std::vector<resp_value> &args, encode_buffer &out) {
+                 auto found = db.find(args[1].text);
+                 if (found == db.end())
+                   resp_codec::nil(out);
+                 else
+                   resp_codec::bulk(out, found->second);
+               });
+  srv.listen(port, "127.0.0.1");
+
+  // the same command as redis-benchmark, 3 bytes of value
+  std::string set = "*3\r\n$3\r\nSET\r\n$16\r\nkey:__rand_int__\r\n$3\r\nxxx\r\n";
+  std::string get = "*2\r\n$3\r\nGET\r\n$16\r\nkey:__rand_int__\r\n";
+  for (int pipeline : {1, 16}) {
+    run("resp_set", set, 5, pipeline); // +OK
+    run("resp_get", get, 9, pipeline); // $3 xxx
+  }
+  while (srv.get_server().get_stats().active)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+TEPSOC_BENCH("resp", set_get);
+
+} // namespace
@@ -0,0 +1,154 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+/**
+ * echo over loopback TCP, over unix domain socket and over socketpair adopted
+ * by the server, all on epoll: round trips of small messages and bulk
+ * throughput
+ * */
+
+#include "bench.hpp"
+
+#include <tepsoc.hpp>
+
+#include <array>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace tp::net;
+using namespace tp::bench;
+
+namespace {
+
+using tp::net::socket;
+
+struct endpoint {
+  std::string variant;
+  std::function<void(server &)> listen;
+  std::function<void(socket &)> connect;
+};
+
+std::vector<endpoint> endpoints(unsigned int port) {
+  std::string path = "/tmp/tepsoc_bench_" + std::to_string(getpid()) + "_" +
+                     std::to_string(port) + ".sock";
+  // connected pair without listening, the server adopts one end
+  auto pair = std::make_shared<std::array<int, 2>>();
+  return {{"tcp", [port](server &s) { s.listen(port, "127.0.0.1"); },
+           [port](socket &c) { c.connect(port, "127.0.0.1"); }},
+          {"unix", [path](server &s) { s.listen_unix(path); },
+           [path](socket &c) { c.connect_unix(path); }},
+          {"pair",
+           [pair](server &s) {
+             ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair->data());
+             s.adopt((*pair)[1]);
+           },
+           [pair](socket &c) { c.wrap((*pair)[0]); }}};
+}
+
+void echo(socket &s) {
+  s.on(DATA, [&s](std::vector<char> data) { s.write(std::move(data)); });
+}
+
+void ping_pong(const endpoint &ep) {
+  const long round_trips = 20000;
+  const std::string message(64, 'x');
+
+  event_loop server_loop(loop_backend::EPOLL), client_loop(loop_backend::EPOLL);
+  server_loop.start();
+  client_loop.start();
+  server srv(server_loop, echo);
+  srv.on(LISTENING, [](unsigned int, std::string) {});
+  ep.listen(srv);
+
+  long remaining = round_trips;
+  std::size_t received = 0;
+  std::promise<void> done;
+  socket c(client_loop);
+  auto start = std::chrono::steady_clock::now();
+  c.on(CONNECT, [&]() { c.write(message); });
+  c.on(DATA, [&](std::vector<char> data) {
+    received += data.size();
+    while (received >= message.size()) {
+      received -= message.size();
+      if (--remaining > 0)
+        c.write(message);
+      else if (remaining == 0)
+        done.set_value();
+    }
+  });
+  ep.connect(c);
+  done.get_future().wait();
+  double t = seconds_since(start);
+  report("local_latency", ep.variant, t / round_trips * 1e6, "us/round trip");
+}
+
+void throughput(const endpoint &ep) {
+  const std::size_t chunk = 64 * 1024;
+  const std::size_t total = 256 * chunk;
+
+  event_loop server_loop(loop_backend::EPOLL), client_loop(loop_backend::EPOLL);
+  server_loop.start();
+  client_loop.start();
+  server srv(server_loop, echo);
+  srv.on(LISTENING, [](unsigned int, std::string) {});
+  ep.listen(srv);
+
+  std::promise<void> done;
+  std::size_t received = 0;
+  socket c(client_loop);
+  auto start = std::chrono::steady_clock::now();
+  c.on(CONNECT, [&]() {
+    std::vector<char> data(chunk, 'y');
+    for (std::size_t sent = 0; sent < total; sent += chunk)
+      c.write(data);
+  });
+  c.on(DATA, [&](std::vector<char> data) {
+    std::size_t before = received;
+    received += data.size();
+    if ((before < total) && (received >= total))
+      done.set_value();
+  });
+  ep.connect(c);
+  done.get_future().wait();
+  double t = seconds_since(start);
+  report("local_throughput", ep.variant, total / t / (1024 * 1024), "MiB/s");
+}
+
+TEPSOC_BENCH("local_latency", []() {
+  for (auto &ep : endpoints(9321))
+    ping_pong(ep);
+});
+
+TEPSOC_BENCH("local_throughput", []() {
+  for (auto &ep : endpoints(9322))
+    throughput(ep);
+});
+
+} // namespace
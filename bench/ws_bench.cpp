@@ -0,0 +1,143 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+/**
+ * WebSocket unmasking and fan-out. Unmasking compares a byte loop with
+ * websocket_mask on 64 KiB payloads. Fan-out sends small text messages to
+ * many websockets on socketpairs: every websocket encoding its own frame,
+ * or one broadcast frame shared by all of them. Messages fit in the socket
+ * buffers, so only the sending is timed; the clients read afterwards.
+ * */
+
+#include "bench.hpp"
+
+#include <tepsoc_ws.hpp>
+
+#include <array>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace tp::net;
+using namespace tp::bench;
+
+namespace {
+
+const std::size_t unmask_size = 64 * 1024;
+const int unmask_rounds = 20000;
+const int fanout_sockets = 1000;
+const int fanout_rounds = 100;
+const std::size_t fanout_message = 128;
+
+void unmask() {
+  const unsigned char key[4] = {0x11, 0x22, 0x33, 0x44};
+  std::vector<char> src(unmask_size, 'u'), dst(unmask_size);
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < unmask_rounds; r++) {
+    for (std::size_t i = 0; i < unmask_size; i++)
+      dst[i] = src[i] ^ key[i & 3];
+    // keep the stores
+    asm volatile("" : : "r"(dst.data()) : "memory");
+  }
+  double t = seconds_since(start);
+  report("ws_unmask", "bytes", unmask_size * unmask_rounds / t / 1e9, "GB/s");
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < unmask_rounds; r++) {
+    websocket_mask(dst.data(), src.data(), unmask_size, key);
+    asm volatile("" : : "r"(dst.data()) : "memory");
+  }
+  t = seconds_since(start);
+  report("ws_unmask", websocket_mask_implementation(),
+         unmask_size * unmask_rounds / t / 1e9, "GB/s");
+}
+
+void fanout(const std::string &variant) {
+  event_loop loop(loop_backend::EPOLL);
+  loop.start();
+  std::vector<websocket *> websockets(fanout_sockets);
+  std::atomic<int> upgraded(0);
+  websocket_server srv(loop,
+                       [&](websocket &ws) { websockets[upgraded++] = &ws; });
+  std::string request = "GET / HTTP/1.1\r\nUpgrade: websocket\r\n"
+                        "Connection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                        "Sec-WebSocket-Version: 13\r\n\r\n";
+  std::vector<int> clients;
+  for (int i = 0; i < fanout_sockets; i++) {
+    std::array<int, 2> pair;
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair.data()))
+      throw std::runtime_error("socketpair failed");
+    srv.get_server().adopt(pair[1]);
+    ::send(pair[0], request.data(), request.size(), 0);
+    clients.push_back(pair[0]);
+  }
+  char buf[64 * 1024];
+  for (int c : clients)
+    ::recv(c, buf, sizeof(buf), 0);
+  while (upgraded < fanout_sockets)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  std::string message(fanout_message, 'm');
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < fanout_rounds; r++) {
+    if (variant == "broadcast")
+      srv.broadcast(WS_TEXT, message);
+    else
+      for (auto ws : websockets)
+        ws->send(message);
+  }
+  double t = seconds_since(start);
+  // frame of 128 bytes has 4 bytes of header
+  std::size_t expected = fanout_rounds * (fanout_message + 4);
+  for (int c : clients) {
+    std::size_t received = 0;
+    while (received < expected) {
+      long n = ::recv(c, buf, std::min(sizeof(buf), expected - received), 0);
+      if (n <= 0)
+        throw std::runtime_error("recv failed");
+      received += n;
+    }
+    ::close(c);
+  }
+  while (srv.get_server().get_stats().active)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  report("ws_fanout", variant, fanout_sockets * fanout_rounds / t,
+         "messages/s");
+}
+
+void run() {
+  unmask();
+  fanout("per_socket");
+  fanout("broadcast");
+}
+
+TEPSOC_BENCH("websocket", run);
+
+} // namespace
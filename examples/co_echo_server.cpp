@@ -0,0 +1,39 @@
+/**
+ * Echo server written with coroutines. You can check it using
+ *
+ * netcat localhost 2213
+ *
+ * Documentation license
+ * **/
+
+#include <tepsoc_co.hpp>
+
+#include <iostream>
+
+using namespace tp::net;
+
+task<> serve_client(socket_p s) {
+  std::vector<char> buf(4096);
+  while (auto n = co_await s->read_some(buf)) {
+    co_await s->write_all(std::string(buf.data(), n));
+  }
+}
+
+task<> accept_clients(server &srv) {
+  while (true) {
+    spawn(srv.get_loop(), serve_client(co_await srv.accept()));
+  }
+}
+
+int main() {
+  event_loop loop;
+  server srv(loop);
+  srv.on(LISTENING,
+         [](int port, std::string addr) {
+           std::cout << "listening: " << port << " on addr " << addr
+                     << std::endl;
+         })
+      .listen(2213);
+  spawn(loop, accept_clients(srv));
+  loop.run();
+}
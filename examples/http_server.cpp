@@ -25,10 +25,10 @@ struct request_t {
   std::list<std::string> req_lines;
   std::string last_req_line;
   std::size_t content_length;
-  tp::net::socket_p connection;
+  tp::net::socket *connection;
 };
 struct response_t {
-  tp::net::socket_p connection;
+  tp::net::socket *connection;
   std::string val;
   void send(std::string s) {val = s;}
 };
@@ -46,7 +46,16 @@ public:
       mappings;
   tp::net::server srv;
 
-  void on_header_finished(tp::net::socket_p s, request_p req) {
+  /**
+   * state of one connection, kept in the socket context. Request and
+   * response are parts of it, so they do not need allocations of their own.
+   * */
+  struct connection_t : public std::enable_shared_from_this<connection_t> {
+    request_t req;
+    response_t res;
+  };
+
+  void on_header_finished(tp::net::socket &s, request_p req) {
     std::cout << "header complete: " << req->method << " " << req->originalUrl
               << " " << req->http_version << std::endl;
     for (auto &[k, v] : req->headers) {
@@ -54,7 +63,7 @@ public:
     }
     req->stage = BODY;
   }
-  void on_request_finished(tp::net::socket_p s, request_p req,response_p res) {
+  void on_request_finished(tp::net::socket &s, request_p req,response_p res) {
     if (mappings[req->method].size() > 0) {
 
       // todo: pass next
@@ -65,9 +74,9 @@ public:
       prepared_response << "Content-Type: text/html\r\n";
       prepared_response << "\r\n";
       prepared_response << res->val;
-      s->end(prepared_response.str());
+      s.end(prepared_response.str());
     } else {
-      s->end(std::string("HTTP/1.1 200 OK\r\n") +
+      s.end(std::string("HTTP/1.1 200 OK\r\n") +
              std::string("Date: Mon, 27 Jul 2009 12:28:53 GMT\r\n") +
              std::string("Content-Type: text/html\r\n") + std::string("\r\n") +
              std::string("<html>\r\n") + std::string("<body>\r\n") +
@@ -79,7 +88,7 @@ public:
   std::map<input_stage_e, std::function<void(std::string &data, request_p)>>
       handle_incoming_data_map;
 
-  void on_incoming_data(tp::net::socket_p s, request_p req, response_p res,std::string &str) {
+  void on_incoming_data(tp::net::socket &s, request_p req, response_p res,std::string &str) {
     for (auto &c : str) {
       req->last_req_line = req->last_req_line + c;
       switch (req->stage) {
@@ -142,19 +151,26 @@ public:
 
   http_express_t &listen(int port) {
     using namespace tp::net;
-    srv.on(CONNECTION, [&](tp::net::socket_p s) {
-      request_p req = std::make_shared<request_t>();
-      response_p res = std::make_shared<response_t>();
-      req->connection = s;
-      res->connection = s;
-      std::cout << "client connected on socket " << s->get_wrapped_socket()
+    // handlers are shared by all connections, accepting only adds the state
+    connection_handlers handlers;
+    handlers.data = [this](tp::net::socket &s, std::string_view data) {
+      auto c = s.get_context<connection_t>()->shared_from_this();
+      request_p req(c, &c->req);
+      response_p res(c, &c->res);
+      std::string str(data);
+      req->stage = HTTP;
+      on_incoming_data(s, req, res, str);
+    };
+    handlers.end = [](tp::net::socket &) {
+      std::cout << "client clsed channel" << std::endl;
+    };
+    srv.set_connection_handlers(handlers);
+    srv.on(CONNECTION, [](tp::net::socket &s) {
+      auto c = std::make_shared<connection_t>();
+      c->req.connection = c->res.connection = &s;
+      s.set_context(c);
+      std::cout << "client connected on socket " << s.get_wrapped_socket()
                 << std::endl;
-      s->on(DATA, [=](std::string str) {
-        req->stage = HTTP;
-        on_incoming_data(s, req,res, str);
-      });
-      s->on(END,
-            [s, req]() { std::cout << "client clsed channel" << std::endl; });
     });
     srv.on(LISTENING,
            [](int port, std::string addr) {
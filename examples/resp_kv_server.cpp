@@ -0,0 +1,116 @@
+/**
+ * In-memory key-value store speaking the Redis protocol. You can check it
+ * using
+ *
+ * redis-cli -p 6380 set greeting hello
+ * redis-benchmark -p 6380 -t set,get -P 16 -q
+ *
+ * Documentation license
+ * **/
+
+#include <tepsoc_resp.hpp>
+
+#include <charconv>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+using namespace tp::net;
+
+using args_t = std::vector<resp_value>;
+
+/**
+ * keys can be looked up by views of the received command
+ * */
+struct key_hash {
+  using is_transparent = void;
+  std::size_t operator()(std::string_view k) const {
+    return std::hash<std::string_view>()(k);
+  }
+};
+
+int main(int argc, char **argv) {
+  unsigned int port = (argc > 1) ? std::stoi(argv[1]) : 6380;
+  // commands run in the loop thread, so the map is not locked
+  std::unordered_map<std::string, std::string, key_hash, std::equal_to<>> db;
+
+  event_loop loop;
+  resp_server kv(loop);
+  kv.command("GET", 2,
+             [&db](const args_t &args, encode_buffer &out) {
+               auto found = db.find(args[1].text);
+               if (found == db.end())
+                 resp_codec::nil(out);
+               else
+                 resp_codec::bulk(out, found->second);
+             })
+      .command("SET", -3,
+               [&db](const args_t &args, encode_buffer &out) {
+                 auto found = db.find(args[1].text);
+                 if (found == db.end())
+                   db.emplace(args[1].text, args[2].text);
+                 else
+                   found->second.assign(args[2].text);
+                 resp_codec::simple(out, "OK");
+               })
+      .command("DEL", -2,
+               [&db](const args_t &args, encode_buffer &out) {
+                 long long n = 0;
+                 for (std::size_t i = 1; i < args.size(); i++) {
+                   auto found = db.find(args[i].text);
+                   if (found != db.end()) {
+                     db.erase(found);
+                     n++;
+                   }
+                 }
+                 resp_codec::integer(out, n);
+               })
+      .command("EXISTS", -2,
+               [&db](const args_t &args, encode_buffer &out) {
+                 long long n = 0;
+                 for (std::size_t i = 1; i < args.size(); i++)
+                   n += db.count(args[i].text);
+                 resp_codec::integer(out, n);
+               })
+      .command("INCR", 2,
+               [&db](const args_t &args, encode_buffer &out) {
+                 auto &value = db[std::string(args[1].text)];
+                 long long n = 0;
+                 auto [ptr, ec] = std::from_chars(
+                     value.data(), value.data() + value.size(), n);
+                 if (value.size() &&
+                     ((ec != std::errc()) ||
+                      (ptr != value.data() + value.size()))) {
+                   resp_codec::error(
+                       out, "ERR value is not an integer or out of range");
+                   return;
+                 }
+                 value = std::to_string(++n);
+                 resp_codec::integer(out, n);
+               })
+      .command("MGET", -2,
+               [&db](const args_t &args, encode_buffer &out) {
+                 resp_codec::array(out, args.size() - 1);
+                 for (std::size_t i = 1; i < args.size(); i++) {
+                   auto found = db.find(args[i].text);
+                   if (found == db.end())
+                     resp_codec::nil(out);
+                   else
+                     resp_codec::bulk(out, found->second);
+                 }
+               })
+      .command("DBSIZE", 1,
+               [&db](const args_t &, encode_buffer &out) {
+                 resp_codec::integer(out, db.size());
+               })
+      .command("FLUSHALL", -1,
+               [&db](const args_t &, encode_buffer &out) {
+                 db.clear();
+                 resp_codec::simple(out, "OK");
+               });
+  kv.get_server().on(LISTENING, [](int port, std::string addr) {
+    std::cout << "listening: " << port << " on addr " << addr << std::endl;
+  });
+  kv.listen(port);
+  loop.run();
+}
@@ -30,33 +30,170 @@ SOFTWARE.
 #include <functional>
 #include <list>
 #include <map>
+#include <memory_resource>
 #include <mutex>
+#include <string_view>
 #include <thread>
+#include <typeinfo>
 #include <variant>
 #include <vector>
 
 #include <future>
 #include <optional>
 
+#include <tepsoc_loop.hpp>
+
+struct addrinfo;
+
 namespace tp {
 namespace net {
 class socket;
+class server;
+class recv_awaiter;
+class send_awaiter;
+class accept_awaiter;
+class connect_awaiter;
+struct dgram_message;
+class tls_context;
+class tls_session;
+struct tls_info;
 enum socket_event {
   CONNECT,   // when client socket is connected
   ERROR,     // when error is reported
   DATA,      // data in form of string
   END,       // when connection is about to end
   LISTENING, // when starting listening
-  CONNECTION // when someone connects to server socket
+  CONNECTION, // when someone connects to server socket
+  TIMEOUT,   // when connection timed out, see socket::set_timeout
+  FDS,       // when file descriptors are received over unix domain socket
+  MESSAGE,   // when datagram is received, see dgram_socket
+  FINISH     // when the write side is shut down after end()
+};
+/**
+ * kinds of connection timeouts. Name of the kind ("idle", "read" or "write")
+ * is given to the TIMEOUT handler.
+ * */
+enum socket_timeout {
+  IDLE_TIMEOUT,  // nothing was received nor sent
+  READ_TIMEOUT,  // nothing was received
+  WRITE_TIMEOUT  // queued data did not move
 };
+/**
+ * TCP options of sockets. Only options that are set are applied. Options of
+ * listening sockets (defer_accept, fast_open queue) are used by server.
+ * */
+struct socket_options {
+  std::optional<bool> no_delay;          // TCP_NODELAY
+  std::optional<int> send_buffer;        // SO_SNDBUF in bytes
+  std::optional<int> receive_buffer;     // SO_RCVBUF in bytes
+  std::optional<bool> keep_alive;        // SO_KEEPALIVE
+  std::optional<int> keep_idle;          // TCP_KEEPIDLE in seconds
+  std::optional<int> keep_interval;      // TCP_KEEPINTVL in seconds
+  std::optional<int> keep_count;         // TCP_KEEPCNT probes
+  std::optional<bool> quick_ack;         // TCP_QUICKACK, it is not permanent
+  std::optional<int> defer_accept;       // TCP_DEFER_ACCEPT in seconds
+  std::optional<int> fast_open;          // TCP_FASTOPEN queue, on client
+                                         // TCP_FASTOPEN_CONNECT
+  std::optional<int> busy_poll;          // SO_BUSY_POLL in microseconds
+  std::optional<int> not_sent_lowat;     // TCP_NOTSENT_LOWAT in bytes
+};
+
 using socket_event_callback_f = std::variant<
     std::function<void()>, std::function<void(std::string s)>,
     std::function<void(socket &)>, std::function<void(std::vector<char> v)>,
     std::function<void(const unsigned int port_, const std::string addr_)>,
-    std::function<void(std::shared_ptr<socket>)>
+    std::function<void(std::shared_ptr<socket>)>,
+    std::function<void(std::vector<int> fds)>,
+    std::function<void(const dgram_message &)>,
+    // DATA without copy, the view is valid during the call. Lambdas taking
+    // std::string_view must be wrapped in this std::function explicitly.
+    std::function<void(std::string_view v)>
     >;
 
+/**
+ * handlers shared by all connections of a server, see
+ * server::set_connection_handlers. They get the connection, so one table
+ * serves all of them. The view given to data is valid during the call.
+ * */
+struct connection_handlers {
+  std::function<void(socket &, std::string_view)> data;
+  std::function<void(socket &)> end;
+  std::function<void(socket &, const std::string &)> error;
+};
+
+/**
+ * immutable data that can be queued on many sockets without copying
+ * */
+using shared_buffer = std::shared_ptr<const std::vector<char>>;
+
+/**
+ * contiguous data handed over to the write queue. The storage of a string, a
+ * vector or a shared buffer is adopted without copying the bytes. Any other
+ * storage can be adopted together with its owner, that keeps the bytes valid
+ * until they are sent. It can only be moved.
+ * */
+class owned_buffer {
+  struct adopted_t {
+    std::shared_ptr<const void> owner;
+    const char *data;
+    std::size_t size;
+  };
+  std::variant<std::vector<char>, std::string, adopted_t> _storage;
+
+public:
+  owned_buffer() = default;
+  explicit owned_buffer(std::vector<char> &&data_);
+  explicit owned_buffer(std::string &&data_);
+  explicit owned_buffer(shared_buffer data_);
+  /**
+   * bytes [data_, data_ + size_) stay valid as long as owner_ exists
+   * */
+  owned_buffer(std::shared_ptr<const void> owner_, const char *data_,
+               std::size_t size_);
+
+  owned_buffer(owned_buffer &&) = default;
+  owned_buffer &operator=(owned_buffer &&) = default;
+  owned_buffer(const owned_buffer &) = delete;
+  owned_buffer &operator=(const owned_buffer &) = delete;
+
+  const char *data() const;
+  std::size_t size() const;
+  bool empty() const { return size() == 0; }
+};
+
+/**
+ * memory resource of one connection. Calls to the upstream resource are
+ * serialized, because the loop thread and writing threads allocate at the
+ * same time, and the standard arenas and pools are not synchronized. The
+ * socket object and its containers are allocated here, and the upstream is
+ * released when the last of them is freed.
+ * */
+class connection_memory : public std::pmr::memory_resource {
+  std::mutex _mutex;
+  std::shared_ptr<std::pmr::memory_resource> _upstream;
+
+protected:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override;
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+
+public:
+  /**
+   * nullptr means the default resource, which is used without locking
+   * */
+  explicit connection_memory(
+      std::shared_ptr<std::pmr::memory_resource> upstream_)
+      : _upstream(std::move(upstream_)) {}
+};
+
 class socket {
+  // containers of the socket allocate here, so it is released after them
+  std::shared_ptr<connection_memory> _memory;
+
   std::mutex _callbacks_mutex;
   std::mutex _in_handler_mutex;
 
@@ -69,18 +206,164 @@ class socket {
     f();
   }
 
+  // handlers of events not set on this socket, shared by all sockets
+  static const socket_event_callback_f &_default_callback(socket_event e);
+  // handlers of the server, set before the connection is wrapped
+  std::shared_ptr<const connection_handlers> _shared_handlers;
+  // the server table when it handles e and this socket does not
+  const connection_handlers *_shared_for(socket_event e);
+  // user data of the connection and its type
+  std::shared_ptr<void> _context;
+  const std::type_info *_context_type;
+
   inline socket_event_callback_f get_callback(socket_event e) {
     std::lock_guard<std::mutex> lock(_callbacks_mutex);
-    return _callbacks[e];
+    auto found = _callbacks.find(e);
+    return (found != _callbacks.end()) ? found->second : _default_callback(e);
   };
 
   std::atomic<bool> _active_connection;
 
-  std::map<socket_event, socket_event_callback_f> _callbacks;
+  std::pmr::map<socket_event, socket_event_callback_f> _callbacks;
   int connected_socket;
-  std::future<void> _recv_fut;
 
+  event_loop *_loop;
+  // expires when socket is destroyed, so posted work can detect it
+  std::shared_ptr<char> _alive;
+
+  // outgoing data that could not be sent immediately. Guarded by _write_mutex
+  std::mutex _write_mutex;
+  std::pmr::list<owned_buffer> _write_queue;
+  std::size_t _write_offset;
+  // bytes in the queue and in the submitted send, not yet sent. Read by the
+  // pipe peer without the lock.
+  std::atomic<std::size_t> _write_queued;
+  bool _end_requested;
+  bool _close_requested;
+  // half close: the write side is shut down, the peer ended its side. The
+  // connection is closed when both happened, or when the peer ends and half
+  // open connections are not allowed.
+  bool _write_ended;
+  bool _read_ended;
+  bool _allow_half_open;
+  // io_uring backend: receive stream is armed, send is submitted
+  bool _recv_streaming;
+  bool _send_in_flight;
+  // unix domain socket: served by epoll, so descriptors can be passed
+  bool _local;
+  // descriptors sent with the queued data. First is the number of queued
+  // bytes before the message, counted from the start of the previous
+  // message, or from the next byte to send for the front entry.
+  std::pmr::list<std::pair<std::size_t, std::vector<int>>> _queued_fds;
+
+  // timeouts in milliseconds (0 is disabled) and times of the last activity
+  // on the loop clock. The timer is moved only when it expires, so activity
+  // costs just storing the time.
+  unsigned long _timeouts[3];
+  std::atomic<std::uint64_t> _last_read;
+  std::atomic<std::uint64_t> _last_write;
+  timer_id _timeout_timer;
+
+  // received data not yet accepted by the DATA handler, or received while
+  // paused. Reading stops when it has _receive_limit bytes (0 is no limit), so
+  // the sender is slowed down by TCP. The end of stream received meanwhile
+  // waits for the backlog. Used by the loop thread.
+  std::pmr::list<std::vector<char>> _backlog;
+  std::size_t _backlog_bytes;
+  std::size_t _receive_limit;
+  bool _end_pending;
+  std::atomic<bool> _paused;
+
+  // coroutine mode: socket is driven by awaiters instead of DATA events
+  bool _co_mode;
+  std::function<void()> _read_ready;
+  std::function<void()> _write_ready;
+
+  // applied to connected socket, allocated only when set_options was called
+  std::unique_ptr<socket_options> _options;
+
+  // TLS: context given by use_tls, session of the connection and whether
+  // its handshake is done. The session is used with _write_mutex held.
+  std::shared_ptr<tls_context> _tls_context;
+  std::string _tls_server_name;
+  std::unique_ptr<tls_session> _tls;
+  bool _tls_ready;
+
+  // pipe: connection that gets the data read from this socket, and points
+  // back here. The kernel pipe between them (-1 when data is copied, because
+  // TLS records can not be spliced) and bytes held in it. After the end of
+  // stream is read, the write side of the peer is shut down when the pipe is
+  // empty. Used by the loop thread.
+  socket *_pipe_peer;
+  int _pipe_fds[2];
+  std::size_t _pipe_held;
+  bool _pipe_eof;
+
+  // server that accepted the connection, told when it is connected and
+  // closed. Cleared by the server when it is closed first.
+  server *_server;
+  std::weak_ptr<char> _server_alive;
+  std::weak_ptr<socket> _self;
+  // given by the previous process with the connection, see server::take_over
+  std::string _handoff_state;
+
+  void _handle_io(unsigned int events);
   void _handle_incoming_data();
+  long _receive_local(char *buf_, std::size_t size_);
+  long _receive_tls(char *buf_, std::size_t size_);
+  long _send_some(const char *data_, std::size_t size_);
+  // sends the front of the write queue, many buffers in one call
+  long _send_queued();
+  bool _uses_uring() const {
+    return _loop->uring() && !_local && !_tls && !_pipe_peer;
+  }
+  void _start_tls();
+  void _continue_handshake();
+  // called with _write_mutex held
+  void _shutdown_write();
+  void _on_received(const char *data_, long size_);
+  void _on_finish();
+  bool _reading_blocked() const {
+    return _paused || _end_pending ||
+           (_receive_limit && (_backlog_bytes >= _receive_limit));
+  }
+  void _deliver_backlog();
+  void _check_reading();
+  void _resume_reading();
+  void _on_stream_stopped();
+  void _start_reading();
+  void _flush_write_queue();
+  void _request_flush();
+  void _enqueue(const char *data_, std::size_t size_);
+  // offset_ is the part already sent, only when nothing else is queued
+  void _enqueue(owned_buffer buf_, std::size_t offset_);
+  void _clear_write_queue();
+  void _submit_send();
+  void _on_sent(std::shared_ptr<owned_buffer> buf_, long result_);
+  unsigned int _io_events();
+  socket &_write_bytes(const char *data_, std::size_t size_,
+                       owned_buffer *owned_ = nullptr);
+  void _finish();
+  // called with _write_mutex held
+  void _arm_timeout();
+  void _check_timeout();
+  void _on_timeout(socket_timeout kind);
+  void _close_connection();
+  void _start_pipe(socket &other_);
+  void _pipe_forward();
+  void _pipe_flush();
+  void _pipe_rearm();
+  bool _pipe_stalled() const;
+  void _end_pipe();
+
+  void _start_connect(unsigned int port_, std::string addr_,
+                      std::function<void(std::string err)> done_);
+  void _connect_next(std::shared_ptr<struct addrinfo> all_,
+                     struct addrinfo *rp,
+                     std::function<void(std::string err)> done_);
+  void _adopt(int s);
+  void _on_ready(unsigned int events);
+
   void _on_connect();
   /**
    * @brief handles data
@@ -88,9 +371,11 @@ class socket {
    * @return 0 if handled. -1 if there is no handler for data
    *
    */
-  int _on_data(const std::vector<char> &recvbuff);
+  // data_ is the read buffer, idle sockets keep no buffer of their own
+  int _on_data(const char *data_, std::size_t size_);
   void _on_end();
   void _on_error(const std::string err);
+  void _on_fds(std::vector<int> fds_);
 
 public:
   /**
@@ -100,31 +385,159 @@ public:
   socket &wrap(int s);
 
   int get_wrapped_socket() {return connected_socket; }
+  /**
+   * state that the previous process gave with this connection in
+   * server::hand_over. Empty for other connections.
+   * */
+  const std::string &get_handoff_state() const { return _handoff_state; }
   /**
    * sets callback for event
    * */
   socket &on(const socket_event evnt, socket_event_callback_f f);
   /**
-   * gracefully close connection.
+   * user data of the connection, for example state of the parser used by
+   * handlers shared by the server. It lives until it is replaced or the
+   * socket is destroyed. Set it in the CONNECTION handler or in handlers of
+   * this socket, they do not run at the same time.
+   * */
+  template <class T> socket &set_context(std::shared_ptr<T> context_) {
+    _context_type = context_ ? &typeid(T) : nullptr;
+    _context = std::move(context_);
+    return *this;
+  }
+  /**
+   * the context, or nullptr when it is not set or has another type
+   * */
+  template <class T> T *get_context() const {
+    return (_context_type && (*_context_type == typeid(T)))
+               ? static_cast<T *>(_context.get())
+               : nullptr;
+  }
+  /**
+   * gracefully close connection. Queued data is sent before the write side is
+   * shut down.
    * */
   socket &end(std::string data_to_send_and_close = "");
   /**
-   * write data to socket
+   * keep the connection open for writing after the peer ended its side.
+   * END is emitted as before, and the connection is closed after end() is
+   * called and FINISH is emitted. By default the connection is closed when
+   * the peer ends.
    * */
-  socket &write(const std::string data);
+  socket &set_allow_half_open(bool allow_ = true);
   /**
-   * write data to socket
+   * stop reading from the connection. Data received meanwhile is kept and
+   * given to DATA handler after resume(), and the sender is slowed down by
+   * TCP flow control.
+   * */
+  socket &pause();
+  /**
+   * deliver the data kept while paused and continue reading
+   * */
+  socket &resume();
+  bool is_paused() const { return _paused; }
+  /**
+   * bytes received and not taken by DATA handler (it is not set, or the
+   * socket is paused) before reading stops. 0 means no limit. It is 1 MiB by
+   * default.
+   * */
+  socket &set_receive_limit(std::size_t bytes_);
+  /**
+   * write data to socket. Data that can not be sent immediately is queued and
+   * sent by the event loop.
+   * */
+  socket &write(const std::string &data);
+  /**
+   * write data to socket. The part that can not be sent immediately is queued
+   * in the string's own storage.
    * */
-  socket &write(const std::vector<char> data);
+  socket &write(std::string &&data);
   /**
    * write data to socket
    * */
-  socket &write(const std::list<char> data);
+  socket &write(const std::vector<char> &data);
+  /**
+   * write data to socket. The part that can not be sent immediately is queued
+   * in the vector's own storage.
+   * */
+  socket &write(std::vector<char> &&data);
+  /**
+   * write size bytes starting at data
+   * */
+  socket &write(const char *data, std::size_t size);
+  /**
+   * write data whose storage is handed over to the socket
+   * */
+  socket &write(owned_buffer data);
+  /**
+   * write shared data. The buffer is queued without copying, so the same
+   * buffer can be written to many sockets.
+   * */
+  socket &write(shared_buffer data);
+  /**
+   * write first, then second, with nothing written by other threads between
+   * them. On a plain connection with nothing queued both go out in one
+   * sendmsg(2), so a small header does not need to be copied in front of
+   * the data that follows it.
+   * */
+  socket &write(owned_buffer first, owned_buffer second);
+  /**
+   * number of bytes written but not yet sent
+   * */
+  std::size_t get_queued_bytes();
+  /**
+   * forward everything received on this socket to other_ and everything
+   * received on other_ to this socket, without DATA events. Plain connections
+   * are joined with splice(2) through kernel pipes, so the data is not copied
+   * to user space. Reading stops while the receiving side can not take more.
+   * The end of stream is passed on as shutdown of the write side, and both
+   * connections are closed when both directions are finished, or when one of
+   * them is closed or broken. Data written before is sent first.
+   *
+   * Both sockets must use the same event loop. other_ may still be
+   * connecting; this socket then waits for it.
+   * */
+  socket &pipe(socket &other_);
 
   /**
    * connect to the port in the specified server
    * */
   socket &connect(unsigned int port_, char const *addr_);
+  /**
+   * connect to the unix domain socket. Path starting with '@' is in the
+   * abstract namespace.
+   * */
+  socket &connect_unix(const std::string &path_);
+  /**
+   * send file descriptors with data over unix domain socket. Descriptors are
+   * duplicated, so the caller can close them. Peer gets them in FDS event
+   * before the DATA with the first byte of data_, and must close them. Data
+   * must not be empty.
+   * */
+  socket &send_fds(const std::vector<int> &fds_,
+                   const std::string &data_ = std::string(1, '\0'));
+  /**
+   * emit TIMEOUT when there is no activity of the kind for ms milliseconds. 0
+   * disables the timeout. Without TIMEOUT handler the connection is closed.
+   * */
+  socket &set_timeout(socket_timeout kind, unsigned long ms);
+  /**
+   * set TCP options. They are applied now if the socket is connected, and
+   * before connecting otherwise. Failures are reported as ERROR.
+   * */
+  socket &set_options(const socket_options &options_);
+  /**
+   * use TLS on the next connection. CONNECT is emitted after the handshake,
+   * and handshake failure is reported as ERROR. server_name_ is checked
+   * against the certificate and sent as SNI; the connect address is used
+   * when it is empty. Not available for coroutine awaiters.
+   * */
+  socket &use_tls(std::shared_ptr<tls_context> context_,
+                  const std::string &server_name_ = "");
+  /**
+   * negotiated TLS parameters. Include tepsoc_tls.hpp to use it.
+   * */
+  tls_info get_tls_info();
   /**
    * check if the connection is still active.
    * Connection can be deactivated by the reading thread (when both sides closes
@@ -134,23 +547,98 @@ public:
    * */
   bool is_active() { return _active_connection; };
 
+  /**
+   * awaitable that reads at most buf.size() bytes. Result is number of bytes
+   * read, 0 means that peer closed connection. Include tepsoc_co.hpp to use it.
+   * */
+  recv_awaiter read_some(std::vector<char> &buf);
+  /**
+   * awaitable that sends whole data. Include tepsoc_co.hpp to use it.
+   * */
+  send_awaiter write_all(std::string data);
+  /**
+   * awaitable that connects to the server and results in socket_p that can be
+   * used with read_some and write_all. Include tepsoc_co.hpp to use it.
+   * */
+  static connect_awaiter connect(event_loop &loop, unsigned int port_,
+                                 char const *addr_);
+
+  /**
+   * the loop that drives this socket
+   * */
+  event_loop &get_loop() { return *_loop; }
+
   /**
    * constructs not connected client socket
    * */
   socket();
   /**
-   * destructor closes everything and waits for threads to finish
+   * constructs not connected client socket driven by the given loop
+   * */
+  explicit socket(event_loop &loop);
+  /**
+   * constructs socket whose containers (callbacks, write queue, received
+   * backlog) allocate from memory_. The resource is kept until the socket is
+   * destroyed, so an arena is released in bulk with the connection.
+   * connection_memory is used as is, other resources are wrapped in one.
+   * */
+  socket(event_loop &loop, std::shared_ptr<std::pmr::memory_resource> memory_);
+  /**
+   * destructor closes everything and waits for the loop to finish callbacks
    * */
   virtual ~socket();
 
   // socket(socket const&) = delete;
   // socket& operator=(socket const&) = delete;
-  template <class T> friend socket &socket_write(socket &sckt, const T &data_);
+  friend class server;
+  friend class recv_awaiter;
+  friend class send_awaiter;
+  friend class accept_awaiter;
+  friend class connect_awaiter;
 };
 using socket_p = std::shared_ptr<socket>;
 
 
-auto b = [](socket &) -> void {};
+inline auto b = [](socket &) -> void {};
+
+/**
+ * what server does with connections over the limits. Connections over the
+ * limit of one source address are always dropped.
+ * */
+enum overload_policy {
+  PAUSE_ACCEPTING, // leave connections in the listen backlog
+  DROP_CONNECTIONS // accept and reset them
+};
+/**
+ * admission control of server. 0 means no limit.
+ * */
+struct admission_limits {
+  int backlog = 100;                     // listen backlog
+  std::size_t max_connections = 0;       // connections at the same time
+  std::size_t max_connections_per_ip = 0; // connections from one address
+  double accept_rate = 0;                // accepted connections per second
+  double accept_burst = 0;               // bucket size, 0 means accept_rate
+  overload_policy policy = PAUSE_ACCEPTING;
+};
+/**
+ * counters of server connections
+ * */
+struct server_stats {
+  std::uint64_t accepted = 0;
+  std::uint64_t rejected_max_connections = 0;
+  std::uint64_t rejected_per_ip = 0;
+  std::uint64_t rejected_rate = 0;
+  std::uint64_t pauses = 0; // how many times accepting was paused
+  std::uint64_t broadcast_skipped = 0; // slow connections skipped by broadcast
+  std::size_t active = 0;
+};
+/**
+ * connections reached by server::broadcast
+ * */
+struct broadcast_result {
+  std::size_t sent = 0;
+  std::size_t skipped = 0; // over max_queued bytes
+};
 
 class server {
 protected:
@@ -171,20 +659,61 @@ protected:
     return _callbacks[e];
   };
 
-  std::vector<int> listening_sockets;
-  // std::map<int, std::future<void>> connections; // key: connected socket;
-  // value socket object
+  event_loop *_loop;
+  std::shared_ptr<char> _alive;
 
-  // std::optional<std::future<void>> accepting_fut;
-  std::future<void> accepting_fut;
+  std::vector<int> listening_sockets;
 
   std::map<int, socket_p> _connected_sockets;
 
+  // coroutine mode: accepted connections are given to the awaiting accept
+  bool _pull_mode;
+  std::list<std::function<void(int connected_socket)>> _accept_waiters;
+  // listening sockets are served by multishot accept on io_uring
+  bool _accept_streaming;
+  // timeouts given to accepted connections
+  unsigned long _timeouts[3];
+  // options of listening and accepted sockets
+  socket_options _options;
+  // TLS of accepted connections
+  std::shared_ptr<tls_context> _tls_context;
+  // handlers shared by accepted connections
+  std::shared_ptr<const connection_handlers> _connection_handlers;
+  // gives memory resource to each accepted connection
+  std::function<std::shared_ptr<std::pmr::memory_resource>()> _memory_factory;
+  // files of unix domain sockets removed when server is closed
+  std::vector<std::string> _unix_paths;
+
+  // admission control. Guarded by _connection_handling_mutex, except _paused
+  // and _resume_timer which belong to the loop thread
+  admission_limits _limits;
+  server_stats _stats;
+  std::map<std::string, std::size_t> _per_ip;
+  std::map<const socket *, std::string> _peers; // counted in _per_ip until closed
+  double _tokens;
+  std::uint64_t _tokens_time;
+  bool _paused;
+  timer_id _resume_timer;
+
+  void _start_accepting();
+  void _accept_ready(int listening_socket);
+  void _arm_accept(bool armed);
+  void _enter_pull_mode();
+  // prepare_ is called with the new socket before CONNECTION
+  void _on_accepted(int connected_socket,
+                    std::function<void(socket &)> prepare_ = nullptr);
+  void _accept_by_readiness();
+  bool _can_pause();
+  bool _admit(int connected_socket, std::string &peer_);
+  void _update_accepting();
 
   void _on_connect(socket_p connected_socket_);
+  // called by the socket after its connection is closed
+  void _on_closed(int connected_socket, socket *raw);
   void _on_listen(const unsigned int port_, const std::string addr_);
   void _on_error(const std::string &err);
 
+  void _stop_listening();
   void _close();
 
 public:
@@ -199,15 +728,155 @@ public:
    *
    * */
   server(std::function<void(socket &)> oc = b);
+  /**
+   * create server driven by the given event loop.
+   * @arg oc - on connection callback
+   *
+   * */
+  server(event_loop &loop, std::function<void(socket &)> oc = b);
 
   /**
    * starts listening for connections
    * */
   server &listen(unsigned int port_, char const *addr_ = "*");
+  /**
+   * starts listening on the unix domain socket. Path starting with '@' is in
+   * the abstract namespace, otherwise the file is replaced and removed when
+   * server is closed. LISTENING gets port 0 and the path.
+   * */
+  server &listen_unix(const std::string &path_);
+  /**
+   * serve sockets that are already listening, so nothing is bound and no
+   * connection is refused during restart. LISTENING is emitted for each of
+   * them. Throws std::invalid_argument if one is not a listening socket.
+   * */
+  server &listen_fds(const std::vector<int> &fds_);
+  /**
+   * listening sockets given to this process: by systemd socket activation
+   * (LISTEN_FDS, LISTEN_PID) or by the previous program in
+   * TEPSOC_LISTEN_FDS (see share_listening_sockets). The variables are
+   * removed, so child processes do not take the sockets again. Empty when
+   * there are none.
+   * */
+  static std::vector<int> inherited_listeners();
+  /**
+   * keep the listening sockets open across exec and list them for
+   * TEPSOC_LISTEN_FDS of the new program, e.g. "5,6". The new program
+   * accepts from the same kernel backlog, so no connection is refused.
+   * */
+  std::string share_listening_sockets();
+  /**
+   * serve connected socket as if it was accepted, for example one end of
+   * socketpair or a connection received in FDS. The server owns it then.
+   * Connections are given to the CONNECTION handler also in coroutine mode.
+   * */
+  server &adopt(int connected_socket_);
+  /**
+   * hot restart: give live connections to the process that called take_over
+   * on the unix socket path_, so clients do not notice the deploy. Accepting
+   * stops (pass listening sockets with share_listening_sockets first), and
+   * reading of every connection stops. Each descriptor is then sent with
+   * SCM_RIGHTS, together with state_(socket) which the library does not
+   * look into, the data received but not given to DATA handler, and the
+   * data written but not sent yet. Connections are released here without
+   * shutdown. state_ is called while the loop is held, and data written to
+   * the connections afterwards is dropped.
+   *
+   * TLS, piped, coroutine and ending connections, and those with queued
+   * descriptors, can not be moved; they are finished here as usual. Waits
+   * up to timeout_ms_ for the successor and for the sends. Must not be
+   * called from the loop thread.
+   *
+   * @return number of connections handed over
+   * */
+  std::size_t hand_over(const std::string &path_,
+                        std::function<std::string(socket &)> state_ = nullptr,
+                        int timeout_ms_ = 5000);
+  /**
+   * receive connections from hand_over of the previous process on the unix
+   * socket path_. They are served as adopted, so CONNECTION handler gets each
+   * with socket::get_handoff_state. Data left unsent is sent before anything
+   * written by the handler, and the received data is given to DATA handler
+   * before new data. Waits up to timeout_ms_ for the previous process, and
+   * returns when it has sent everything.
+   *
+   * @return number of connections taken
+   * */
+  std::size_t take_over(const std::string &path_, int timeout_ms_ = 5000);
+  /**
+   * awaitable that results in the next accepted connection. After the first
+   * call connections are no longer passed to CONNECTION handler. Include
+   * tepsoc_co.hpp to use it.
+   * */
+  accept_awaiter accept();
+  /**
+   * timeout for accepted connections, see socket::set_timeout. Connections
+   * accepted before the call keep their timeouts.
+   * */
+  server &set_timeout(socket_timeout kind, unsigned long ms);
+  /**
+   * set admission control. Backlog is used by the next listen.
+   * */
+  server &set_limits(const admission_limits &limits_);
+  /**
+   * set TCP options of listening sockets created by the next listen and of
+   * accepted connections
+   * */
+  server &set_options(const socket_options &options_);
+  /**
+   * use TLS on connections accepted from now. CONNECTION is emitted after
+   * the handshake. Include tepsoc_tls.hpp to create the context.
+   * */
+  server &use_tls(std::shared_ptr<tls_context> context_);
+  /**
+   * DATA, END and ERROR handlers of connections accepted from now. The table
+   * is stored once and shared, so accepting a connection does not allocate
+   * handlers. A handler set on the socket is used instead of the shared one.
+   * Per-connection state goes to socket::set_context.
+   * */
+  server &set_connection_handlers(connection_handlers handlers_);
+  /**
+   * memory resource for each connection accepted from now, for example a
+   * monotonic arena released when the connection is destroyed. Called in the
+   * loop thread. Empty function means the default resource.
+   * */
+  server &set_memory_resource(
+      std::function<std::shared_ptr<std::pmr::memory_resource>()> factory_);
+  /**
+   * listening sockets, for options that are not in socket_options
+   * */
+  std::vector<int> get_listening_sockets() { return listening_sockets; }
+  /**
+   * counters of accepted and rejected connections
+   * */
+  server_stats get_stats();
+  /**
+   * write payload to every connection accepted by the filter (all when it is
+   * empty). The payload is shared by the connections, not copied. Connections
+   * that have more than max_queued bytes waiting (0 is no limit) are skipped,
+   * so a slow consumer does not collect updates it can not send.
+   * */
+  broadcast_result broadcast(shared_buffer payload_,
+                             std::function<bool(socket &)> filter_ = nullptr,
+                             std::size_t max_queued_ = 0);
+  /**
+   * broadcast copy of the string, see above
+   * */
+  broadcast_result broadcast(const std::string &payload_,
+                             std::function<bool(socket &)> filter_ = nullptr,
+                             std::size_t max_queued_ = 0);
+
+  /**
+   * the loop that drives this server
+   * */
+  event_loop &get_loop() { return *_loop; }
   /**
    * wait for everything to end
    * */
   virtual ~server() { _close(); };
+
+  friend class socket;
+  friend class accept_awaiter;
 };
 
 using server_p = std::shared_ptr<server>;
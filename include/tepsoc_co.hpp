@@ -0,0 +1,266 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_CO__HPP___
+#define __TP__NET__TEPSOC_CO__HPP___
+
+#include <tepsoc.hpp>
+
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace tp {
+namespace net {
+
+/**
+ * allocator for coroutine frames. Freed frames are kept on per thread free
+ * lists grouped by size, so a protocol loop that starts a coroutine for every
+ * request does not go to the global heap.
+ * */
+struct frame_pool {
+  static void *allocate(std::size_t size);
+  static void deallocate(void *p, std::size_t size) noexcept;
+};
+
+namespace detail {
+struct promise_base {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+  bool detached = false;
+
+  static void *operator new(std::size_t size) {
+    return frame_pool::allocate(size);
+  }
+  static void operator delete(void *p, std::size_t size) noexcept {
+    frame_pool::deallocate(p, size);
+  }
+
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <class P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      promise_base &p = h.promise();
+      if (p.detached) {
+        if (p.exception) {
+          try {
+            std::rethrow_exception(p.exception);
+          } catch (std::exception &e) {
+            std::cerr << "coroutine error: " << e.what() << std::endl;
+          } catch (...) {
+            std::cerr << "coroutine error" << std::endl;
+          }
+        }
+        h.destroy();
+        return std::noop_coroutine();
+      }
+      if (p.continuation)
+        return p.continuation;
+      return std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { exception = std::current_exception(); }
+};
+} // namespace detail
+
+/**
+ * lazily started coroutine. It starts when it is awaited or given to spawn.
+ * */
+template <class T = void> class task {
+public:
+  struct promise_type : public detail::promise_base {
+    std::optional<T> value;
+    task get_return_object() {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    void return_value(T v) { value = std::move(v); }
+  };
+
+  bool await_ready() noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+    _h.promise().continuation = c;
+    return _h;
+  }
+  T await_resume() {
+    if (_h.promise().exception)
+      std::rethrow_exception(_h.promise().exception);
+    return std::move(*_h.promise().value);
+  }
+
+  std::coroutine_handle<promise_type> release() {
+    return std::exchange(_h, nullptr);
+  }
+
+  task(task &&o) noexcept : _h(std::exchange(o._h, nullptr)) {}
+  task &operator=(task &&o) noexcept {
+    std::swap(_h, o._h);
+    return *this;
+  }
+  ~task() {
+    if (_h)
+      _h.destroy();
+  }
+
+private:
+  explicit task(std::coroutine_handle<promise_type> h) : _h(h) {}
+  std::coroutine_handle<promise_type> _h;
+};
+
+template <> class task<void> {
+public:
+  struct promise_type : public detail::promise_base {
+    task get_return_object() {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    void return_void() {}
+  };
+
+  bool await_ready() noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+    _h.promise().continuation = c;
+    return _h;
+  }
+  void await_resume() {
+    if (_h.promise().exception)
+      std::rethrow_exception(_h.promise().exception);
+  }
+
+  std::coroutine_handle<promise_type> release() {
+    return std::exchange(_h, nullptr);
+  }
+
+  task(task &&o) noexcept : _h(std::exchange(o._h, nullptr)) {}
+  task &operator=(task &&o) noexcept {
+    std::swap(_h, o._h);
+    return *this;
+  }
+  ~task() {
+    if (_h)
+      _h.destroy();
+  }
+
+private:
+  explicit task(std::coroutine_handle<promise_type> h) : _h(h) {}
+  std::coroutine_handle<promise_type> _h;
+};
+
+/**
+ * run the task on the loop. The frame is released when the task finishes,
+ * uncaught exception is reported on stderr.
+ * */
+inline void spawn(event_loop &loop, task<void> t) {
+  auto h = t.release();
+  h.promise().detached = true;
+  loop.post([h]() { h.resume(); });
+}
+/**
+ * run the task on the default loop
+ * */
+inline void spawn(task<void> t) {
+  spawn(event_loop::get_default(), std::move(t));
+}
+
+/**
+ * result of socket::read_some
+ * */
+class recv_awaiter {
+  socket *_s;
+  std::vector<char> *_buf;
+  long _result;
+  int _err;
+  std::coroutine_handle<> _h;
+  bool _try_recv();
+
+public:
+  recv_awaiter(socket &s, std::vector<char> &buf)
+      : _s(&s), _buf(&buf), _result(0), _err(0) {}
+  bool await_ready() { return _try_recv(); }
+  void await_suspend(std::coroutine_handle<> h);
+  std::size_t await_resume();
+};
+
+/**
+ * result of socket::write_all
+ * */
+class send_awaiter {
+  socket *_s;
+  std::string _data;
+  std::size_t _sent;
+  int _err;
+  std::coroutine_handle<> _h;
+  bool _try_send();
+
+public:
+  send_awaiter(socket &s, std::string data)
+      : _s(&s), _data(std::move(data)), _sent(0), _err(0) {}
+  bool await_ready() { return _try_send(); }
+  void await_suspend(std::coroutine_handle<> h);
+  std::size_t await_resume();
+};
+
+/**
+ * result of server::accept
+ * */
+class accept_awaiter {
+  server *_srv;
+  int _fd;
+  std::coroutine_handle<> _h;
+
+public:
+  explicit accept_awaiter(server &srv) : _srv(&srv), _fd(-1) {}
+  bool await_ready();
+  void await_suspend(std::coroutine_handle<> h);
+  socket_p await_resume();
+};
+
+/**
+ * result of socket::connect(loop, port, addr)
+ * */
+class connect_awaiter {
+  socket_p _s;
+  unsigned int _port;
+  std::string _addr;
+  std::string _err;
+
+public:
+  connect_awaiter(event_loop &loop, unsigned int port_, std::string addr_)
+      : _s(std::make_shared<socket>(loop)), _port(port_),
+        _addr(std::move(addr_)) {}
+  bool await_ready() { return false; }
+  void await_suspend(std::coroutine_handle<> h);
+  socket_p await_resume();
+};
+
+} // namespace net
+} // namespace tp
+
+#endif
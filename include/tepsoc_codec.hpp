@@ -0,0 +1,308 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_CODEC__HPP___
+#define __TP__NET__TEPSOC_CODEC__HPP___
+
+#include <tepsoc.hpp>
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace tp {
+namespace net {
+
+/**
+ * data that does not follow the protocol. The stream can not be framed after
+ * it, so the connection should be closed.
+ * */
+class codec_error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+/**
+ * space where messages are encoded. take() hands the bytes over to the write
+ * queue without copying, so messages are serialized once, directly into the
+ * memory that is sent.
+ * */
+class encode_buffer {
+  std::shared_ptr<char[]> _data;
+  std::size_t _size = 0;
+  std::size_t _capacity = 0;
+
+public:
+  /**
+   * at least size_ writable bytes after the encoded ones. They are valid
+   * until the next reserve or take.
+   * */
+  char *reserve(std::size_t size_) {
+    if (_size + size_ > _capacity)
+      _grow(size_);
+    return _data.get() + _size;
+  }
+  /**
+   * size_ of the reserved bytes were written
+   * */
+  void commit(std::size_t size_) { _size += size_; }
+  void append(const char *data_, std::size_t size_) {
+    std::memcpy(reserve(size_), data_, size_);
+    commit(size_);
+  }
+  void append(std::string_view data_) { append(data_.data(), data_.size()); }
+
+  const char *data() const { return _data.get(); }
+  std::size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  /**
+   * the encoded bytes, for socket::write. The buffer is empty after it.
+   * */
+  owned_buffer take();
+
+private:
+  void _grow(std::size_t size_);
+};
+
+/**
+ * splits a stream of bytes into messages of Codec. Codec has:
+ *
+ * - message, the decoded form, which may refer to the decoded bytes;
+ * - std::size_t decode(const char *data, std::size_t size, message &m), the
+ *   number of bytes of the first message in data, 0 when it is not complete;
+ *   throws codec_error;
+ * - void encode(const V &value, encode_buffer &out) for the values it sends.
+ *
+ * A codec whose decode reads the whole message before it finds it is
+ * incomplete also has progress and std::size_t complete(const char *data,
+ * std::size_t size, progress &p), the size of the first message when it is
+ * complete and 0 otherwise. It continues from where p stopped on the same
+ * message, so a message split between many reads is decoded once instead
+ * of on every read.
+ *
+ * Messages are decoded from the received data where it is, only a message
+ * split between reads is copied until it is complete. The message given to
+ * the handler is valid during the call.
+ * */
+template <class Codec, class = void> struct progress_of {
+  struct type {};
+  static constexpr bool value = false;
+};
+template <class Codec>
+struct progress_of<Codec, std::void_t<typename Codec::progress>> {
+  using type = typename Codec::progress;
+  static constexpr bool value = true;
+};
+
+template <class Codec> class decoder {
+  Codec _codec;
+  typename Codec::message _message;
+  std::vector<char> _pending;
+  // how far the pending message was checked
+  typename progress_of<Codec>::type _progress;
+
+public:
+  explicit decoder(Codec codec_ = Codec()) : _codec(std::move(codec_)) {}
+
+  Codec &codec() { return _codec; }
+  /**
+   * bytes of incomplete message kept from previous feeds
+   * */
+  std::size_t pending() const { return _pending.size(); }
+
+  /**
+   * decode data_ and call on_message_(message &) for every complete message.
+   * On codec_error the rest of the data is dropped.
+   * */
+  template <class F>
+  void feed(const char *data_, std::size_t size_, F &&on_message_) {
+    if (_pending.size()) {
+      _pending.insert(_pending.end(), data_, data_ + size_);
+      data_ = _pending.data();
+      size_ = _pending.size();
+    }
+    std::size_t used = 0;
+    try {
+      if constexpr (progress_of<Codec>::value) {
+        if (_pending.size()) {
+          if (_codec.complete(data_, size_, _progress) == 0)
+            return;
+          _progress = typename Codec::progress();
+        }
+      }
+      while (used < size_) {
+        std::size_t n = _codec.decode(data_ + used, size_ - used, _message);
+        if (n == 0)
+          break;
+        used += n;
+        on_message_(_message);
+      }
+    } catch (const codec_error &) {
+      _pending.clear();
+      if constexpr (progress_of<Codec>::value)
+        _progress = typename Codec::progress();
+      throw;
+    }
+    if (_pending.size())
+      _pending.erase(_pending.begin(), _pending.begin() + used);
+    else
+      _pending.assign(data_ + used, data_ + size_);
+  }
+};
+
+/**
+ * binary messages, each after its length as 4 bytes in network order
+ * */
+struct length_prefixed_codec {
+  using message = std::string_view;
+  // longer messages are codec_error
+  std::size_t max_size = 16 * 1024 * 1024;
+
+  std::size_t decode(const char *data_, std::size_t size_,
+                     message &message_) const;
+  void encode(std::string_view message_, encode_buffer &out_) const;
+};
+
+/**
+ * newline delimited JSON: one JSON text per line. The text is not parsed,
+ * the handler gets it without the line end ("\n" or "\r\n").
+ * */
+struct json_lines_codec {
+  using message = std::string_view;
+  // longer lines are codec_error
+  std::size_t max_size = 1024 * 1024;
+
+  std::size_t decode(const char *data_, std::size_t size_,
+                     message &message_) const;
+  /**
+   * throws codec_error when the text has a line end
+   * */
+  void encode(std::string_view message_, encode_buffer &out_) const;
+};
+
+/**
+ * kinds of RESP (Redis serialization protocol) values
+ * */
+enum class resp_type { SIMPLE, ERROR, INTEGER, BULK, NIL, ARRAY };
+/**
+ * RESP value. Strings refer to the decoded data.
+ * */
+struct resp_value {
+  resp_type type = resp_type::NIL;
+  std::string_view text;            // SIMPLE, ERROR and BULK
+  long long integer = 0;            // INTEGER
+  std::vector<resp_value> elements; // ARRAY
+};
+
+/**
+ * RESP2, the protocol of Redis. Commands are arrays of bulk strings; inline
+ * commands (words on a line, as typed in telnet) are decoded to the same
+ * form. Nested arrays keep their storage between messages, so decoding
+ * commands of the same shape does not allocate.
+ * */
+struct resp_codec {
+  using message = resp_value;
+  // longer bulk strings, longer arrays and deeper nesting are codec_error
+  std::size_t max_bulk = 512 * 1024 * 1024;
+  std::size_t max_elements = 1024 * 1024;
+  int max_depth = 8;
+
+  /**
+   * how far a message split between reads was checked, see decoder
+   * */
+  struct progress {
+    std::size_t checked = 0;      // bytes of complete values
+    std::vector<long long> left;  // elements still missing in open arrays
+  };
+
+  std::size_t decode(const char *data_, std::size_t size_,
+                     message &message_) const;
+  /**
+   * size of the first message when it is complete, 0 otherwise. Checks the
+   * same limits as decode, but does not build the value.
+   * */
+  std::size_t complete(const char *data_, std::size_t size_,
+                       progress &progress_) const;
+  void encode(const resp_value &value_, encode_buffer &out_) const;
+
+  // replies written without building resp_value
+  static void simple(encode_buffer &out_, std::string_view text_);
+  static void error(encode_buffer &out_, std::string_view text_);
+  static void integer(encode_buffer &out_, long long value_);
+  static void bulk(encode_buffer &out_, std::string_view data_);
+  static void nil(encode_buffer &out_);
+  /**
+   * header of array, its size_ elements are encoded next
+   * */
+  static void array(encode_buffer &out_, std::size_t size_);
+};
+
+/**
+ * decode data received on s_ with codec_, and give every message to
+ * handler_ together with buffer for replies. Replies to the messages of one
+ * read are written at once, as one buffer. Data that can not be decoded ends
+ * the connection, after the replies to the messages before it.
+ * */
+template <class Codec>
+socket &on_messages(
+    socket &s_,
+    std::function<void(typename Codec::message &, encode_buffer &)> handler_,
+    Codec codec_ = Codec()) {
+  struct state_t {
+    decoder<Codec> in;
+    encode_buffer out;
+    // data after the error is not decoded, it may be framed anywhere
+    bool broken = false;
+  };
+  auto state = std::make_shared<state_t>(
+      state_t{decoder<Codec>(std::move(codec_)), encode_buffer()});
+  return s_.on(DATA, std::function<void(std::string_view)>(
+                         [&s_, state, handler_](std::string_view data_) {
+                           auto &[in, out, broken] = *state;
+                           if (broken)
+                             return;
+                           try {
+                             in.feed(data_.data(), data_.size(),
+                                     [&](typename Codec::message &m) {
+                                       handler_(m, out);
+                                     });
+                           } catch (const codec_error &) {
+                             broken = true;
+                           }
+                           if (out.size())
+                             s_.write(out.take());
+                           if (broken)
+                             s_.end();
+                         }));
+}
+
+} // namespace net
+} // namespace tp
+
+#endif
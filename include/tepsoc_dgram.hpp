@@ -0,0 +1,234 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_DGRAM__HPP___
+#define __TP__NET__TEPSOC_DGRAM__HPP___
+
+#include <tepsoc.hpp>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace tp {
+namespace net {
+
+/**
+ * address of datagram peer
+ * */
+struct dgram_address {
+  sockaddr_storage storage = {};
+  socklen_t length = 0;
+
+  /**
+   * numeric host
+   * */
+  std::string host() const;
+  unsigned int port() const;
+  bool operator==(const dgram_address &other) const;
+  bool operator!=(const dgram_address &other) const {
+    return !(*this == other);
+  }
+
+  /**
+   * resolve numeric or named host
+   * */
+  static dgram_address resolve(unsigned int port_, char const *addr_);
+};
+
+/**
+ * received datagram. Data is valid only during MESSAGE handler.
+ * */
+struct dgram_message {
+  const char *data;
+  std::size_t size;
+  dgram_address from;
+  // datagram was longer than the receive buffer, see set_max_message_size
+  bool truncated;
+
+  std::string_view payload() const { return std::string_view(data, size); }
+};
+
+/**
+ * UDP socket. Datagrams are received in batches with recvmmsg into buffers
+ * allocated once, and are given to MESSAGE handler
+ * (std::function<void(const dgram_message &)>). Sent datagrams are queued
+ * and sent with sendmmsg by the loop, so many sends cost one system call.
+ * */
+class dgram_socket {
+  std::mutex _callbacks_mutex;
+  std::map<socket_event, socket_event_callback_f> _callbacks;
+
+  event_loop *_loop;
+  std::shared_ptr<char> _alive;
+  int _fd;
+
+  struct outgoing_t {
+    dgram_address to;
+    std::vector<char> data;
+  };
+  // guarded by _send_mutex
+  std::mutex _send_mutex;
+  std::vector<outgoing_t> _outgoing;
+  bool _flush_posted;
+  bool _write_blocked;
+  bool _gso;
+  dgram_address _peer;
+
+  // options applied when the socket is opened, guarded by _send_mutex
+  bool _reuse_address;
+  bool _broadcast;
+  std::optional<bool> _multicast_loop;
+  std::optional<int> _multicast_hops;
+  std::string _multicast_interface;
+
+  // receive batch, allocated when the socket is opened
+  std::size_t _max_message_size;
+  bool _gro;
+  std::vector<char> _buffers;
+  std::vector<char> _controls;
+
+  std::string _open(int family_);
+  std::string _apply_options();
+  dgram_socket &_option_guard(std::function<void()> f);
+  std::string _membership(const char *group_, const char *interface_,
+                          bool join_);
+  void _watch();
+  void _handle_io(unsigned int events);
+  void _receive();
+  void _on_error(const std::string &err);
+
+public:
+  /**
+   * number of datagrams in one recvmmsg and sendmmsg
+   * */
+  static const unsigned int batch_size = 64;
+
+  /**
+   * sets callback for MESSAGE or ERROR
+   * */
+  dgram_socket &on(const socket_event evnt, socket_event_callback_f f);
+  /**
+   * receive datagrams sent to the address. "*" means every interface.
+   * */
+  dgram_socket &bind(unsigned int port_, char const *addr_ = "*");
+  /**
+   * set default destination for send and receive only from it
+   * */
+  dgram_socket &connect(unsigned int port_, char const *addr_);
+  /**
+   * queue datagram. Datagrams are sent together by the loop.
+   * */
+  dgram_socket &send_to(const dgram_address &to_, const char *data_,
+                        std::size_t size_);
+  dgram_socket &send_to(const dgram_address &to_, const std::string &data_) {
+    return send_to(to_, data_.data(), data_.size());
+  }
+  /**
+   * queue datagram to the connected peer
+   * */
+  dgram_socket &send(const std::string &data_);
+  /**
+   * send queued datagrams now. It is called by the loop after sends.
+   * */
+  dgram_socket &flush();
+
+  /**
+   * send runs of equal datagrams to the same address as one UDP_SEGMENT
+   * (GSO) message, that is split by the kernel or the network card
+   * */
+  dgram_socket &set_gso(bool enabled_);
+  /**
+   * receive coalesced datagrams (UDP_GRO). They are split before MESSAGE
+   * handler, so it sees original datagrams.
+   * */
+  dgram_socket &set_gro(bool enabled_);
+  /**
+   * size of receive buffer for one datagram, 2048 by default. Must be set
+   * before bind or connect.
+   * */
+  dgram_socket &set_max_message_size(std::size_t size_);
+
+  /**
+   * receive datagrams sent to the multicast group (IPv4 or IPv6) on the
+   * interface given by name or IPv4 address, or the default one. The socket
+   * must be bound, usually to "*" and the port of the group.
+   * */
+  dgram_socket &join_group(char const *group_,
+                           char const *interface_ = nullptr);
+  dgram_socket &leave_group(char const *group_,
+                            char const *interface_ = nullptr);
+  /**
+   * bind to the port of the group with SO_REUSEADDR, so more subscribers on
+   * one host can receive it, and join the group
+   * */
+  dgram_socket &subscribe(unsigned int port_, char const *group_,
+                          char const *interface_ = nullptr);
+  /**
+   * interface (name or IPv4 address) used to send multicast datagrams
+   * */
+  dgram_socket &set_multicast_interface(char const *interface_);
+  /**
+   * deliver sent multicast datagrams to subscribers on this host, it is on by
+   * default in the kernel
+   * */
+  dgram_socket &set_multicast_loop(bool enabled_);
+  /**
+   * how many routers can forward sent multicast datagrams, 1 by default
+   * */
+  dgram_socket &set_multicast_hops(int hops_);
+  /**
+   * SO_REUSEADDR, must be set before bind
+   * */
+  dgram_socket &set_reuse_address(bool enabled_);
+  /**
+   * allow sending to broadcast addresses (SO_BROADCAST)
+   * */
+  dgram_socket &set_broadcast(bool enabled_);
+
+  /**
+   * local address, for example port chosen by the system
+   * */
+  dgram_address local_address() const;
+  int get_wrapped_socket() { return _fd; }
+  event_loop &get_loop() { return *_loop; }
+
+  dgram_socket();
+  explicit dgram_socket(event_loop &loop);
+  virtual ~dgram_socket();
+
+  dgram_socket(dgram_socket const &) = delete;
+  dgram_socket &operator=(dgram_socket const &) = delete;
+};
+
+using dgram_socket_p = std::shared_ptr<dgram_socket>;
+
+} // namespace net
+} // namespace tp
+
+#endif
@@ -0,0 +1,232 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_LOOP__HPP___
+#define __TP__NET__TEPSOC_LOOP__HPP___
+
+#include <tepsoc_timer.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tp {
+namespace net {
+
+/**
+ * readiness flags used by event_loop::watch. Values are the same as the epoll
+ * ones.
+ * */
+enum io_event : unsigned int {
+  IO_READ = 0x001,
+  IO_WRITE = 0x004,
+  IO_ERROR = 0x008,
+  IO_HANGUP = 0x010,
+  IO_PEER_CLOSED = 0x2000,
+  IO_EDGE = 1u << 31 // edge triggered notifications
+};
+
+using io_callback_f = std::function<void(unsigned int events)>;
+
+/**
+ * mechanism used by event_loop. AUTO selects io_uring when the library is built
+ * with TEPSOC_IO_URING and the kernel supports it, otherwise epoll. Environment
+ * variable TEPSOC_BACKEND=epoll or TEPSOC_BACKEND=io_uring overrides AUTO.
+ * */
+enum class loop_backend { AUTO, EPOLL, IO_URING };
+
+class uring_backend;
+
+/**
+ * reactor that drives sockets and servers. Every socket and server is attached
+ * to one event loop and all of its callbacks are called from the thread that
+ * runs that loop.
+ * */
+class event_loop {
+  int _epoll_fd;
+  int _wakeup_fd;
+
+  std::unique_ptr<uring_backend> _uring;
+  bool _epoll_armed;
+
+  std::atomic<bool> _stop_requested;
+  std::atomic<std::thread::id> _loop_thread;
+  std::thread _thread;
+
+  std::mutex _watchers_mutex;
+  std::map<int, std::shared_ptr<io_callback_f>> _watchers;
+
+  std::mutex _posted_mutex;
+  std::vector<std::function<void()>> _posted;
+  // posted work being run. Swapped with _posted, so both keep capacity
+  std::vector<std::function<void()>> _running;
+
+  // held by the loop while it calls callbacks
+  std::mutex _dispatch_mutex;
+
+  std::mutex _timers_mutex;
+  timer_wheel _timers;
+  std::chrono::steady_clock::time_point _epoch;
+
+  void _run_posted();
+  int _run_timers();
+  int _wait_timeout(int timeout_ms);
+  bool _holds_dispatch() const;
+  int _dispatch_epoll(void *events, int n);
+  int _run_once_uring(int timeout_ms);
+
+public:
+  /**
+   * register fd for events. Callback is called from the loop thread.
+   * Watching fd that is already watched replaces callback and events.
+   * */
+  void watch(int fd, unsigned int events, io_callback_f callback_);
+  /**
+   * change events that fd is watched for
+   * */
+  void modify(int fd, unsigned int events);
+  /**
+   * stop watching fd. When called outside of the loop thread it waits until
+   * the loop is not in the middle of calling callbacks, so the callback will
+   * not be called after this returns.
+   * */
+  void unwatch(int fd);
+
+  /**
+   * run function in the loop thread on the next iteration. Thread safe.
+   * */
+  void post(std::function<void()> f);
+  /**
+   * run function immediately when in loop thread, otherwise run it while the
+   * loop is not dispatching any events.
+   * */
+  void synchronized(std::function<void()> f);
+  /**
+   * run function now when called from the loop thread, otherwise post it
+   * */
+  void execute(std::function<void()> f);
+  /**
+   * call function once after delay_ms milliseconds. Thread safe.
+   *
+   * @return id for clear_timeout
+   * */
+  timer_id set_timeout(std::function<void()> f, unsigned long delay_ms);
+  /**
+   * call function every period_ms milliseconds until it is cleared. Thread
+   * safe.
+   *
+   * @return id for clear_interval
+   * */
+  timer_id set_interval(std::function<void()> f, unsigned long period_ms);
+  /**
+   * cancel timer. After it returns on the loop thread, the callback will not
+   * be called.
+   *
+   * @return true if the timer was still armed
+   * */
+  bool clear_timeout(timer_id id);
+  /**
+   * cancel interval timer
+   * */
+  bool clear_interval(timer_id id) { return clear_timeout(id); }
+  /**
+   * milliseconds since the loop was created. Used as the time base of timers.
+   * */
+  std::uint64_t now_ms() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - _epoch)
+        .count();
+  }
+
+  /**
+   * check if current thread is the one that runs this loop
+   * */
+  bool in_loop_thread() const {
+    return _loop_thread.load() == std::this_thread::get_id();
+  }
+
+  /**
+   * wait for events at most timeout_ms milliseconds (-1 means forever) and
+   * dispatch them.
+   *
+   * @return number of dispatched events
+   * */
+  int run_once(int timeout_ms = -1);
+  /**
+   * dispatch events until stop is called
+   * */
+  void run();
+  /**
+   * make run return. When called before run, the next run returns
+   * immediately. Thread safe.
+   * */
+  void stop();
+  /**
+   * run the loop in the background thread
+   * */
+  event_loop &start();
+
+  /**
+   * the loop used by sockets and servers created without explicit loop. It is
+   * started in the background thread on the first use.
+   * */
+  static event_loop &get_default();
+
+  /**
+   * backend that was selected for this loop
+   * */
+  loop_backend get_backend() const {
+    return _uring ? loop_backend::IO_URING : loop_backend::EPOLL;
+  }
+  /**
+   * completion based operations, or nullptr for epoll backend. Used by sockets
+   * and servers.
+   * */
+  uring_backend *uring() { return _uring.get(); }
+  /**
+   * check if io_uring backend can be used in this build and on this kernel
+   * */
+  static bool io_uring_available();
+
+  /**
+   * create loop with the backend. When IO_URING is requested but not
+   * available, epoll is used.
+   * */
+  explicit event_loop(loop_backend backend_ = loop_backend::AUTO);
+  virtual ~event_loop();
+
+  event_loop(event_loop const &) = delete;
+  event_loop &operator=(event_loop const &) = delete;
+};
+
+} // namespace net
+} // namespace tp
+
+#endif
@@ -0,0 +1,107 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_RESP__HPP___
+#define __TP__NET__TEPSOC_RESP__HPP___
+
+#include <tepsoc_codec.hpp>
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace tp {
+namespace net {
+
+/**
+ * server of RESP (Redis protocol) commands. Every read is decoded into the
+ * commands it completes, they are executed in order, and their replies are
+ * written at once, so pipelined clients get one write per read. Commands are
+ * executed in the loop thread, so a server on one loop needs no locks for its
+ * data.
+ *
+ * PING, ECHO and COMMAND are registered by default, QUIT replies and closes
+ * the connection after the replies before it. Unknown commands
+ * and wrong number of arguments are answered with errors, protocol errors
+ * with an error before the connection is closed.
+ * */
+class resp_server {
+public:
+  /**
+   * arguments of the command, the first is its name. They refer to the
+   * received data and are valid during the call. The reply is encoded into
+   * out_, see resp_codec.
+   * */
+  using command_f = std::function<void(const std::vector<resp_value> &args_,
+                                       encode_buffer &out_)>;
+
+  /**
+   * create server on the loop
+   * */
+  explicit resp_server(event_loop &loop_ = event_loop::get_default());
+
+  /**
+   * register command. The name is not case sensitive. Arity is the number of
+   * arguments with the name, -n means at least n, as in Redis. Register
+   * commands before listening.
+   * */
+  resp_server &command(const std::string &name_, int arity_,
+                       command_f handler_);
+  /**
+   * start listening, see server::listen
+   * */
+  resp_server &listen(unsigned int port_, char const *addr_ = "*");
+  /**
+   * the underlying server, for limits, options, unix sockets or adopt
+   * */
+  server &get_server() { return _server; }
+
+private:
+  struct command_t {
+    int arity;
+    command_f handler;
+  };
+  struct name_hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view name_) const {
+      return std::hash<std::string_view>()(name_);
+    }
+  };
+  // upper case names, looked up by views without allocation
+  std::unordered_map<std::string, command_t, name_hash, std::equal_to<>>
+      _commands;
+  server _server;
+
+  void _serve(socket &s_);
+  // returns false when the connection is to be closed
+  bool _execute(const resp_value &command_, encode_buffer &out_);
+};
+
+} // namespace net
+} // namespace tp
+
+#endif
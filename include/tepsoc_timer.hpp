@@ -0,0 +1,144 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_TIMER__HPP___
+#define __TP__NET__TEPSOC_TIMER__HPP___
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace tp {
+namespace net {
+
+/**
+ * identifies timer armed on the timer_wheel. 0 is never used.
+ * */
+using timer_id = std::uint64_t;
+
+/**
+ * hierarchical timing wheel with the resolution of one tick (event_loop uses
+ * milliseconds). There are 4 levels of 256 slots, so timers up to 2^32 ticks
+ * are kept in the wheel and cascaded down when their time comes closer.
+ *
+ * Arming, restarting and cancelling timer is O(1). Timers are kept in a
+ * vector of nodes linked by index, so the wheel does not allocate after it
+ * grows to the peak number of timers.
+ *
+ * The wheel is not thread safe.
+ * */
+class timer_wheel {
+public:
+  using callback_f = std::function<void()>;
+
+  /**
+   * arm timer that expires delay_ ticks from now. When period_ is not 0 the
+   * timer is armed again for period_ ticks every time it expires.
+   * */
+  timer_id add(std::uint64_t delay_, std::uint64_t period_,
+               callback_f callback_);
+  /**
+   * disarm timer. It is safe to cancel timer that already expired.
+   *
+   * @return true if the timer was armed
+   * */
+  bool cancel(timer_id id_);
+  /**
+   * arm the timer again for delay_ ticks from now, keeping its callback
+   *
+   * @return true if the timer was armed
+   * */
+  bool restart(timer_id id_, std::uint64_t delay_);
+
+  /**
+   * move time forward to now_ and collect timers that expired
+   * */
+  void advance(std::uint64_t now_);
+  /**
+   * take the next expired timer. Interval timers are armed again.
+   *
+   * @return callback of expired timer or nullptr when there are no more
+   * */
+  std::shared_ptr<callback_f> pop_expired();
+
+  /**
+   * number of ticks after which advance should be called, 0 when there are
+   * expired timers and -1 when nothing is armed
+   * */
+  std::int64_t ticks_to_next() const;
+  /**
+   * current time of the wheel
+   * */
+  std::uint64_t now() const { return _now; }
+  /**
+   * number of armed and expired timers
+   * */
+  std::size_t size() const { return _count; }
+
+  explicit timer_wheel(std::uint64_t now_ = 0);
+
+private:
+  static const unsigned slot_bits = 8;
+  static const unsigned slots = 1 << slot_bits;
+  static const unsigned levels = 4;
+  static const std::uint32_t nil = 0xffffffff;
+  // lists after the slots: expired timers and timers beyond the last level
+  static const std::uint32_t expired_list = levels * slots;
+  static const std::uint32_t overflow_list = expired_list + 1;
+  static const std::uint32_t lists = overflow_list + 1;
+
+  struct node_t {
+    std::uint64_t expires;
+    std::uint64_t period;
+    std::uint32_t prev;
+    std::uint32_t next;
+    std::uint32_t list; // nil when node is free
+    std::uint32_t generation;
+    std::shared_ptr<callback_f> callback;
+  };
+
+  std::vector<node_t> _nodes;
+  std::uint32_t _free;
+  std::uint32_t _heads[lists];
+  std::uint32_t _tails[lists];
+  std::uint64_t _occupied[levels][slots / 64];
+  std::uint64_t _now;
+  std::size_t _count;
+
+  node_t *_find(timer_id id_);
+  void _link(std::uint32_t i, std::uint32_t list);
+  void _unlink(std::uint32_t i);
+  void _insert(std::uint32_t i);
+  void _release(std::uint32_t i);
+  void _reinsert_list(std::uint32_t list);
+  int _next_occupied(unsigned level, unsigned from) const;
+  std::uint64_t _next_event() const;
+};
+
+} // namespace net
+} // namespace tp
+
+#endif
@@ -0,0 +1,126 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_TLS__HPP___
+#define __TP__NET__TEPSOC_TLS__HPP___
+
+#include <tepsoc.hpp>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ssl_ctx_st;
+struct ssl_session_st;
+
+namespace tp {
+namespace net {
+
+/**
+ * configuration of TLS context. Files are in PEM format.
+ * */
+struct tls_config {
+  std::string certificate_file; // certificate chain, required by server
+  std::string private_key_file; // required by server
+  std::string ca_file;          // trusted certificates, system ones if empty
+  bool verify_peer = true;      // client checks the server certificate
+  bool require_client_certificate = false; // server checks client
+  std::vector<std::string> alpn; // protocols in order of preference
+  std::size_t session_cache_size = 1024; // resumable sessions, 0 disables
+  bool ktls = true; // move encryption to the kernel when it supports it
+};
+
+/**
+ * state of TLS connection, see socket::get_tls_info
+ * */
+struct tls_info {
+  bool established = false; // handshake is done
+  std::string version;       // "TLSv1.3"...
+  std::string cipher;
+  std::string alpn;          // selected protocol or empty
+  bool resumed = false;      // session was resumed
+  bool ktls_send = false;    // kernel encrypts sent data
+  bool ktls_receive = false; // kernel decrypts received data
+};
+
+/**
+ * shared configuration of TLS connections. Client context caches sessions
+ * per server name, so the next connection to the same server is resumed.
+ * Server context keeps its own session cache and issues tickets.
+ *
+ * TLS sockets are served by epoll, also when the loop uses io_uring.
+ * */
+class tls_context {
+  ssl_ctx_st *_ctx;
+  bool _server;
+  std::size_t _cache_size;
+  // ALPN protocols in the wire format
+  std::vector<unsigned char> _alpn;
+
+  // client sessions, the most recent first
+  std::mutex _sessions_mutex;
+  std::list<std::pair<std::string, ssl_session_st *>> _sessions;
+
+  tls_context(bool server_, const tls_config &config_);
+
+public:
+  /**
+   * context of server. Throws std::invalid_argument when the certificate or
+   * key can not be loaded and std::runtime_error when TLS is not built in.
+   * */
+  static std::shared_ptr<tls_context> create_server(const tls_config &config_);
+  /**
+   * context of client, see create_server
+   * */
+  static std::shared_ptr<tls_context> create_client(const tls_config &config_);
+
+  bool is_server() const { return _server; }
+  /**
+   * OpenSSL SSL_CTX, for settings that are not in tls_config
+   * */
+  ssl_ctx_st *native_handle() { return _ctx; }
+
+  /**
+   * session to resume for the server name, nullptr if none. The caller owns
+   * one reference.
+   * */
+  ssl_session_st *get_session(const std::string &name_);
+  /**
+   * remember session for the server name. Takes the reference.
+   * */
+  void put_session(const std::string &name_, ssl_session_st *session_);
+
+  ~tls_context();
+  tls_context(tls_context const &) = delete;
+  tls_context &operator=(tls_context const &) = delete;
+};
+using tls_context_p = std::shared_ptr<tls_context>;
+
+} // namespace net
+} // namespace tp
+
+#endif
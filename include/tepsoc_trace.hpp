@@ -0,0 +1,59 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_TRACE__HPP___
+#define __TP__NET__TEPSOC_TRACE__HPP___
+
+#include <ostream>
+
+namespace tp {
+namespace net {
+
+/**
+ * true when the library is built with tracing (CMake option TEPSOC_TRACE).
+ *
+ * Then every thread records spans of the hot path (waiting for events,
+ * accept, recv, callback lookup, handlers, send) into its own ring buffer,
+ * without locks. The newest 8192 spans of each thread are kept. Without the
+ * option the trace points are not compiled in.
+ * */
+bool trace_enabled();
+
+/**
+ * write the recorded spans of all threads as Chrome trace event JSON, that
+ * can be opened in ui.perfetto.dev or chrome://tracing. Spans written while
+ * the trace is read may be missing.
+ * */
+void write_chrome_trace(std::ostream &out_);
+
+/**
+ * forget the spans recorded so far
+ * */
+void clear_trace();
+
+} // namespace net
+} // namespace tp
+
+#endif
@@ -0,0 +1,278 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_WS__HPP___
+#define __TP__NET__TEPSOC_WS__HPP___
+
+#include <tepsoc_codec.hpp>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tp {
+namespace net {
+
+/**
+ * WebSocket frame types (RFC 6455 section 5.2)
+ * */
+enum ws_opcode {
+  WS_CONTINUATION = 0,
+  WS_TEXT = 1,
+  WS_BINARY = 2,
+  WS_CLOSE = 8,
+  WS_PING = 9,
+  WS_PONG = 10
+};
+
+/**
+ * one WebSocket frame. The decoded payload refers to the received data and
+ * is still masked, see websocket_mask.
+ * */
+struct ws_frame {
+  bool fin = true;
+  int rsv = 0; // reserved bits, 0 without extensions
+  ws_opcode opcode = WS_TEXT;
+  bool masked = false;
+  unsigned char mask[4] = {0, 0, 0, 0};
+  std::string_view payload;
+};
+
+/**
+ * frame longer than ws_frame_codec::max_payload
+ * */
+class ws_frame_too_big : public codec_error {
+public:
+  using codec_error::codec_error;
+};
+
+/**
+ * RFC 6455 framing, for decoder. Servers send unmasked frames, clients
+ * masked ones.
+ * */
+struct ws_frame_codec {
+  using message = ws_frame;
+  // longer frames are ws_frame_too_big
+  std::size_t max_payload = 16 * 1024 * 1024;
+
+  std::size_t decode(const char *data_, std::size_t size_,
+                     message &message_) const;
+  /**
+   * frame with the plain payload, masked with frame_.mask when
+   * frame_.masked
+   * */
+  void encode(const ws_frame &frame_, encode_buffer &out_) const;
+  /**
+   * header of unmasked frame with size_ bytes of payload, at most
+   * max_header bytes written to out_
+   *
+   * @return size of the header
+   * */
+  static std::size_t header(char *out_, ws_opcode opcode_, std::size_t size_,
+                            bool fin_ = true);
+  static constexpr std::size_t max_header = 10;
+};
+
+/**
+ * dst_ = src_ xor the masking key, starting at byte offset_ of the key
+ * (RFC 6455 section 5.3). Masking and unmasking are the same, dst_ may be
+ * src_. Uses AVX2 or SSE2 when the processor has them.
+ * */
+void websocket_mask(char *dst_, const char *src_, std::size_t size_,
+                    const unsigned char key_[4], std::size_t offset_ = 0);
+/**
+ * "avx2", "sse2" or "scalar", the implementation used by websocket_mask
+ * */
+const char *websocket_mask_implementation();
+/**
+ * Sec-WebSocket-Accept for the Sec-WebSocket-Key of the request
+ * */
+std::string websocket_accept_key(std::string_view key_);
+
+class websocket_server;
+
+/**
+ * WebSocket connection accepted by websocket_server. Messages are given to
+ * the handler when complete, fragmented ones are joined. Pings are answered,
+ * and the closing handshake is done before the connection is closed.
+ * Protocol errors close the connection with the status of RFC 6455 section
+ * 7.4. Sending is thread safe.
+ * */
+class websocket {
+public:
+  using message_f = std::function<void(ws_opcode opcode_,
+                                       std::string_view data_)>;
+  using close_f = std::function<void(int code_, std::string_view reason_)>;
+
+  /**
+   * created by websocket_server for the upgraded connection
+   * */
+  websocket(socket_p socket_, std::string path_,
+            std::map<std::string, std::string> headers_,
+            std::size_t max_message_);
+
+  /**
+   * handler of text and binary messages. Data is valid during the call,
+   * text is valid UTF-8.
+   * */
+  websocket &on_message(message_f handler_);
+  /**
+   * called once when the connection is closed, with the status from the
+   * close frame, 1005 when it had none and 1006 when there was no closing
+   * handshake
+   * */
+  websocket &on_close(close_f handler_);
+
+  /**
+   * send text message
+   * */
+  websocket &send(std::string_view text_);
+  /**
+   * send message of the opcode_ type
+   * */
+  websocket &send(ws_opcode opcode_, std::string_view data_);
+  /**
+   * send message without copying data_, the header is written in front of
+   * it with one vectored write
+   * */
+  websocket &send(ws_opcode opcode_, shared_buffer data_);
+  /**
+   * send ping, the peer answers with pong
+   * */
+  websocket &ping(std::string_view data_ = "");
+  /**
+   * start closing handshake. The connection is closed when the peer answers
+   * with its close frame.
+   * */
+  websocket &close(int code_ = 1000, std::string_view reason_ = "");
+
+  bool is_open() const { return !_close_sent && !_closed; }
+  /**
+   * path of the upgrade request, with the query
+   * */
+  const std::string &get_path() const { return _path; }
+  /**
+   * header of the upgrade request, the name in lower case. Empty when there
+   * was none.
+   * */
+  std::string get_header(const std::string &name_) const;
+  /**
+   * the underlying connection, nullptr after it was closed
+   * */
+  socket_p get_socket() const { return _socket.lock(); }
+
+private:
+  friend class websocket_server;
+
+  std::weak_ptr<socket> _socket;
+  std::string _path;
+  std::map<std::string, std::string> _headers;
+  message_f _on_message;
+  close_f _on_close;
+  // frames are written under _send_mutex, nothing follows the close frame
+  std::mutex _send_mutex;
+  std::atomic<bool> _close_sent;
+  std::atomic<bool> _closed;
+
+  // used by the loop thread
+  decoder<ws_frame_codec> _in;
+  std::string _message;
+  ws_opcode _message_opcode;
+  bool _in_message;
+  std::string _control;
+
+  void _on_data(const char *data_, std::size_t size_);
+  void _on_frame(ws_frame &frame_);
+  void _on_end();
+  // close the connection after the close frame
+  void _fail(int code_, std::string_view reason_);
+  void _finish(int code_, std::string_view reason_);
+  // a close frame marks the close as sent, later frames are dropped
+  void _send_frame(ws_opcode opcode_, std::string_view data_);
+  // write an encoded frame, false when the close frame was already sent
+  bool _send_encoded(shared_buffer frame_);
+};
+
+/**
+ * WebSocket server. HTTP/1.1 upgrade requests are answered with the
+ * handshake (RFC 6455 section 4.2), other requests with 400 or 426. The
+ * connection handler gets every upgraded websocket to set its handlers.
+ * */
+class websocket_server {
+public:
+  using connection_f = std::function<void(websocket &)>;
+
+  explicit websocket_server(connection_f on_connection_);
+  websocket_server(event_loop &loop_, connection_f on_connection_);
+
+  /**
+   * start listening, see server::listen
+   * */
+  websocket_server &listen(unsigned int port_, char const *addr_ = "*");
+  /**
+   * longer messages close the connection with 1009. The default is 16 MiB.
+   * */
+  websocket_server &set_max_message(std::size_t bytes_);
+  /**
+   * send message to every open websocket for which filter_ is true. The
+   * frame is encoded once and queued on all sockets without copying.
+   * Websockets with more than max_queued_ bytes waiting to be sent are
+   * skipped, 0 is no limit, as in server::broadcast.
+   * */
+  broadcast_result broadcast(ws_opcode opcode_, std::string_view data_,
+                             std::function<bool(websocket &)> filter_ = nullptr,
+                             std::size_t max_queued_ = 0);
+  /**
+   * number of open websockets
+   * */
+  std::size_t size();
+  /**
+   * the underlying server, for limits, options, TLS, unix sockets or adopt
+   * */
+  server &get_server() { return _server; }
+
+private:
+  connection_f _on_connection;
+  std::size_t _max_message;
+  std::mutex _websockets_mutex;
+  std::vector<std::weak_ptr<websocket>> _websockets;
+  server _server;
+
+  // removes expired websockets, with _websockets_mutex held
+  void _prune();
+  void _serve(socket_p s_);
+  // the websocket, or nullptr when the request was answered with an error
+  std::shared_ptr<websocket> _upgrade(socket_p s_, std::string_view request_);
+};
+
+} // namespace net
+} // namespace tp
+
+#endif
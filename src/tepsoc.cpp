@@ -25,6 +25,11 @@ SOFTWARE.
 
 #include <tepsoc.hpp>
 
+#include "tepsoc_tls_session.hpp"
+#include "tepsoc_trace_span.hpp"
+#include "tepsoc_uring.hpp"
+
+#include <algorithm>
 #include <stdexcept>
 
 #include <future>
@@ -37,14 +42,322 @@ SOFTWARE.
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 namespace tp {
 namespace net {
 
+enum option_target { LISTENING_SOCKET, CONNECTING_SOCKET, CONNECTED_SOCKET };
+
+/**
+ * apply options that are set and make sense for the target
+ *
+ * @return error message or empty string
+ * */
+static std::string apply_options(int fd, const socket_options &o,
+                                 option_target target) {
+  std::string err;
+  int domain = AF_UNSPEC;
+  socklen_t domain_len = sizeof(domain);
+  getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &domain_len);
+  auto set = [&](int level, int name, char const *name_s,
+                 const std::optional<int> &value) {
+    if (!value || ((domain == AF_UNIX) && (level == IPPROTO_TCP)))
+      return;
+    int v = *value;
+    if (setsockopt(fd, level, name, &v, sizeof(v)) == -1)
+      err += std::string(err.size() ? "; " : "") + "setsockopt " + name_s +
+             ": " + strerror(errno);
+  };
+  auto flag = [](const std::optional<bool> &value) -> std::optional<int> {
+    if (value)
+      return *value ? 1 : 0;
+    return std::nullopt;
+  };
+  set(IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", flag(o.no_delay));
+  set(SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", o.send_buffer);
+  set(SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", o.receive_buffer);
+  set(SOL_SOCKET, SO_KEEPALIVE, "SO_KEEPALIVE", flag(o.keep_alive));
+  set(IPPROTO_TCP, TCP_KEEPIDLE, "TCP_KEEPIDLE", o.keep_idle);
+  set(IPPROTO_TCP, TCP_KEEPINTVL, "TCP_KEEPINTVL", o.keep_interval);
+  set(IPPROTO_TCP, TCP_KEEPCNT, "TCP_KEEPCNT", o.keep_count);
+  set(SOL_SOCKET, SO_BUSY_POLL, "SO_BUSY_POLL", o.busy_poll);
+  set(IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT", o.not_sent_lowat);
+  switch (target) {
+  case LISTENING_SOCKET:
+    set(IPPROTO_TCP, TCP_DEFER_ACCEPT, "TCP_DEFER_ACCEPT", o.defer_accept);
+    set(IPPROTO_TCP, TCP_FASTOPEN, "TCP_FASTOPEN", o.fast_open);
+    break;
+  case CONNECTING_SOCKET:
+    if (o.fast_open)
+      set(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, "TCP_FASTOPEN_CONNECT",
+          (*o.fast_open > 0) ? 1 : 0);
+    set(IPPROTO_TCP, TCP_QUICKACK, "TCP_QUICKACK", flag(o.quick_ack));
+    break;
+  case CONNECTED_SOCKET:
+    set(IPPROTO_TCP, TCP_QUICKACK, "TCP_QUICKACK", flag(o.quick_ack));
+    break;
+  }
+  return err;
+}
+
+/**
+ * address of unix domain socket in the form used by _connect_next. Path
+ * starting with '@' is in the abstract namespace.
+ * */
+static std::shared_ptr<struct addrinfo> unix_addrinfo(const std::string &path) {
+  struct unix_addrinfo_t {
+    struct addrinfo ai;
+    struct sockaddr_un sun;
+  };
+  auto p = std::make_shared<unix_addrinfo_t>();
+  if (path.empty() || (path.size() >= sizeof(p->sun.sun_path)))
+    throw std::invalid_argument("bad unix socket path: " + path);
+  p->sun.sun_family = AF_UNIX;
+  std::copy(path.begin(), path.end(), p->sun.sun_path);
+  socklen_t len = offsetof(struct sockaddr_un, sun_path) + path.size();
+  if (path[0] == '@')
+    p->sun.sun_path[0] = '\0';
+  else
+    len++; // terminating zero
+  p->ai.ai_family = AF_UNIX;
+  p->ai.ai_socktype = SOCK_STREAM;
+  p->ai.ai_addr = (struct sockaddr *)&p->sun;
+  p->ai.ai_addrlen = len;
+  return std::shared_ptr<struct addrinfo>(p, &p->ai);
+}
+
+// bytes moved by one splice into the pipe, and data copied to the pipe peer
+// that may wait in its write queue before reading stops
+static const std::size_t pipe_chunk = 64 * 1024;
+static const std::size_t pipe_copy_limit = 64 * 1024;
+// received data kept for DATA handler before reading stops
+static const std::size_t default_receive_limit = 1024 * 1024;
+
+static void close_all(const std::vector<int> &fds) {
+  for (int fd : fds)
+    ::close(fd);
+}
+
+/**
+ * send data with descriptors attached to its first byte
+ * */
+static long send_with_fds(int s, const char *data, std::size_t size,
+                          const std::vector<int> &fds) {
+  struct iovec iov = {(void *)data, size};
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  std::copy(fds.begin(), fds.end(), (int *)CMSG_DATA(cmsg));
+  return ::sendmsg(s, &msg, MSG_NOSIGNAL);
+}
+
+/**
+ * connection given by server::hand_over. The header is sent with the
+ * descriptor attached, and the state, received and unsent bytes follow it.
+ * */
+struct handoff_record {
+  int fd = -1;
+  std::string state;
+  std::string received;
+  std::string unsent;
+};
+struct handoff_header {
+  std::uint32_t magic;
+  std::uint32_t state_size;
+  std::uint64_t received_size;
+  std::uint64_t unsent_size;
+};
+static const std::uint32_t handoff_magic = 0x74706831; // "tph1"
+
+static void set_io_timeout(int s, int optname, int timeout_ms) {
+  struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+  setsockopt(s, SOL_SOCKET, optname, &tv, sizeof(tv));
+}
+
+static bool send_all(int s, const char *data, std::size_t size) {
+  while (size) {
+    long n = ::send(s, data, size, MSG_NOSIGNAL);
+    if ((n < 0) && (errno == EINTR))
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool recv_all(int s, std::string &data, std::size_t size) {
+  data.resize(size);
+  for (std::size_t got = 0; got < size;) {
+    long n = ::recv(s, data.data() + got, size - got, 0);
+    if ((n < 0) && (errno == EINTR))
+      continue;
+    if (n <= 0)
+      return false;
+    got += n;
+  }
+  return true;
+}
+
+static bool send_handoff(int s, const handoff_record &r) {
+  handoff_header h = {handoff_magic, (std::uint32_t)r.state.size(),
+                      r.received.size(), r.unsent.size()};
+  return (send_with_fds(s, (const char *)&h, sizeof(h), {r.fd}) ==
+          sizeof(h)) &&
+         send_all(s, r.state.data(), r.state.size()) &&
+         send_all(s, r.received.data(), r.received.size()) &&
+         send_all(s, r.unsent.data(), r.unsent.size());
+}
+
+/**
+ * @return 1 when r was received, 0 at the end and -1 on error
+ * */
+static int receive_handoff(int s, handoff_record &r) {
+  handoff_header h;
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = {&h, sizeof(h)};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  long n;
+  do {
+    n = ::recvmsg(s, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+  } while ((n < 0) && (errno == EINTR));
+  if (n == 0)
+    return 0;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && (cmsg->cmsg_level == SOL_SOCKET) &&
+      (cmsg->cmsg_type == SCM_RIGHTS))
+    r.fd = *(int *)CMSG_DATA(cmsg);
+  if ((n != sizeof(h)) || (h.magic != handoff_magic) || (r.fd < 0) ||
+      !recv_all(s, r.state, h.state_size) ||
+      !recv_all(s, r.received, h.received_size) ||
+      !recv_all(s, r.unsent, h.unsent_size))
+    return -1;
+  return 1;
+}
+
+owned_buffer::owned_buffer(std::vector<char> &&data_)
+    : _storage(std::move(data_)) {}
+
+owned_buffer::owned_buffer(std::string &&data_) : _storage(std::move(data_)) {}
+
+owned_buffer::owned_buffer(shared_buffer data_) {
+  if (data_) {
+    const char *data = data_->data();
+    std::size_t size = data_->size();
+    _storage = adopted_t{std::move(data_), data, size};
+  }
+}
+
+owned_buffer::owned_buffer(std::shared_ptr<const void> owner_,
+                           const char *data_, std::size_t size_)
+    : _storage(adopted_t{std::move(owner_), data_, size_}) {}
+
+// the string keeps short data inside itself, so the address is taken on use
+const char *owned_buffer::data() const {
+  if (auto v = std::get_if<std::vector<char>>(&_storage))
+    return v->data();
+  if (auto str = std::get_if<std::string>(&_storage))
+    return str->data();
+  return std::get<adopted_t>(_storage).data;
+}
+
+std::size_t owned_buffer::size() const {
+  if (auto v = std::get_if<std::vector<char>>(&_storage))
+    return v->size();
+  if (auto str = std::get_if<std::string>(&_storage))
+    return str->size();
+  return std::get<adopted_t>(_storage).size;
+}
+
+void *connection_memory::do_allocate(std::size_t bytes, std::size_t alignment) {
+  if (!_upstream)
+    return std::pmr::get_default_resource()->allocate(bytes, alignment);
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _upstream->allocate(bytes, alignment);
+}
+
+void connection_memory::do_deallocate(void *p, std::size_t bytes,
+                                      std::size_t alignment) {
+  if (!_upstream)
+    return std::pmr::get_default_resource()->deallocate(p, bytes, alignment);
+  std::lock_guard<std::mutex> lock(_mutex);
+  _upstream->deallocate(p, bytes, alignment);
+}
+
+/**
+ * allocator that keeps the connection memory until the last allocation is
+ * freed, so objects that outlive the socket (control blocks) can use it
+ * */
+template <class T> struct connection_allocator {
+  using value_type = T;
+  std::shared_ptr<connection_memory> memory;
+
+  explicit connection_allocator(std::shared_ptr<connection_memory> memory_)
+      : memory(std::move(memory_)) {}
+  template <class U>
+  connection_allocator(const connection_allocator<U> &other)
+      : memory(other.memory) {}
+  T *allocate(std::size_t n) {
+    return (T *)memory->allocate(n * sizeof(T), alignof(T));
+  }
+  void deallocate(T *p, std::size_t n) {
+    memory->deallocate(p, n * sizeof(T), alignof(T));
+  }
+  template <class U> bool operator==(const connection_allocator<U> &o) const {
+    return memory == o.memory;
+  }
+  template <class U> bool operator!=(const connection_allocator<U> &o) const {
+    return memory != o.memory;
+  }
+};
+
+static std::shared_ptr<connection_memory>
+to_connection_memory(std::shared_ptr<std::pmr::memory_resource> memory_) {
+  // sockets without their own resource share the unlocked default
+  static auto default_memory = std::make_shared<connection_memory>(nullptr);
+  if (!memory_)
+    return default_memory;
+  if (auto m = std::dynamic_pointer_cast<connection_memory>(memory_))
+    return m;
+  return std::make_shared<connection_memory>(std::move(memory_));
+}
+
 void socket::_on_connect() {
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    int domain = AF_UNSPEC;
+    socklen_t len = sizeof(domain);
+    getsockopt(connected_socket, SOL_SOCKET, SO_DOMAIN, &domain, &len);
+    _local = (domain == AF_UNIX);
+  }
+  if (_tls_context && !_tls_ready) {
+    // CONNECT is emitted when the handshake is done
+    _start_tls();
+    return;
+  }
   tp::net::socket_event_callback_f cb;
   int cb_count = 0;
   _callback_guard([&]() {
@@ -53,6 +366,9 @@ void socket::_on_connect() {
       cb = _callbacks.at(socket_event::CONNECT);
   });
 
+  if (server *owner = _server; owner && !_server_alive.expired())
+    if (auto self = _self.lock())
+      _handler_guard([&]() { owner->_on_connect(self); });
   if (cb_count) {
     switch (cb.index()) {
     case 0:
@@ -65,29 +381,226 @@ void socket::_on_connect() {
       _on_error("bad CONNECT callback: " + std::to_string(cb.index()));
     }
   }
+  _start_reading();
+  if (socket *peer = _pipe_peer) {
+    // the pipe waited for this connection
+    peer->_pipe_flush();
+    _pipe_flush();
+    _pipe_rearm();
+  }
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  _last_read = _last_write = _loop->now_ms();
+  _arm_timeout();
+}
+
+void socket::_start_reading() {
+  if (_uses_uring()) {
+    std::weak_ptr<char> alive = _alive;
+    _loop->execute([this, alive]() {
+      if (alive.expired())
+        return;
+      std::lock_guard<std::mutex> lock(_write_mutex);
+      // piped meanwhile, so served by epoll
+      if ((connected_socket < 0) || _recv_streaming || !_uses_uring() ||
+          _reading_blocked())
+        return;
+      _recv_streaming = true;
+      _loop->uring()->recv_stream(
+          connected_socket, [this, alive](const char *data_, long size_) {
+            if (alive.expired())
+              return;
+            if (size_ <= 0)
+              _recv_streaming = false;
+            if (size_ == -ECANCELED)
+              _on_stream_stopped();
+            else
+              _on_received(data_, size_);
+          });
+    });
+    return;
+  }
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  if (connected_socket >= 0)
+    _loop->watch(connected_socket, _io_events(),
+                 [this](unsigned int events) { _handle_io(events); });
+}
+
+void socket::_start_tls() {
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    if (connected_socket < 0)
+      return;
+    _tls = tls_session::create(_tls_context, connected_socket,
+                               _tls_server_name);
+    // stalled handshake expires like idle connection
+    _last_read = _last_write = _loop->now_ms();
+    _arm_timeout();
+    _loop->watch(connected_socket, _io_events(),
+                 [this](unsigned int events) { _handle_io(events); });
+  }
+  _continue_handshake();
+}
+
+void socket::_continue_handshake() {
+  tls_session::handshake_e result;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    if ((connected_socket < 0) || _tls_ready)
+      return;
+    result = _tls->handshake();
+    if (result == tls_session::DONE)
+      _tls_ready = true;
+    else if (result != tls_session::FAILED)
+      _loop->modify(connected_socket, _io_events());
+  }
+  if (result == tls_session::FAILED) {
+    _on_error(_tls->error());
+    _close_connection();
+    return;
+  }
+  if (result != tls_session::DONE)
+    return;
+  _on_connect();
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    if ((connected_socket >= 0) && _end_requested &&
+        (_write_queue.size() == 0))
+      _shutdown_write();
+  }
+  // records that came with the handshake do not make the socket readable
   _handle_incoming_data();
 }
 
-int socket::_on_data(const std::vector<char> &recvbuff) {
+void socket::_shutdown_write() {
+  if (_write_ended)
+    return;
+  _write_ended = true;
+  if (_tls)
+    _tls->shutdown();
+  ::shutdown(connected_socket, SHUT_WR);
+  // callers hold _write_mutex, so FINISH is emitted by the loop
+  std::weak_ptr<char> alive = _alive;
+  _loop->post([this, alive]() {
+    if (!alive.expired())
+      _on_finish();
+  });
+}
+
+long socket::_send_some(const char *data_, std::size_t size_) {
+  TEPSOC_TRACE_NAMED(span, "socket.send", size_);
+  long ret = _tls ? _tls->write(data_, size_)
+                  : ::send(connected_socket, data_, size_, MSG_NOSIGNAL);
+  TEPSOC_TRACE_ARG(span, ret);
+  return ret;
+}
+
+/**
+ * buffers gathered by one sendmsg, small ones are not worth a system call
+ * each
+ * */
+static constexpr int max_gathered_buffers = 16;
+
+static long send_gathered(int fd_, iovec *iov_, int count_,
+                          std::size_t size_) {
+  (void)size_; // only traced
+  TEPSOC_TRACE_NAMED(span, "socket.send", size_);
+  msghdr msg = {};
+  msg.msg_iov = iov_;
+  msg.msg_iovlen = count_;
+  long ret = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+  TEPSOC_TRACE_ARG(span, ret);
+  return ret;
+}
+
+long socket::_send_queued() {
+  auto &front = _write_queue.front();
+  if (_tls || (_write_queue.size() == 1))
+    return _send_some(front.data() + _write_offset,
+                      front.size() - _write_offset);
+  iovec iov[max_gathered_buffers];
+  int count = 0;
+  std::size_t size = 0;
+  std::size_t offset = _write_offset;
+  for (auto &buf : _write_queue) {
+    iov[count].iov_base = const_cast<char *>(buf.data()) + offset;
+    iov[count].iov_len = buf.size() - offset;
+    size += iov[count].iov_len;
+    offset = 0;
+    if (++count == max_gathered_buffers)
+      break;
+  }
+  return send_gathered(connected_socket, iov, count, size);
+}
+
+long socket::_receive_tls(char *buf_, std::size_t size_) {
+  long ret;
+  int err;
+  std::string message;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    ret = _tls->read(buf_, size_);
+    err = errno;
+    if ((ret == -1) && (err == EPROTO))
+      message = _tls->error();
+  }
+  if (message.size())
+    _on_error(message);
+  errno = err;
+  return ret;
+}
+
+socket &socket::use_tls(std::shared_ptr<tls_context> context_,
+                        const std::string &server_name_) {
+  if (context_ && context_->is_server())
+    throw std::invalid_argument("use_tls needs client context");
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  _tls_context = context_;
+  _tls_server_name = server_name_;
+  return *this;
+}
+
+tls_info socket::get_tls_info() {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  if (!_tls)
+    return tls_info();
+  return _tls->info();
+}
+
+int socket::_on_data(const char *data_, std::size_t size_) {
+  TEPSOC_TRACE_SCOPE("socket.data", size_);
   tp::net::socket_event_callback_f cb;
 
-  cb = get_callback(socket_event::DATA);
+  if (auto shared = _shared_for(DATA)) {
+    _handler_guard([&]() {
+      TEPSOC_TRACE_SCOPE("handler.data", size_);
+      shared->data(*this, std::string_view(data_, size_));
+    });
+    return 0;
+  }
+  {
+    TEPSOC_TRACE_SCOPE("socket.callbacks", 0);
+    cb = get_callback(socket_event::DATA);
+  }
 
+  // the time between socket.data and handler.data is the handler lock
   switch (cb.index()) {
   case 1:
     _handler_guard([&]() {
-      std::string s = "";
-      for (auto c : recvbuff) {
-        s = s + ((c > 0) ? c : ' ');
-      }
-      std::get<1>(cb)(s);
-      //      std::get<1>(cb)(std::string(recvbuff.begin(), recvbuff.end()));
+      TEPSOC_TRACE_SCOPE("handler.data", size_);
+      std::get<1>(cb)(std::string(data_, size_));
     });
-    std::cout << "recvbuff size: " << recvbuff.size() << " ok " << std::endl;
     return 0;
   case 3:
-    _handler_guard([&]() { std::get<3>(cb)(recvbuff); });
-    std::cout << "recvbuff size: " << recvbuff.size() << " ok " << std::endl;
+    _handler_guard([&]() {
+      TEPSOC_TRACE_SCOPE("handler.data", size_);
+      std::get<3>(cb)(std::vector<char>(data_, data_ + size_));
+    });
+    return 0;
+  case 8:
+    _handler_guard([&]() {
+      TEPSOC_TRACE_SCOPE("handler.data", size_);
+      std::get<8>(cb)(std::string_view(data_, size_));
+    });
     return 0;
   default:
     _on_error("bad DATA callback");
@@ -97,6 +610,11 @@ int socket::_on_data(const std::vector<char> &recvbuff) {
 void socket::_on_error(const std::string err) {
   tp::net::socket_event_callback_f cb;
 
+  if (auto shared = _shared_for(ERROR)) {
+    _handler_guard([&]() { shared->error(*this, err); });
+    return;
+  }
+
   cb = get_callback(socket_event::ERROR);
   switch (cb.index()) {
   case 0:
@@ -111,98 +629,1083 @@ void socket::_on_error(const std::string err) {
     return;
   }
 }
+void socket::_on_fds(std::vector<int> fds_) {
+  tp::net::socket_event_callback_f cb;
+  cb = get_callback(socket_event::FDS);
+  if (cb.index() == 6) {
+    _handler_guard([&]() { std::get<6>(cb)(fds_); });
+  } else {
+    // nobody takes them
+    close_all(fds_);
+  }
+}
 void socket::_on_end() {
   tp::net::socket_event_callback_f cb;
+  if (auto shared = _shared_for(END)) {
+    _handler_guard([&]() { shared->end(*this); });
+    return;
+  }
   cb = get_callback(socket_event::END);
   if (cb.index() == 0)
     _handler_guard([&]() { std::get<0>(cb)(); });
 }
+void socket::_on_finish() {
+  tp::net::socket_event_callback_f cb;
+  cb = get_callback(socket_event::FINISH);
+  if ((cb.index() == 0) && std::get<0>(cb))
+    _handler_guard([&]() { std::get<0>(cb)(); });
+  bool close_now;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    close_now = _read_ended && (connected_socket >= 0);
+  }
+  if (close_now)
+    _close_connection();
+}
+void socket::_on_timeout(socket_timeout kind) {
+  static const char *names[] = {"idle", "read", "write"};
+  tp::net::socket_event_callback_f cb;
+  cb = get_callback(socket_event::TIMEOUT);
+  switch (cb.index()) {
+  case 0:
+    if (std::get<0>(cb)) {
+      _handler_guard([&]() { std::get<0>(cb)(); });
+    } else {
+      // no handler, so the connection is closed
+      _on_end();
+      _close_connection();
+    }
+    return;
+  case 1:
+    _handler_guard([&]() { std::get<1>(cb)(names[kind]); });
+    return;
+  case 2:
+    _handler_guard([&]() { std::get<2>(cb)(*this); });
+    return;
+  default:
+    _on_error("bad TIMEOUT callback: " + std::to_string(cb.index()));
+  }
+}
+
+void socket::_arm_timeout() {
+  if (_timeout_timer) {
+    _loop->clear_timeout(_timeout_timer);
+    _timeout_timer = 0;
+  }
+  if (connected_socket < 0)
+    return;
+  std::uint64_t deadline = 0;
+  auto earliest = [&](socket_timeout kind, std::uint64_t since) {
+    if (_timeouts[kind] && (!deadline || (since + _timeouts[kind] < deadline)))
+      deadline = since + _timeouts[kind];
+  };
+  earliest(IDLE_TIMEOUT, std::max<std::uint64_t>(_last_read, _last_write));
+  earliest(READ_TIMEOUT, _last_read);
+  if (_write_queue.size() || _send_in_flight)
+    earliest(WRITE_TIMEOUT, _last_write);
+  if (!deadline)
+    return;
+  std::uint64_t now = _loop->now_ms();
+  std::weak_ptr<char> alive = _alive;
+  _timeout_timer = _loop->set_timeout(
+      [this, alive]() {
+        if (!alive.expired())
+          _check_timeout();
+      },
+      (deadline > now) ? (deadline - now) : 0);
+}
+
+void socket::_check_timeout() {
+  socket_timeout kind;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    _timeout_timer = 0;
+    if (connected_socket < 0)
+      return;
+    std::uint64_t now = _loop->now_ms();
+    auto expired = [&](socket_timeout k, std::uint64_t since) {
+      return _timeouts[k] && (since + _timeouts[k] <= now);
+    };
+    if ((_write_queue.size() || _send_in_flight) &&
+        expired(WRITE_TIMEOUT, _last_write)) {
+      kind = WRITE_TIMEOUT;
+    } else if (expired(READ_TIMEOUT, _last_read)) {
+      kind = READ_TIMEOUT;
+    } else if (expired(IDLE_TIMEOUT,
+                       std::max<std::uint64_t>(_last_read, _last_write))) {
+      kind = IDLE_TIMEOUT;
+    } else {
+      // there was activity since the timer was armed
+      _arm_timeout();
+      return;
+    }
+    _last_read = _last_write = now;
+  }
+  _on_timeout(kind);
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  if (!_timeout_timer)
+    _arm_timeout();
+}
+
+const socket_event_callback_f &socket::_default_callback(socket_event e) {
+  static const socket_event_callback_f on_error =
+      std::function<void(std::string)>([](std::string err) {
+        std::cerr << "socket error: " << err << std::endl;
+      });
+  static const socket_event_callback_f nothing = std::function<void()>([]() {});
+  static const socket_event_callback_f none;
+  switch (e) {
+  case ERROR:
+    return on_error;
+  case CONNECT:
+  case END:
+    return nothing;
+  default:
+    return none;
+  }
+}
+
+const connection_handlers *socket::_shared_for(socket_event e) {
+  // not changed after the connection is wrapped, so read without locking
+  const connection_handlers *shared = _shared_handlers.get();
+  if (!shared)
+    return nullptr;
+  bool handles = (e == DATA)    ? bool(shared->data)
+                 : (e == END)   ? bool(shared->end)
+                 : (e == ERROR) ? bool(shared->error)
+                                : false;
+  if (!handles)
+    return nullptr;
+  std::lock_guard<std::mutex> lock(_callbacks_mutex);
+  return _callbacks.count(e) ? nullptr : shared;
+}
+
+socket &socket::set_options(const socket_options &options_) {
+  std::string err;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    _options = std::make_unique<socket_options>(options_);
+    if (connected_socket >= 0)
+      err = apply_options(connected_socket, *_options, CONNECTED_SOCKET);
+  }
+  if (err.size())
+    _on_error(err);
+  return *this;
+}
+
+socket &socket::set_timeout(socket_timeout kind, unsigned long ms) {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  _timeouts[kind] = ms;
+  _arm_timeout();
+  return *this;
+}
+
+unsigned int socket::_io_events() {
+  if (_co_mode)
+    return IO_READ | IO_WRITE | IO_PEER_CLOSED | IO_EDGE;
+  if (_tls && !_tls_ready)
+    return IO_READ | (_tls->wants_write() ? (unsigned int)IO_WRITE : 0);
+  // a stopped receive stream of io_uring may still deliver data
+  bool reading = !_close_requested && !_read_ended && !_recv_streaming &&
+                 !_reading_blocked() && !_pipe_stalled();
+  unsigned int events = reading ? (unsigned int)IO_READ : 0;
+  // the pipe peer holds data for this socket
+  if (_write_queue.size() ||
+      (_pipe_peer && _pipe_peer->_pipe_held && !_send_in_flight))
+    events |= IO_WRITE;
+  return events;
+}
+
+void socket::_handle_io(unsigned int events) {
+  if (_tls && !_tls_ready) {
+    _continue_handshake();
+    return;
+  }
+  if (events & (IO_WRITE | IO_ERROR | IO_HANGUP)) {
+    _flush_write_queue();
+    if (socket *peer = _pipe_peer) {
+      peer->_pipe_flush();
+      peer->_pipe_rearm();
+    }
+  }
+  if (events & (IO_READ | IO_ERROR | IO_HANGUP))
+    _handle_incoming_data();
+}
 
 void socket::_handle_incoming_data() {
-  int ret = 0;
-  std::vector<char> recvbuff(4096);
-  std::list<std::vector<char>> backlog;
-  // MSG_DONTWAIT
-  while (true) {
-    ret = ::recv(connected_socket, recvbuff.data(), recvbuff.size(), 0);
-    if (ret == 0)
-      break;
+  if (_recv_streaming)
+    return;
+  if (_pipe_peer && (_pipe_fds[1] >= 0)) {
+    _pipe_forward();
+    _pipe_rearm();
+    return;
+  }
+  // limit reads per readiness, so one fast peer does not starve the others
+  const int max_reads = 16;
+  char recvbuff[4096];
+  for (int i = 0; (i < max_reads) && (connected_socket >= 0) &&
+                  !_close_requested && !_read_ended && !_reading_blocked() &&
+                  !_pipe_stalled();
+       i++) {
+    long ret;
+    {
+      TEPSOC_TRACE_NAMED(span, "socket.recv", 0);
+      ret = _tls     ? _receive_tls(recvbuff, sizeof(recvbuff))
+            : _local ? _receive_local(recvbuff, sizeof(recvbuff))
+                     : ::recv(connected_socket, recvbuff, sizeof(recvbuff), 0);
+      TEPSOC_TRACE_ARG(span, ret);
+    }
     if (ret == -1) {
-      if (!((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return;
+      if (errno == EINTR)
+        continue;
+      ret = -errno;
+    }
+    _on_received(recvbuff, ret);
+  }
+  if (_tls && (connected_socket >= 0) && !_close_requested) {
+    bool pending;
+    {
+      std::lock_guard<std::mutex> lock(_write_mutex);
+      pending = _tls->has_pending();
+    }
+    // decrypted data does not make the socket readable
+    std::weak_ptr<char> alive = _alive;
+    if (pending && !_reading_blocked())
+      _loop->post([this, alive]() {
+        if (!alive.expired())
+          _handle_incoming_data();
+      });
+  }
+  if (_pipe_peer)
+    _pipe_rearm();
+}
+
+long socket::_receive_local(char *buf_, std::size_t size_) {
+  const std::size_t max_fds = 64;
+  char control[CMSG_SPACE(sizeof(int) * max_fds)];
+  struct iovec iov = {buf_, size_};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  long ret = ::recvmsg(connected_socket, &msg, MSG_CMSG_CLOEXEC);
+  if (ret <= 0)
+    return ret;
+  std::vector<int> fds;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+      int *first = (int *)CMSG_DATA(cmsg);
+      fds.insert(fds.end(), first,
+                 first + (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC)
+    _on_error("too many file descriptors received, some were dropped");
+  if (fds.size())
+    _on_fds(std::move(fds));
+  return ret;
+}
+
+void socket::_on_received(const char *data_, long size_) {
+  if (size_ > 0) {
+    _last_read = _loop->now_ms();
+    if (_pipe_peer) {
+      _pipe_peer->write(data_, size_);
+      return;
+    }
+    if ((_backlog.size() == 0) && !_paused) {
+      // straight from the read buffer, copied only when not accepted
+      if (_on_data(data_, size_) == 0)
+        return;
+      _backlog_bytes += size_;
+      _backlog.emplace_back(data_, data_ + size_);
+    } else {
+      _backlog_bytes += size_;
+      _backlog.emplace_back(data_, data_ + size_);
+      _deliver_backlog();
+    }
+    _check_reading();
+    return;
+  }
+  if ((size_ == 0) && (_backlog.size() || _paused) && !_pipe_peer) {
+    // END follows the data
+    _end_pending = true;
+    _check_reading();
+    return;
+  }
+  if ((size_ == 0) && _pipe_peer) {
+    // the peer is ended when the pipe is empty
+    _pipe_eof = true;
+    _on_end();
+    _pipe_flush();
+    return;
+  }
+  if ((size_ == 0) && _allow_half_open) {
+    bool close_now;
+    {
+      std::lock_guard<std::mutex> lock(_write_mutex);
+      _read_ended = true;
+      close_now = _write_ended;
+      if ((connected_socket >= 0) && !_uses_uring())
+        _loop->modify(connected_socket, _io_events());
+    }
+    _on_end();
+    if (close_now)
+      _close_connection();
+    return;
+  }
+  if (size_ < 0)
+    _on_error("connection broken");
+  _on_end();
+  _finish();
+}
+
+void socket::_flush_write_queue() {
+  bool close_now = false;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    // submitted to io_uring before the socket was piped
+    if ((connected_socket < 0) || _send_in_flight)
+      return;
+    while (_write_queue.size()) {
+      auto &front = _write_queue.front();
+      const char *data = front.data() + _write_offset;
+      std::size_t size = front.size() - _write_offset;
+      long s;
+      if (_queued_fds.size() && (_queued_fds.front().first == 0)) {
+        s = send_with_fds(connected_socket, data, size,
+                          _queued_fds.front().second);
+        if (s > 0) {
+          close_all(_queued_fds.front().second);
+          _queued_fds.pop_front();
+          // the next message was counted from the start of this one
+          if (_queued_fds.size())
+            _queued_fds.front().first -= s;
+        }
+      } else if (_queued_fds.size()) {
+        // stop before the data that carries descriptors
+        auto &before = _queued_fds.front().first;
+        s = ::send(connected_socket, data, std::min(size, before),
+                   MSG_NOSIGNAL);
+        if (s > 0)
+          before -= s;
+      } else {
+        s = _send_queued();
+      }
+      if (s > 0) {
+        _last_write = _loop->now_ms();
+        _write_queued -= s;
+        // a gathered send can finish many buffers
+        for (std::size_t left = s; left;) {
+          auto &sent = _write_queue.front();
+          std::size_t n = std::min(left, sent.size() - _write_offset);
+          _write_offset += n;
+          left -= n;
+          if (_write_offset == sent.size()) {
+            _write_queue.pop_front();
+            _write_offset = 0;
+          }
+        }
+      } else if ((s == -1) && (errno == EINTR)) {
+        continue;
+      } else if ((s == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        break;
+      } else {
+        // connection is broken, the read side will report it
+        _clear_write_queue();
+        close_now = _close_requested;
         break;
       }
     }
+    if (_write_queue.size() == 0) {
+      if (_end_requested)
+        _shutdown_write();
+      close_now = _close_requested;
+    }
+    if (!close_now)
+      _loop->modify(connected_socket, _io_events());
+  }
+  if (close_now)
+    _close_connection();
+}
+
+void socket::_clear_write_queue() {
+  _write_queue.clear();
+  _write_offset = 0;
+  _write_queued = 0;
+  for (auto &[before, fds] : _queued_fds)
+    close_all(fds);
+  _queued_fds.clear();
+}
+
+void socket::_request_flush() {
+  if (_co_mode)
+    return;
+  if (_uses_uring()) {
+    // a submission is already pending when something was queued before
+    if (_send_in_flight || (_write_queue.size() > 1))
+      return;
+    std::weak_ptr<char> alive = _alive;
+    _loop->post([this, alive]() {
+      if (!alive.expired())
+        _submit_send();
+    });
+  } else {
+    _loop->modify(connected_socket, _io_events());
+  }
+}
+
+void socket::_submit_send() {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  if ((connected_socket < 0) || _send_in_flight || (_write_queue.size() == 0))
+    return;
+  // the buffer is owned by the completion, so it survives closing the socket
+  auto buf = std::make_shared<owned_buffer>(std::move(_write_queue.front()));
+  _write_queue.pop_front();
+  _send_in_flight = true;
+  std::weak_ptr<char> alive = _alive;
+  _loop->uring()->send(connected_socket, buf->data() + _write_offset,
+                       buf->size() - _write_offset,
+                       [this, alive, buf](long result_) {
+                         if (!alive.expired())
+                           _on_sent(buf, result_);
+                       });
+}
+
+void socket::_on_sent(std::shared_ptr<owned_buffer> buf_, long result_) {
+  bool close_now = false;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    _send_in_flight = false;
+    if (connected_socket < 0)
+      return;
+    if (result_ == -EAGAIN) {
+      _write_queue.push_front(std::move(*buf_));
+      std::weak_ptr<char> alive = _alive;
+      _loop->uring()->poll_once(connected_socket, POLLOUT,
+                                [this, alive](long) {
+                                  if (!alive.expired())
+                                    _submit_send();
+                                });
+      return;
+    }
+    if (result_ > 0) {
+      _last_write = _loop->now_ms();
+      _write_queued -= result_;
+    }
+    if (result_ < 0) {
+      // connection is broken, the read side will report it
+      _clear_write_queue();
+    } else if (_write_offset + result_ < buf_->size()) {
+      _write_offset += result_;
+      _write_queue.push_front(std::move(*buf_));
+    } else {
+      _write_offset = 0;
+    }
+    if (_write_queue.size() == 0) {
+      if (_end_requested)
+        _shutdown_write();
+      close_now = _close_requested;
+    }
+  }
+  if (close_now) {
+    _close_connection();
+  } else if (_uses_uring()) {
+    _submit_send();
+  } else {
+    // piped while the send was in flight, the rest is sent by epoll
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    if (connected_socket >= 0)
+      _request_flush();
+  }
+}
+
+socket &socket::_write_bytes(const char *data_, std::size_t size_,
+                             owned_buffer *owned_) {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  if ((connected_socket < 0) || _end_requested)
+    return *this;
+  std::size_t sent = 0;
+  // with io_uring the loop thread queues data and sends it in the next batch
+  bool direct = !(_uses_uring() && _loop->in_loop_thread()) &&
+                (!_tls || _tls_ready);
+  if (direct && (_write_queue.size() == 0) && !_send_in_flight) {
+    while (sent < size_) {
+      auto s = _send_some(data_ + sent, size_ - sent);
+      if (s > 0) {
+        _last_write = _loop->now_ms();
+        sent += s;
+      } else if ((s == -1) && (errno == EINTR)) {
+        continue;
+      } else if ((s == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        break;
+      } else {
+        // connection is broken, the read side will report it
+        return *this;
+      }
+    }
+  }
+  if ((sent < size_) && owned_)
+    _enqueue(std::move(*owned_), sent);
+  else if (sent < size_)
+    _enqueue(data_ + sent, size_ - sent);
+  return *this;
+}
+
+void socket::_enqueue(const char *data_, std::size_t size_) {
+  _enqueue(owned_buffer(std::vector<char>(data_, data_ + size_)), 0);
+}
+
+void socket::_enqueue(owned_buffer buf_, std::size_t offset_) {
+  if ((_write_queue.size() == 0) && !_send_in_flight) {
+    // write timeout counts from the moment data waits to be sent
+    _last_write = _loop->now_ms();
+    if (_timeouts[WRITE_TIMEOUT] && !_timeout_timer)
+      _arm_timeout();
+  }
+  if (offset_)
+    _write_offset = offset_;
+  _write_queued += buf_.size() - offset_;
+  _write_queue.push_back(std::move(buf_));
+  _request_flush();
+}
+
+socket &socket::send_fds(const std::vector<int> &fds_,
+                         const std::string &data_) {
+  if (data_.empty())
+    throw std::invalid_argument("send_fds needs data to carry descriptors");
+  std::vector<int> fds;
+  for (int fd : fds_) {
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (copy == -1) {
+      close_all(fds);
+      _on_error(std::string("send_fds: ") + strerror(errno));
+      return *this;
+    }
+    fds.push_back(copy);
+  }
+  std::string err;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    long sent = 0;
+    if ((connected_socket < 0) || _end_requested || !_local || _tls) {
+      err = "send_fds: unix domain socket is not connected";
+    } else if (_write_queue.size() == 0) {
+      do {
+        sent = send_with_fds(connected_socket, data_.data(), data_.size(), fds);
+      } while ((sent == -1) && (errno == EINTR));
+      if ((sent == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+        err = std::string("send_fds: ") + strerror(errno);
+    }
+    if ((sent > 0) || err.size()) {
+      close_all(fds);
+      if (sent > 0)
+        _last_write = _loop->now_ms();
+      if ((sent > 0) && ((std::size_t)sent < data_.size()))
+        _enqueue(data_.data() + sent, data_.size() - sent);
+    } else {
+      // the message starts after everything that is queued
+      std::size_t before = 0;
+      for (auto &chunk : _write_queue)
+        before += chunk.size();
+      before -= _write_offset;
+      for (auto &[b, f] : _queued_fds)
+        before -= b;
+      _queued_fds.emplace_back(before, std::move(fds));
+      _enqueue(data_.data(), data_.size());
+    }
+  }
+  if (err.size())
+    _on_error(err);
+  return *this;
+}
+
+void socket::_finish() {
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    if (_write_queue.size() || _send_in_flight) {
+      // close after everything queued by the END handler is sent
+      _close_requested = true;
+      if (!_uses_uring())
+        _loop->modify(connected_socket, _io_events());
+      return;
+    }
+  }
+  _close_connection();
+}
+
+void socket::_close_connection() {
+  int fd;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    fd = connected_socket;
+    connected_socket = -1;
+    _clear_write_queue();
+    if (_timeout_timer)
+      _loop->clear_timeout(_timeout_timer);
+    _timeout_timer = 0;
+    _tls_ready = false;
+  }
+  _end_pipe();
+  if (fd < 0)
+    return;
+  if (_recv_streaming) {
+    _loop->uring()->cancel_streams(fd);
+    _recv_streaming = false;
+  }
+  _loop->unwatch(fd);
+  ::close(fd);
+  _active_connection = false;
+  if (server *owner = _server; owner && !_server_alive.expired()) {
+    // told once per connection
+    _server = nullptr;
+    owner->_on_closed(fd, this);
+  }
+}
+
+socket &socket::pipe(socket &other_) {
+  if (&other_ == this)
+    throw std::invalid_argument("pipe: socket can not be piped to itself");
+  if (other_._loop != _loop)
+    throw std::invalid_argument("pipe: sockets must use the same event loop");
+  if (_co_mode || other_._co_mode)
+    throw std::invalid_argument("pipe: socket is used by coroutines");
+  std::weak_ptr<char> alive = _alive;
+  std::weak_ptr<char> other_alive = other_._alive;
+  // receive streams of io_uring are cancelled by the loop thread
+  _loop->execute([this, alive, &other_, other_alive]() {
+    if (!alive.expired() && !other_alive.expired())
+      _start_pipe(other_);
+  });
+  return *this;
+}
+
+void socket::_start_pipe(socket &other_) {
+  if (_pipe_peer || other_._pipe_peer) {
+    _on_error("pipe: socket is already piped");
+    return;
+  }
+  // TLS records are decrypted in user space
+  bool spliced = !_tls_context && !other_._tls_context;
+  _pipe_peer = &other_;
+  other_._pipe_peer = this;
+  for (socket *s : {this, &other_}) {
+    if (spliced && (::pipe2(s->_pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1)) {
+      // the data is copied instead
+      s->_pipe_fds[0] = s->_pipe_fds[1] = -1;
+      s->_on_error(std::string("pipe: ") + strerror(errno));
+    }
+    std::lock_guard<std::mutex> lock(s->_write_mutex);
+    // connecting socket is watched when it is connected
+    if ((s->connected_socket < 0) || !s->_active_connection)
+      continue;
+    // data still delivered by the stream is copied to the peer, and epoll
+    // reads after the stream ends
+    if (s->_recv_streaming)
+      _loop->uring()->stop_recv(s->connected_socket);
+    _loop->watch(s->connected_socket, s->_io_events(),
+                 [s](unsigned int events) { s->_handle_io(events); });
+  }
+  _pipe_flush();
+  other_._pipe_flush();
+  _pipe_rearm();
+}
+
+bool socket::_pipe_stalled() const {
+  if (!_pipe_peer)
+    return false;
+  if (_pipe_eof || _pipe_held || !_pipe_peer->_active_connection)
+    return true;
+  // copied data waits in the write queue of the peer
+  return (_pipe_fds[1] < 0) && (_pipe_peer->_write_queued >= pipe_copy_limit);
+}
+
+void socket::_pipe_forward() {
+  // limit reads per readiness, so one fast peer does not starve the others
+  const int max_reads = 16;
+  for (int i = 0; (i < max_reads) && (connected_socket >= 0) && _pipe_peer &&
+                  !_pipe_stalled();
+       i++) {
+    long ret = ::splice(connected_socket, nullptr, _pipe_fds[1], nullptr,
+                        pipe_chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
     if (ret > 0) {
-      recvbuff.resize(ret);
-      backlog.push_back(recvbuff);
-      recvbuff.resize(4096);
+      _last_read = _loop->now_ms();
+      _pipe_held += ret;
+      _pipe_flush();
+      continue;
+    }
+    if (ret == -1) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return;
+      if (errno == EINTR)
+        continue;
+      ret = -errno;
     }
-    while ((backlog.size() > 0) && (_on_data(backlog.front()) == 0)) {
-      backlog.pop_front();
+    _on_received(nullptr, ret);
+    return;
+  }
+}
+
+void socket::_pipe_flush() {
+  socket *peer = _pipe_peer;
+  if (!peer || !peer->_active_connection)
+    return;
+  // received before piping and not taken by the DATA handler
+  while (_backlog.size()) {
+    _backlog_bytes -= _backlog.front().size();
+    peer->write(std::move(_backlog.front()));
+    _backlog.pop_front();
+  }
+  bool broken = false;
+  if (_pipe_held) {
+    std::lock_guard<std::mutex> lock(peer->_write_mutex);
+    // data written to the peer before is sent first
+    if ((peer->connected_socket < 0) || peer->_write_queue.size() ||
+        peer->_send_in_flight)
+      return;
+    while (_pipe_held) {
+      long s = ::splice(_pipe_fds[0], nullptr, peer->connected_socket,
+                        nullptr, _pipe_held, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (s > 0) {
+        peer->_last_write = _loop->now_ms();
+        _pipe_held -= s;
+      } else if ((s == -1) && (errno == EINTR)) {
+        continue;
+      } else {
+        broken = (s == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK));
+        break;
+      }
+    }
+  }
+  if (broken) {
+    // held data has nowhere to go
+    peer->_on_error("connection broken");
+    peer->_close_connection();
+    return;
+  }
+  if (!_pipe_eof || _pipe_held)
+    return;
+  peer->end();
+  if (peer->_pipe_eof && !peer->_pipe_held)
+    _finish();
+}
+
+void socket::_pipe_rearm() {
+  for (socket *s : {this, _pipe_peer}) {
+    if (!s)
+      continue;
+    std::lock_guard<std::mutex> lock(s->_write_mutex);
+    if ((s->connected_socket >= 0) && s->_active_connection)
+      _loop->modify(s->connected_socket, s->_io_events());
+  }
+}
+
+void socket::_end_pipe() {
+  socket *peer = nullptr;
+  _loop->synchronized([&]() {
+    peer = _pipe_peer;
+    if (!peer)
+      return;
+    for (socket *s : {this, peer}) {
+      s->_pipe_peer = nullptr;
+      for (int &fd : s->_pipe_fds) {
+        if (fd >= 0)
+          ::close(fd);
+        fd = -1;
+      }
+      s->_pipe_held = 0;
+      s->_pipe_eof = false;
+    }
+  });
+  // the other direction has nowhere to go
+  if (peer)
+    peer->_finish();
+}
+
+socket &socket::on(const socket_event evnt, socket_event_callback_f f) {
+  _callback_guard([&]() { _callbacks[evnt] = f; });
+  if ((evnt == DATA) && (connected_socket >= 0)) {
+    // data kept without handler is given to the new one
+    std::weak_ptr<char> alive = _alive;
+    _loop->execute([this, alive]() {
+      if (!alive.expired() && _backlog.size())
+        _resume_reading();
+    });
+  }
+  return *this;
+}
+
+socket &socket::pause() {
+  _paused = true;
+  std::weak_ptr<char> alive = _alive;
+  _loop->execute([this, alive]() {
+    if (!alive.expired())
+      _check_reading();
+  });
+  return *this;
+}
+
+socket &socket::resume() {
+  _paused = false;
+  std::weak_ptr<char> alive = _alive;
+  _loop->execute([this, alive]() {
+    if (!alive.expired())
+      _resume_reading();
+  });
+  return *this;
+}
+
+socket &socket::set_receive_limit(std::size_t bytes_) {
+  std::weak_ptr<char> alive = _alive;
+  _loop->execute([this, alive, bytes_]() {
+    if (alive.expired())
+      return;
+    bool blocked = _reading_blocked();
+    _receive_limit = bytes_;
+    if (blocked)
+      _resume_reading();
+  });
+  return *this;
+}
+
+void socket::_deliver_backlog() {
+  while (_backlog.size() && !_paused) {
+    auto &front = _backlog.front();
+    if (_on_data(front.data(), front.size()) != 0)
+      return;
+    _backlog_bytes -= front.size();
+    _backlog.pop_front();
+  }
+}
+
+void socket::_check_reading() {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  if ((connected_socket < 0) || !_active_connection || !_reading_blocked())
+    return;
+  if (_recv_streaming)
+    _loop->uring()->stop_recv(connected_socket);
+  else if (!_uses_uring())
+    _loop->modify(connected_socket, _io_events());
+}
+
+void socket::_resume_reading() {
+  _deliver_backlog();
+  if (_end_pending && _backlog.empty() && !_paused) {
+    _end_pending = false;
+    _on_received(nullptr, 0);
+    return;
+  }
+  bool streaming;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    if ((connected_socket < 0) || !_active_connection || _reading_blocked())
+      return;
+    streaming = _recv_streaming;
+    if (!_uses_uring())
+      _loop->modify(connected_socket, _io_events());
+  }
+  // stopped stream is started again when it ends
+  if (!_uses_uring())
+    _handle_incoming_data();
+  else if (!streaming)
+    _start_reading();
+}
+
+void socket::_on_stream_stopped() {
+  bool restart;
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    if (connected_socket < 0)
+      return;
+    restart = _uses_uring() && !_reading_blocked();
+    // piped, the read interest was held back for the stream
+    if (!_uses_uring())
+      _loop->modify(connected_socket, _io_events());
+  }
+  if (restart)
+    _start_reading();
+}
+
+socket &socket::write(const std::string &data_) {
+  return _write_bytes(data_.data(), data_.size());
+}
+socket &socket::write(std::string &&data_) {
+  return write(owned_buffer(std::move(data_)));
+}
+socket &socket::write(const std::vector<char> &data_) {
+  return _write_bytes(data_.data(), data_.size());
+}
+socket &socket::write(std::vector<char> &&data_) {
+  return write(owned_buffer(std::move(data_)));
+}
+socket &socket::write(const char *data_, std::size_t size_) {
+  return _write_bytes(data_, size_);
+}
+socket &socket::write(shared_buffer data_) {
+  if (!data_)
+    return *this;
+  return write(owned_buffer(std::move(data_)));
+}
+socket &socket::write(owned_buffer data_) {
+  if (data_.empty())
+    return *this;
+  return _write_bytes(data_.data(), data_.size(), &data_);
+}
+socket &socket::write(owned_buffer first_, owned_buffer second_) {
+  if (first_.empty())
+    return write(std::move(second_));
+  if (second_.empty())
+    return write(std::move(first_));
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  if ((connected_socket < 0) || _end_requested)
+    return *this;
+  std::size_t first_size = first_.size();
+  std::size_t size = first_size + second_.size();
+  std::size_t sent = 0;
+  // TLS records take the queue, one buffer at a time
+  bool direct = !(_uses_uring() && _loop->in_loop_thread()) && !_tls &&
+                (_write_queue.size() == 0) && !_send_in_flight;
+  while (direct && (sent < size)) {
+    iovec iov[2];
+    int count = 0;
+    if (sent < first_size)
+      iov[count++] = {const_cast<char *>(first_.data()) + sent,
+                      first_size - sent};
+    std::size_t second_sent = sent > first_size ? sent - first_size : 0;
+    iov[count++] = {const_cast<char *>(second_.data()) + second_sent,
+                    second_.size() - second_sent};
+    long s = send_gathered(connected_socket, iov, count, size - sent);
+    if (s > 0) {
+      _last_write = _loop->now_ms();
+      sent += s;
+    } else if ((s == -1) && (errno == EINTR)) {
+      continue;
+    } else if ((s == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      break;
+    } else {
+      // connection is broken, the read side will report it
+      return *this;
     }
   }
-  if (ret != 0) {
-    tp::net::socket_event_callback_f cb;
-    cb = get_callback(socket_event::ERROR);
-    _handler_guard([&]() { std::get<1>(cb)("connection broken"); });
+  if (sent < first_size) {
+    _enqueue(std::move(first_), sent);
+    _enqueue(std::move(second_), 0);
+  } else if (sent < size) {
+    _enqueue(std::move(second_), sent - first_size);
   }
-  _on_end();
-  ::close(connected_socket);
-  connected_socket = -1;
-  _active_connection = false;
-}
-
-socket &socket::on(const socket_event evnt, socket_event_callback_f f) {
-  _callback_guard([&]() { _callbacks[evnt] = f; });
   return *this;
 }
 
-template <class T> socket &socket_write(socket &sckt, const T &data_) {
-  std::vector<char> data(data_.begin(), data_.end());
-  while (data.size() > 0) {
-    auto s = ::send(sckt.connected_socket, data.data(), data.size(), 0);
-    data.erase(data.begin(), data.begin() + std::min((int)s, (int)data.size()));
-  }
-  return sckt;
-}
-
-socket &socket::write(const std::string data_) {
-  return socket_write(*this, data_);
-}
-socket &socket::write(const std::vector<char> data_) {
-  return socket_write(*this, data_);
-}
-socket &socket::write(const std::list<char> data_) {
-  return socket_write(*this, data_);
+std::size_t socket::get_queued_bytes() {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  return _write_queued;
 }
 
 socket &socket::end(std::string data) {
-
-  while (data.size() > 0) {
-    std::cout << "data(" << connected_socket << "): " << data << std::endl;
-    auto s = ::send(connected_socket, data.data(), data.size(), 0);
-    if (s <= 0) {
-      std::cout << "s = " << s << std::endl;
-      break;
-    }
-    data = data.substr(s, data.size());
+  write(std::move(data));
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  if ((connected_socket >= 0) && !_end_requested) {
+    _end_requested = true;
+    if ((_write_queue.size() == 0) && !_send_in_flight &&
+        (!_tls || _tls_ready))
+      _shutdown_write();
   }
-  ::shutdown(connected_socket, SHUT_WR);
+  return *this;
+}
+
+socket &socket::set_allow_half_open(bool allow_) {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  _allow_half_open = allow_;
   return *this;
 }
 
 socket &socket::wrap(int connected_socket_) {
-  this->connected_socket = connected_socket_;
+  int flags = fcntl(connected_socket_, F_GETFL, 0);
+  fcntl(connected_socket_, F_SETFL, flags | O_NONBLOCK);
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    this->connected_socket = connected_socket_;
+  }
   _active_connection = true;
   _on_connect();
   return *this;
 }
 
+void socket::_adopt(int connected_socket_) {
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    this->connected_socket = connected_socket_;
+    _co_mode = true;
+  }
+  _active_connection = true;
+  _loop->watch(connected_socket_, _io_events(),
+               [this](unsigned int events) { _on_ready(events); });
+}
+
+void socket::_on_ready(unsigned int events) {
+  std::function<void()> r, w;
+  if (events & (IO_READ | IO_ERROR | IO_HANGUP | IO_PEER_CLOSED))
+    r.swap(_read_ready);
+  if (events & (IO_WRITE | IO_ERROR | IO_HANGUP))
+    w.swap(_write_ready);
+  // the resumed coroutine may release this socket, so do not touch it below
+  if (r)
+    r();
+  if (w)
+    w();
+}
+
 socket &socket::connect(unsigned int port_, char const *addr_c) {
   if (connected_socket >= 0)
     throw std::invalid_argument("socket already connected");
-  std::string addrr(addr_c);
-  std::thread t([=]() {
+  {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    if (_tls_context && _tls_server_name.empty())
+      _tls_server_name = addr_c;
+  }
+  _start_connect(port_, addr_c, [this](std::string err) {
+    if (err.size()) {
+      _on_error(err);
+      // the piped socket does not wait any more
+      _end_pipe();
+    } else {
+      _active_connection = true;
+      _on_connect();
+    }
+  });
+  return *this;
+}
+
+socket &socket::connect_unix(const std::string &path_) {
+  if (connected_socket >= 0)
+    throw std::invalid_argument("socket already connected");
+  auto addr = unix_addrinfo(path_);
+  std::weak_ptr<char> alive = _alive;
+  _loop->post([this, alive, addr]() {
+    if (alive.expired())
+      return;
+    _connect_next(addr, addr.get(), [this](std::string err) {
+      if (err.size()) {
+        _on_error(err);
+      } else {
+        _active_connection = true;
+        _on_connect();
+      }
+    });
+  });
+  return *this;
+}
+
+void socket::_start_connect(unsigned int port_, std::string addrr,
+                            std::function<void(std::string err)> done_) {
+  std::weak_ptr<char> alive = _alive;
+  _loop->post([this, alive, port_, addrr, done_]() {
+    if (alive.expired())
+      return;
     char const *addr_ = addrr.c_str();
     struct addrinfo hints;
     std::fill((char *)&hints, (char *)&hints + sizeof(struct addrinfo), 0);
@@ -215,51 +1718,133 @@ socket &socket::connect(unsigned int port_, char const *addr_c) {
     if (int err =
             getaddrinfo(addr_, std::to_string(port_).c_str(), &hints, &addr_p);
         err) {
-      throw std::invalid_argument(gai_strerror(err));
+      done_(gai_strerror(err));
+      return;
     }
-    struct addrinfo *rp;
     std::shared_ptr<struct addrinfo> addr_sp(
         addr_p, [](struct addrinfo *addr_p) { freeaddrinfo(addr_p); });
+    _connect_next(addr_sp, addr_p, done_);
+  });
+}
 
-    for (rp = addr_p; rp != NULL; rp = rp->ai_next) {
-      connected_socket =
-          ::socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-      if (connected_socket != -1) {
-        if (::connect(connected_socket, rp->ai_addr, rp->ai_addrlen) != -1) {
-          _active_connection = true;
-          _on_connect();
+void socket::_connect_next(std::shared_ptr<struct addrinfo> all_,
+                           struct addrinfo *rp,
+                           std::function<void(std::string err)> done_) {
+  for (; rp != NULL; rp = rp->ai_next) {
+    int s = ::socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                     rp->ai_protocol);
+    if (s == -1)
+      continue;
+    socket_options options;
+    {
+      std::lock_guard<std::mutex> lock(_write_mutex);
+      if (_options)
+        options = *_options;
+    }
+    // buffers and fast open must be set before connecting
+    if (auto err = apply_options(s, options, CONNECTING_SOCKET); err.size())
+      _on_error(err);
+    if ((::connect(s, rp->ai_addr, rp->ai_addrlen) == 0) ||
+        (errno == EINPROGRESS)) {
+      {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        connected_socket = s;
+      }
+      _loop->watch(s, IO_WRITE, [this, all_, rp, s, done_](unsigned int) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len);
+        _loop->unwatch(s);
+        if (err == 0) {
+          done_("");
           return;
         }
-        ::close(connected_socket);
-        connected_socket = -1;
-      }
+        {
+          std::lock_guard<std::mutex> lock(_write_mutex);
+          connected_socket = -1;
+        }
+        ::close(s);
+        _connect_next(all_, rp->ai_next, done_);
+      });
+      return;
     }
-    tp::net::socket_event_callback_f cb;
-    cb = get_callback(socket_event::ERROR);
-    _handler_guard([&]() { std::get<1>(cb)("could not create connection"); });
-  });
-  t.detach();
-  return *this;
+    ::close(s);
+  }
+  done_("could not create connection");
 }
 
-socket::socket() {
+socket::socket() : socket(event_loop::get_default()) {}
+
+socket::socket(event_loop &loop) : socket(loop, nullptr) {}
+
+socket::socket(event_loop &loop,
+               std::shared_ptr<std::pmr::memory_resource> memory_)
+    : _memory(to_connection_memory(std::move(memory_))),
+      _callbacks(_memory.get()), _write_queue(_memory.get()),
+      _queued_fds(_memory.get()), _backlog(_memory.get()) {
   static auto signal_ready = ::signal(SIGPIPE, SIG_IGN);
+  (void)signal_ready;
   // if (signal_ready == nullptr) throw std::runtime_error("could not setup
   // signal");
   connected_socket = -1;
-  _callbacks[ERROR] = [](std::string err) {
-    std::cerr << "socket error: " << err << std::endl;
-  };
-  _callbacks[CONNECT] = []() {};
-  _callbacks[END] = []() {};
+  _loop = &loop;
+  _alive = std::allocate_shared<char>(connection_allocator<char>(_memory), 0);
+  _write_offset = 0;
+  _write_queued = 0;
+  _end_requested = false;
+  _close_requested = false;
+  _write_ended = false;
+  _read_ended = false;
+  _allow_half_open = false;
+  _backlog_bytes = 0;
+  _receive_limit = default_receive_limit;
+  _end_pending = false;
+  _paused = false;
+  _recv_streaming = false;
+  _send_in_flight = false;
+  _local = false;
+  _tls_ready = false;
+  _co_mode = false;
+  _pipe_peer = nullptr;
+  _pipe_fds[0] = _pipe_fds[1] = -1;
+  _pipe_held = 0;
+  _pipe_eof = false;
+  _timeouts[IDLE_TIMEOUT] = _timeouts[READ_TIMEOUT] =
+      _timeouts[WRITE_TIMEOUT] = 0;
+  _last_read = _last_write = 0;
+  _timeout_timer = 0;
+  _server = nullptr;
+  _context_type = nullptr;
   _active_connection = false;
 }
 
 socket::~socket() {
-  // std::lock_guard<std::mutex> lock(_in_handler_mutex);
-  //::close(connected_socket);
-  if (_recv_fut.valid())
-    _recv_fut.get();
+  _loop->synchronized([this]() {
+    _alive.reset();
+    int fd;
+    {
+      std::lock_guard<std::mutex> lock(_write_mutex);
+      fd = connected_socket;
+      connected_socket = -1;
+      if (_timeout_timer)
+        _loop->clear_timeout(_timeout_timer);
+      _clear_write_queue();
+    }
+    _end_pipe();
+    if (fd >= 0) {
+      _loop->unwatch(fd);
+      if (_recv_streaming) {
+        // the ring must be touched only by the loop thread
+        event_loop *loop = _loop;
+        _loop->execute([loop, fd]() {
+          loop->uring()->cancel_streams(fd);
+          ::close(fd);
+        });
+      } else {
+        ::close(fd);
+      }
+    }
+  });
   {
     std::lock_guard<std::mutex> lock(_in_handler_mutex);
     _active_connection = false;
@@ -301,6 +1886,7 @@ void server::_on_listen(const unsigned int port_, const std::string addr_) {
 }
 
 void server::_on_connect(socket_p connected_socket_) {
+  TEPSOC_TRACE_SCOPE("handler.connection", connected_socket_->connected_socket);
   tp::net::socket_event_callback_f cb;
 
   _callback_guard([&]() { cb = _callbacks.at(CONNECTION); });
@@ -316,14 +1902,70 @@ void server::_on_connect(socket_p connected_socket_) {
   }
 }
 
+server &server::use_tls(std::shared_ptr<tls_context> context_) {
+  if (context_ && !context_->is_server())
+    throw std::invalid_argument("use_tls needs server context");
+  std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+  _tls_context = context_;
+  return *this;
+}
+
+server &server::set_connection_handlers(connection_handlers handlers_) {
+  auto shared = std::make_shared<const connection_handlers>(std::move(handlers_));
+  std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+  _connection_handlers = std::move(shared);
+  return *this;
+}
+
+server &server::set_memory_resource(
+    std::function<std::shared_ptr<std::pmr::memory_resource>()> factory_) {
+  std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+  _memory_factory = factory_;
+  return *this;
+}
+
+server &server::set_timeout(socket_timeout kind, unsigned long ms) {
+  _timeouts[kind] = ms;
+  return *this;
+}
+
 server &server::on(socket_event evnt, socket_event_callback_f callback_) {
   std::lock_guard<std::mutex> lock(_callbacks_mutex);
   _callbacks[evnt] = callback_;
   return *this;
 }
 
+void server::_stop_listening() {
+  for (auto s : listening_sockets) {
+    if (_accept_streaming) {
+      event_loop *loop = _loop;
+      _loop->execute([loop, s]() {
+        loop->uring()->cancel_streams(s);
+        ::close(s);
+      });
+    } else {
+      _loop->unwatch(s);
+      ::close(s);
+    }
+  }
+  _accept_streaming = false;
+  listening_sockets.clear();
+  for (auto &path : _unix_paths)
+    ::unlink(path.c_str());
+  _unix_paths.clear();
+  if (_resume_timer)
+    _loop->clear_timeout(_resume_timer);
+  _resume_timer = 0;
+  auto waiters = std::move(_accept_waiters);
+  _accept_waiters.clear();
+  for (auto &w : waiters)
+    w(-1);
+}
+
 void server::_close() {
-  while (true) {
+  _loop->synchronized([this]() { _stop_listening(); });
+  // connections can not be finished by the loop we would block
+  while (!_loop->in_loop_thread()) {
     {
       std::lock_guard<std::mutex> lock(_connection_handling_mutex);
       if (_connected_sockets.size() == 0)
@@ -331,11 +1973,31 @@ void server::_close() {
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(5));
   };
-  for (auto s : listening_sockets)
-    ::close(s);
+  _loop->synchronized([this]() {
+    _alive.reset();
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    for (auto &[fd, s] : _connected_sockets)
+      s->_server = nullptr;
+    _connected_sockets.clear();
+    _peers.clear();
+  });
 }
 
-server::server(std::function<void(tp::net::socket &s)> on_connection_) {
+server::server(std::function<void(tp::net::socket &s)> on_connection_)
+    : server(event_loop::get_default(), on_connection_) {}
+
+server::server(event_loop &loop,
+               std::function<void(tp::net::socket &s)> on_connection_) {
+  _loop = &loop;
+  _alive = std::make_shared<char>(0);
+  _pull_mode = false;
+  _accept_streaming = false;
+  _tokens = 0;
+  _tokens_time = 0;
+  _paused = false;
+  _resume_timer = 0;
+  _timeouts[IDLE_TIMEOUT] = _timeouts[READ_TIMEOUT] =
+      _timeouts[WRITE_TIMEOUT] = 0;
   _callbacks[LISTENING] = []() {};
   _callbacks[ERROR] = [](std::string err) {
     std::cerr << "server::ERROR: " << err << std::endl;
@@ -343,6 +2005,305 @@ server::server(std::function<void(tp::net::socket &s)> on_connection_) {
   _callbacks[CONNECTION] = on_connection_; //[](socket &cs) {};
 }
 
+void server::_arm_accept(bool armed) {
+  for (auto sockfd : listening_sockets)
+    _loop->modify(sockfd, armed ? (unsigned int)IO_READ : 0);
+}
+
+void server::_enter_pull_mode() {
+  if (_pull_mode)
+    return;
+  _pull_mode = true;
+  _paused = false;
+  _accept_by_readiness();
+}
+
+void server::_accept_by_readiness() {
+  if (!_accept_streaming)
+    return;
+  // multishot accept can not wait, so go back to epoll
+  _accept_streaming = false;
+  for (auto sockfd : listening_sockets) {
+    event_loop *loop = _loop;
+    _loop->execute([loop, sockfd]() { loop->uring()->cancel_streams(sockfd); });
+    _loop->watch(sockfd, _pull_mode ? 0 : (unsigned int)IO_READ,
+                 [this, sockfd](unsigned int) { _accept_ready(sockfd); });
+  }
+}
+
+void server::_accept_ready(int listening_socket) {
+  // limit accepts per readiness, so established connections are served too
+  const int max_accepts = 64;
+  for (int i = 0; i < max_accepts; i++) {
+    if (_paused)
+      return;
+    if (_pull_mode && (_accept_waiters.size() == 0)) {
+      // leave connections in the kernel backlog until someone awaits them
+      _arm_accept(false);
+      return;
+    }
+    int connected_socket;
+    {
+      TEPSOC_TRACE_NAMED(span, "server.accept", 0);
+      connected_socket = ::accept4(listening_socket, nullptr, nullptr,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+      TEPSOC_TRACE_ARG(span, connected_socket);
+    }
+    if (connected_socket < 0) {
+      if ((errno == EINTR) || (errno == ECONNABORTED))
+        continue;
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+        _on_error(std::string("accept: ") + strerror(errno));
+      return;
+    }
+    if (_pull_mode) {
+      auto waiter = std::move(_accept_waiters.front());
+      _accept_waiters.pop_front();
+      waiter(connected_socket);
+    } else {
+      _on_accepted(connected_socket);
+    }
+  }
+}
+
+void server::_on_accepted(int connected_socket,
+                          std::function<void(socket &)> prepare_) {
+  TEPSOC_TRACE_SCOPE("server.connection", connected_socket);
+  std::string peer;
+  if (!_admit(connected_socket, peer)) {
+    // reset, so the client does not wait for data
+    struct linger reset = {1, 0};
+    setsockopt(connected_socket, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    ::close(connected_socket);
+    _update_accepting();
+    return;
+  }
+  std::shared_ptr<connection_memory> memory;
+  {
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    if (_memory_factory)
+      memory = std::make_shared<connection_memory>(_memory_factory());
+  }
+  socket_p connected_socket_obj =
+      memory ? std::allocate_shared<socket>(
+                   connection_allocator<socket>(memory), *_loop, memory)
+             : std::make_shared<socket>(*_loop);
+  std::string err;
+  {
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    _connected_sockets[connected_socket] = connected_socket_obj;
+    if (peer.size())
+      _peers[connected_socket_obj.get()] = std::move(peer);
+    connected_socket_obj->_tls_context = _tls_context;
+    connected_socket_obj->_shared_handlers = _connection_handlers;
+    err = apply_options(connected_socket, _options, CONNECTED_SOCKET);
+  }
+  if (err.size())
+    _on_error(err);
+  // no closures, so accepting does not allocate them
+  connected_socket_obj->_server = this;
+  connected_socket_obj->_server_alive = _alive;
+  connected_socket_obj->_self = connected_socket_obj;
+  for (auto kind : {IDLE_TIMEOUT, READ_TIMEOUT, WRITE_TIMEOUT})
+    connected_socket_obj->_timeouts[kind] = _timeouts[kind];
+  if (prepare_)
+    prepare_(*connected_socket_obj);
+  connected_socket_obj->wrap(connected_socket);
+  _update_accepting();
+}
+
+void server::_on_closed(int connected_socket, socket *raw) {
+  // the server may be closing, so its own _alive is not read here
+  std::weak_ptr<char> alive = raw->_server_alive;
+  std::string peer;
+  {
+    // now, while the socket is alive, because its address can be reused
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    if (auto p = _peers.find(raw); p != _peers.end()) {
+      peer = std::move(p->second);
+      _peers.erase(p);
+    }
+  }
+  // the socket can not be released while it is handling its own event
+  _loop->post([this, alive, connected_socket, raw, peer]() {
+    if (alive.expired())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+      if (auto ip = _per_ip.find(peer);
+          peer.size() && (ip != _per_ip.end()) && (--ip->second == 0))
+        _per_ip.erase(ip);
+      auto found = _connected_sockets.find(connected_socket);
+      if ((found == _connected_sockets.end()) || (found->second.get() != raw))
+        return;
+      _connected_sockets.erase(found);
+    }
+    _update_accepting();
+  });
+}
+
+bool server::_admit(int connected_socket, std::string &peer_) {
+  std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+  if (_limits.max_connections_per_ip) {
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    char host[NI_MAXHOST] = "";
+    if (getpeername(connected_socket, (sockaddr *)&addr, &len) == 0)
+      getnameinfo((sockaddr *)&addr, len, host, sizeof(host), nullptr, 0,
+                  NI_NUMERICHOST);
+    peer_ = host;
+    if (_per_ip[peer_] >= _limits.max_connections_per_ip) {
+      _stats.rejected_per_ip++;
+      return false;
+    }
+  }
+  if (_limits.max_connections &&
+      (_connected_sockets.size() >= _limits.max_connections)) {
+    _stats.rejected_max_connections++;
+    return false;
+  }
+  if (_limits.accept_rate > 0) {
+    // token bucket refilled with accept_rate tokens per second
+    double burst = (_limits.accept_burst > 0) ? _limits.accept_burst
+                                              : _limits.accept_rate;
+    std::uint64_t now = _loop->now_ms();
+    _tokens = std::min(burst, _tokens + (now - _tokens_time) *
+                                            _limits.accept_rate / 1000.0);
+    _tokens_time = now;
+    if (_tokens < 1) {
+      _stats.rejected_rate++;
+      return false;
+    }
+    _tokens -= 1;
+  }
+  if (_limits.max_connections_per_ip)
+    _per_ip[peer_]++;
+  _stats.accepted++;
+  return true;
+}
+
+void server::_update_accepting() {
+  if (_pull_mode || (listening_sockets.size() == 0))
+    return;
+  bool full = false;
+  std::uint64_t wait_ms = 0;
+  {
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    if (_limits.policy != PAUSE_ACCEPTING)
+      return;
+    full = _limits.max_connections &&
+           (_connected_sockets.size() >= _limits.max_connections);
+    if (_limits.accept_rate > 0) {
+      double burst = (_limits.accept_burst > 0) ? _limits.accept_burst
+                                                : _limits.accept_rate;
+      double tokens =
+          std::min(burst, _tokens + (_loop->now_ms() - _tokens_time) *
+                                        _limits.accept_rate / 1000.0);
+      if (tokens < 1)
+        wait_ms = 1 + (std::uint64_t)((1 - tokens) * 1000.0 /
+                                      _limits.accept_rate);
+    }
+    if ((full || wait_ms) && !_paused)
+      _stats.pauses++;
+  }
+  if (wait_ms && !full && !_resume_timer) {
+    // closed connections resume accepting, the rate limit needs a timer
+    std::weak_ptr<char> alive = _alive;
+    _resume_timer = _loop->set_timeout(
+        [this, alive]() {
+          if (alive.expired())
+            return;
+          _resume_timer = 0;
+          _update_accepting();
+        },
+        wait_ms);
+  }
+  bool pause = full || wait_ms;
+  if (pause == _paused)
+    return;
+  _paused = pause;
+  _arm_accept(!pause);
+}
+
+bool server::_can_pause() {
+  return (_limits.policy == PAUSE_ACCEPTING) &&
+         (_limits.max_connections || (_limits.accept_rate > 0));
+}
+
+server &server::set_limits(const admission_limits &limits_) {
+  {
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    _limits = limits_;
+    _tokens = (_limits.accept_burst > 0) ? _limits.accept_burst
+                                         : _limits.accept_rate;
+    _tokens_time = _loop->now_ms();
+  }
+  std::weak_ptr<char> alive = _alive;
+  _loop->execute([this, alive]() {
+    if (alive.expired())
+      return;
+    bool can_pause;
+    {
+      std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+      can_pause = _can_pause();
+    }
+    if (can_pause)
+      _accept_by_readiness();
+    _update_accepting();
+  });
+  return *this;
+}
+
+server &server::set_options(const socket_options &options_) {
+  std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+  _options = options_;
+  return *this;
+}
+
+server_stats server::get_stats() {
+  std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+  server_stats stats = _stats;
+  stats.active = _connected_sockets.size();
+  return stats;
+}
+
+broadcast_result server::broadcast(shared_buffer payload_,
+                                   std::function<bool(socket &)> filter_,
+                                   std::size_t max_queued_) {
+  broadcast_result result;
+  std::vector<socket_p> connections;
+  {
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    connections.reserve(_connected_sockets.size());
+    for (auto &[fd, s] : _connected_sockets)
+      connections.push_back(s);
+  }
+  // not under the lock, because closing connection takes it
+  for (auto &s : connections) {
+    if (filter_ && !filter_(*s))
+      continue;
+    if (max_queued_ && (s->get_queued_bytes() > max_queued_)) {
+      result.skipped++;
+      continue;
+    }
+    s->write(payload_);
+    result.sent++;
+  }
+  if (result.skipped) {
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    _stats.broadcast_skipped += result.skipped;
+  }
+  return result;
+}
+
+broadcast_result server::broadcast(const std::string &payload_,
+                                   std::function<bool(socket &)> filter_,
+                                   std::size_t max_queued_) {
+  return broadcast(std::make_shared<const std::vector<char>>(payload_.begin(),
+                                                             payload_.end()),
+                   filter_, max_queued_);
+}
+
 server &server::listen(unsigned int port_, char const *server_name) {
   if (listening_sockets.size()) {
     _on_error("server already listening.");
@@ -351,7 +2312,11 @@ server &server::listen(unsigned int port_, char const *server_name) {
   using namespace std;
   std::string port_name_s = to_string(port_);
   const char *port_name = port_name_s.c_str();
-  const int max_queue = 100;
+  int max_queue;
+  {
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    max_queue = _limits.backlog;
+  }
   // std::cout << server_name << " : " << port_name << std::endl;
   int listening_socket;
   struct addrinfo hints;
@@ -375,14 +2340,22 @@ server &server::listen(unsigned int port_, char const *server_name) {
       result, [](auto *p) { freeaddrinfo(p); });
 
   for (rp = result; rp != NULL; rp = rp->ai_next) {
-    listening_socket =
-        ::socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+    listening_socket = ::socket(rp->ai_family, rp->ai_socktype | SOCK_CLOEXEC,
+                                rp->ai_protocol);
     if (listening_socket != -1) {
       if (int yes = 1; setsockopt(listening_socket, SOL_SOCKET, SO_REUSEADDR,
                                   &yes, sizeof(yes)) == -1) {
         // throw invalid_argument("setsockopt( ... ) error");
         _on_error("could not setsockopt"); // continue with error
       }
+      socket_options options;
+      {
+        std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+        options = _options;
+      }
+      if (auto err = apply_options(listening_socket, options, LISTENING_SOCKET);
+          err.size())
+        _on_error(err);
       if (::bind(listening_socket, rp->ai_addr, rp->ai_addrlen) == 0) {
         if (::listen(listening_socket, max_queue) == -1) {
           ::close(listening_socket);
@@ -417,77 +2390,374 @@ server &server::listen(unsigned int port_, char const *server_name) {
     _on_error("there are no valid listening sockets");
     return *this;
   }
-  accepting_fut = std::async(std::launch::async, [this]() {
-    int delay_btw_connectoins = 1;
-    // std::list<socket *> connected_sockets;
-    while (listening_sockets.size()) {
-      // std::cout << "waiting connection ..." << std::endl;
-      std::vector<int> ls;
-      for (auto sockfd : listening_sockets) {
-        struct sockaddr_storage peer_addr;
-        socklen_t peer_addr_len = sizeof(struct sockaddr_storage);
-        int connected_socket;
-        if ((connected_socket = ::accept(sockfd, (struct sockaddr *)&peer_addr,
-                                         &peer_addr_len)) < 0) {
-          if (errno == EWOULDBLOCK) {
-            // artificial delay between connections
-            ls.push_back(sockfd);
-          } else {
-            delay_btw_connectoins = 1;
-            // socket was closed...
-          }
-        } else {
-          delay_btw_connectoins = 1;
-          ls.push_back(sockfd);
-          char host[NI_MAXHOST], service[NI_MAXSERV];
-          getnameinfo((struct sockaddr *)&peer_addr, peer_addr_len, host,
-                      NI_MAXHOST, service, NI_MAXSERV, NI_NUMERICSERV);
+  _start_accepting();
+  return *this;
+}
 
-          std::string host_str = host;
-          std::string service_str = service;
-          std::thread([this, connected_socket, host_str, service_str]() {
-            {
-              socket *s = new socket();
-              socket_p connected_socket_obj(s, [connected_socket](auto s) {
-                std::cout << "delete s " << connected_socket << std::endl;
-                delete s;
-              });
-              {
-                std::lock_guard<std::mutex> lock(_connection_handling_mutex);
-                _connected_sockets[connected_socket] = connected_socket_obj;
-              }
-              std::cout << "on connection .." << std::endl;
-              connected_socket_obj->on(CONNECT, [this, connected_socket_obj]() {
-                _on_connect(connected_socket_obj);
-              });
-              std::cout << "on connection .. wrap " << connected_socket
-                        << std::endl;
-              connected_socket_obj->wrap(connected_socket);
-              std::cout << "on connection ..       lock" << std::endl;
-              std::lock_guard<std::mutex> lock(_connection_handling_mutex);
-              std::cout << "on connection ..              finished"
-                        << std::endl;
-            }
-            {
-              std::lock_guard<std::mutex> lock(_connection_handling_mutex);
-              _connected_sockets.erase(connected_socket);
-            }
-          })
-              .detach();
-        }
-      }
-      listening_sockets = ls;
-      if (delay_btw_connectoins > 1000) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+server &server::listen_unix(const std::string &path_) {
+  if (listening_sockets.size()) {
+    _on_error("server already listening.");
+    return *this;
+  }
+  auto addr = unix_addrinfo(path_);
+  int listening_socket =
+      ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listening_socket == -1) {
+    _on_error(std::string("socket: ") + strerror(errno));
+    return *this;
+  }
+  // replace socket left by the previous run, but never other files
+  struct stat st;
+  if ((path_[0] != '@') && (::stat(path_.c_str(), &st) == 0) &&
+      S_ISSOCK(st.st_mode))
+    ::unlink(path_.c_str());
+  socket_options options;
+  int max_queue;
+  {
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    options = _options;
+    max_queue = _limits.backlog;
+  }
+  if (auto err = apply_options(listening_socket, options, LISTENING_SOCKET);
+      err.size())
+    _on_error(err);
+  if ((::bind(listening_socket, addr->ai_addr, addr->ai_addrlen) == -1) ||
+      (::listen(listening_socket, max_queue) == -1)) {
+    _on_error("listen on " + path_ + ": " + strerror(errno));
+    ::close(listening_socket);
+    return *this;
+  }
+  if (path_[0] != '@')
+    _unix_paths.push_back(path_);
+  listening_sockets.push_back(listening_socket);
+  _on_listen(0, path_);
+  _start_accepting();
+  return *this;
+}
+
+server &server::listen_fds(const std::vector<int> &fds_) {
+  if (listening_sockets.size()) {
+    _on_error("server already listening.");
+    return *this;
+  }
+  for (int fd : fds_) {
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    if ((getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) != 0) ||
+        !listening)
+      throw std::invalid_argument("listen_fds: " + std::to_string(fd) +
+                                  " is not a listening socket");
+  }
+  for (int fd : fds_) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    listening_sockets.push_back(fd);
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    unsigned int port = 0;
+    std::string name;
+    if (getsockname(fd, (sockaddr *)&addr, &len) == 0) {
+      if (addr.ss_family == AF_UNIX) {
+        auto *un = (sockaddr_un *)&addr;
+        std::size_t size = len - offsetof(sockaddr_un, sun_path);
+        if (size && (un->sun_path[0] == 0))
+          name = "@" + std::string(un->sun_path + 1, size - 1);
+        else
+          name = un->sun_path;
       } else {
-        delay_btw_connectoins = delay_btw_connectoins + 1;
+        char host[NI_MAXHOST], service[NI_MAXSERV];
+        if (getnameinfo((sockaddr *)&addr, len, host, NI_MAXHOST, service,
+                        NI_MAXSERV, NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+          name = host;
+          port = std::stoul(service);
+        }
       }
-      if (delay_btw_connectoins > 500)
-        delay_btw_connectoins = 400;
     }
+    _on_listen(port, name);
+  }
+  if (listening_sockets.size())
+    _start_accepting();
+  return *this;
+}
+
+std::vector<int> server::inherited_listeners() {
+  std::vector<int> fds;
+  const char *pid = getenv("LISTEN_PID");
+  const char *count = getenv("LISTEN_FDS");
+  if (pid && count && (atol(pid) == (long)getpid())) {
+    // systemd passes them from descriptor 3
+    for (int i = 0, n = atoi(count); i < n; i++)
+      fds.push_back(3 + i);
+  }
+  if (const char *list = getenv("TEPSOC_LISTEN_FDS")) {
+    for (const char *p = list; *p;) {
+      char *end;
+      long fd = strtol(p, &end, 10);
+      if (end == p)
+        break;
+      if (fd >= 0)
+        fds.push_back(fd);
+      p = (*end == ',') ? end + 1 : end;
+    }
+  }
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  unsetenv("LISTEN_FDNAMES");
+  unsetenv("TEPSOC_LISTEN_FDS");
+  return fds;
+}
+
+std::string server::share_listening_sockets() {
+  std::string list;
+  for (int fd : listening_sockets) {
+    fcntl(fd, F_SETFD, 0);
+    if (list.size())
+      list += ",";
+    list += std::to_string(fd);
+  }
+  return list;
+}
+
+server &server::adopt(int connected_socket_) {
+  if (connected_socket_ < 0)
+    throw std::invalid_argument("adopt: bad socket");
+  std::weak_ptr<char> alive = _alive;
+  _loop->execute([this, alive, connected_socket_]() {
+    if (alive.expired())
+      ::close(connected_socket_);
+    else
+      _on_accepted(connected_socket_);
   });
   return *this;
 }
 
+std::size_t server::hand_over(const std::string &path_,
+                              std::function<std::string(socket &)> state_,
+                              int timeout_ms_) {
+  if (_loop->in_loop_thread())
+    throw std::invalid_argument("hand_over: called from the loop thread");
+  auto addr = unix_addrinfo(path_);
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(timeout_ms_);
+  auto left_ms = [&deadline]() {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    return std::max<int>(1, left.count());
+  };
+  // the next process may not be listening yet
+  int link = -1;
+  while (link < 0) {
+    link = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (link == -1) {
+      _on_error(std::string("hand_over: ") + strerror(errno));
+      return 0;
+    }
+    if (::connect(link, addr->ai_addr, addr->ai_addrlen) == 0)
+      break;
+    int err = errno;
+    ::close(link);
+    link = -1;
+    if (((err != ENOENT) && (err != ECONNREFUSED) && (err != EINTR)) ||
+        (std::chrono::steady_clock::now() > deadline)) {
+      _on_error("hand_over to " + path_ + ": " + strerror(err));
+      return 0;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  auto movable = [](socket &s) {
+    std::lock_guard<std::mutex> lock(s._write_mutex);
+    return (s.connected_socket >= 0) && !s._tls_context && !s._pipe_peer &&
+           !s._co_mode && !s._end_requested && !s._close_requested &&
+           !s._write_ended && !s._read_ended && !s._end_pending &&
+           s._queued_fds.empty();
+  };
+  // connection and whether it was paused before
+  std::vector<std::pair<socket_p, bool>> moving;
+  _loop->synchronized([&]() {
+    _stop_listening();
+    {
+      std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+      for (auto &[fd, s] : _connected_sockets)
+        moving.emplace_back(s, s->_paused);
+    }
+    for (auto &[s, paused] : moving) {
+      s->_paused = true;
+      s->_check_reading();
+    }
+  });
+  // stopped receive streams and submitted sends still complete
+  auto settled = [&]() {
+    bool result = true;
+    _loop->synchronized([&]() {
+      for (auto &[s, paused] : moving) {
+        std::lock_guard<std::mutex> lock(s->_write_mutex);
+        if (s->_recv_streaming || s->_send_in_flight)
+          result = false;
+      }
+    });
+    return result;
+  };
+  while (!settled() && (std::chrono::steady_clock::now() < deadline))
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  std::vector<handoff_record> records;
+  _loop->synchronized([&]() {
+    for (auto &[s, paused] : moving) {
+      handoff_record r;
+      if (movable(*s)) {
+        std::lock_guard<std::mutex> lock(s->_write_mutex);
+        if (!s->_recv_streaming && !s->_send_in_flight)
+          r.fd = fcntl(s->connected_socket, F_DUPFD_CLOEXEC, 0);
+        std::size_t offset = s->_write_offset;
+        for (auto &buf : s->_write_queue) {
+          r.unsent.append(buf.data() + offset, buf.data() + buf.size());
+          offset = 0;
+        }
+      }
+      if (r.fd < 0) {
+        // finished here
+        if (!paused)
+          s->resume();
+        continue;
+      }
+      if (state_)
+        r.state = state_(*s);
+      for (auto &b : s->_backlog)
+        r.received.append(b.begin(), b.end());
+      s->_backlog.clear();
+      s->_backlog_bytes = 0;
+      // the peer does not see it, the duplicate keeps the connection open
+      s->_close_connection();
+      records.push_back(std::move(r));
+    }
+  });
+
+  std::size_t sent = 0;
+  set_io_timeout(link, SO_SNDTIMEO, left_ms());
+  bool linked = true;
+  for (auto &r : records) {
+    linked = linked && send_handoff(link, r);
+    if (linked)
+      sent++;
+    ::close(r.fd);
+  }
+  ::close(link);
+  if (sent < records.size())
+    _on_error("hand_over: " + std::to_string(records.size() - sent) +
+              " connections were lost");
+  return sent;
+}
+
+std::size_t server::take_over(const std::string &path_, int timeout_ms_) {
+  auto addr = unix_addrinfo(path_);
+  int listening_socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listening_socket == -1) {
+    _on_error(std::string("take_over: ") + strerror(errno));
+    return 0;
+  }
+  struct stat st;
+  if ((path_[0] != '@') && (::stat(path_.c_str(), &st) == 0) &&
+      S_ISSOCK(st.st_mode))
+    ::unlink(path_.c_str());
+  if ((::bind(listening_socket, addr->ai_addr, addr->ai_addrlen) == -1) ||
+      (::listen(listening_socket, 1) == -1)) {
+    _on_error("take_over on " + path_ + ": " + strerror(errno));
+    ::close(listening_socket);
+    return 0;
+  }
+  int link = -1;
+  pollfd p = {listening_socket, POLLIN, 0};
+  if (::poll(&p, 1, timeout_ms_) == 1)
+    link = ::accept4(listening_socket, nullptr, nullptr, SOCK_CLOEXEC);
+  ::close(listening_socket);
+  if (path_[0] != '@')
+    ::unlink(path_.c_str());
+  if (link < 0) {
+    _on_error("take_over: nothing was handed over on " + path_);
+    return 0;
+  }
+  set_io_timeout(link, SO_RCVTIMEO, timeout_ms_);
+  std::size_t taken = 0;
+  while (true) {
+    auto r = std::make_shared<handoff_record>();
+    int result = receive_handoff(link, *r);
+    if (result <= 0) {
+      if (result < 0)
+        _on_error("take_over: broken hand over");
+      if (r->fd >= 0)
+        ::close(r->fd);
+      break;
+    }
+    taken++;
+    std::weak_ptr<char> alive = _alive;
+    _loop->execute([this, alive, r]() {
+      if (alive.expired()) {
+        ::close(r->fd);
+        return;
+      }
+      socket *adopted = nullptr;
+      _on_accepted(r->fd, [r, &adopted](socket &s) {
+        adopted = &s;
+        s._handoff_state = std::move(r->state);
+        // the connection was plain in the previous process
+        s._tls_context = nullptr;
+        // before anything the CONNECTION handler writes
+        if (r->unsent.size()) {
+          std::lock_guard<std::mutex> lock(s._write_mutex);
+          s._write_queued += r->unsent.size();
+          s._write_queue.emplace_back(std::move(r->unsent));
+        }
+      });
+      if (!adopted || !adopted->is_active())
+        return;
+      if (adopted->get_queued_bytes()) {
+        if (adopted->_uses_uring())
+          adopted->_submit_send();
+        else
+          adopted->_flush_write_queue();
+      }
+      // reading has not started yet, so it goes before new data
+      if (r->received.size()) {
+        adopted->_backlog.emplace_front(r->received.begin(),
+                                        r->received.end());
+        adopted->_backlog_bytes += r->received.size();
+        adopted->_resume_reading();
+      }
+    });
+  }
+  ::close(link);
+  return taken;
+}
+
+void server::_start_accepting() {
+  bool can_pause;
+  {
+    std::lock_guard<std::mutex> lock(_connection_handling_mutex);
+    can_pause = _can_pause();
+  }
+  if (_loop->uring() && !_pull_mode && !can_pause) {
+    _accept_streaming = true;
+    std::weak_ptr<char> alive = _alive;
+    for (auto sockfd : listening_sockets)
+      _loop->execute([this, alive, sockfd]() {
+        if (alive.expired() || !_accept_streaming)
+          return;
+        _loop->uring()->accept_stream(sockfd, [this, alive](long result_) {
+          if (alive.expired())
+            return;
+          if (result_ < 0)
+            _on_error(std::string("accept: ") + strerror(-result_));
+          else
+            _on_accepted(result_);
+        });
+      });
+    return;
+  }
+  for (auto sockfd : listening_sockets)
+    _loop->watch(sockfd, _pull_mode ? 0 : (unsigned int)IO_READ,
+                 [this, sockfd](unsigned int) { _accept_ready(sockfd); });
+}
+
 } // namespace net
 } // namespace tp
@@ -0,0 +1,223 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include <tepsoc_co.hpp>
+
+#include <stdexcept>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace tp {
+namespace net {
+
+////////////////////// FRAME POOL //////////////////////////////////////
+
+namespace {
+const std::size_t frame_granularity = 64;
+const std::size_t frame_classes = 32; // frames up to 2 KiB are pooled
+const std::size_t max_free_frames = 1024;
+
+struct free_frame {
+  free_frame *next;
+};
+struct frame_free_lists {
+  free_frame *heads[frame_classes];
+  std::size_t counts[frame_classes];
+  ~frame_free_lists() {
+    for (std::size_t c = 0; c < frame_classes; c++) {
+      while (free_frame *f = heads[c]) {
+        heads[c] = f->next;
+        ::operator delete(f);
+      }
+      // frames released later during thread exit go directly to the heap
+      counts[c] = max_free_frames;
+    }
+  }
+};
+thread_local frame_free_lists free_lists = {};
+} // namespace
+
+void *frame_pool::allocate(std::size_t size) {
+  std::size_t c = (size + frame_granularity - 1) / frame_granularity;
+  if (c >= frame_classes)
+    return ::operator new(size);
+  if (free_frame *f = free_lists.heads[c]; f) {
+    free_lists.heads[c] = f->next;
+    free_lists.counts[c]--;
+    return f;
+  }
+  return ::operator new(c * frame_granularity);
+}
+
+void frame_pool::deallocate(void *p, std::size_t size) noexcept {
+  std::size_t c = (size + frame_granularity - 1) / frame_granularity;
+  if ((c >= frame_classes) || (free_lists.counts[c] >= max_free_frames)) {
+    ::operator delete(p);
+    return;
+  }
+  free_frame *f = static_cast<free_frame *>(p);
+  f->next = free_lists.heads[c];
+  free_lists.heads[c] = f;
+  free_lists.counts[c]++;
+}
+
+////////////////////// AWAITERS ////////////////////////////////////////
+
+bool recv_awaiter::_try_recv() {
+  while (true) {
+    if (_s->connected_socket < 0) {
+      _err = EBADF;
+      return true;
+    }
+    _result = ::recv(_s->connected_socket, _buf->data(), _buf->size(), 0);
+    if (_result >= 0)
+      return true;
+    if (errno == EINTR)
+      continue;
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      return false;
+    _err = errno;
+    return true;
+  }
+}
+
+void recv_awaiter::await_suspend(std::coroutine_handle<> h) {
+  _h = h;
+  _s->_read_ready = [this]() {
+    if (_try_recv())
+      _h.resume();
+    else
+      await_suspend(_h);
+  };
+}
+
+std::size_t recv_awaiter::await_resume() {
+  if (_err)
+    throw std::runtime_error(std::string("read_some: ") + strerror(_err));
+  return _result;
+}
+
+bool send_awaiter::_try_send() {
+  while (_sent < _data.size()) {
+    if (_s->connected_socket < 0) {
+      _err = EBADF;
+      return true;
+    }
+    auto s = ::send(_s->connected_socket, _data.data() + _sent,
+                    _data.size() - _sent, MSG_NOSIGNAL);
+    if (s > 0) {
+      _sent += s;
+    } else if (errno == EINTR) {
+      continue;
+    } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      return false;
+    } else {
+      _err = errno;
+      return true;
+    }
+  }
+  return true;
+}
+
+void send_awaiter::await_suspend(std::coroutine_handle<> h) {
+  _h = h;
+  _s->_write_ready = [this]() {
+    if (_try_send())
+      _h.resume();
+    else
+      await_suspend(_h);
+  };
+}
+
+std::size_t send_awaiter::await_resume() {
+  if (_err)
+    throw std::runtime_error(std::string("write_all: ") + strerror(_err));
+  return _sent;
+}
+
+bool accept_awaiter::await_ready() {
+  _srv->_enter_pull_mode();
+  if (_srv->_accept_waiters.size())
+    return false; // keep the order of waiting coroutines
+  for (auto sockfd : _srv->listening_sockets) {
+    _fd = ::accept4(sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (_fd >= 0)
+      return true;
+  }
+  return _srv->listening_sockets.size() == 0;
+}
+
+void accept_awaiter::await_suspend(std::coroutine_handle<> h) {
+  _h = h;
+  _srv->_accept_waiters.push_back([this](int connected_socket) {
+    _fd = connected_socket;
+    _h.resume();
+  });
+  _srv->_arm_accept(true);
+}
+
+socket_p accept_awaiter::await_resume() {
+  if (_fd < 0)
+    throw std::runtime_error("accept: server is not listening");
+  auto s = std::make_shared<socket>(*_srv->_loop);
+  s->_adopt(_fd);
+  return s;
+}
+
+void connect_awaiter::await_suspend(std::coroutine_handle<> h) {
+  _s->_start_connect(_port, _addr, [this, h](std::string err) {
+    _err = err;
+    if (err.size() == 0)
+      _s->_adopt(_s->connected_socket);
+    h.resume();
+  });
+}
+
+socket_p connect_awaiter::await_resume() {
+  if (_err.size())
+    throw std::runtime_error("connect: " + _err);
+  return _s;
+}
+
+////////////////////// SOCKET AND SERVER ///////////////////////////////
+
+recv_awaiter socket::read_some(std::vector<char> &buf) { return {*this, buf}; }
+
+send_awaiter socket::write_all(std::string data) {
+  return {*this, std::move(data)};
+}
+
+connect_awaiter socket::connect(event_loop &loop, unsigned int port_,
+                                char const *addr_) {
+  return {loop, port_, addr_};
+}
+
+accept_awaiter server::accept() { return accept_awaiter(*this); }
+
+} // namespace net
+} // namespace tp
@@ -0,0 +1,410 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include <tepsoc_codec.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+
+namespace tp {
+namespace net {
+
+void encode_buffer::_grow(std::size_t size_) {
+  std::size_t capacity =
+      std::max<std::size_t>({_capacity * 2, _size + size_, 4096});
+  std::shared_ptr<char[]> data(new char[capacity]);
+  if (_size)
+    std::memcpy(data.get(), _data.get(), _size);
+  _data = std::move(data);
+  _capacity = capacity;
+}
+
+owned_buffer encode_buffer::take() {
+  if (_size == 0)
+    return owned_buffer();
+  const char *data = _data.get();
+  owned_buffer result(std::shared_ptr<const void>(std::move(_data), data),
+                      data, _size);
+  _data.reset();
+  _size = _capacity = 0;
+  return result;
+}
+
+std::size_t length_prefixed_codec::decode(const char *data_, std::size_t size_,
+                                          message &message_) const {
+  if (size_ < 4)
+    return 0;
+  auto *b = (const unsigned char *)data_;
+  std::size_t length = ((std::size_t)b[0] << 24) | ((std::size_t)b[1] << 16) |
+                       ((std::size_t)b[2] << 8) | (std::size_t)b[3];
+  if (length > max_size)
+    throw codec_error("message of " + std::to_string(length) +
+                      " bytes is too long");
+  if (size_ - 4 < length)
+    return 0;
+  message_ = std::string_view(data_ + 4, length);
+  return 4 + length;
+}
+
+void length_prefixed_codec::encode(std::string_view message_,
+                                   encode_buffer &out_) const {
+  std::size_t length = message_.size();
+  if ((length > max_size) || (length > UINT32_MAX))
+    throw codec_error("message of " + std::to_string(length) +
+                      " bytes is too long");
+  auto *b = (unsigned char *)out_.reserve(4 + length);
+  b[0] = length >> 24;
+  b[1] = length >> 16;
+  b[2] = length >> 8;
+  b[3] = length;
+  std::memcpy(b + 4, message_.data(), length);
+  out_.commit(4 + length);
+}
+
+std::size_t json_lines_codec::decode(const char *data_, std::size_t size_,
+                                     message &message_) const {
+  // the line end may follow max_size bytes
+  auto *end = (const char *)std::memchr(data_, '\n',
+                                        std::min(size_, max_size + 2));
+  if (end == nullptr) {
+    if (size_ > max_size + 1)
+      throw codec_error("line is too long");
+    return 0;
+  }
+  std::size_t length = end - data_;
+  if (length && (data_[length - 1] == '\r'))
+    length--;
+  if (length > max_size)
+    throw codec_error("line is too long");
+  message_ = std::string_view(data_, length);
+  return end - data_ + 1;
+}
+
+void json_lines_codec::encode(std::string_view message_,
+                              encode_buffer &out_) const {
+  if (message_.find('\n') != std::string_view::npos)
+    throw codec_error("JSON text has a line end");
+  char *out = out_.reserve(message_.size() + 1);
+  std::memcpy(out, message_.data(), message_.size());
+  out[message_.size()] = '\n';
+  out_.commit(message_.size() + 1);
+}
+
+namespace {
+
+// length of type line or inline command, as in Redis
+const std::size_t resp_max_line = 64 * 1024;
+
+/**
+ * the "\r\n" that ends line starting at p, nullptr when not received yet
+ * */
+const char *resp_line_end(const char *p, const char *end) {
+  std::size_t size = end - p;
+  auto *lf = (const char *)std::memchr(p, '\n', std::min(size, resp_max_line));
+  if (lf == nullptr) {
+    if (size >= resp_max_line)
+      throw codec_error("RESP: line is too long");
+    return nullptr;
+  }
+  if ((lf == p) || (lf[-1] != '\r'))
+    throw codec_error("RESP: line does not end with CRLF");
+  return lf - 1;
+}
+
+long long resp_number(std::string_view text) {
+  long long value = 0;
+  auto [ptr, ec] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  if ((ec != std::errc()) || (ptr != text.data() + text.size()) ||
+      text.empty())
+    throw codec_error("RESP: bad number " + std::string(text));
+  return value;
+}
+
+/**
+ * words of the line as bulk strings
+ * */
+const char *resp_inline(const char *p, const char *end, resp_value &value) {
+  std::size_t size = end - p;
+  auto *lf = (const char *)std::memchr(p, '\n', std::min(size, resp_max_line));
+  if (lf == nullptr) {
+    if (size >= resp_max_line)
+      throw codec_error("RESP: inline command is too long");
+    return nullptr;
+  }
+  value.type = resp_type::ARRAY;
+  std::size_t count = 0;
+  for (const char *w = p; w < lf;) {
+    while ((w < lf) && ((*w == ' ') || (*w == '\t') || (*w == '\r')))
+      w++;
+    const char *e = w;
+    while ((e < lf) && (*e != ' ') && (*e != '\t') && (*e != '\r'))
+      e++;
+    if (e == w)
+      break;
+    if (value.elements.size() <= count)
+      value.elements.emplace_back();
+    auto &element = value.elements[count++];
+    element.type = resp_type::BULK;
+    element.text = std::string_view(w, e - w);
+    w = e;
+  }
+  value.elements.resize(count);
+  return lf + 1;
+}
+
+/**
+ * decode value at p
+ *
+ * @return the position after it, nullptr when it is not complete
+ * */
+const char *resp_parse(const resp_codec &codec, const char *p, const char *end,
+                       resp_value &value, int depth) {
+  if (p == end)
+    return nullptr;
+  const char type = *p;
+  if ((depth == 0) && (type != '*') && (type != '+') && (type != '-') &&
+      (type != ':') && (type != '$'))
+    return resp_inline(p, end, value);
+  const char *eol = resp_line_end(p + 1, end);
+  if (eol == nullptr)
+    return nullptr;
+  std::string_view line(p + 1, eol - p - 1);
+  const char *next = eol + 2;
+  switch (type) {
+  case '+':
+    value.type = resp_type::SIMPLE;
+    value.text = line;
+    return next;
+  case '-':
+    value.type = resp_type::ERROR;
+    value.text = line;
+    return next;
+  case ':':
+    value.type = resp_type::INTEGER;
+    value.integer = resp_number(line);
+    return next;
+  case '$': {
+    long long size = resp_number(line);
+    if (size == -1) {
+      value.type = resp_type::NIL;
+      return next;
+    }
+    if ((size < 0) || ((std::size_t)size > codec.max_bulk))
+      throw codec_error("RESP: bad bulk length " + std::string(line));
+    if ((std::size_t)(end - next) < (std::size_t)size + 2)
+      return nullptr;
+    if ((next[size] != '\r') || (next[size + 1] != '\n'))
+      throw codec_error("RESP: bulk string does not end with CRLF");
+    value.type = resp_type::BULK;
+    value.text = std::string_view(next, size);
+    return next + size + 2;
+  }
+  case '*': {
+    long long size = resp_number(line);
+    if (size == -1) {
+      value.type = resp_type::NIL;
+      return next;
+    }
+    if ((size < 0) || ((std::size_t)size > codec.max_elements))
+      throw codec_error("RESP: bad array length " + std::string(line));
+    if (depth >= codec.max_depth)
+      throw codec_error("RESP: arrays are nested too deep");
+    // every element takes at least 3 bytes, so a long array is not
+    // allocated before it arrives
+    if ((std::size_t)(end - next) < (std::size_t)size * 3)
+      return nullptr;
+    value.type = resp_type::ARRAY;
+    value.elements.resize(size);
+    for (auto &element : value.elements) {
+      next = resp_parse(codec, next, end, element, depth + 1);
+      if (next == nullptr)
+        return nullptr;
+    }
+    return next;
+  }
+  default:
+    throw codec_error(std::string("RESP: bad type ") + type);
+  }
+}
+
+void resp_line(encode_buffer &out, char type, std::string_view text) {
+  char *p = out.reserve(text.size() + 3);
+  p[0] = type;
+  std::memcpy(p + 1, text.data(), text.size());
+  p[text.size() + 1] = '\r';
+  p[text.size() + 2] = '\n';
+  out.commit(text.size() + 3);
+}
+
+void resp_number_line(encode_buffer &out, char type, long long value) {
+  char *p = out.reserve(24);
+  p[0] = type;
+  char *e = std::to_chars(p + 1, p + 22, value).ptr;
+  e[0] = '\r';
+  e[1] = '\n';
+  out.commit(e + 2 - p);
+}
+
+} // namespace
+
+std::size_t resp_codec::decode(const char *data_, std::size_t size_,
+                               message &message_) const {
+  const char *end = resp_parse(*this, data_, data_ + size_, message_, 0);
+  return end ? end - data_ : 0;
+}
+
+std::size_t resp_codec::complete(const char *data_, std::size_t size_,
+                                 progress &progress_) const {
+  const char *end = data_ + size_;
+  auto &left = progress_.left;
+  while (true) {
+    const char *p = data_ + progress_.checked;
+    if (p == end)
+      return 0;
+    const char type = *p;
+    const char *next;
+    if (left.empty() && (type != '*') && (type != '+') && (type != '-') &&
+        (type != ':') && (type != '$')) {
+      // inline command
+      std::size_t size = end - p;
+      auto *lf =
+          (const char *)std::memchr(p, '\n', std::min(size, resp_max_line));
+      if (lf == nullptr) {
+        if (size >= resp_max_line)
+          throw codec_error("RESP: inline command is too long");
+        return 0;
+      }
+      next = lf + 1;
+    } else {
+      const char *eol = resp_line_end(p + 1, end);
+      if (eol == nullptr)
+        return 0;
+      std::string_view line(p + 1, eol - p - 1);
+      next = eol + 2;
+      switch (type) {
+      case '+':
+      case '-':
+        break;
+      case ':':
+        resp_number(line);
+        break;
+      case '$': {
+        long long size = resp_number(line);
+        if (size == -1)
+          break;
+        if ((size < 0) || ((std::size_t)size > max_bulk))
+          throw codec_error("RESP: bad bulk length " + std::string(line));
+        if ((std::size_t)(end - next) < (std::size_t)size + 2)
+          return 0;
+        if ((next[size] != '\r') || (next[size + 1] != '\n'))
+          throw codec_error("RESP: bulk string does not end with CRLF");
+        next += size + 2;
+        break;
+      }
+      case '*': {
+        long long size = resp_number(line);
+        if (size == -1)
+          break;
+        if ((size < 0) || ((std::size_t)size > max_elements))
+          throw codec_error("RESP: bad array length " + std::string(line));
+        if ((int)left.size() >= max_depth)
+          throw codec_error("RESP: arrays are nested too deep");
+        if (size > 0) {
+          // its elements are checked next
+          progress_.checked = next - data_;
+          left.push_back(size);
+          continue;
+        }
+        break;
+      }
+      default:
+        throw codec_error(std::string("RESP: bad type ") + type);
+      }
+    }
+    progress_.checked = next - data_;
+    // the value is complete, and so are the arrays it completes
+    while (left.size() && (--left.back() == 0))
+      left.pop_back();
+    if (left.empty())
+      return progress_.checked;
+  }
+}
+
+void resp_codec::encode(const resp_value &value_, encode_buffer &out_) const {
+  switch (value_.type) {
+  case resp_type::SIMPLE:
+    simple(out_, value_.text);
+    break;
+  case resp_type::ERROR:
+    error(out_, value_.text);
+    break;
+  case resp_type::INTEGER:
+    integer(out_, value_.integer);
+    break;
+  case resp_type::BULK:
+    bulk(out_, value_.text);
+    break;
+  case resp_type::NIL:
+    nil(out_);
+    break;
+  case resp_type::ARRAY:
+    array(out_, value_.elements.size());
+    for (auto &element : value_.elements)
+      encode(element, out_);
+    break;
+  }
+}
+
+void resp_codec::simple(encode_buffer &out_, std::string_view text_) {
+  resp_line(out_, '+', text_);
+}
+
+void resp_codec::error(encode_buffer &out_, std::string_view text_) {
+  resp_line(out_, '-', text_);
+}
+
+void resp_codec::integer(encode_buffer &out_, long long value_) {
+  resp_number_line(out_, ':', value_);
+}
+
+void resp_codec::bulk(encode_buffer &out_, std::string_view data_) {
+  resp_number_line(out_, '$', data_.size());
+  char *p = out_.reserve(data_.size() + 2);
+  std::memcpy(p, data_.data(), data_.size());
+  p[data_.size()] = '\r';
+  p[data_.size() + 1] = '\n';
+  out_.commit(data_.size() + 2);
+}
+
+void resp_codec::nil(encode_buffer &out_) { out_.append("$-1\r\n", 5); }
+
+void resp_codec::array(encode_buffer &out_, std::size_t size_) {
+  resp_number_line(out_, '*', size_);
+}
+
+} // namespace net
+} // namespace tp
@@ -0,0 +1,605 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include <tepsoc_dgram.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace tp {
+namespace net {
+
+std::string dgram_address::host() const {
+  char host[NI_MAXHOST] = "";
+  getnameinfo((const sockaddr *)&storage, length, host, sizeof(host), nullptr,
+              0, NI_NUMERICHOST);
+  return host;
+}
+
+unsigned int dgram_address::port() const {
+  switch (storage.ss_family) {
+  case AF_INET:
+    return ntohs(((const sockaddr_in *)&storage)->sin_port);
+  case AF_INET6:
+    return ntohs(((const sockaddr_in6 *)&storage)->sin6_port);
+  default:
+    return 0;
+  }
+}
+
+bool dgram_address::operator==(const dgram_address &other) const {
+  if (storage.ss_family != other.storage.ss_family)
+    return false;
+  switch (storage.ss_family) {
+  case AF_INET: {
+    auto a = (const sockaddr_in *)&storage;
+    auto b = (const sockaddr_in *)&other.storage;
+    return (a->sin_port == b->sin_port) &&
+           (a->sin_addr.s_addr == b->sin_addr.s_addr);
+  }
+  case AF_INET6: {
+    auto a = (const sockaddr_in6 *)&storage;
+    auto b = (const sockaddr_in6 *)&other.storage;
+    return (a->sin6_port == b->sin6_port) &&
+           (a->sin6_scope_id == b->sin6_scope_id) &&
+           (memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0);
+  }
+  default:
+    return (length == other.length) &&
+           (memcmp(&storage, &other.storage, length) == 0);
+  }
+}
+
+dgram_address dgram_address::resolve(unsigned int port_, char const *addr_) {
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  bool any = (addr_ == nullptr) || (std::string(addr_) == "*");
+  if (any)
+    hints.ai_flags = AI_PASSIVE;
+  struct addrinfo *result;
+  if (int err = getaddrinfo(any ? nullptr : addr_,
+                            std::to_string(port_).c_str(), &hints, &result);
+      err)
+    throw std::invalid_argument(gai_strerror(err));
+  dgram_address ret;
+  std::copy((char *)result->ai_addr,
+            (char *)result->ai_addr + result->ai_addrlen, (char *)&ret.storage);
+  ret.length = result->ai_addrlen;
+  freeaddrinfo(result);
+  return ret;
+}
+
+dgram_socket::dgram_socket() : dgram_socket(event_loop::get_default()) {}
+
+dgram_socket::dgram_socket(event_loop &loop) {
+  _loop = &loop;
+  _alive = std::make_shared<char>(0);
+  _fd = -1;
+  _flush_posted = false;
+  _write_blocked = false;
+  _gso = false;
+  _gro = false;
+  _max_message_size = 2048;
+  _reuse_address = false;
+  _broadcast = false;
+  _callbacks[ERROR] = [](std::string err) {
+    std::cerr << "dgram_socket error: " << err << std::endl;
+  };
+}
+
+dgram_socket::~dgram_socket() {
+  _loop->synchronized([this]() {
+    _alive.reset();
+    if (_fd >= 0) {
+      _loop->unwatch(_fd);
+      ::close(_fd);
+      _fd = -1;
+    }
+  });
+}
+
+dgram_socket &dgram_socket::on(const socket_event evnt,
+                               socket_event_callback_f f) {
+  std::lock_guard<std::mutex> lock(_callbacks_mutex);
+  _callbacks[evnt] = f;
+  return *this;
+}
+
+void dgram_socket::_on_error(const std::string &err) {
+  socket_event_callback_f cb;
+  {
+    std::lock_guard<std::mutex> lock(_callbacks_mutex);
+    cb = _callbacks[ERROR];
+  }
+  switch (cb.index()) {
+  case 0:
+    if (std::get<0>(cb))
+      std::get<0>(cb)();
+    break;
+  case 1:
+    std::get<1>(cb)(err);
+    break;
+  }
+}
+
+std::string dgram_socket::_open(int family_) {
+  if (_fd >= 0)
+    return "";
+  int fd = ::socket(family_, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    throw std::runtime_error(std::string("socket: ") + strerror(errno));
+  std::size_t buffer_size = _max_message_size;
+  if (_gro) {
+    int one = 1;
+    if (setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0)
+      buffer_size = std::max<std::size_t>(buffer_size, 65536);
+    else
+      _gro = false;
+  }
+  _buffers.resize(batch_size * buffer_size);
+  _controls.resize(batch_size * CMSG_SPACE(sizeof(int)));
+  _fd = fd;
+  return _apply_options();
+}
+
+std::string dgram_socket::_apply_options() {
+  std::string err;
+  int family = AF_UNSPEC;
+  socklen_t family_len = sizeof(family);
+  getsockopt(_fd, SOL_SOCKET, SO_DOMAIN, &family, &family_len);
+  bool v6 = (family == AF_INET6);
+  auto set = [&](int level, int name, char const *name_s, const void *value,
+                 socklen_t len) {
+    if (setsockopt(_fd, level, name, value, len) == -1)
+      err += std::string(err.size() ? "; " : "") + "setsockopt " + name_s +
+             ": " + strerror(errno);
+  };
+  int one = 1;
+  if (_reuse_address)
+    set(SOL_SOCKET, SO_REUSEADDR, "SO_REUSEADDR", &one, sizeof(one));
+  if (_broadcast)
+    set(SOL_SOCKET, SO_BROADCAST, "SO_BROADCAST", &one, sizeof(one));
+  if (_multicast_loop) {
+    int v = *_multicast_loop ? 1 : 0;
+    if (v6)
+      set(IPPROTO_IPV6, IPV6_MULTICAST_LOOP, "IPV6_MULTICAST_LOOP", &v,
+          sizeof(v));
+    else
+      set(IPPROTO_IP, IP_MULTICAST_LOOP, "IP_MULTICAST_LOOP", &v, sizeof(v));
+  }
+  if (_multicast_hops) {
+    int v = *_multicast_hops;
+    if (v6)
+      set(IPPROTO_IPV6, IPV6_MULTICAST_HOPS, "IPV6_MULTICAST_HOPS", &v,
+          sizeof(v));
+    else
+      set(IPPROTO_IP, IP_MULTICAST_TTL, "IP_MULTICAST_TTL", &v, sizeof(v));
+  }
+  if (_multicast_interface.size()) {
+    const char *name = _multicast_interface.c_str();
+    if (v6) {
+      int index = if_nametoindex(name);
+      set(IPPROTO_IPV6, IPV6_MULTICAST_IF, "IPV6_MULTICAST_IF", &index,
+          sizeof(index));
+    } else {
+      ip_mreqn m = {};
+      if (inet_pton(AF_INET, name, &m.imr_address) != 1)
+        m.imr_ifindex = if_nametoindex(name);
+      set(IPPROTO_IP, IP_MULTICAST_IF, "IP_MULTICAST_IF", &m, sizeof(m));
+    }
+  }
+  return err;
+}
+
+std::string dgram_socket::_membership(const char *group_,
+                                      const char *interface_, bool join_) {
+  auto group = dgram_address::resolve(0, group_);
+  if (_fd < 0)
+    return "bind before joining multicast group";
+  int r;
+  if (group.storage.ss_family == AF_INET6) {
+    ipv6_mreq m = {};
+    m.ipv6mr_multiaddr = ((sockaddr_in6 *)&group.storage)->sin6_addr;
+    if (interface_)
+      m.ipv6mr_interface = if_nametoindex(interface_);
+    r = setsockopt(_fd, IPPROTO_IPV6,
+                   join_ ? IPV6_JOIN_GROUP : IPV6_LEAVE_GROUP, &m, sizeof(m));
+  } else {
+    ip_mreqn m = {};
+    m.imr_multiaddr = ((sockaddr_in *)&group.storage)->sin_addr;
+    if (interface_ && (inet_pton(AF_INET, interface_, &m.imr_address) != 1))
+      m.imr_ifindex = if_nametoindex(interface_);
+    r = setsockopt(_fd, IPPROTO_IP,
+                   join_ ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &m,
+                   sizeof(m));
+  }
+  if (r == -1)
+    return std::string(join_ ? "join " : "leave ") + group_ + ": " +
+           strerror(errno);
+  return "";
+}
+
+dgram_socket &dgram_socket::join_group(char const *group_,
+                                       char const *interface_) {
+  std::string err;
+  {
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    err = _membership(group_, interface_, true);
+  }
+  if (err.size())
+    _on_error(err);
+  return *this;
+}
+
+dgram_socket &dgram_socket::leave_group(char const *group_,
+                                        char const *interface_) {
+  std::string err;
+  {
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    err = _membership(group_, interface_, false);
+  }
+  if (err.size())
+    _on_error(err);
+  return *this;
+}
+
+dgram_socket &dgram_socket::subscribe(unsigned int port_, char const *group_,
+                                      char const *interface_) {
+  // bound to the group, so other datagrams to the port are not received
+  set_reuse_address(true);
+  bind(port_, group_);
+  return join_group(group_, interface_);
+}
+
+void dgram_socket::_watch() {
+  _loop->watch(_fd, IO_READ,
+               [this](unsigned int events) { _handle_io(events); });
+}
+
+dgram_socket &dgram_socket::bind(unsigned int port_, char const *addr_) {
+  auto addr = dgram_address::resolve(port_, addr_);
+  std::string err;
+  bool bound;
+  {
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    err = _open(addr.storage.ss_family);
+    bound = (::bind(_fd, (sockaddr *)&addr.storage, addr.length) == 0);
+    if (!bound)
+      err = std::string("bind: ") + strerror(errno);
+  }
+  if (err.size())
+    _on_error(err);
+  if (bound)
+    _watch();
+  return *this;
+}
+
+dgram_socket &dgram_socket::connect(unsigned int port_, char const *addr_) {
+  auto addr = dgram_address::resolve(port_, addr_);
+  std::string err;
+  bool connected;
+  {
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    err = _open(addr.storage.ss_family);
+    connected = (::connect(_fd, (sockaddr *)&addr.storage, addr.length) == 0);
+    if (connected)
+      _peer = addr;
+    else
+      err = std::string("connect: ") + strerror(errno);
+  }
+  if (err.size())
+    _on_error(err);
+  if (connected)
+    _watch();
+  return *this;
+}
+
+dgram_socket &dgram_socket::send_to(const dgram_address &to_,
+                                    const char *data_, std::size_t size_) {
+  bool opened = false;
+  std::string err;
+  {
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    if (_fd < 0) {
+      err = _open(to_.storage.ss_family);
+      opened = true;
+    }
+    _outgoing.push_back({to_, std::vector<char>(data_, data_ + size_)});
+    if (!_flush_posted && !_write_blocked) {
+      // everything sent until the loop gets to it goes in one batch
+      _flush_posted = true;
+      std::weak_ptr<char> alive = _alive;
+      _loop->post([this, alive]() {
+        if (!alive.expired())
+          flush();
+      });
+    }
+  }
+  if (err.size())
+    _on_error(err);
+  if (opened)
+    _watch(); // replies come to the same socket
+  return *this;
+}
+
+dgram_socket &dgram_socket::send(const std::string &data_) {
+  dgram_address peer;
+  {
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    peer = _peer;
+  }
+  if (peer.length == 0) {
+    _on_error("send: dgram_socket is not connected");
+    return *this;
+  }
+  return send_to(peer, data_.data(), data_.size());
+}
+
+dgram_socket &dgram_socket::flush() {
+  std::string err;
+  {
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    _flush_posted = false;
+    if (_fd < 0)
+      return *this;
+    std::size_t done = 0;
+    bool blocked = false;
+    const std::size_t max_segments = 64;
+    const std::size_t max_gso_bytes = 65000;
+    while ((done < _outgoing.size()) && !blocked) {
+      std::vector<mmsghdr> msgs;
+      std::vector<std::size_t> runs;
+      std::vector<iovec> iovs;
+      std::vector<char> controls(batch_size * CMSG_SPACE(sizeof(uint16_t)));
+      iovs.reserve(_outgoing.size() - done);
+      msgs.reserve(batch_size);
+      for (std::size_t i = done;
+           (i < _outgoing.size()) && (msgs.size() < batch_size);) {
+        std::size_t run = 1;
+        std::size_t segment = _outgoing[i].data.size();
+        if (_gso && segment) {
+          // equal datagrams to the same address, the last may be shorter
+          std::size_t bytes = segment;
+          while ((i + run < _outgoing.size()) && (run < max_segments) &&
+                 (_outgoing[i + run - 1].data.size() == segment) &&
+                 (_outgoing[i + run].data.size() <= segment) &&
+                 (_outgoing[i + run].data.size() > 0) &&
+                 (bytes + _outgoing[i + run].data.size() <= max_gso_bytes) &&
+                 (_outgoing[i + run].to == _outgoing[i].to)) {
+            bytes += _outgoing[i + run].data.size();
+            run++;
+          }
+        }
+        mmsghdr m = {};
+        m.msg_hdr.msg_name = &_outgoing[i].to.storage;
+        m.msg_hdr.msg_namelen = _outgoing[i].to.length;
+        m.msg_hdr.msg_iov = iovs.data() + iovs.size();
+        m.msg_hdr.msg_iovlen = run;
+        for (std::size_t k = i; k < i + run; k++)
+          iovs.push_back({_outgoing[k].data.data(), _outgoing[k].data.size()});
+        if (run > 1) {
+          char *control =
+              controls.data() + msgs.size() * CMSG_SPACE(sizeof(uint16_t));
+          m.msg_hdr.msg_control = control;
+          m.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+          struct cmsghdr *cmsg = CMSG_FIRSTHDR(&m.msg_hdr);
+          cmsg->cmsg_level = SOL_UDP;
+          cmsg->cmsg_type = UDP_SEGMENT;
+          cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+          *(uint16_t *)CMSG_DATA(cmsg) = (uint16_t)segment;
+        }
+        msgs.push_back(m);
+        runs.push_back(run);
+        i += run;
+      }
+      int n = ::sendmmsg(_fd, msgs.data(), msgs.size(), MSG_NOSIGNAL);
+      if (n > 0) {
+        for (int k = 0; k < n; k++)
+          done += runs[k];
+      } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        blocked = true;
+      } else if (errno == EINTR) {
+        continue;
+      } else if ((runs[0] > 1) && _gso) {
+        // the device can not segment, send datagrams one by one
+        err += std::string(err.size() ? "; " : "") +
+               "GSO disabled: " + strerror(errno);
+        _gso = false;
+      } else {
+        // the datagram is lost, the rest can still be sent
+        err += std::string(err.size() ? "; " : "") + "sendmmsg: " +
+               strerror(errno);
+        done += runs[0];
+      }
+    }
+    _outgoing.erase(_outgoing.begin(), _outgoing.begin() + done);
+    if (blocked != _write_blocked) {
+      _write_blocked = blocked;
+      _loop->modify(_fd, IO_READ | (blocked ? (unsigned int)IO_WRITE : 0));
+    }
+  }
+  if (err.size())
+    _on_error(err);
+  return *this;
+}
+
+void dgram_socket::_handle_io(unsigned int events) {
+  if (events & IO_WRITE)
+    flush();
+  if (events & (IO_READ | IO_ERROR))
+    _receive();
+}
+
+void dgram_socket::_receive() {
+  // limit batches per readiness, so one busy socket does not starve others
+  const int max_batches = 16;
+  socket_event_callback_f cb;
+  {
+    std::lock_guard<std::mutex> lock(_callbacks_mutex);
+    if (auto found = _callbacks.find(MESSAGE); found != _callbacks.end())
+      cb = found->second;
+  }
+  std::size_t buffer_size = _buffers.size() / batch_size;
+  std::size_t control_size = _controls.size() / batch_size;
+  mmsghdr msgs[batch_size];
+  iovec iovs[batch_size];
+  sockaddr_storage addrs[batch_size];
+  for (int batch = 0; (batch < max_batches) && (_fd >= 0); batch++) {
+    for (unsigned int i = 0; i < batch_size; i++) {
+      iovs[i] = {_buffers.data() + i * buffer_size, buffer_size};
+      msgs[i] = {};
+      msgs[i].msg_hdr.msg_name = &addrs[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      if (_gro) {
+        msgs[i].msg_hdr.msg_control = _controls.data() + i * control_size;
+        msgs[i].msg_hdr.msg_controllen = control_size;
+      }
+    }
+    int n = ::recvmmsg(_fd, msgs, batch_size, 0, nullptr);
+    if (n == -1) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return;
+      if (errno == EINTR)
+        continue;
+      // for example ICMP port unreachable on connected socket
+      _on_error(std::string("recvmmsg: ") + strerror(errno));
+      continue;
+    }
+    for (int i = 0; i < n; i++) {
+      dgram_message message;
+      message.data = (const char *)iovs[i].iov_base;
+      message.size = msgs[i].msg_len;
+      message.truncated = msgs[i].msg_hdr.msg_flags & MSG_TRUNC;
+      std::copy((char *)&addrs[i],
+                (char *)&addrs[i] + msgs[i].msg_hdr.msg_namelen,
+                (char *)&message.from.storage);
+      message.from.length = msgs[i].msg_hdr.msg_namelen;
+      std::size_t segment = 0;
+      if (_gro) {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+             cmsg != nullptr; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+          if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO))
+            segment = *(int *)CMSG_DATA(cmsg);
+      }
+      if (cb.index() != 7)
+        continue;
+      auto &handler = std::get<7>(cb);
+      if ((segment == 0) || (segment >= message.size)) {
+        handler(message);
+        continue;
+      }
+      // coalesced datagrams are given one by one
+      const char *data = message.data;
+      std::size_t left = message.size;
+      while (left) {
+        message.data = data;
+        message.size = std::min(segment, left);
+        handler(message);
+        data += message.size;
+        left -= message.size;
+      }
+    }
+    if (n < (int)batch_size)
+      return;
+  }
+}
+
+dgram_socket &dgram_socket::set_gso(bool enabled_) {
+  std::lock_guard<std::mutex> lock(_send_mutex);
+  _gso = enabled_;
+  return *this;
+}
+
+dgram_socket &dgram_socket::set_gro(bool enabled_) {
+  std::lock_guard<std::mutex> lock(_send_mutex);
+  if (_fd >= 0)
+    throw std::invalid_argument("set_gro must be called before bind");
+  _gro = enabled_;
+  return *this;
+}
+
+dgram_socket &dgram_socket::set_max_message_size(std::size_t size_) {
+  std::lock_guard<std::mutex> lock(_send_mutex);
+  if (_fd >= 0)
+    throw std::invalid_argument(
+        "set_max_message_size must be called before bind");
+  _max_message_size = size_;
+  return *this;
+}
+
+dgram_socket &dgram_socket::_option_guard(std::function<void()> f) {
+  std::string err;
+  {
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    f();
+    if (_fd >= 0)
+      err = _apply_options();
+  }
+  if (err.size())
+    _on_error(err);
+  return *this;
+}
+
+dgram_socket &dgram_socket::set_multicast_interface(char const *interface_) {
+  return _option_guard(
+      [&]() { _multicast_interface = interface_ ? interface_ : ""; });
+}
+dgram_socket &dgram_socket::set_multicast_loop(bool enabled_) {
+  return _option_guard([&]() { _multicast_loop = enabled_; });
+}
+dgram_socket &dgram_socket::set_multicast_hops(int hops_) {
+  return _option_guard([&]() { _multicast_hops = hops_; });
+}
+dgram_socket &dgram_socket::set_reuse_address(bool enabled_) {
+  return _option_guard([&]() { _reuse_address = enabled_; });
+}
+dgram_socket &dgram_socket::set_broadcast(bool enabled_) {
+  return _option_guard([&]() { _broadcast = enabled_; });
+}
+
+dgram_address dgram_socket::local_address() const {
+  dgram_address ret;
+  ret.length = sizeof(ret.storage);
+  if ((_fd < 0) ||
+      (getsockname(_fd, (sockaddr *)&ret.storage, &ret.length) == -1))
+    ret.length = 0;
+  return ret;
+}
+
+} // namespace net
+} // namespace tp
@@ -0,0 +1,363 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include <tepsoc_loop.hpp>
+
+#include "tepsoc_trace_span.hpp"
+#include "tepsoc_uring.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <stdexcept>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace tp {
+namespace net {
+
+static_assert((unsigned int)IO_READ == (unsigned int)EPOLLIN, "IO_READ must match EPOLLIN");
+static_assert((unsigned int)IO_WRITE == (unsigned int)EPOLLOUT, "IO_WRITE must match EPOLLOUT");
+static_assert((unsigned int)IO_ERROR == (unsigned int)EPOLLERR, "IO_ERROR must match EPOLLERR");
+static_assert((unsigned int)IO_HANGUP == (unsigned int)EPOLLHUP, "IO_HANGUP must match EPOLLHUP");
+static_assert((unsigned int)IO_PEER_CLOSED == (unsigned int)EPOLLRDHUP, "IO_PEER_CLOSED must match EPOLLRDHUP");
+static_assert((unsigned int)IO_EDGE == (unsigned int)EPOLLET, "IO_EDGE must match EPOLLET");
+
+// loop that is held by synchronized in the current thread
+static thread_local event_loop const *synchronized_loop = nullptr;
+
+event_loop::event_loop(loop_backend backend_) {
+  _epoch = std::chrono::steady_clock::now();
+  _stop_requested = false;
+  _epoll_armed = false;
+  _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (_epoll_fd == -1)
+    throw std::runtime_error(std::string("epoll_create1: ") + strerror(errno));
+  _wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_wakeup_fd == -1) {
+    ::close(_epoll_fd);
+    throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+  }
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = _wakeup_fd;
+  epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wakeup_fd, &ev);
+
+  if (backend_ == loop_backend::AUTO) {
+    backend_ = loop_backend::IO_URING;
+    if (char const *env = getenv("TEPSOC_BACKEND");
+        env && (std::string(env) == "epoll"))
+      backend_ = loop_backend::EPOLL;
+  }
+  if (backend_ == loop_backend::IO_URING)
+    _uring = uring_backend::create(); // nullptr means epoll
+}
+
+bool event_loop::io_uring_available() {
+  static bool available = uring_backend::create() != nullptr;
+  return available;
+}
+
+event_loop::~event_loop() {
+  stop();
+  if (_thread.joinable())
+    _thread.join();
+  // posted work releases resources of destroyed sockets
+  _loop_thread = std::this_thread::get_id();
+  _run_posted();
+  _uring.reset();
+  ::close(_wakeup_fd);
+  ::close(_epoll_fd);
+}
+
+void event_loop::watch(int fd, unsigned int events, io_callback_f callback_) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.fd = fd;
+  std::lock_guard<std::mutex> lock(_watchers_mutex);
+  bool existing = _watchers.count(fd);
+  _watchers[fd] = std::make_shared<io_callback_f>(callback_);
+  if (epoll_ctl(_epoll_fd, existing ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) ==
+      -1) {
+    _watchers.erase(fd);
+    throw std::invalid_argument(std::string("epoll_ctl: ") + strerror(errno));
+  }
+}
+
+void event_loop::modify(int fd, unsigned int events) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.fd = fd;
+  epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void event_loop::unwatch(int fd) {
+  {
+    std::lock_guard<std::mutex> lock(_watchers_mutex);
+    if (_watchers.erase(fd) == 0)
+      return;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+  if (!_holds_dispatch()) {
+    // wait for the callbacks that are being called right now
+    std::lock_guard<std::mutex> lock(_dispatch_mutex);
+  }
+}
+
+void event_loop::post(std::function<void()> f) {
+  {
+    std::lock_guard<std::mutex> lock(_posted_mutex);
+    _posted.push_back(std::move(f));
+  }
+  uint64_t one = 1;
+  if (::write(_wakeup_fd, &one, sizeof(one))) {
+  }
+}
+
+void event_loop::execute(std::function<void()> f) {
+  if (in_loop_thread())
+    f();
+  else
+    post(std::move(f));
+}
+
+void event_loop::synchronized(std::function<void()> f) {
+  if (_holds_dispatch()) {
+    f();
+  } else {
+    std::lock_guard<std::mutex> lock(_dispatch_mutex);
+    synchronized_loop = this;
+    try {
+      f();
+    } catch (...) {
+      synchronized_loop = nullptr;
+      throw;
+    }
+    synchronized_loop = nullptr;
+  }
+}
+
+bool event_loop::_holds_dispatch() const {
+  return (synchronized_loop == this) || in_loop_thread();
+}
+
+void event_loop::_run_posted() {
+  std::vector<std::function<void()>> posted;
+  {
+    std::lock_guard<std::mutex> lock(_posted_mutex);
+    posted.swap(_running);
+    posted.swap(_posted);
+  }
+  for (auto &f : posted) {
+    TEPSOC_TRACE_SCOPE("loop.posted", 0);
+    f();
+  }
+  posted.clear();
+  std::lock_guard<std::mutex> lock(_posted_mutex);
+  if (_running.capacity() < posted.capacity())
+    _running.swap(posted);
+}
+
+timer_id event_loop::set_timeout(std::function<void()> f,
+                                 unsigned long delay_ms) {
+  timer_id id;
+  {
+    std::lock_guard<std::mutex> lock(_timers_mutex);
+    // the wheel is behind the clock by the time since the last advance
+    id = _timers.add(delay_ms + (now_ms() - _timers.now()), 0, std::move(f));
+  }
+  if (!in_loop_thread()) {
+    // the loop may be waiting with longer timeout
+    uint64_t one = 1;
+    if (::write(_wakeup_fd, &one, sizeof(one))) {
+    }
+  }
+  return id;
+}
+
+timer_id event_loop::set_interval(std::function<void()> f,
+                                  unsigned long period_ms) {
+  timer_id id;
+  if (period_ms == 0)
+    period_ms = 1;
+  {
+    std::lock_guard<std::mutex> lock(_timers_mutex);
+    id = _timers.add(period_ms + (now_ms() - _timers.now()), period_ms,
+                     std::move(f));
+  }
+  if (!in_loop_thread()) {
+    uint64_t one = 1;
+    if (::write(_wakeup_fd, &one, sizeof(one))) {
+    }
+  }
+  return id;
+}
+
+bool event_loop::clear_timeout(timer_id id) {
+  std::lock_guard<std::mutex> lock(_timers_mutex);
+  return _timers.cancel(id);
+}
+
+int event_loop::_run_timers() {
+  int n = 0;
+  std::unique_lock<std::mutex> lock(_timers_mutex);
+  _timers.advance(now_ms());
+  while (auto callback = _timers.pop_expired()) {
+    // callbacks may arm and clear timers
+    lock.unlock();
+    {
+      TEPSOC_TRACE_SCOPE("loop.timer", 0);
+      (*callback)();
+    }
+    n++;
+    lock.lock();
+  }
+  return n;
+}
+
+int event_loop::_wait_timeout(int timeout_ms) {
+  std::lock_guard<std::mutex> lock(_timers_mutex);
+  std::int64_t ticks = _timers.ticks_to_next();
+  if (ticks < 0)
+    return timeout_ms;
+  std::int64_t behind = now_ms() - _timers.now();
+  std::int64_t t = std::min<std::int64_t>(
+      std::max<std::int64_t>(0, ticks - behind), INT_MAX);
+  if ((timeout_ms >= 0) && (timeout_ms < t))
+    return timeout_ms;
+  return (int)t;
+}
+
+int event_loop::_dispatch_epoll(void *events_, int n) {
+  epoll_event *events = (epoll_event *)events_;
+  bool wakeup = false;
+  for (int i = 0; i < n; i++) {
+    int fd = events[i].data.fd;
+    if (fd == _wakeup_fd) {
+      uint64_t v;
+      if (::read(_wakeup_fd, &v, sizeof(v))) {
+      }
+      wakeup = true;
+      continue;
+    }
+    std::shared_ptr<io_callback_f> cb;
+    {
+      std::lock_guard<std::mutex> lock(_watchers_mutex);
+      auto found = _watchers.find(fd);
+      if (found == _watchers.end())
+        continue;
+      cb = found->second;
+    }
+    TEPSOC_TRACE_SCOPE("loop.io", fd);
+    (*cb)(events[i].events);
+  }
+  if (wakeup)
+    _run_posted();
+  return n;
+}
+
+int event_loop::_run_once_uring(int timeout_ms) {
+  if (!_epoll_armed) {
+    // readiness based watchers are served by epoll, which is polled through
+    // the ring. Single shot poll is rearmed after every dispatch, so fds that
+    // are still ready are reported again.
+    _epoll_armed = true;
+    _uring->poll_once(_epoll_fd, POLLIN, [this](long) {
+      const int max_events = 64;
+      epoll_event events[max_events];
+      _epoll_armed = false;
+      int n = epoll_wait(_epoll_fd, events, max_events, 0);
+      if (n > 0)
+        _dispatch_epoll(events, n);
+    });
+  }
+  {
+    TEPSOC_TRACE_SCOPE("loop.wait", 0);
+    _uring->wait(_wait_timeout(timeout_ms));
+  }
+  std::lock_guard<std::mutex> dispatch_lock(_dispatch_mutex);
+  int n = _uring->process_completions();
+  return n + _run_timers();
+}
+
+int event_loop::run_once(int timeout_ms) {
+  const int max_events = 64;
+  epoll_event events[max_events];
+  _loop_thread = std::this_thread::get_id();
+  if (_uring)
+    return _run_once_uring(timeout_ms);
+  int n;
+  {
+    TEPSOC_TRACE_SCOPE("loop.wait", 0);
+    n = epoll_wait(_epoll_fd, events, max_events, _wait_timeout(timeout_ms));
+  }
+  if (n == -1) {
+    if (errno == EINTR)
+      return 0;
+    throw std::runtime_error(std::string("epoll_wait: ") + strerror(errno));
+  }
+  std::lock_guard<std::mutex> dispatch_lock(_dispatch_mutex);
+  n = _dispatch_epoll(events, n);
+  return n + _run_timers();
+}
+
+void event_loop::run() {
+  while (!_stop_requested) {
+    try {
+      run_once(-1);
+    } catch (std::exception &e) {
+      std::cerr << "event_loop: " << e.what() << std::endl;
+    }
+  }
+  _stop_requested = false;
+}
+
+void event_loop::stop() {
+  _stop_requested = true;
+  uint64_t one = 1;
+  if (::write(_wakeup_fd, &one, sizeof(one))) {
+  }
+}
+
+event_loop &event_loop::start() {
+  _thread = std::thread([this]() { run(); });
+  return *this;
+}
+
+event_loop &event_loop::get_default() {
+  static event_loop default_loop;
+  static std::once_flag started;
+  std::call_once(started, []() { default_loop.start(); });
+  return default_loop;
+}
+
+} // namespace net
+} // namespace tp
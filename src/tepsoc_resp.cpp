@@ -0,0 +1,163 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include <tepsoc_resp.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+
+namespace tp {
+namespace net {
+
+namespace {
+
+// longer names are not registered
+const std::size_t max_command_name = 32;
+
+std::string upper(std::string_view name) {
+  std::string result(name);
+  for (auto &c : result)
+    c = std::toupper((unsigned char)c);
+  return result;
+}
+
+} // namespace
+
+resp_server::resp_server(event_loop &loop_)
+    : _server(loop_, [this](socket &s) { _serve(s); }) {
+  _server.on(LISTENING, []() {});
+  command("PING", -1, [](const std::vector<resp_value> &args_,
+                         encode_buffer &out_) {
+    if (args_.size() > 2)
+      resp_codec::error(out_, "ERR wrong number of arguments for 'ping' "
+                              "command");
+    else if (args_.size() == 2)
+      resp_codec::bulk(out_, args_[1].text);
+    else
+      resp_codec::simple(out_, "PONG");
+  });
+  command("ECHO", 2,
+          [](const std::vector<resp_value> &args_, encode_buffer &out_) {
+            resp_codec::bulk(out_, args_[1].text);
+          });
+  // clients ask for documentation of commands, there is none
+  command("COMMAND", -1,
+          [](const std::vector<resp_value> &, encode_buffer &out_) {
+            resp_codec::array(out_, 0);
+          });
+}
+
+resp_server &resp_server::command(const std::string &name_, int arity_,
+                                  command_f handler_) {
+  if (name_.empty() || (name_.size() > max_command_name) || (arity_ == 0))
+    throw std::invalid_argument("resp_server: bad command " + name_);
+  _commands[upper(name_)] = command_t{arity_, std::move(handler_)};
+  return *this;
+}
+
+resp_server &resp_server::listen(unsigned int port_, char const *addr_) {
+  _server.listen(port_, addr_);
+  return *this;
+}
+
+void resp_server::_serve(socket &s_) {
+  struct connection_t {
+    decoder<resp_codec> in;
+    bool closing = false;
+  };
+  auto connection = std::make_shared<connection_t>();
+  s_.on(DATA, std::function<void(std::string_view)>(
+                  [this, &s_, connection](std::string_view data_) {
+                    if (connection->closing)
+                      return;
+                    encode_buffer out;
+                    try {
+                      connection->in.feed(
+                          data_.data(), data_.size(), [&](resp_value &c) {
+                            if (!connection->closing)
+                              connection->closing = !_execute(c, out);
+                          });
+                    } catch (const codec_error &e) {
+                      resp_codec::error(out, std::string("ERR Protocol "
+                                                         "error: ") +
+                                                 e.what());
+                      connection->closing = true;
+                    }
+                    if (out.size())
+                      s_.write(out.take());
+                    if (connection->closing)
+                      s_.end();
+                  }));
+}
+
+bool resp_server::_execute(const resp_value &command_, encode_buffer &out_) {
+  if (command_.type != resp_type::ARRAY) {
+    resp_codec::error(out_, "ERR Protocol error: expected array");
+    return false;
+  }
+  auto &args = command_.elements;
+  // empty inline command
+  if (args.empty())
+    return true;
+  for (auto &a : args)
+    if (a.type != resp_type::BULK) {
+      resp_codec::error(out_, "ERR Protocol error: expected bulk string");
+      return false;
+    }
+  std::string_view name = args[0].text;
+  char name_buf[max_command_name];
+  if (name.size() <= max_command_name) {
+    for (std::size_t i = 0; i < name.size(); i++)
+      name_buf[i] = std::toupper((unsigned char)name[i]);
+    std::string_view key(name_buf, name.size());
+    if (key == "QUIT") {
+      resp_codec::simple(out_, "OK");
+      return false;
+    }
+    auto found = _commands.find(key);
+    if (found != _commands.end()) {
+      int arity = found->second.arity;
+      if ((arity > 0) ? (args.size() != (std::size_t)arity)
+                      : (args.size() < (std::size_t)-arity)) {
+        std::string err = "ERR wrong number of arguments for '";
+        err += name;
+        err += "' command";
+        resp_codec::error(out_, err);
+        return true;
+      }
+      found->second.handler(args, out_);
+      return true;
+    }
+  }
+  std::string err = "ERR unknown command '";
+  err += name.substr(0, 128);
+  err += "'";
+  resp_codec::error(out_, err);
+  return true;
+}
+
+} // namespace net
+} // namespace tp
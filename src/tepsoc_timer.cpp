@@ -0,0 +1,243 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include <tepsoc_timer.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace tp {
+namespace net {
+
+timer_wheel::timer_wheel(std::uint64_t now_)
+    : _free(nil), _now(now_), _count(0) {
+  for (std::uint32_t l = 0; l < lists; l++)
+    _heads[l] = _tails[l] = nil;
+  memset(_occupied, 0, sizeof(_occupied));
+}
+
+timer_wheel::node_t *timer_wheel::_find(timer_id id_) {
+  std::uint32_t i = (std::uint32_t)id_;
+  if ((i >= _nodes.size()) || (_nodes[i].generation != (id_ >> 32)) ||
+      (_nodes[i].list == nil))
+    return nullptr;
+  return &_nodes[i];
+}
+
+void timer_wheel::_link(std::uint32_t i, std::uint32_t list) {
+  node_t &n = _nodes[i];
+  n.list = list;
+  n.next = nil;
+  n.prev = _tails[list];
+  if (n.prev == nil)
+    _heads[list] = i;
+  else
+    _nodes[n.prev].next = i;
+  _tails[list] = i;
+  if (list < expired_list)
+    _occupied[list / slots][(list % slots) / 64] |= 1ull << (list % 64);
+}
+
+void timer_wheel::_unlink(std::uint32_t i) {
+  node_t &n = _nodes[i];
+  if (n.prev == nil)
+    _heads[n.list] = n.next;
+  else
+    _nodes[n.prev].next = n.next;
+  if (n.next == nil)
+    _tails[n.list] = n.prev;
+  else
+    _nodes[n.next].prev = n.prev;
+  if ((n.list < expired_list) && (_heads[n.list] == nil))
+    _occupied[n.list / slots][(n.list % slots) / 64] &=
+        ~(1ull << (n.list % 64));
+}
+
+void timer_wheel::_insert(std::uint32_t i) {
+  std::uint64_t e = _nodes[i].expires;
+  if (e <= _now) {
+    _link(i, expired_list);
+    return;
+  }
+  // the lowest level where the timer falls into the current rotation of the
+  // level above, so it is cascaded before it expires
+  for (unsigned l = 0; l < levels; l++) {
+    unsigned shift = slot_bits * (l + 1);
+    if ((e >> shift) == (_now >> shift)) {
+      _link(i, l * slots + ((e >> (slot_bits * l)) & (slots - 1)));
+      return;
+    }
+  }
+  _link(i, overflow_list);
+}
+
+void timer_wheel::_release(std::uint32_t i) {
+  node_t &n = _nodes[i];
+  n.list = nil;
+  n.callback.reset();
+  n.generation++;
+  n.next = _free;
+  _free = i;
+  _count--;
+}
+
+void timer_wheel::_reinsert_list(std::uint32_t list) {
+  std::uint32_t i = _heads[list];
+  _heads[list] = _tails[list] = nil;
+  if (list < expired_list)
+    _occupied[list / slots][(list % slots) / 64] &= ~(1ull << (list % 64));
+  while (i != nil) {
+    std::uint32_t next = _nodes[i].next;
+    _insert(i);
+    i = next;
+  }
+}
+
+int timer_wheel::_next_occupied(unsigned level, unsigned from) const {
+  for (unsigned w = from / 64; w < slots / 64; w++) {
+    std::uint64_t bits = _occupied[level][w];
+    if (w == from / 64)
+      bits &= ~0ull << (from % 64);
+    if (bits)
+      return w * 64 + __builtin_ctzll(bits);
+  }
+  return -1;
+}
+
+timer_id timer_wheel::add(std::uint64_t delay_, std::uint64_t period_,
+                          callback_f callback_) {
+  std::uint32_t i;
+  if (_free != nil) {
+    i = _free;
+    _free = _nodes[i].next;
+  } else {
+    i = (std::uint32_t)_nodes.size();
+    _nodes.push_back({0, 0, nil, nil, nil, 1, nullptr});
+  }
+  node_t &n = _nodes[i];
+  n.expires = _now + delay_;
+  n.period = period_;
+  n.callback = std::make_shared<callback_f>(std::move(callback_));
+  _count++;
+  _insert(i);
+  return ((timer_id)n.generation << 32) | i;
+}
+
+bool timer_wheel::cancel(timer_id id_) {
+  node_t *n = _find(id_);
+  if (!n)
+    return false;
+  std::uint32_t i = (std::uint32_t)id_;
+  _unlink(i);
+  _release(i);
+  return true;
+}
+
+bool timer_wheel::restart(timer_id id_, std::uint64_t delay_) {
+  node_t *n = _find(id_);
+  if (!n)
+    return false;
+  std::uint32_t i = (std::uint32_t)id_;
+  _unlink(i);
+  n->expires = _now + delay_;
+  _insert(i);
+  return true;
+}
+
+std::uint64_t timer_wheel::_next_event() const {
+  // the first occupied slot above the current one, on the lowest level that
+  // has any. Empty rotations of the lower levels are skipped.
+  for (unsigned l = 0; l < levels; l++) {
+    unsigned shift = slot_bits * l;
+    int s = _next_occupied(l, ((_now >> shift) & (slots - 1)) + 1);
+    if (s >= 0)
+      return ((_now >> (shift + slot_bits)) << (shift + slot_bits)) |
+             ((std::uint64_t)s << shift);
+  }
+  if (_heads[overflow_list] != nil)
+    return (_now | ((1ull << (slot_bits * levels)) - 1)) + 1;
+  return 0;
+}
+
+void timer_wheel::advance(std::uint64_t now_) {
+  while (_now < now_) {
+    // jump to the time when the next slot expires or is cascaded
+    std::uint64_t next = _next_event();
+    if (next == 0)
+      next = now_;
+    if (next > now_) {
+      _now = now_;
+      break;
+    }
+    _now = next;
+    if ((_now & (slots - 1)) == 0) {
+      // cascade from the highest level whose rotation ends now
+      unsigned top = 1;
+      while ((top < levels) &&
+             (((_now >> (slot_bits * top)) & (slots - 1)) == 0))
+        top++;
+      if (top == levels)
+        _reinsert_list(overflow_list);
+      for (unsigned l = std::min(top, levels - 1); l >= 1; l--)
+        _reinsert_list(l * slots + ((_now >> (slot_bits * l)) & (slots - 1)));
+    }
+    std::uint32_t slot = _now & (slots - 1);
+    std::uint32_t i = _heads[slot];
+    _heads[slot] = _tails[slot] = nil;
+    _occupied[0][slot / 64] &= ~(1ull << (slot % 64));
+    while (i != nil) {
+      std::uint32_t next_node = _nodes[i].next;
+      _link(i, expired_list);
+      i = next_node;
+    }
+  }
+}
+
+std::shared_ptr<timer_wheel::callback_f> timer_wheel::pop_expired() {
+  std::uint32_t i = _heads[expired_list];
+  if (i == nil)
+    return nullptr;
+  _unlink(i);
+  node_t &n = _nodes[i];
+  auto callback = n.callback;
+  if (n.period) {
+    n.expires = _now + n.period;
+    _insert(i);
+  } else {
+    _release(i);
+  }
+  return callback;
+}
+
+std::int64_t timer_wheel::ticks_to_next() const {
+  if (_heads[expired_list] != nil)
+    return 0;
+  if (_count == 0)
+    return -1;
+  return _next_event() - _now;
+}
+
+} // namespace net
+} // namespace tp
@@ -0,0 +1,401 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include <tepsoc_tls.hpp>
+
+#include "tepsoc_tls_session.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef TEPSOC_TLS
+#include <arpa/inet.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+namespace tp {
+namespace net {
+
+#ifdef TEPSOC_TLS
+
+/**
+ * the oldest error from OpenSSL queue, and clear the queue
+ * */
+static std::string ssl_error_string(const std::string &what) {
+  unsigned long e = ERR_get_error();
+  ERR_clear_error();
+  if (e == 0)
+    return what;
+  char buf[256];
+  ERR_error_string_n(e, buf, sizeof(buf));
+  return what + ": " + buf;
+}
+
+tls_context::tls_context(bool server_, const tls_config &config_) {
+  _server = server_;
+  _cache_size = config_.session_cache_size;
+  _ctx = SSL_CTX_new(server_ ? TLS_server_method() : TLS_client_method());
+  if (_ctx == nullptr)
+    throw std::runtime_error(ssl_error_string("SSL_CTX_new"));
+  SSL_CTX_set_app_data(_ctx, this);
+  SSL_CTX_set_min_proto_version(_ctx, TLS1_2_VERSION);
+  // peer closing without close_notify is the end of stream, like for TCP
+  SSL_CTX_set_options(_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#ifdef SSL_OP_ENABLE_KTLS
+  if (config_.ktls)
+    SSL_CTX_set_options(_ctx, SSL_OP_ENABLE_KTLS);
+#endif
+  // queued data is written from its queue entry, which may move
+  SSL_CTX_set_mode(_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                             SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+  try {
+    if (config_.certificate_file.size() &&
+        (SSL_CTX_use_certificate_chain_file(
+             _ctx, config_.certificate_file.c_str()) != 1))
+      throw std::invalid_argument(
+          ssl_error_string("certificate " + config_.certificate_file));
+    if (config_.private_key_file.size() &&
+        ((SSL_CTX_use_PrivateKey_file(_ctx, config_.private_key_file.c_str(),
+                                      SSL_FILETYPE_PEM) != 1) ||
+         (SSL_CTX_check_private_key(_ctx) != 1)))
+      throw std::invalid_argument(
+          ssl_error_string("private key " + config_.private_key_file));
+    if (server_ && (config_.certificate_file.empty() ||
+                    config_.private_key_file.empty()))
+      throw std::invalid_argument("TLS server needs certificate and key");
+    if (config_.ca_file.size()) {
+      if (SSL_CTX_load_verify_locations(_ctx, config_.ca_file.c_str(),
+                                        nullptr) != 1)
+        throw std::invalid_argument(
+            ssl_error_string("CA file " + config_.ca_file));
+    } else {
+      SSL_CTX_set_default_verify_paths(_ctx);
+    }
+    for (auto &protocol : config_.alpn) {
+      if (protocol.empty() || (protocol.size() > 255))
+        throw std::invalid_argument("bad ALPN protocol: " + protocol);
+      _alpn.push_back((unsigned char)protocol.size());
+      _alpn.insert(_alpn.end(), protocol.begin(), protocol.end());
+    }
+  } catch (...) {
+    SSL_CTX_free(_ctx);
+    throw;
+  }
+
+  if (server_) {
+    if (config_.require_client_certificate)
+      SSL_CTX_set_verify(
+          _ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+    if (_cache_size) {
+      static const unsigned char id_context[] = "tepsoc";
+      SSL_CTX_set_session_id_context(_ctx, id_context, sizeof(id_context) - 1);
+      SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_SERVER);
+      SSL_CTX_sess_set_cache_size(_ctx, (long)_cache_size);
+    } else {
+      SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_OFF);
+      SSL_CTX_set_options(_ctx, SSL_OP_NO_TICKET);
+      SSL_CTX_set_num_tickets(_ctx, 0);
+    }
+    if (_alpn.size())
+      SSL_CTX_set_alpn_select_cb(
+          _ctx,
+          [](SSL *, const unsigned char **out, unsigned char *outlen,
+             const unsigned char *in, unsigned int inlen, void *arg) -> int {
+            auto self = (tls_context *)arg;
+            // the first protocol of server that client offers
+            if (SSL_select_next_proto((unsigned char **)out, outlen,
+                                      self->_alpn.data(), self->_alpn.size(),
+                                      in, inlen) != OPENSSL_NPN_NEGOTIATED)
+              return SSL_TLSEXT_ERR_NOACK;
+            return SSL_TLSEXT_ERR_OK;
+          },
+          this);
+  } else {
+    SSL_CTX_set_verify(_ctx,
+                       config_.verify_peer ? SSL_VERIFY_PEER : SSL_VERIFY_NONE,
+                       nullptr);
+    if (_alpn.size())
+      SSL_CTX_set_alpn_protos(_ctx, _alpn.data(), _alpn.size());
+    if (_cache_size) {
+      // sessions are kept by server name, not by OpenSSL internal cache
+      SSL_CTX_set_session_cache_mode(
+          _ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(_ctx, [](SSL *ssl, SSL_SESSION *session) -> int {
+        auto self = (tls_context *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+        auto name = (const std::string *)SSL_get_app_data(ssl);
+        if ((name == nullptr) || name->empty())
+          return 0;
+        self->put_session(*name, session);
+        return 1;
+      });
+    }
+  }
+}
+
+tls_context::~tls_context() {
+  for (auto &[name, session] : _sessions)
+    SSL_SESSION_free(session);
+  SSL_CTX_free(_ctx);
+}
+
+ssl_session_st *tls_context::get_session(const std::string &name_) {
+  std::lock_guard<std::mutex> lock(_sessions_mutex);
+  for (auto i = _sessions.begin(); i != _sessions.end(); i++) {
+    if (i->first == name_) {
+      // tickets should be used once, the server sends new ones
+      auto session = i->second;
+      _sessions.erase(i);
+      return session;
+    }
+  }
+  return nullptr;
+}
+
+void tls_context::put_session(const std::string &name_,
+                              ssl_session_st *session_) {
+  std::lock_guard<std::mutex> lock(_sessions_mutex);
+  for (auto i = _sessions.begin(); i != _sessions.end(); i++) {
+    if (i->first == name_) {
+      SSL_SESSION_free(i->second);
+      _sessions.erase(i);
+      break;
+    }
+  }
+  _sessions.emplace_front(name_, session_);
+  while (_sessions.size() > _cache_size) {
+    SSL_SESSION_free(_sessions.back().second);
+    _sessions.pop_back();
+  }
+}
+
+std::unique_ptr<tls_session>
+tls_session::create(std::shared_ptr<tls_context> context_, int fd_,
+                    const std::string &server_name_) {
+  std::unique_ptr<tls_session> s(new tls_session());
+  s->_context = context_;
+  s->_server_name = server_name_;
+  ERR_clear_error();
+  s->_ssl = SSL_new(context_->native_handle());
+  if ((s->_ssl == nullptr) || (SSL_set_fd(s->_ssl, fd_) != 1)) {
+    s->_failed = true;
+    s->_error = ssl_error_string("tls");
+    return s;
+  }
+  // the name is the key of client session cache
+  SSL_set_app_data(s->_ssl, &s->_server_name);
+  if (context_->is_server()) {
+    SSL_set_accept_state(s->_ssl);
+    return s;
+  }
+  SSL_set_connect_state(s->_ssl);
+  if (server_name_.size()) {
+    unsigned char addr[sizeof(struct in6_addr)];
+    if ((inet_pton(AF_INET, server_name_.c_str(), addr) == 1) ||
+        (inet_pton(AF_INET6, server_name_.c_str(), addr) == 1)) {
+      // addresses are not sent as SNI
+      X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(s->_ssl),
+                                    server_name_.c_str());
+    } else {
+      SSL_set_tlsext_host_name(s->_ssl, server_name_.c_str());
+      SSL_set1_host(s->_ssl, server_name_.c_str());
+    }
+    if (auto session = context_->get_session(server_name_)) {
+      SSL_set_session(s->_ssl, session);
+      SSL_SESSION_free(session);
+    }
+  }
+  return s;
+}
+
+tls_session::~tls_session() {
+  if (_ssl == nullptr)
+    return;
+  // OpenSSL removes sessions of connections closed without close_notify from
+  // the cache, which makes the cached ticket of client not resumable
+  if (_established && !_failed)
+    SSL_set_shutdown(_ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+  SSL_free(_ssl);
+}
+
+tls_session::handshake_e tls_session::handshake() {
+  if (_failed)
+    return FAILED;
+  ERR_clear_error();
+  int r = SSL_do_handshake(_ssl);
+  if (r == 1) {
+    _established = true;
+    _want_write = false;
+    return DONE;
+  }
+  int saved_errno = errno;
+  switch (SSL_get_error(_ssl, r)) {
+  case SSL_ERROR_WANT_READ:
+    _want_write = false;
+    return WANT_READ;
+  case SSL_ERROR_WANT_WRITE:
+    _want_write = true;
+    return WANT_WRITE;
+  case SSL_ERROR_SYSCALL:
+    _error = (saved_errno == 0)
+                 ? "tls handshake: connection closed"
+                 : std::string("tls handshake: ") + strerror(saved_errno);
+    ERR_clear_error();
+    break;
+  default:
+    _error = ssl_error_string("tls handshake");
+    if (SSL_get_verify_result(_ssl) != X509_V_OK)
+      _error += std::string(" (") +
+                X509_verify_cert_error_string(SSL_get_verify_result(_ssl)) +
+                ")";
+  }
+  _failed = true;
+  return FAILED;
+}
+
+long tls_session::_result(int ret_, char const *what_) {
+  int saved_errno = errno;
+  switch (SSL_get_error(_ssl, ret_)) {
+  case SSL_ERROR_WANT_READ:
+  case SSL_ERROR_WANT_WRITE:
+    errno = EAGAIN;
+    return -1;
+  case SSL_ERROR_ZERO_RETURN:
+    return 0;
+  case SSL_ERROR_SYSCALL:
+    _failed = true;
+    ERR_clear_error();
+    errno = saved_errno;
+    return (saved_errno == 0) ? 0 : -1;
+  default:
+    _failed = true;
+    _error = ssl_error_string(what_);
+    errno = EPROTO;
+    return -1;
+  }
+}
+
+long tls_session::read(char *buf_, std::size_t size_) {
+  if (_failed) {
+    errno = EPROTO;
+    return -1;
+  }
+  ERR_clear_error();
+  int r = SSL_read(_ssl, buf_, (int)std::min<std::size_t>(size_, INT_MAX));
+  if (r > 0)
+    return r;
+  return _result(r, "SSL_read");
+}
+
+long tls_session::write(const char *data_, std::size_t size_) {
+  if (_failed) {
+    errno = EPIPE;
+    return -1;
+  }
+  ERR_clear_error();
+  int r = SSL_write(_ssl, data_, (int)std::min<std::size_t>(size_, INT_MAX));
+  if (r > 0)
+    return r;
+  return _result(r, "SSL_write");
+}
+
+bool tls_session::has_pending() {
+  return !_failed && (SSL_has_pending(_ssl) == 1);
+}
+
+void tls_session::shutdown() {
+  if (!_established || _failed)
+    return;
+  ERR_clear_error();
+  SSL_shutdown(_ssl);
+  ERR_clear_error();
+}
+
+tls_info tls_session::info() {
+  tls_info i;
+  i.established = _established;
+  if (!_established)
+    return i;
+  i.version = SSL_get_version(_ssl);
+  i.cipher = SSL_get_cipher_name(_ssl);
+  const unsigned char *alpn;
+  unsigned int alpn_len = 0;
+  SSL_get0_alpn_selected(_ssl, &alpn, &alpn_len);
+  i.alpn = std::string((const char *)alpn, alpn_len);
+  i.resumed = SSL_session_reused(_ssl) == 1;
+  i.ktls_send = BIO_get_ktls_send(SSL_get_wbio(_ssl)) == 1;
+  i.ktls_receive = BIO_get_ktls_recv(SSL_get_rbio(_ssl)) == 1;
+  return i;
+}
+
+#else
+
+tls_context::tls_context(bool, const tls_config &) {
+  throw std::runtime_error("tepsoc is built without TLS");
+}
+tls_context::~tls_context() {}
+ssl_session_st *tls_context::get_session(const std::string &) {
+  return nullptr;
+}
+void tls_context::put_session(const std::string &, ssl_session_st *) {}
+
+std::unique_ptr<tls_session> tls_session::create(std::shared_ptr<tls_context>,
+                                                 int, const std::string &) {
+  return nullptr;
+}
+tls_session::~tls_session() {}
+tls_session::handshake_e tls_session::handshake() { return FAILED; }
+long tls_session::read(char *, std::size_t) {
+  errno = EPROTO;
+  return -1;
+}
+long tls_session::write(const char *, std::size_t) {
+  errno = EPIPE;
+  return -1;
+}
+bool tls_session::has_pending() { return false; }
+void tls_session::shutdown() {}
+tls_info tls_session::info() { return tls_info(); }
+
+#endif
+
+std::shared_ptr<tls_context>
+tls_context::create_server(const tls_config &config_) {
+  return std::shared_ptr<tls_context>(new tls_context(true, config_));
+}
+
+std::shared_ptr<tls_context>
+tls_context::create_client(const tls_config &config_) {
+  return std::shared_ptr<tls_context>(new tls_context(false, config_));
+}
+
+} // namespace net
+} // namespace tp
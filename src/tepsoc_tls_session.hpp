@@ -0,0 +1,98 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_TLS_SESSION__HPP___
+#define __TP__NET__TEPSOC_TLS_SESSION__HPP___
+
+#include <tepsoc_tls.hpp>
+
+#include <memory>
+#include <string>
+
+struct ssl_st;
+
+namespace tp {
+namespace net {
+
+/**
+ * TLS on connected non blocking socket. read and write work like recv and
+ * send: -1 with errno EAGAIN when the operation must wait for the socket.
+ * The socket serializes calls with its write mutex.
+ * */
+class tls_session {
+public:
+  enum handshake_e { DONE, WANT_READ, WANT_WRITE, FAILED };
+
+  /**
+   * @return session or nullptr when TLS is not built in
+   * */
+  static std::unique_ptr<tls_session>
+  create(std::shared_ptr<tls_context> context_, int fd_,
+         const std::string &server_name_);
+
+  handshake_e handshake();
+  long read(char *buf_, std::size_t size_);
+  long write(const char *data_, std::size_t size_);
+  /**
+   * decrypted data that was not read yet. Socket is not readable then.
+   * */
+  bool has_pending();
+  /**
+   * the last handshake wants to write
+   * */
+  bool wants_write() const { return _want_write; }
+  /**
+   * send close_notify
+   * */
+  void shutdown();
+  tls_info info();
+  /**
+   * description of the last failure
+   * */
+  std::string error() const { return _error; }
+
+  ~tls_session();
+  tls_session(tls_session const &) = delete;
+  tls_session &operator=(tls_session const &) = delete;
+
+private:
+  tls_session() = default;
+
+  std::shared_ptr<tls_context> _context;
+  ssl_st *_ssl = nullptr;
+  std::string _server_name;
+  bool _want_write = false;
+  bool _established = false;
+  // after fatal error the session must not send close_notify
+  bool _failed = false;
+  std::string _error;
+
+  long _result(int ret_, char const *what_);
+};
+
+} // namespace net
+} // namespace tp
+
+#endif
@@ -0,0 +1,133 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include "tepsoc_trace_span.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace tp {
+namespace net {
+
+#ifdef TEPSOC_TRACE
+
+namespace {
+
+// never destroyed, static loops record spans while the program exits
+std::mutex &rings_mutex() {
+  static std::mutex *m = new std::mutex;
+  return *m;
+}
+
+std::vector<std::shared_ptr<trace_ring>> &rings() {
+  static auto *all = new std::vector<std::shared_ptr<trace_ring>>;
+  return *all;
+}
+
+/**
+ * registers the ring of the thread. The ring can be read after the thread
+ * ends, until the trace is cleared.
+ * */
+struct thread_trace {
+  std::shared_ptr<trace_ring> ring;
+  thread_trace() : ring(std::make_shared<trace_ring>()) {
+    ring->tid = ::syscall(SYS_gettid);
+    std::lock_guard<std::mutex> lock(rings_mutex());
+    rings().push_back(ring);
+  }
+  ~thread_trace() { ring->finished = true; }
+};
+
+} // namespace
+
+trace_ring &this_thread_trace() {
+  thread_local thread_trace t;
+  return *t.ring;
+}
+
+bool trace_enabled() { return true; }
+
+void write_chrome_trace(std::ostream &out_) {
+  // the owner may overwrite the oldest spans while they are read
+  const std::uint64_t margin = 256;
+  std::vector<std::shared_ptr<trace_ring>> all;
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex());
+    all = rings();
+  }
+  long pid = ::getpid();
+  const char *separator = "";
+  char line[256];
+  out_ << "{\"traceEvents\":[";
+  for (auto &r : all) {
+    std::uint64_t head = r->head.load(std::memory_order_acquire);
+    std::uint64_t from = r->cleared.load();
+    if (head - from > trace_ring::capacity - margin)
+      from = head - (trace_ring::capacity - margin);
+    for (std::uint64_t i = from; i < head; i++) {
+      trace_span s = r->spans[i % trace_ring::capacity];
+      std::snprintf(line, sizeof(line),
+                    "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                    "\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld,"
+                    "\"args\":{\"arg\":%ld}}",
+                    separator, s.name, s.begin_ns / 1000.0,
+                    (s.end_ns - s.begin_ns) / 1000.0, pid, r->tid, s.arg);
+      out_ << line;
+      separator = ",";
+    }
+  }
+  out_ << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+void clear_trace() {
+  std::lock_guard<std::mutex> lock(rings_mutex());
+  auto &all = rings();
+  for (auto &r : all)
+    r->cleared = r->head.load();
+  all.erase(std::remove_if(all.begin(), all.end(),
+                           [](auto &r) { return r->finished.load(); }),
+            all.end());
+}
+
+#else
+
+bool trace_enabled() { return false; }
+
+void write_chrome_trace(std::ostream &out_) {
+  out_ << "{\"traceEvents\":[\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+void clear_trace() {}
+
+#endif
+
+} // namespace net
+} // namespace tp
@@ -0,0 +1,117 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_TRACE_SPAN__HPP___
+#define __TP__NET__TEPSOC_TRACE_SPAN__HPP___
+
+#include <tepsoc_trace.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace tp {
+namespace net {
+
+/**
+ * one traced stage. Name is a string literal, arg is the descriptor or the
+ * number of bytes.
+ * */
+struct trace_span {
+  const char *name;
+  std::uint64_t begin_ns;
+  std::uint64_t end_ns;
+  long arg;
+};
+
+/**
+ * spans of one thread. Only the owner writes, readers take the spans below
+ * head and skip these that could have been overwritten meanwhile.
+ * */
+struct trace_ring {
+  static const std::size_t capacity = 8192;
+  std::array<trace_span, capacity> spans;
+  std::atomic<std::uint64_t> head{0};
+  std::atomic<std::uint64_t> cleared{0}; // spans below are forgotten
+  std::atomic<bool> finished{false};     // the thread ended
+  long tid = 0;
+
+  void record(const char *name_, std::uint64_t begin_, std::uint64_t end_,
+              long arg_) {
+    auto h = head.load(std::memory_order_relaxed);
+    spans[h % capacity] = {name_, begin_, end_, arg_};
+    head.store(h + 1, std::memory_order_release);
+  }
+};
+
+/**
+ * ring of the calling thread, created on the first use
+ * */
+trace_ring &this_thread_trace();
+
+inline std::uint64_t trace_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * records the span from construction to destruction
+ * */
+class trace_scope {
+  const char *_name;
+  std::uint64_t _begin;
+
+public:
+  long arg;
+  trace_scope(const char *name_, long arg_ = 0)
+      : _name(name_), _begin(trace_now()), arg(arg_) {}
+  ~trace_scope() { this_thread_trace().record(_name, _begin, trace_now(), arg); }
+};
+
+} // namespace net
+} // namespace tp
+
+#define TEPSOC_TRACE_CAT2(a, b) a##b
+#define TEPSOC_TRACE_CAT(a, b) TEPSOC_TRACE_CAT2(a, b)
+
+/**
+ * TEPSOC_TRACE_SCOPE(name, arg) traces the rest of the block.
+ * TEPSOC_TRACE_NAMED(var, name, arg) does the same, and var.arg can be set
+ * later, for example to the result of the call.
+ * */
+#ifdef TEPSOC_TRACE
+#define TEPSOC_TRACE_SCOPE(name, arg)                                          \
+  tp::net::trace_scope TEPSOC_TRACE_CAT(trace_scope_, __LINE__)(name, arg)
+#define TEPSOC_TRACE_NAMED(var, name, arg) tp::net::trace_scope var(name, arg)
+#define TEPSOC_TRACE_ARG(var, value) (var.arg = (value))
+#else
+#define TEPSOC_TRACE_SCOPE(name, arg)
+#define TEPSOC_TRACE_NAMED(var, name, arg)
+#define TEPSOC_TRACE_ARG(var, value)
+#endif
+
+#endif
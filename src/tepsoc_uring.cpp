@@ -0,0 +1,410 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include "tepsoc_trace_span.hpp"
+#include "tepsoc_uring.hpp"
+
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef TEPSOC_IO_URING
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+namespace tp {
+namespace net {
+
+#ifdef TEPSOC_IO_URING
+
+namespace {
+const unsigned ring_entries = 256;
+const unsigned buffer_count = 512; // must be power of 2
+const unsigned buffer_size = 4096;
+const unsigned short buffer_group = 0;
+
+int io_uring_setup(unsigned entries, io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags, void *arg, std::size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      arg, argsz);
+}
+int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+} // namespace
+
+uring_backend::uring_backend()
+    : _ring_fd(-1), _sq_ptr(MAP_FAILED), _sq_size(0), _sqes_ptr(MAP_FAILED), _sqes_size(0), _to_submit(0),
+      _buf_ring(MAP_FAILED), _buf_ring_size(0), _buf_count(buffer_count),
+      _buf_size(buffer_size), _next_id(1) {}
+
+std::unique_ptr<uring_backend> uring_backend::create() {
+  std::unique_ptr<uring_backend> u(new uring_backend());
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL |
+            IORING_SETUP_COOP_TASKRUN;
+  p.cq_entries = ring_entries * 8; // room for multishot completions
+  u->_ring_fd = io_uring_setup(ring_entries, &p);
+  if (u->_ring_fd < 0)
+    return nullptr;
+  const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                            IORING_FEAT_EXT_ARG | IORING_FEAT_FAST_POLL;
+  if ((p.features & required) != required)
+    return nullptr;
+
+  // one mapping holds both rings (IORING_FEAT_SINGLE_MMAP)
+  u->_sq_size =
+      std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+               p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+  u->_sq_ptr = mmap(0, u->_sq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->_ring_fd, IORING_OFF_SQ_RING);
+  if (u->_sq_ptr == MAP_FAILED)
+    return nullptr;
+  u->_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+  u->_sqes_ptr = mmap(0, u->_sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->_ring_fd, IORING_OFF_SQES);
+  if (u->_sqes_ptr == MAP_FAILED)
+    return nullptr;
+
+  char *sq = (char *)u->_sq_ptr;
+  u->_sq_head = (unsigned *)(sq + p.sq_off.head);
+  u->_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  u->_sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  u->_sq_array = (unsigned *)(sq + p.sq_off.array);
+  u->_cq_head = (unsigned *)(sq + p.cq_off.head);
+  u->_cq_tail = (unsigned *)(sq + p.cq_off.tail);
+  u->_cq_mask = *(unsigned *)(sq + p.cq_off.ring_mask);
+  u->_cqes = sq + p.cq_off.cqes;
+
+  // provided buffer ring for multishot receive
+  u->_buf_ring_size = u->_buf_count * sizeof(io_uring_buf);
+  u->_buf_ring = mmap(0, u->_buf_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (u->_buf_ring == MAP_FAILED)
+    return nullptr;
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long)u->_buf_ring;
+  reg.ring_entries = u->_buf_count;
+  reg.bgid = buffer_group;
+  if (io_uring_register(u->_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    return nullptr;
+  u->_buffers.resize((std::size_t)u->_buf_count * u->_buf_size);
+  for (unsigned i = 0; i < u->_buf_count; i++)
+    u->_recycle_buffer(i);
+
+  // multishot accept and receive are probed by opcode support
+  std::vector<char> probe_mem(sizeof(io_uring_probe) +
+                              256 * sizeof(io_uring_probe_op));
+  io_uring_probe *probe = (io_uring_probe *)probe_mem.data();
+  if (io_uring_register(u->_ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    return nullptr;
+  for (auto opcode : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                      IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL,
+                      IORING_OP_SEND_ZC}) {
+    if ((opcode > probe->last_op) ||
+        !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED))
+      return nullptr; // SEND_ZC marks kernels that have multishot recv
+  }
+  return u;
+}
+
+uring_backend::~uring_backend() {
+  if (_buf_ring != MAP_FAILED)
+    munmap(_buf_ring, _buf_ring_size);
+  if (_sqes_ptr != MAP_FAILED)
+    munmap(_sqes_ptr, _sqes_size);
+  if (_sq_ptr != MAP_FAILED)
+    munmap(_sq_ptr, _sq_size);
+  if (_ring_fd >= 0)
+    ::close(_ring_fd);
+}
+
+void uring_backend::_recycle_buffer(unsigned bid) {
+  io_uring_buf_ring *br = (io_uring_buf_ring *)_buf_ring;
+  unsigned short tail = br->tail;
+  // not br->bufs: the flexible array is shifted by an empty struct in C++
+  io_uring_buf *buf = (io_uring_buf *)_buf_ring + (tail & (_buf_count - 1));
+  buf->addr = (unsigned long)(_buffers.data() + (std::size_t)bid * _buf_size);
+  buf->len = _buf_size;
+  buf->bid = bid;
+  __atomic_store_n(&br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+void *uring_backend::_get_sqe() {
+  unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *_sq_tail;
+  if (tail - head > _sq_mask) {
+    // queue is full, submit what we have so far
+    _enter(_to_submit, 0, 0);
+    head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head > _sq_mask)
+      throw std::runtime_error("io_uring submission queue is full");
+  }
+  unsigned idx = tail & _sq_mask;
+  io_uring_sqe *sqe = (io_uring_sqe *)_sqes_ptr + idx;
+  memset(sqe, 0, sizeof(*sqe));
+  _sq_array[idx] = idx;
+  __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+  _to_submit++;
+  return sqe;
+}
+
+std::uint64_t uring_backend::_add_op(op_t op) {
+  std::uint64_t id = _next_id++;
+  if (op.kind != ONESHOT)
+    _streams.insert({op.fd, id});
+  _ops.emplace(id, std::move(op));
+  return id;
+}
+
+void uring_backend::_submit_accept(int fd, std::uint64_t id) {
+  io_uring_sqe *sqe = (io_uring_sqe *)_get_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = id;
+}
+
+void uring_backend::_submit_recv(int fd, std::uint64_t id) {
+  io_uring_sqe *sqe = (io_uring_sqe *)_get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = buffer_group;
+  sqe->user_data = id;
+}
+
+void uring_backend::accept_stream(int fd, result_callback_f callback_) {
+  _submit_accept(fd, _add_op({fd, ACCEPT,
+                              std::make_shared<result_callback_f>(callback_),
+                              nullptr}));
+}
+
+void uring_backend::recv_stream(int fd, recv_callback_f callback_) {
+  _submit_recv(fd, _add_op({fd, RECV, nullptr,
+                            std::make_shared<recv_callback_f>(callback_)}));
+}
+
+void uring_backend::cancel_streams(int fd) {
+  auto range = _streams.equal_range(fd);
+  for (auto i = range.first; i != range.second; ++i) {
+    if (auto op = _ops.find(i->second); op != _ops.end()) {
+      if (op->second.kind == ACCEPT)
+        _cancelled_accepts.insert(i->second);
+      _ops.erase(op);
+    }
+    io_uring_sqe *sqe = (io_uring_sqe *)_get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = i->second;
+    sqe->user_data = 0; // completion of cancel is ignored
+  }
+  _streams.erase(fd);
+}
+
+void uring_backend::stop_recv(int fd) {
+  auto range = _streams.equal_range(fd);
+  for (auto i = range.first; i != range.second; ++i) {
+    auto op = _ops.find(i->second);
+    if ((op == _ops.end()) || (op->second.kind != RECV) || op->second.stopping)
+      continue;
+    op->second.stopping = true;
+    io_uring_sqe *sqe = (io_uring_sqe *)_get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = i->second;
+    sqe->user_data = 0; // completion of cancel is ignored
+  }
+}
+
+void uring_backend::send(int fd, const char *data, std::size_t size,
+                         result_callback_f callback_) {
+  std::uint64_t id = _add_op(
+      {fd, ONESHOT, std::make_shared<result_callback_f>(callback_), nullptr});
+  io_uring_sqe *sqe = (io_uring_sqe *)_get_sqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long)data;
+  sqe->len = size;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = id;
+}
+
+void uring_backend::poll_once(int fd, unsigned int events,
+                              result_callback_f callback_) {
+  std::uint64_t id = _add_op(
+      {fd, ONESHOT, std::make_shared<result_callback_f>(callback_), nullptr});
+  io_uring_sqe *sqe = (io_uring_sqe *)_get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->user_data = id;
+}
+
+int uring_backend::_enter(unsigned to_submit, unsigned min_complete,
+                          int timeout_ms) {
+  io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  __kernel_timespec ts;
+  if (timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    arg.ts = (unsigned long)&ts;
+  }
+  arg.sigmask_sz = _NSIG / 8;
+  unsigned flags = IORING_ENTER_EXT_ARG;
+  if (min_complete)
+    flags |= IORING_ENTER_GETEVENTS;
+  int ret = io_uring_enter(_ring_fd, to_submit, min_complete, flags, &arg,
+                           sizeof(arg));
+  if (ret > 0)
+    _to_submit -= std::min((unsigned)ret, _to_submit);
+  return ret;
+}
+
+void uring_backend::wait(int timeout_ms) {
+  unsigned head = __atomic_load_n(_cq_head, __ATOMIC_RELAXED);
+  unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+  bool ready = head != tail;
+  int ret = _enter(_to_submit, ready ? 0 : 1, ready ? 0 : timeout_ms);
+  if ((ret < 0) && (errno != ETIME) && (errno != EINTR) && (errno != EBUSY))
+    throw std::runtime_error(std::string("io_uring_enter: ") + strerror(errno));
+}
+
+int uring_backend::process_completions() {
+  int count = 0;
+  unsigned head = __atomic_load_n(_cq_head, __ATOMIC_RELAXED);
+  while (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+    io_uring_cqe cqe = ((io_uring_cqe *)_cqes)[head & _cq_mask];
+    head++;
+    // release the slot before the callback, it may queue new operations
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    count++;
+
+    bool has_buffer = cqe.flags & IORING_CQE_F_BUFFER;
+    unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    auto found = _ops.find(cqe.user_data);
+    if (found == _ops.end()) {
+      // cancelled operation
+      if (has_buffer)
+        _recycle_buffer(bid);
+      if (_cancelled_accepts.count(cqe.user_data)) {
+        // connection accepted before the cancel took effect
+        if (cqe.res >= 0)
+          ::close(cqe.res);
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+          _cancelled_accepts.erase(cqe.user_data);
+      }
+      continue;
+    }
+    TEPSOC_TRACE_SCOPE("uring.completion", cqe.res);
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    op_t &op = found->second;
+    int fd = op.fd;
+    switch (op.kind) {
+    case ONESHOT: {
+      auto cb = std::move(op.on_result);
+      _ops.erase(found);
+      (*cb)(cqe.res);
+    } break;
+    case ACCEPT: {
+      auto cb = op.on_result;
+      if (!more) {
+        if (cqe.res < 0) {
+          _ops.erase(found);
+          _streams.erase(fd);
+        } else {
+          _submit_accept(fd, cqe.user_data); // multishot was stopped
+        }
+      }
+      (*cb)(cqe.res);
+    } break;
+    case RECV: {
+      auto cb = op.on_data;
+      bool stopping = op.stopping;
+      if ((cqe.res == -ENOBUFS) && !stopping) {
+        // all buffers are in use; they are returned right after callbacks
+        _submit_recv(fd, cqe.user_data);
+        break;
+      }
+      if (!more) {
+        if ((cqe.res <= 0) || stopping) {
+          _ops.erase(found);
+          auto range = _streams.equal_range(fd);
+          for (auto i = range.first; i != range.second; ++i)
+            if (i->second == cqe.user_data) {
+              _streams.erase(i);
+              break;
+            }
+        } else {
+          _submit_recv(fd, cqe.user_data);
+        }
+      }
+      if (has_buffer) {
+        (*cb)(_buffers.data() + (std::size_t)bid * _buf_size, cqe.res);
+        _recycle_buffer(bid);
+      } else if (cqe.res != -ENOBUFS) {
+        (*cb)(nullptr, cqe.res);
+      }
+      // the last completion of a stopped stream carried data or nothing
+      if (!more && stopping && ((cqe.res > 0) || (cqe.res == -ENOBUFS)))
+        (*cb)(nullptr, -ECANCELED);
+    } break;
+    }
+  }
+  return count;
+}
+
+#else
+
+std::unique_ptr<uring_backend> uring_backend::create() { return nullptr; }
+uring_backend::uring_backend() {}
+uring_backend::~uring_backend() {}
+void uring_backend::accept_stream(int, result_callback_f) {}
+void uring_backend::recv_stream(int, recv_callback_f) {}
+void uring_backend::cancel_streams(int) {}
+void uring_backend::stop_recv(int) {}
+void uring_backend::send(int, const char *, std::size_t, result_callback_f) {}
+void uring_backend::poll_once(int, unsigned int, result_callback_f) {}
+void uring_backend::wait(int) {}
+int uring_backend::process_completions() { return 0; }
+
+#endif
+
+} // namespace net
+} // namespace tp
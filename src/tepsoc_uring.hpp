@@ -0,0 +1,166 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#ifndef __TP__NET__TEPSOC_URING__HPP___
+#define __TP__NET__TEPSOC_URING__HPP___
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace tp {
+namespace net {
+
+/**
+ * completion based operations on io_uring. It is used by event_loop when the
+ * library is built with TEPSOC_IO_URING and the kernel supports multishot
+ * accept, multishot receive and provided buffer rings.
+ *
+ * Operations are queued and submitted in one batch by wait(). All methods must
+ * be called from the loop thread.
+ * */
+class uring_backend {
+public:
+  /**
+   * data is valid only during the callback. Size 0 means end of stream,
+   * negative size is -errno.
+   * */
+  using recv_callback_f = std::function<void(const char *data, long size)>;
+  /**
+   * result of operation: accepted socket, number of bytes sent, poll events or
+   * -errno
+   * */
+  using result_callback_f = std::function<void(long result)>;
+
+  /**
+   * @return backend or nullptr when io_uring can not be used
+   * */
+  static std::unique_ptr<uring_backend> create();
+
+  /**
+   * accept connections until cancelled. Accepted sockets are non blocking.
+   * */
+  void accept_stream(int fd, result_callback_f callback_);
+  /**
+   * receive into provided buffers until cancelled or end of stream
+   * */
+  void recv_stream(int fd, recv_callback_f callback_);
+  /**
+   * stop accept_stream and recv_stream on fd. Callbacks are not called after
+   * this.
+   * */
+  void cancel_streams(int fd);
+  /**
+   * stop recv_stream on fd. Data received before the cancel takes effect is
+   * still given to the callback, and then it is called with -ECANCELED (or
+   * with the end of stream).
+   * */
+  void stop_recv(int fd);
+  /**
+   * send data. The data must stay valid until callback is called.
+   * */
+  void send(int fd, const char *data, std::size_t size,
+            result_callback_f callback_);
+  /**
+   * wait once for poll events (POLLIN, POLLOUT...)
+   * */
+  void poll_once(int fd, unsigned int events, result_callback_f callback_);
+
+  /**
+   * submit queued operations and wait for at least one completion, but not
+   * longer than timeout_ms (-1 means forever)
+   * */
+  void wait(int timeout_ms);
+  /**
+   * call callbacks for completed operations
+   *
+   * @return number of completions
+   * */
+  int process_completions();
+
+  ~uring_backend();
+
+  uring_backend(uring_backend const &) = delete;
+  uring_backend &operator=(uring_backend const &) = delete;
+
+private:
+  uring_backend();
+
+  enum op_kind_e { ACCEPT, RECV, ONESHOT };
+  struct op_t {
+    int fd;
+    op_kind_e kind;
+    // shared, so the callback can be called while it cancels its own stream
+    std::shared_ptr<result_callback_f> on_result;
+    std::shared_ptr<recv_callback_f> on_data;
+    // receive stream is being cancelled by stop_recv
+    bool stopping = false;
+  };
+
+  int _ring_fd;
+  void *_sq_ptr;
+  std::size_t _sq_size;
+  void *_sqes_ptr;
+  std::size_t _sqes_size;
+
+  unsigned *_sq_head;
+  unsigned *_sq_tail;
+  unsigned _sq_mask;
+  unsigned *_sq_array;
+  unsigned *_cq_head;
+  unsigned *_cq_tail;
+  unsigned _cq_mask;
+  void *_cqes;
+
+  unsigned _to_submit;
+
+  // provided buffers for receive
+  void *_buf_ring;
+  std::size_t _buf_ring_size;
+  std::vector<char> _buffers;
+  unsigned _buf_count;
+  unsigned _buf_size;
+
+  std::uint64_t _next_id;
+  std::unordered_map<std::uint64_t, op_t> _ops;
+  std::unordered_multimap<int, std::uint64_t> _streams;
+  // accepted sockets still arriving for these must be closed
+  std::unordered_set<std::uint64_t> _cancelled_accepts;
+
+  void *_get_sqe();
+  std::uint64_t _add_op(op_t op);
+  void _submit_accept(int fd, std::uint64_t id);
+  void _submit_recv(int fd, std::uint64_t id);
+  void _recycle_buffer(unsigned bid);
+  int _enter(unsigned to_submit, unsigned min_complete, int timeout_ms);
+};
+
+} // namespace net
+} // namespace tp
+
+#endif
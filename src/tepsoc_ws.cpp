@@ -0,0 +1,793 @@
+/**
+MIT License
+
+Copyright (c) 2019 Tadeusz Puźniakowski
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ * */
+
+#include <tepsoc_ws.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace tp {
+namespace net {
+
+namespace {
+
+// longer upgrade requests are refused
+const std::size_t max_request = 8 * 1024;
+// the message buffer is released after longer messages
+const std::size_t kept_message_capacity = 64 * 1024;
+
+const char *ws_guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+std::uint32_t rotl(std::uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+/**
+ * SHA-1 of data, only for the handshake. It does not depend on TLS being
+ * compiled in.
+ * */
+void sha1(std::string_view data, unsigned char digest[20]) {
+  std::uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                        0xC3D2E1F0};
+  std::string msg(data);
+  msg += '\x80';
+  while (msg.size() % 64 != 56)
+    msg += '\0';
+  std::uint64_t bits = (std::uint64_t)data.size() * 8;
+  for (int i = 7; i >= 0; i--)
+    msg += (char)(bits >> (i * 8));
+  for (std::size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+    auto *p = (const unsigned char *)msg.data() + chunk;
+    std::uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+      w[i] = ((std::uint32_t)p[4 * i] << 24) | (p[4 * i + 1] << 16) |
+             (p[4 * i + 2] << 8) | p[4 * i + 3];
+    for (int i = 16; i < 80; i++)
+      w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    std::uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      std::uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      std::uint32_t t = rotl(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotl(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  for (int i = 0; i < 20; i++)
+    digest[i] = h[i / 4] >> (24 - (i % 4) * 8);
+}
+
+std::string base64(const unsigned char *data, std::size_t size) {
+  static const char *chars =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string result;
+  for (std::size_t i = 0; i < size; i += 3) {
+    std::uint32_t v = data[i] << 16;
+    if (i + 1 < size)
+      v |= data[i + 1] << 8;
+    if (i + 2 < size)
+      v |= data[i + 2];
+    result += chars[(v >> 18) & 63];
+    result += chars[(v >> 12) & 63];
+    result += (i + 1 < size) ? chars[(v >> 6) & 63] : '=';
+    result += (i + 2 < size) ? chars[v & 63] : '=';
+  }
+  return result;
+}
+
+bool valid_utf8(std::string_view text) {
+  auto *s = (const unsigned char *)text.data();
+  std::size_t n = text.size();
+  std::size_t i = 0;
+  while (i < n) {
+    // ASCII is checked 8 bytes at a time
+    if (i + 8 <= n) {
+      std::uint64_t w;
+      std::memcpy(&w, s + i, 8);
+      if ((w & 0x8080808080808080ULL) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+    unsigned char c = s[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+    std::size_t len;
+    std::uint32_t cp;
+    if ((c & 0xE0) == 0xC0) {
+      len = 2;
+      cp = c & 0x1F;
+    } else if ((c & 0xF0) == 0xE0) {
+      len = 3;
+      cp = c & 0x0F;
+    } else if ((c & 0xF8) == 0xF0) {
+      len = 4;
+      cp = c & 0x07;
+    } else {
+      return false;
+    }
+    if (i + len > n)
+      return false;
+    for (std::size_t k = 1; k < len; k++) {
+      if ((s[i + k] & 0xC0) != 0x80)
+        return false;
+      cp = (cp << 6) | (s[i + k] & 0x3F);
+    }
+    // overlong forms, surrogates and values above Unicode
+    if (((len == 2) && (cp < 0x80)) || ((len == 3) && (cp < 0x800)) ||
+        ((len == 4) && ((cp < 0x10000) || (cp > 0x10FFFF))) ||
+        ((cp >= 0xD800) && (cp <= 0xDFFF)))
+      return false;
+    i += len;
+  }
+  return true;
+}
+
+/**
+ * status codes a peer may send (RFC 6455 section 7.4)
+ * */
+bool valid_close_code(int code) {
+  if ((code >= 3000) && (code <= 4999))
+    return true;
+  return (code >= 1000) && (code <= 1014) && (code != 1004) &&
+         (code != 1005) && (code != 1006);
+}
+
+// key_ starts at the byte used for the first byte of src_
+using mask_f = void (*)(char *dst_, const char *src_, std::size_t size_,
+                        const unsigned char key_[4]);
+
+void mask_scalar(char *dst_, const char *src_, std::size_t size_,
+                 const unsigned char key_[4]) {
+  unsigned char key8[8];
+  for (int i = 0; i < 8; i++)
+    key8[i] = key_[i & 3];
+  std::uint64_t key;
+  std::memcpy(&key, key8, 8);
+  std::size_t i = 0;
+  for (; i + 8 <= size_; i += 8) {
+    std::uint64_t w;
+    std::memcpy(&w, src_ + i, 8);
+    w ^= key;
+    std::memcpy(dst_ + i, &w, 8);
+  }
+  for (; i < size_; i++)
+    dst_[i] = src_[i] ^ key_[i & 3];
+}
+
+#if defined(__SSE2__)
+void mask_sse2(char *dst_, const char *src_, std::size_t size_,
+               const unsigned char key_[4]) {
+  std::int32_t key32;
+  std::memcpy(&key32, key_, 4);
+  __m128i key = _mm_set1_epi32(key32);
+  std::size_t i = 0;
+  for (; i + 16 <= size_; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src_ + i));
+    _mm_storeu_si128((__m128i *)(dst_ + i), _mm_xor_si128(v, key));
+  }
+  // the key phase does not change after whole vectors
+  mask_scalar(dst_ + i, src_ + i, size_ - i, key_);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2"))) void
+mask_avx2(char *dst_, const char *src_, std::size_t size_,
+          const unsigned char key_[4]) {
+  std::int32_t key32;
+  std::memcpy(&key32, key_, 4);
+  __m256i key = _mm256_set1_epi32(key32);
+  std::size_t i = 0;
+  for (; i + 64 <= size_; i += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(src_ + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src_ + i + 32));
+    _mm256_storeu_si256((__m256i *)(dst_ + i), _mm256_xor_si256(a, key));
+    _mm256_storeu_si256((__m256i *)(dst_ + i + 32), _mm256_xor_si256(b, key));
+  }
+  for (; i + 32 <= size_; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(src_ + i));
+    _mm256_storeu_si256((__m256i *)(dst_ + i), _mm256_xor_si256(a, key));
+  }
+  mask_sse2(dst_ + i, src_ + i, size_ - i, key_);
+}
+#endif
+
+struct mask_implementation_t {
+  mask_f mask;
+  const char *name;
+};
+
+mask_implementation_t select_mask() {
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return {mask_avx2, "avx2"};
+#endif
+#if defined(__SSE2__)
+  return {mask_sse2, "sse2"};
+#else
+  return {mask_scalar, "scalar"};
+#endif
+}
+
+const mask_implementation_t &mask_implementation() {
+  static const mask_implementation_t selected = select_mask();
+  return selected;
+}
+
+std::string lower(std::string_view text) {
+  std::string result(text);
+  for (auto &c : result)
+    c = std::tolower((unsigned char)c);
+  return result;
+}
+
+std::string_view trim(std::string_view text) {
+  while (text.size() && ((text.front() == ' ') || (text.front() == '\t')))
+    text.remove_prefix(1);
+  while (text.size() && ((text.back() == ' ') || (text.back() == '\t')))
+    text.remove_suffix(1);
+  return text;
+}
+
+/**
+ * true when the comma separated list has the token, not case sensitive
+ * */
+bool has_token(const std::string &list, std::string_view token) {
+  std::string_view rest = list;
+  while (rest.size()) {
+    auto comma = rest.find(',');
+    if (lower(trim(rest.substr(0, comma))) == token)
+      return true;
+    if (comma == std::string_view::npos)
+      break;
+    rest.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+/**
+ * status and reason, as the payload of close frame
+ * */
+std::string close_payload(int code, std::string_view reason) {
+  std::string payload;
+  payload += (char)(code >> 8);
+  payload += (char)code;
+  // control frames have at most 125 bytes
+  payload += reason.substr(0, 123);
+  return payload;
+}
+
+} // namespace
+
+void websocket_mask(char *dst_, const char *src_, std::size_t size_,
+                    const unsigned char key_[4], std::size_t offset_) {
+  unsigned char key[4];
+  for (int i = 0; i < 4; i++)
+    key[i] = key_[(offset_ + i) & 3];
+  mask_implementation().mask(dst_, src_, size_, key);
+}
+
+const char *websocket_mask_implementation() {
+  return mask_implementation().name;
+}
+
+std::string websocket_accept_key(std::string_view key_) {
+  std::string text(key_);
+  text += ws_guid;
+  unsigned char digest[20];
+  sha1(text, digest);
+  return base64(digest, sizeof(digest));
+}
+
+std::size_t ws_frame_codec::decode(const char *data_, std::size_t size_,
+                                   message &message_) const {
+  if (size_ < 2)
+    return 0;
+  auto *d = (const unsigned char *)data_;
+  message_.fin = d[0] & 0x80;
+  message_.rsv = (d[0] >> 4) & 7;
+  message_.opcode = (ws_opcode)(d[0] & 0x0F);
+  message_.masked = d[1] & 0x80;
+  std::uint64_t length = d[1] & 0x7F;
+  std::size_t pos = 2;
+  if (length == 126) {
+    if (size_ < 4)
+      return 0;
+    length = (d[2] << 8) | d[3];
+    pos = 4;
+  } else if (length == 127) {
+    if (size_ < 10)
+      return 0;
+    length = 0;
+    for (int i = 0; i < 8; i++)
+      length = (length << 8) | d[2 + i];
+    if (length >> 63)
+      throw codec_error("frame length has the most significant bit set");
+    pos = 10;
+  }
+  if (length > max_payload)
+    throw ws_frame_too_big("frame is longer than " +
+                           std::to_string(max_payload) + " bytes");
+  if (message_.masked) {
+    if (size_ < pos + 4)
+      return 0;
+    std::memcpy(message_.mask, d + pos, 4);
+    pos += 4;
+  }
+  if (size_ - pos < length)
+    return 0;
+  message_.payload = std::string_view(data_ + pos, length);
+  return pos + length;
+}
+
+void ws_frame_codec::encode(const ws_frame &frame_, encode_buffer &out_) const {
+  std::size_t size = frame_.payload.size();
+  char *p = out_.reserve(max_header + 4 + size);
+  std::size_t pos = header(p, frame_.opcode, size, frame_.fin);
+  p[0] |= (frame_.rsv & 7) << 4;
+  if (frame_.masked) {
+    p[1] |= 0x80;
+    std::memcpy(p + pos, frame_.mask, 4);
+    pos += 4;
+    websocket_mask(p + pos, frame_.payload.data(), size, frame_.mask);
+  } else {
+    std::memcpy(p + pos, frame_.payload.data(), size);
+  }
+  out_.commit(pos + size);
+}
+
+std::size_t ws_frame_codec::header(char *out_, ws_opcode opcode_,
+                                   std::size_t size_, bool fin_) {
+  out_[0] = (fin_ ? 0x80 : 0) | opcode_;
+  if (size_ < 126) {
+    out_[1] = size_;
+    return 2;
+  }
+  if (size_ <= 0xFFFF) {
+    out_[1] = 126;
+    out_[2] = size_ >> 8;
+    out_[3] = size_;
+    return 4;
+  }
+  out_[1] = 127;
+  for (int i = 0; i < 8; i++)
+    out_[2 + i] = (std::uint64_t)size_ >> (56 - 8 * i);
+  return 10;
+}
+
+websocket::websocket(socket_p socket_, std::string path_,
+                     std::map<std::string, std::string> headers_,
+                     std::size_t max_message_)
+    : _socket(socket_), _path(std::move(path_)),
+      _headers(std::move(headers_)), _close_sent(false), _closed(false),
+      _in(ws_frame_codec{max_message_}), _message_opcode(WS_TEXT),
+      _in_message(false) {}
+
+websocket &websocket::on_message(message_f handler_) {
+  _on_message = std::move(handler_);
+  return *this;
+}
+
+websocket &websocket::on_close(close_f handler_) {
+  _on_close = std::move(handler_);
+  return *this;
+}
+
+websocket &websocket::send(std::string_view text_) {
+  return send(WS_TEXT, text_);
+}
+
+websocket &websocket::send(ws_opcode opcode_, std::string_view data_) {
+  _send_frame(opcode_, data_);
+  return *this;
+}
+
+websocket &websocket::send(ws_opcode opcode_, shared_buffer data_) {
+  if (!data_)
+    return *this;
+  auto s = _socket.lock();
+  if (!s)
+    return *this;
+  std::string header(ws_frame_codec::max_header, '\0');
+  header.resize(ws_frame_codec::header(header.data(), opcode_, data_->size()));
+  std::lock_guard<std::mutex> lock(_send_mutex);
+  if (!_close_sent)
+    s->write(owned_buffer(std::move(header)), owned_buffer(std::move(data_)));
+  return *this;
+}
+
+websocket &websocket::ping(std::string_view data_) {
+  return send(WS_PING, data_.substr(0, 125));
+}
+
+websocket &websocket::close(int code_, std::string_view reason_) {
+  _send_frame(WS_CLOSE, close_payload(code_, reason_));
+  return *this;
+}
+
+std::string websocket::get_header(const std::string &name_) const {
+  auto found = _headers.find(name_);
+  return found == _headers.end() ? std::string() : found->second;
+}
+
+void websocket::_send_frame(ws_opcode opcode_, std::string_view data_) {
+  std::lock_guard<std::mutex> lock(_send_mutex);
+  if (_close_sent)
+    return;
+  if (opcode_ == WS_CLOSE)
+    _close_sent = true;
+  auto s = _socket.lock();
+  if (!s)
+    return;
+  // header and small payload in one buffer, one send
+  encode_buffer out;
+  ws_frame frame;
+  frame.opcode = opcode_;
+  frame.payload = data_;
+  _in.codec().encode(frame, out);
+  s->write(out.take());
+}
+
+bool websocket::_send_encoded(shared_buffer frame_) {
+  auto s = _socket.lock();
+  if (!s)
+    return false;
+  std::lock_guard<std::mutex> lock(_send_mutex);
+  if (_close_sent)
+    return false;
+  s->write(std::move(frame_));
+  return true;
+}
+
+void websocket::_on_data(const char *data_, std::size_t size_) {
+  if (_closed)
+    return;
+  try {
+    _in.feed(data_, size_, [this](ws_frame &frame_) {
+      if (!_closed)
+        _on_frame(frame_);
+    });
+  } catch (const ws_frame_too_big &) {
+    _fail(1009, "message too big");
+  } catch (const codec_error &e) {
+    _fail(1002, e.what());
+  }
+}
+
+void websocket::_on_frame(ws_frame &frame_) {
+  if (!frame_.masked)
+    return _fail(1002, "client frame is not masked");
+  if (frame_.rsv)
+    return _fail(1002, "reserved bits are set");
+  auto payload = frame_.payload;
+  if (frame_.opcode >= WS_CLOSE) {
+    if (frame_.opcode > WS_PONG)
+      return _fail(1002, "unknown opcode");
+    if (!frame_.fin || (payload.size() > 125))
+      return _fail(1002, "control frame is fragmented or too long");
+    _control.resize(payload.size());
+    websocket_mask(_control.data(), payload.data(), payload.size(),
+                   frame_.mask);
+    if (frame_.opcode == WS_PING)
+      return _send_frame(WS_PONG, _control);
+    if (frame_.opcode == WS_PONG)
+      return;
+    int code = 1005;
+    std::string_view reason;
+    if (_control.size() == 1)
+      return _fail(1002, "close frame with one byte");
+    if (_control.size() >= 2) {
+      code = ((unsigned char)_control[0] << 8) | (unsigned char)_control[1];
+      reason = std::string_view(_control).substr(2);
+      if (!valid_close_code(code))
+        return _fail(1002, "bad close status");
+      if (!valid_utf8(reason))
+        return _fail(1007, "close reason is not UTF-8");
+    }
+    // the status is echoed, then the connection is done
+    _send_frame(WS_CLOSE,
+                code == 1005 ? std::string() : close_payload(code, ""));
+    return _finish(code, reason);
+  }
+  if (frame_.opcode == WS_CONTINUATION) {
+    if (!_in_message)
+      return _fail(1002, "continuation without message");
+  } else if ((frame_.opcode == WS_TEXT) || (frame_.opcode == WS_BINARY)) {
+    if (_in_message)
+      return _fail(1002, "previous message is not finished");
+    _in_message = true;
+    _message_opcode = frame_.opcode;
+    _message.clear();
+  } else {
+    return _fail(1002, "unknown opcode");
+  }
+  if (_message.size() + payload.size() > _in.codec().max_payload)
+    return _fail(1009, "message too big");
+  std::size_t old_size = _message.size();
+  _message.resize(old_size + payload.size());
+  websocket_mask(_message.data() + old_size, payload.data(), payload.size(),
+                 frame_.mask);
+  if (!frame_.fin)
+    return;
+  _in_message = false;
+  if ((_message_opcode == WS_TEXT) && !valid_utf8(_message))
+    return _fail(1007, "text is not UTF-8");
+  if (_on_message)
+    _on_message(_message_opcode, _message);
+  if (_message.capacity() > kept_message_capacity)
+    std::string().swap(_message);
+}
+
+void websocket::_on_end() {
+  if (!_closed)
+    _finish(1006, "");
+}
+
+void websocket::_fail(int code_, std::string_view reason_) {
+  _send_frame(WS_CLOSE, close_payload(code_, reason_));
+  _finish(code_, reason_);
+}
+
+void websocket::_finish(int code_, std::string_view reason_) {
+  _closed = true;
+  if (auto s = _socket.lock())
+    s->end();
+  if (_on_close) {
+    auto handler = std::move(_on_close);
+    _on_close = nullptr;
+    handler(code_, reason_);
+  }
+}
+
+websocket_server::websocket_server(connection_f on_connection_)
+    : websocket_server(event_loop::get_default(), std::move(on_connection_)) {}
+
+websocket_server::websocket_server(event_loop &loop_,
+                                   connection_f on_connection_)
+    : _on_connection(std::move(on_connection_)),
+      _max_message(16 * 1024 * 1024), _server(loop_) {
+  _server.on(LISTENING, []() {});
+  _server.on(CONNECTION, std::function<void(socket_p)>(
+                             [this](socket_p s_) { _serve(s_); }));
+}
+
+websocket_server &websocket_server::listen(unsigned int port_,
+                                           char const *addr_) {
+  _server.listen(port_, addr_);
+  return *this;
+}
+
+websocket_server &websocket_server::set_max_message(std::size_t bytes_) {
+  _max_message = bytes_;
+  return *this;
+}
+
+broadcast_result
+websocket_server::broadcast(ws_opcode opcode_, std::string_view data_,
+                            std::function<bool(websocket &)> filter_,
+                            std::size_t max_queued_) {
+  std::vector<std::shared_ptr<websocket>> targets;
+  {
+    std::lock_guard<std::mutex> lock(_websockets_mutex);
+    targets.reserve(_websockets.size());
+    for (auto &w : _websockets)
+      if (auto ws = w.lock())
+        targets.push_back(std::move(ws));
+    _prune();
+  }
+  // encoded once, every socket queues the same bytes
+  auto frame = std::make_shared<std::vector<char>>(ws_frame_codec::max_header +
+                                                   data_.size());
+  std::size_t header =
+      ws_frame_codec::header(frame->data(), opcode_, data_.size());
+  std::memcpy(frame->data() + header, data_.data(), data_.size());
+  frame->resize(header + data_.size());
+  shared_buffer shared = std::move(frame);
+  broadcast_result result;
+  for (auto &ws : targets) {
+    if (!ws->is_open() || (filter_ && !filter_(*ws)))
+      continue;
+    auto s = ws->get_socket();
+    if (!s)
+      continue;
+    if (max_queued_ && (s->get_queued_bytes() > max_queued_)) {
+      result.skipped++;
+      continue;
+    }
+    // checked against the close frame under the websocket's lock
+    if (ws->_send_encoded(shared))
+      result.sent++;
+  }
+  return result;
+}
+
+std::size_t websocket_server::size() {
+  std::lock_guard<std::mutex> lock(_websockets_mutex);
+  _prune();
+  std::size_t open = 0;
+  for (auto &w : _websockets)
+    if (auto ws = w.lock())
+      open += ws->is_open();
+  return open;
+}
+
+void websocket_server::_prune() {
+  // forget the closed ones
+  _websockets.erase(std::remove_if(_websockets.begin(), _websockets.end(),
+                                   [](const std::weak_ptr<websocket> &w) {
+                                     return w.expired();
+                                   }),
+                    _websockets.end());
+}
+
+void websocket_server::_serve(socket_p s_) {
+  struct connection_t {
+    std::string request;
+    std::shared_ptr<websocket> ws;
+    bool refused = false;
+  };
+  auto connection = std::make_shared<connection_t>();
+  std::weak_ptr<socket> weak = s_;
+  socket &s = *s_;
+  s.on(DATA, std::function<void(std::string_view)>(
+                 [this, &s, weak, connection](std::string_view data_) {
+                   if (connection->ws) {
+                     connection->ws->_on_data(data_.data(), data_.size());
+                     return;
+                   }
+                   if (connection->refused)
+                     return;
+                   auto &request = connection->request;
+                   request.append(data_);
+                   auto end = request.find("\r\n\r\n");
+                   if (end == std::string::npos) {
+                     if (request.size() > max_request) {
+                       connection->refused = true;
+                       s.end("HTTP/1.1 431 Request Header Fields Too "
+                             "Large\r\nConnection: close\r\n"
+                             "Content-Length: 0\r\n\r\n");
+                     }
+                     return;
+                   }
+                   auto owner = weak.lock();
+                   if (owner)
+                     connection->ws = _upgrade(
+                         owner, std::string_view(request).substr(0, end));
+                   if (!connection->ws) {
+                     connection->refused = true;
+                     return;
+                   }
+                   // frames sent right after the request
+                   std::string rest = request.substr(end + 4);
+                   std::string().swap(request);
+                   if (_on_connection)
+                     _on_connection(*connection->ws);
+                   if (rest.size())
+                     connection->ws->_on_data(rest.data(), rest.size());
+                 }));
+  s.on(END, [connection]() {
+    if (connection->ws)
+      connection->ws->_on_end();
+  });
+}
+
+std::shared_ptr<websocket>
+websocket_server::_upgrade(socket_p s_, std::string_view request_) {
+  auto refuse = [&s_](const char *status, const char *extra = "") {
+    std::string response = "HTTP/1.1 ";
+    response += status;
+    response += "\r\nConnection: close\r\nContent-Length: 0\r\n";
+    response += extra;
+    response += "\r\n";
+    s_->end(response);
+    return nullptr;
+  };
+  auto line_end = request_.find("\r\n");
+  std::string_view line = request_.substr(0, line_end);
+  auto first_space = line.find(' ');
+  auto last_space = line.rfind(' ');
+  if ((first_space == std::string_view::npos) || (first_space == last_space))
+    return refuse("400 Bad Request");
+  std::string_view method = line.substr(0, first_space);
+  std::string path(line.substr(first_space + 1, last_space - first_space - 1));
+  std::string_view version = line.substr(last_space + 1);
+  if ((method != "GET") || (version != "HTTP/1.1") || path.empty())
+    return refuse("400 Bad Request");
+  std::map<std::string, std::string> headers;
+  std::string_view rest = line_end == std::string_view::npos
+                              ? std::string_view()
+                              : request_.substr(line_end + 2);
+  while (rest.size()) {
+    auto end = rest.find("\r\n");
+    std::string_view header = rest.substr(0, end);
+    rest = end == std::string_view::npos ? std::string_view()
+                                         : rest.substr(end + 2);
+    auto colon = header.find(':');
+    if (colon == std::string_view::npos)
+      return refuse("400 Bad Request");
+    auto &value = headers[lower(trim(header.substr(0, colon)))];
+    // repeated headers are one list
+    if (value.size())
+      value += ", ";
+    value += trim(header.substr(colon + 1));
+  }
+  if (!has_token(headers["upgrade"], "websocket") ||
+      !has_token(headers["connection"], "upgrade"))
+    return refuse("400 Bad Request");
+  if (headers["sec-websocket-version"] != "13")
+    return refuse("426 Upgrade Required", "Sec-WebSocket-Version: 13\r\n");
+  auto &key = headers["sec-websocket-key"];
+  // base64 of 16 bytes
+  if (key.size() != 24)
+    return refuse("400 Bad Request");
+  std::string response = "HTTP/1.1 101 Switching Protocols\r\n"
+                         "Upgrade: websocket\r\n"
+                         "Connection: Upgrade\r\n"
+                         "Sec-WebSocket-Accept: ";
+  response += websocket_accept_key(key);
+  response += "\r\n\r\n";
+  auto ws = std::make_shared<websocket>(s_, std::move(path), std::move(headers),
+                                        _max_message);
+  // broadcasts that see it are written after the response
+  std::lock_guard<std::mutex> lock(_websockets_mutex);
+  s_->write(std::move(response));
+  // before the vector grows, so a server that never broadcasts keeps at
+  // most twice the open websockets
+  if (_websockets.size() == _websockets.capacity())
+    _prune();
+  _websockets.push_back(ws);
+  return ws;
+}
+
+} // namespace net
+} // namespace tp
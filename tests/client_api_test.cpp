@@ -1,13 +1,14 @@
 #include <tepsoc.hpp>
 
-#include "mock_server.hpp"
+#include "fake_network.hpp"
 
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
-#include <iostream>
+#include <future>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <catch2/catch.hpp>
 
@@ -19,28 +20,14 @@
 using namespace tp;
 using namespace tp::net;
 
-auto barrier = [](int n) {
-  static std::condition_variable barrier_cv;
-  static std::mutex m;
-  static int x = 0;
-  int notif = 0;
-  {
-    std::unique_lock<std::mutex> lk(m);
-    x++;
-    if (x >= n)
-      notif = 1;
-  }
-  if (notif == 1) {
-    barrier_cv.notify_all();
-  } else {
-    std::unique_lock<std::mutex> lk(m);
-    // barrier_cv.wait(lk, [n]() { return x >= n; });
-    if (!(barrier_cv.wait_for(lk, std::chrono::milliseconds(1000),
-                              [n]() { return x >= n; })))
-      throw std::invalid_argument("BARRIER TIMED OUT!");
-    x = 0;
-  }
-};
+/**
+ * the value of the future, or "timeout"
+ * */
+static std::string wait_for(std::future<std::string> f) {
+  if (f.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+    return "timeout";
+  return f.get();
+}
 
 TEST_CASE("create simple socket", "[client]") {
   using namespace tp::net;
@@ -53,252 +40,221 @@ TEST_CASE("create simple socket", "[client]") {
 
 TEST_CASE("create simple connection and handles", "[client]") {
   using namespace tp::net;
-  std::vector<int> lsockets;
-  auto on_listen = [&lsockets](int listening_socket) {
-    lsockets.push_back(listening_socket);
-  };
-  std::vector<std::future<void>> mock_threads;
 
   SECTION("connect to should connect") {
-    bool on_connection_called_back = false;
-    auto on_connection = [&on_connection_called_back](int, char const *,
-                                                      char const *) {
-      on_connection_called_back = true;
-      barrier(2);
-    };
-    mock_threads = mock_server(1337, on_connection, on_listen);
+    std::promise<std::string> accepted;
+    tp::net::server srv([&accepted](tp::net::socket &) {
+      accepted.set_value("accepted");
+    });
+    srv.on(LISTENING, []() {}).listen(7786, "127.0.0.1");
 
     tp::net::socket client;
-    client.connect(1337, "127.0.0.1");
-    barrier(2);
-    for (auto s : lsockets)
-      ::close(s);
-    for (auto &e : mock_threads)
-      e.get();
-
-    REQUIRE(on_connection_called_back);
+    client.connect(7786, "127.0.0.1");
+    REQUIRE(wait_for(accepted.get_future()) == "accepted");
   }
 
   SECTION("connect to should connect and call callback properly") {
-    auto on_connection = [](int, char const *, char const *) { barrier(2); };
-    mock_threads = mock_server(1337, on_connection, on_listen);
-
-    bool callback_called = false;
+    tp::net::server srv([](tp::net::socket &) {});
+    srv.on(LISTENING, []() {}).listen(7787, "127.0.0.1");
 
+    std::promise<std::string> connected;
     tp::net::socket client;
-    client.on(CONNECT, [&callback_called]() { callback_called = true; })
-        .connect(1337, "127.0.0.1");
-
-    barrier(2);
-    for (auto s : lsockets)
-      ::close(s);
-    for (auto &e : mock_threads)
-      e.get();
-    REQUIRE(callback_called);
+    client.on(CONNECT, [&connected]() { connected.set_value("connected"); })
+        .connect(7787, "127.0.0.1");
+    REQUIRE(wait_for(connected.get_future()) == "connected");
   }
 
   SECTION("send data after connection") {
-    std::string ret_val = "";
-    auto on_connection = [&ret_val](int s, char const *, char const *) {
-      char data[100];
-      int size = ::recv(s, data, 100, 0);
-      ret_val = std::string(data, data + size);
-      barrier(2);
-    };
-    mock_threads = mock_server(1337, on_connection, on_listen);
-
-    bool callback_called = false;
-
+    fake_link link;
     tp::net::socket client;
-    client
-        .on(CONNECT, [&callback_called, &client]() { client.write("hello"); })
-        .connect(1337, "127.0.0.1")
-        .on(DATA, [](const std::string) {});
-
-    barrier(2);
-    // std::this_thread::sleep_for(std::chrono::milliseconds(10000));
-    for (auto s : lsockets)
-      ::close(s);
-    for (auto &e : mock_threads)
-      e.get();
-    CHECK(ret_val == "hello");
+    client.on(CONNECT, [&client]() { client.write("hello"); })
+        .on(DATA, [](const std::string) {})
+        .wrap(link.client_end());
+    CHECK(link.take(TO_SERVER, 5) == "hello");
   }
 
   SECTION("recv data after connection") {
-    std::string ret_val = "";
-    auto on_connection = [&ret_val](int s, char const *, char const *) {
-      std::string data = "hello";
-      ::send(s, data.data(), data.size(), 0);
-    };
-    mock_threads = mock_server(1337, on_connection, on_listen);
-
-    bool callback_called = false;
-
+    fake_link link;
+    std::promise<std::string> result;
     tp::net::socket client;
-    client
-        .on(CONNECT, [&callback_called, &client]() {})
-
-        .connect(1337, "127.0.0.1")
-        .on(DATA, [&ret_val](const std::string data) {
-          ret_val = data;
-          barrier(2);
-        });
-
-    barrier(2);
-
-    for (auto s : lsockets)
-      ::close(s);
-    for (auto &e : mock_threads)
-      e.get();
-    CHECK(ret_val == "hello");
+    client.on(DATA, [&result](const std::string data) {
+      result.set_value(data);
+    });
+    client.wrap(link.client_end());
+    REQUIRE(link.inject(TO_CLIENT, "hello"));
+    CHECK(wait_for(result.get_future()) == "hello");
   }
   SECTION("recv data after connection with callback getting socket reference") {
-    std::string ret_val = "";
-    auto on_connection = [&ret_val](int s, char const *, char const *) {
-      std::string data = "hello";
-      ::send(s, data.data(), data.size(), 0);
-    };
-    mock_threads = mock_server(1337, on_connection, on_listen);
-
-    bool callback_called = false;
-
+    fake_link link;
+    std::promise<std::string> result;
     tp::net::socket client;
-    client
-        .on(CONNECT,
-            [&callback_called, &client, &ret_val](tp::net::socket &s) {
-              s.on(DATA, [&ret_val](const std::string data) {
-                ret_val = data;
-                barrier(2);
-              });
-            })
-
-        .connect(1337, "127.0.0.1");
-
-    barrier(2);
-
-    for (auto s : lsockets)
-      ::close(s);
-    for (auto &e : mock_threads)
-      e.get();
-    CHECK(ret_val == "hello");
+    client.on(CONNECT, [&result](tp::net::socket &s) {
+      s.on(DATA, [&result](const std::string data) { result.set_value(data); });
+    });
+    client.wrap(link.client_end());
+    REQUIRE(link.inject(TO_CLIENT, "hello"));
+    CHECK(wait_for(result.get_future()) == "hello");
   }
 
   SECTION("recv data after connection with callback getting socket reference "
           "and recv vector") {
-    std::string ret_val = "";
-    auto on_connection = [&ret_val](int s, char const *, char const *) {
-      std::string data = "hello";
-      ::send(s, data.data(), data.size(), 0);
-    };
-    mock_threads = mock_server(1337, on_connection, on_listen);
-
-    bool callback_called = false;
-
+    fake_link link;
+    std::promise<std::string> result;
     tp::net::socket client;
-    client
-        .on(CONNECT,
-            [&callback_called, &client, &ret_val](tp::net::socket &s) {
-              s.on(DATA, [&ret_val](const std::vector<char> data) {
-                ret_val = std::string(data.begin(), data.end());
-                barrier(2);
-              });
-            })
-
-        .connect(1337, "127.0.0.1");
-
-    barrier(2);
-
-    for (auto s : lsockets)
-      ::close(s);
-    for (auto &e : mock_threads)
-      e.get();
-    CHECK(ret_val == "hello");
+    client.on(CONNECT, [&result](tp::net::socket &s) {
+      s.on(DATA, [&result](const std::vector<char> data) {
+        result.set_value(std::string(data.begin(), data.end()));
+      });
+    });
+    client.wrap(link.client_end());
+    REQUIRE(link.inject(TO_CLIENT, "hello"));
+    CHECK(wait_for(result.get_future()) == "hello");
   }
 
   SECTION("event handler for END event") {
-    std::string ret_val = "";
-    auto on_connection = [&ret_val](int s, char const *, char const *) {
-      std::string data = "hello";
-      ::send(s, data.data(), data.size(), 0);
-      ::shutdown(s, SHUT_WR); // gracefully close connection
-    };
-    mock_threads = mock_server(1337, on_connection, on_listen);
-
-    bool callback_called = false;
-
+    fake_link link;
+    std::string ret_val;
+    std::promise<std::string> ended;
     tp::net::socket client;
-    client.on(END, [&client]() { client.end(); })
-        .on(CONNECT,
-            [&callback_called, &client, &ret_val](tp::net::socket &s) {
-              s.on(DATA, [&ret_val](const std::vector<char> data) {
-                ret_val = std::string(data.begin(), data.end());
-                barrier(2);
-              });
+    client
+        .on(END,
+            [&client, &ended, &ret_val]() {
+              client.end();
+              ended.set_value(ret_val);
             })
-
-        .connect(1337, "127.0.0.1");
-
-    barrier(2);
-
-    for (auto s : lsockets)
-      ::close(s);
-    for (auto &e : mock_threads)
-      e.get();
-    CHECK(ret_val == "hello");
+        .on(CONNECT, [&ret_val](tp::net::socket &s) {
+          s.on(DATA, [&ret_val](const std::vector<char> data) {
+            ret_val = std::string(data.begin(), data.end());
+          });
+        });
+    client.wrap(link.client_end());
+    REQUIRE(link.inject(TO_CLIENT, "hello"));
+    link.end(TO_CLIENT);
+    CHECK(wait_for(ended.get_future()) == "hello");
+    CHECK(link.take(TO_SERVER, 1) == "");
+    CHECK(link.ended(TO_SERVER));
   }
 
   SECTION("event handler for END event and send data to finish") {
-    std::string ret_val = "";
-    std::string ret_val2 = "";
-    auto on_connection = [&ret_val, &ret_val2](int s, char const *,
-                                               char const *) {
-      std::string data = "hello";
-      ::send(s, data.data(), data.size(), 0);
-      ::shutdown(s, SHUT_WR); // gracefully close connection
-      char datac[100];
-      int size = ::recv(s, datac, 100, 0);
-      ret_val2 = std::string(datac, datac + size);
-      barrier(2);
-    };
-    mock_threads = mock_server(1337, on_connection, on_listen);
-
-    bool callback_called = false;
-
+    fake_link link;
+    std::string ret_val;
     tp::net::socket client;
     client.on(END, [&client]() { client.end("bye"); })
-        .on(CONNECT,
-            [&callback_called, &client, &ret_val](tp::net::socket &s) {
-              s.on(DATA, [&ret_val](const std::vector<char> data) {
-                ret_val = std::string(data.begin(), data.end());
-              });
-            })
-
-        .connect(1337, "127.0.0.1");
-
-    barrier(2);
-
-    for (auto s : lsockets)
-      ::close(s);
+        .on(CONNECT, [&ret_val](tp::net::socket &s) {
+          s.on(DATA, [&ret_val](const std::vector<char> data) {
+            ret_val = std::string(data.begin(), data.end());
+          });
+        });
+    client.wrap(link.client_end());
+    REQUIRE(link.inject(TO_CLIENT, "hello"));
+    link.end(TO_CLIENT);
+    CHECK(link.take(TO_SERVER, 100) == "bye");
+    CHECK(link.ended(TO_SERVER));
     CHECK(ret_val == "hello");
-    CHECK(ret_val2 == "bye");
-    for (auto &e : mock_threads)
-      e.get();
   }
 
   SECTION("connect to impossible will produce error") {
-    bool callback_called = false;
-
+    std::promise<std::string> error;
     tp::net::socket client;
-    client
-        .on(ERROR,
-            [&callback_called](std::string) {
-              callback_called = true;
-              barrier(2);
-            })
+    client.on(ERROR, [&error](std::string) { error.set_value("error"); })
         .connect(0, "127.0.0.1");
-    barrier(2);
-    REQUIRE(callback_called);
-    for (auto &e : mock_threads)
-      e.get();
+    REQUIRE(wait_for(error.get_future()) == "error");
+  }
+}
+
+TEST_CASE("socket on fake link", "[client]") {
+  event_loop loop;
+  loop.start();
+
+  // the same over epoll and over the transport of network connections
+  auto transport = GENERATE(UNIX_LINK, TCP_LINK);
+
+  SECTION("every chunk is a separate DATA event") {
+    fake_link link(0, transport);
+    std::vector<std::string> chunks;
+    std::promise<std::string> last;
+    tp::net::socket client(loop);
+    client.on(DATA, [&](std::string data) {
+      chunks.push_back(data);
+      if (chunks.size() == 4)
+        last.set_value(data);
+    });
+    client.wrap(link.client_end());
+    REQUIRE(link.inject(TO_CLIENT, "abcdefgh", 3));
+    REQUIRE(link.inject(TO_CLIENT, "i"));
+    // inject returns when the data is read, the handler may still run
+    REQUIRE(wait_for(last.get_future()) == "i");
+    REQUIRE(chunks == std::vector<std::string>{"abc", "def", "gh", "i"});
+  }
+
+  SECTION("partial writes are queued and sent when the peer reads") {
+    fake_link link(4096, transport);
+    std::string data;
+    for (int i = 0; data.size() < 1024 * 1024; i++)
+      data += std::to_string(i) + ",";
+    std::promise<std::string> finished;
+    tp::net::socket client(loop);
+    client.on(FINISH, [&finished]() { finished.set_value("finished"); })
+        .wrap(link.client_end());
+    client.end(data);
+    // the writer does not wait, the rest is queued
+    std::string received = link.take(TO_SERVER, 1000);
+    REQUIRE(received.size() == 1000);
+    REQUIRE(finished.get_future().wait_for(std::chrono::milliseconds(0)) ==
+            std::future_status::timeout);
+    while (!link.ended(TO_SERVER)) {
+      auto part = link.take(TO_SERVER, 4096);
+      if (part.empty())
+        break;
+      received += part;
+    }
+    REQUIRE(received.size() == data.size());
+    REQUIRE((received == data));
+  }
+
+  SECTION("two buffers are written together, the rest is queued") {
+    fake_link link(4096, transport);
+    std::string header = "header:";
+    std::string body(200000, 'b');
+    tp::net::socket client(loop);
+    client.wrap(link.client_end());
+    client.write(owned_buffer(std::string(header)),
+                 owned_buffer(std::string(body)));
+    client.write("!");
+    std::string received = link.take(TO_SERVER, header.size() + 1);
+    REQUIRE(received == header + "b");
+    received += link.take(TO_SERVER, body.size());
+    REQUIRE((received == header + body + "!"));
+  }
+
+  SECTION("latency of the simulated network") {
+    fake_link link(0, transport);
+    server srv(loop, [](tp::net::socket &s) {
+      s.on(DATA, [&s](std::string d) { s.write(d); });
+    });
+    srv.adopt(link.server_end());
+    link.run(std::chrono::milliseconds(20), 2);
+    std::mutex m;
+    std::vector<std::string> chunks;
+    std::promise<std::string> result;
+    std::string received;
+    tp::net::socket client(loop);
+    client.on(DATA, [&](std::string data) {
+      std::lock_guard<std::mutex> lock(m);
+      chunks.push_back(data);
+      received += data;
+      if (received.size() == 6)
+        result.set_value(received);
+    });
+    auto start = std::chrono::steady_clock::now();
+    client.wrap(link.client_end());
+    client.write("hello!");
+    REQUIRE(wait_for(result.get_future()) == "hello!");
+    // there and back
+    REQUIRE(std::chrono::steady_clock::now() - start >=
+            std::chrono::milliseconds(40));
+    std::lock_guard<std::mutex> lock(m);
+    for (auto &c : chunks)
+      REQUIRE(c.size() <= 2);
   }
 }
@@ -0,0 +1,241 @@
+#include <tepsoc_codec.hpp>
+
+#include "fake_network.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+using namespace tp;
+using namespace tp::net;
+
+/**
+ * messages of data fed in chunks of the given size, as strings
+ * */
+template <class Codec, class F>
+static std::vector<std::string> decode_all(const std::string &data,
+                                           std::size_t chunk, F to_string) {
+  decoder<Codec> d;
+  std::vector<std::string> messages;
+  for (std::size_t pos = 0; pos < data.size(); pos += chunk)
+    d.feed(data.data() + pos, std::min(chunk, data.size() - pos),
+           [&](typename Codec::message &m) { messages.push_back(to_string(m)); });
+  REQUIRE(d.pending() == 0);
+  return messages;
+}
+
+static std::string str(encode_buffer &out) {
+  return std::string(out.data(), out.size());
+}
+
+TEST_CASE("encode buffer", "[codec]") {
+  encode_buffer out;
+  REQUIRE(out.empty());
+  out.append("abc");
+  char *p = out.reserve(10000);
+  std::fill(p, p + 10000, 'x');
+  out.commit(10000);
+  REQUIRE(out.size() == 10003);
+  REQUIRE(str(out).substr(0, 4) == "abcx");
+  const char *data = out.data();
+  // the storage goes to the write queue as it is
+  owned_buffer taken = out.take();
+  REQUIRE(taken.data() == data);
+  REQUIRE(taken.size() == 10003);
+  REQUIRE(out.empty());
+  REQUIRE(out.take().empty());
+}
+
+TEST_CASE("length prefixed codec", "[codec]") {
+  length_prefixed_codec codec;
+  encode_buffer out;
+  codec.encode("hello", out);
+  codec.encode("", out);
+  codec.encode(std::string(300, 'z'), out);
+  REQUIRE(str(out).substr(0, 9) == std::string("\0\0\0\5hello", 9));
+  auto view = [](std::string_view m) { return std::string(m); };
+  auto expected =
+      std::vector<std::string>{"hello", "", std::string(300, 'z')};
+  for (std::size_t chunk : {1, 3, 7, 1000})
+    REQUIRE(decode_all<length_prefixed_codec>(str(out), chunk, view) ==
+            expected);
+
+  codec.max_size = 4;
+  std::string_view m;
+  REQUIRE_THROWS_AS(codec.decode(out.data(), out.size(), m), codec_error);
+  REQUIRE_THROWS_AS(codec.encode("hello", out), codec_error);
+}
+
+TEST_CASE("json lines codec", "[codec]") {
+  json_lines_codec codec;
+  encode_buffer out;
+  codec.encode(R"({"a":1})", out);
+  REQUIRE(str(out) == "{\"a\":1}\n");
+  REQUIRE_THROWS_AS(codec.encode("{\n}", out), codec_error);
+  auto view = [](std::string_view m) { return std::string(m); };
+  REQUIRE(decode_all<json_lines_codec>("[1]\n{\"b\":2}\r\n\n\"x\"\n", 2,
+                                       view) ==
+          std::vector<std::string>{"[1]", "{\"b\":2}", "", "\"x\""});
+
+  codec.max_size = 3;
+  std::string_view m;
+  REQUIRE(codec.decode("abc\r\n", 5, m) == 5);
+  REQUIRE(m == "abc");
+  REQUIRE(codec.decode("abc", 3, m) == 0);
+  REQUIRE_THROWS_AS(codec.decode("abcde", 5, m), codec_error);
+}
+
+TEST_CASE("RESP codec", "[codec]") {
+  resp_codec codec;
+  // words of commands, types of replies
+  auto words = [](resp_value &v) {
+    std::string s;
+    if (v.type != resp_type::ARRAY)
+      return std::string("?");
+    for (auto &e : v.elements)
+      s += std::string(e.text) + "|";
+    return s;
+  };
+
+  SECTION("commands in any chunks") {
+    std::string commands = "*2\r\n$3\r\nGET\r\n$1\r\nk\r\n"
+                           "*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$5\r\nv\r\nal\r\n"
+                           "PING  hello\r\n";
+    for (std::size_t chunk : {1, 5, 1000})
+      REQUIRE(decode_all<resp_codec>(commands, chunk, words) ==
+              std::vector<std::string>{"GET|k|", "SET|k|v\r\nal|",
+                                       "PING|hello|"});
+  }
+  SECTION("replies encoded and decoded") {
+    encode_buffer out;
+    resp_codec::simple(out, "OK");
+    resp_codec::error(out, "ERR no");
+    resp_codec::integer(out, -42);
+    resp_codec::bulk(out, "a\r\nb");
+    resp_codec::nil(out);
+    resp_codec::array(out, 2);
+    resp_codec::integer(out, 1);
+    resp_codec::array(out, 0);
+    REQUIRE(str(out) == "+OK\r\n-ERR no\r\n:-42\r\n$4\r\na\r\nb\r\n$-1\r\n"
+                        "*2\r\n:1\r\n*0\r\n");
+    decoder<resp_codec> d;
+    std::vector<resp_value> values;
+    d.feed(out.data(), out.size(),
+           [&](resp_value &v) { values.push_back(v); });
+    REQUIRE(values.size() == 6);
+    REQUIRE(values[0].type == resp_type::SIMPLE);
+    REQUIRE(values[1].type == resp_type::ERROR);
+    REQUIRE(values[1].text == "ERR no");
+    REQUIRE(values[2].integer == -42);
+    REQUIRE(values[3].text == "a\r\nb");
+    REQUIRE(values[4].type == resp_type::NIL);
+    REQUIRE(values[5].elements.size() == 2);
+    REQUIRE(values[5].elements[1].type == resp_type::ARRAY);
+    // decoded values encode back to the same bytes
+    encode_buffer again;
+    for (auto &v : values)
+      codec.encode(v, again);
+    REQUIRE(str(again) == str(out));
+    // and byte by byte, with nested arrays split between reads
+    std::size_t decoded = 0;
+    for (std::size_t i = 0; i < out.size(); i++)
+      d.feed(out.data() + i, 1, [&](resp_value &) { decoded++; });
+    REQUIRE(decoded == 6);
+  }
+  SECTION("long command split between reads is decoded once") {
+    struct counting_codec : resp_codec {
+      int *decodes;
+      std::size_t decode(const char *data_, std::size_t size_,
+                         message &message_) const {
+        ++*decodes;
+        return resp_codec::decode(data_, size_, message_);
+      }
+    };
+    int decodes = 0;
+    counting_codec counting;
+    counting.decodes = &decodes;
+    decoder<counting_codec> d(counting);
+    const std::size_t count = 100001;
+    encode_buffer out;
+    resp_codec::array(out, count);
+    resp_codec::bulk(out, "MSET");
+    for (std::size_t i = 1; i < count; i++)
+      resp_codec::bulk(out, std::to_string(i));
+    resp_codec::array(out, 1);
+    resp_codec::bulk(out, "PING");
+    std::vector<std::size_t> sizes;
+    for (std::size_t i = 0; i < out.size(); i += 4096)
+      d.feed(out.data() + i, std::min<std::size_t>(4096, out.size() - i),
+             [&](resp_value &v) { sizes.push_back(v.elements.size()); });
+    REQUIRE(sizes == std::vector<std::size_t>{count, 1});
+    // once incomplete in the first read, then once complete
+    REQUIRE(decodes <= 4);
+    REQUIRE(d.pending() == 0);
+
+    // the limits are checked before the message is complete
+    std::string bad = "*2\r\n$3\r\nGET\r\n";
+    d.feed(bad.data(), bad.size(), [](resp_value &) {});
+    REQUIRE_THROWS_AS(d.feed("!x\r\n", 4, [](resp_value &) {}), codec_error);
+    REQUIRE(d.pending() == 0);
+  }
+  SECTION("protocol errors") {
+    resp_value v;
+    for (std::string bad : {"$abc\r\n", "*2\nx", "$3\r\nabcd\r\n", "*-5\r\n",
+                            "*1\r\n!x\r\n", "$9999999999\r\n"})
+      REQUIRE_THROWS_AS(codec.decode(bad.data(), bad.size(), v), codec_error);
+    std::string deep;
+    for (int i = 0; i < 20; i++)
+      deep += "*1\r\n";
+    REQUIRE_THROWS_AS(codec.decode(deep.data(), deep.size(), v), codec_error);
+    // an announced array is not allocated before its elements arrive
+    std::string huge = "*1000000\r\n";
+    resp_value fresh;
+    REQUIRE(codec.decode(huge.data(), huge.size(), fresh) == 0);
+    REQUIRE(fresh.elements.capacity() == 0);
+  }
+}
+
+TEST_CASE("socket messages", "[codec]") {
+  event_loop loop;
+  loop.start();
+  fake_link link;
+  std::promise<std::string> ended;
+  std::atomic<int> handled(0);
+  tp::net::socket s(loop);
+  on_messages<length_prefixed_codec>(
+      s, [&handled](std::string_view m, encode_buffer &out) {
+        handled++;
+        std::string reply = "<";
+        reply += m;
+        reply += ">";
+        length_prefixed_codec().encode(reply, out);
+      });
+  s.on(FINISH, [&ended]() { ended.set_value("finished"); });
+  s.wrap(link.client_end());
+
+  encode_buffer requests;
+  for (auto m : {"a", "bc", "def"})
+    length_prefixed_codec().encode(m, requests);
+  std::string data = str(requests);
+  // the last message is split between reads
+  REQUIRE(link.inject(TO_CLIENT, data.substr(0, data.size() - 2)));
+  REQUIRE(link.inject(TO_CLIENT, data.substr(data.size() - 2)));
+  std::string replies = link.take(TO_SERVER, 24);
+  REQUIRE(replies == std::string("\0\0\0\3<a>\0\0\0\4<bc>\0\0\0\5<def>", 24));
+
+  // a message over the limit ends the connection
+  REQUIRE(link.inject(TO_CLIENT, std::string("\xff\xff\xff\xff", 4)));
+  REQUIRE(ended.get_future().wait_for(std::chrono::seconds(5)) ==
+          std::future_status::ready);
+  REQUIRE(handled == 3);
+  // what comes after is not decoded
+  REQUIRE(link.inject(TO_CLIENT, std::string("\0\0\0\3EVL", 7)));
+  REQUIRE(link.take(TO_SERVER, 1) == "");
+  REQUIRE(link.ended(TO_SERVER));
+  REQUIRE(handled == 3);
+}
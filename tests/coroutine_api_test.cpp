@@ -0,0 +1,74 @@
+#include <tepsoc_co.hpp>
+
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include <catch2/catch.hpp>
+
+using namespace tp;
+using namespace tp::net;
+
+static task<> echo_once(server &srv) {
+  auto s = co_await srv.accept();
+  std::vector<char> buf(100);
+  auto n = co_await s->read_some(buf);
+  co_await s->write_all(std::string(buf.data(), n));
+}
+
+static task<std::string> ask(event_loop &loop, std::string question) {
+  auto s = co_await socket::connect(loop, 7756, "127.0.0.1");
+  co_await s->write_all(question);
+  std::vector<char> buf(100);
+  auto n = co_await s->read_some(buf);
+  co_return std::string(buf.data(), n);
+}
+
+static task<> ask_and_report(event_loop &loop, std::promise<std::string> &p) {
+  try {
+    p.set_value(co_await ask(loop, "hello"));
+  } catch (...) {
+    p.set_exception(std::current_exception());
+  }
+}
+
+TEST_CASE("coroutine api", "[coroutine]") {
+  event_loop loop;
+
+  SECTION("posted function is run in the loop thread") {
+    std::promise<bool> in_loop;
+    loop.post([&]() { in_loop.set_value(loop.in_loop_thread()); });
+    loop.run_once(1000);
+    REQUIRE(in_loop.get_future().get());
+  }
+
+  SECTION("echo with accept, connect, read_some and write_all") {
+    server srv(loop);
+    srv.listen(7756, "127.0.0.1");
+    std::promise<std::string> result;
+    spawn(loop, echo_once(srv));
+    spawn(loop, ask_and_report(loop, result));
+    std::thread t([&]() { loop.run(); });
+    auto f = result.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    loop.stop();
+    t.join();
+    REQUIRE(f.get() == "hello");
+  }
+
+  SECTION("connect to impossible throws") {
+    std::promise<std::string> result;
+    spawn(loop, [](event_loop &loop, std::promise<std::string> &p) -> task<> {
+      try {
+        co_await socket::connect(loop, 0, "127.0.0.1");
+        p.set_value("connected");
+      } catch (std::runtime_error &e) {
+        p.set_value("error");
+      }
+    }(loop, result));
+    auto f = result.get_future();
+    while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      loop.run_once(100);
+    REQUIRE(f.get() == "error");
+  }
+}
@@ -0,0 +1,169 @@
+#include <tepsoc_dgram.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+
+#include <catch2/catch.hpp>
+
+using namespace tp::net;
+
+TEST_CASE("datagram socket", "[dgram]") {
+  event_loop loop;
+  loop.start();
+
+  SECTION("datagrams are received with the sender address") {
+    const int count = 200;
+    dgram_socket receiver(loop), sender(loop);
+    std::promise<void> done;
+    std::atomic<int> received(0);
+    std::atomic<bool> ok(true);
+    unsigned int sender_port = 0;
+    receiver
+        .on(MESSAGE,
+            [&](const dgram_message &m) {
+              if ((m.payload() != "msg" + std::to_string(received)) ||
+                  (m.from.port() != sender_port) ||
+                  (m.from.host() != "127.0.0.1"))
+                ok = false;
+              if (++received == count)
+                done.set_value();
+            })
+        .bind(0, "127.0.0.1");
+    auto to = receiver.local_address();
+    REQUIRE(to.port() != 0);
+    sender.bind(0, "127.0.0.1");
+    sender_port = sender.local_address().port();
+    for (int i = 0; i < count; i++)
+      sender.send_to(to, "msg" + std::to_string(i));
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(5)) ==
+            std::future_status::ready);
+    REQUIRE(ok);
+  }
+  SECTION("connected socket sends to its peer and gets replies") {
+    dgram_socket server(loop), client(loop);
+    server
+        .on(MESSAGE,
+            [&server](const dgram_message &m) {
+              server.send_to(m.from, "re:" + std::string(m.payload()));
+            })
+        .bind(7768, "127.0.0.1");
+    std::promise<std::string> reply;
+    client.on(MESSAGE, [&reply](const dgram_message &m) {
+      reply.set_value(std::string(m.payload()));
+    });
+    client.connect(7768, "127.0.0.1").send("ping");
+    auto f = reply.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    REQUIRE(f.get() == "re:ping");
+  }
+  SECTION("long datagram is truncated to the buffer") {
+    dgram_socket receiver(loop), sender(loop);
+    std::promise<dgram_message> got;
+    receiver.set_max_message_size(16)
+        .on(MESSAGE, [&got](const dgram_message &m) { got.set_value(m); })
+        .bind(0, "127.0.0.1");
+    sender.send_to(receiver.local_address(), std::string(100, 'l'));
+    auto f = got.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    auto m = f.get();
+    REQUIRE(m.size == 16);
+    REQUIRE(m.truncated);
+  }
+  SECTION("segmented send and coalesced receive keep datagrams") {
+    const int count = 100;
+    dgram_socket receiver(loop), sender(loop);
+    std::promise<void> done;
+    std::atomic<int> received(0);
+    std::atomic<bool> ok(true);
+    receiver.set_gro(true)
+        .on(MESSAGE,
+            [&](const dgram_message &m) {
+              // the last datagram of every run is shorter
+              int i = received;
+              std::size_t size = (i % 10 == 9) ? 10 : 1000;
+              if ((m.size != size) || (m.data[0] != (char)('a' + i % 26)))
+                ok = false;
+              if (++received == count)
+                done.set_value();
+            })
+        .bind(0, "127.0.0.1");
+    sender.set_gso(true);
+    auto to = receiver.local_address();
+    for (int i = 0; i < count; i++)
+      sender.send_to(to, std::string((i % 10 == 9) ? 10 : 1000,
+                                     (char)('a' + i % 26)));
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(5)) ==
+            std::future_status::ready);
+    REQUIRE(ok);
+  }
+}
+
+TEST_CASE("multicast and broadcast", "[dgram]") {
+  event_loop loop;
+  loop.start();
+
+  SECTION("every subscriber of the group on loopback gets the datagrams") {
+    const int count = 50;
+    dgram_socket a(loop), b(loop), publisher(loop);
+    std::atomic<int> received_a(0), received_b(0);
+    std::promise<void> done_a, done_b;
+    std::string err;
+    a.on(ERROR, [&err](std::string e) { err = e; })
+        .on(MESSAGE,
+            [&](const dgram_message &) {
+              if (++received_a == count)
+                done_a.set_value();
+            })
+        .subscribe(7769, "239.255.0.33", "lo");
+    b.on(ERROR, [&err](std::string e) { err = e; })
+        .on(MESSAGE,
+            [&](const dgram_message &) {
+              if (++received_b == count)
+                done_b.set_value();
+            })
+        .subscribe(7769, "239.255.0.33", "lo");
+    REQUIRE(err == "");
+    publisher.set_multicast_interface("lo").set_multicast_loop(true);
+    publisher.connect(7769, "239.255.0.33");
+    for (int i = 0; i < count; i++)
+      publisher.send("tick " + std::to_string(i));
+    REQUIRE(done_a.get_future().wait_for(std::chrono::seconds(5)) ==
+            std::future_status::ready);
+    REQUIRE(done_b.get_future().wait_for(std::chrono::seconds(5)) ==
+            std::future_status::ready);
+    REQUIRE(err == "");
+  }
+  SECTION("left group does not receive") {
+    dgram_socket sub(loop), publisher(loop);
+    std::atomic<int> received(0);
+    std::promise<void> first;
+    sub.on(MESSAGE,
+           [&](const dgram_message &) {
+             if (++received == 1)
+               first.set_value();
+           })
+        .subscribe(7770, "239.255.0.35", "lo");
+    publisher.set_multicast_interface("lo");
+    publisher.connect(7770, "239.255.0.35").send("one");
+    REQUIRE(first.get_future().wait_for(std::chrono::seconds(5)) ==
+            std::future_status::ready);
+    sub.leave_group("239.255.0.35", "lo");
+    publisher.send("two");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(received == 1);
+  }
+  SECTION("broadcast needs SO_BROADCAST") {
+    dgram_socket sender(loop);
+    std::string err;
+    sender.on(ERROR, [&err](std::string e) { err = e; });
+    auto to = dgram_address::resolve(7771, "255.255.255.255");
+    sender.send_to(to, "x").flush();
+    REQUIRE(err.find("sendmmsg") != std::string::npos);
+    err = "";
+    sender.set_broadcast(true).send_to(to, "x").flush();
+    REQUIRE(err.find("Permission denied") == std::string::npos);
+  }
+}
@@ -0,0 +1,124 @@
+#include <tepsoc.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+
+#include <catch2/catch.hpp>
+
+using namespace tp::net;
+
+static std::string echo_on(loop_backend backend, unsigned int port) {
+  event_loop loop(backend);
+  loop.start();
+  server srv(loop, [](socket &s) {
+    s.on(DATA, [&s](std::string data) { s.write(data); });
+  });
+  srv.on(LISTENING, []() {});
+  srv.listen(port, "127.0.0.1");
+
+  std::promise<std::string> result;
+  auto received = std::make_shared<std::string>();
+  socket client(loop);
+  client.on(CONNECT, [&client]() { client.write(std::string(10000, 'e')); })
+      .on(DATA,
+          [&client, received](std::string data) {
+            *received += data;
+            if (received->size() == 10000)
+              client.end();
+          })
+      .on(END, [&result, received]() { result.set_value(*received); })
+      .connect(port, "127.0.0.1");
+  auto f = result.get_future();
+  if (f.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+    return "timeout";
+  return f.get();
+}
+
+TEST_CASE("event loop backends", "[loop]") {
+  SECTION("epoll backend echoes data and ends the connection") {
+    event_loop loop(loop_backend::EPOLL);
+    REQUIRE(loop.get_backend() == loop_backend::EPOLL);
+    REQUIRE(echo_on(loop_backend::EPOLL, 7757) == std::string(10000, 'e'));
+  }
+  SECTION("io_uring backend echoes data and ends the connection") {
+    if (!event_loop::io_uring_available())
+      return;
+    event_loop loop(loop_backend::IO_URING);
+    REQUIRE(loop.get_backend() == loop_backend::IO_URING);
+    REQUIRE(echo_on(loop_backend::IO_URING, 7758) == std::string(10000, 'e'));
+  }
+}
+
+TEST_CASE("event loop timers", "[loop]") {
+  event_loop loop(loop_backend::EPOLL);
+  loop.start();
+  SECTION("timeout is called once after the delay") {
+    std::promise<std::uint64_t> fired;
+    auto start = loop.now_ms();
+    loop.set_timeout([&]() { fired.set_value(loop.now_ms()); }, 20);
+    auto f = fired.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+    REQUIRE(f.get() - start >= 20);
+  }
+  SECTION("cleared timeout is not called") {
+    std::atomic<int> calls(0);
+    auto id = loop.set_timeout([&]() { calls++; }, 20);
+    REQUIRE(loop.clear_timeout(id));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(calls == 0);
+  }
+  SECTION("interval is called until cleared") {
+    std::atomic<int> calls(0);
+    std::promise<void> done;
+    timer_id id = 0;
+    id = loop.set_interval(
+        [&]() {
+          if (++calls == 3) {
+            loop.clear_interval(id);
+            done.set_value();
+          }
+        },
+        5);
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(2)) ==
+            std::future_status::ready);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    REQUIRE(calls == 3);
+  }
+}
+
+TEST_CASE("socket timeouts", "[loop]") {
+  event_loop loop;
+  loop.start();
+  SECTION("server closes idle connection") {
+    server srv(loop, [](socket &) {});
+    srv.set_timeout(IDLE_TIMEOUT, 50).listen(7759, "127.0.0.1");
+    std::promise<void> ended;
+    socket client(loop);
+    client.on(DATA, [](std::string) {})
+        .on(END, [&ended]() { ended.set_value(); })
+        .connect(7759, "127.0.0.1");
+    REQUIRE(ended.get_future().wait_for(std::chrono::seconds(3)) ==
+            std::future_status::ready);
+  }
+  SECTION("TIMEOUT handler is given the kind of timeout") {
+    std::promise<std::string> kind;
+    auto received = std::make_shared<std::atomic<bool>>(false);
+    server srv(loop, [&kind, received](socket &s) {
+      s.on(DATA, [](std::string) {})
+          .on(TIMEOUT, [&kind, received, &s](std::string k) {
+            if (!received->exchange(true))
+              kind.set_value(k);
+            s.end();
+          });
+    });
+    srv.set_timeout(READ_TIMEOUT, 50).listen(7760, "127.0.0.1");
+    socket client(loop);
+    client.on(DATA, [](std::string) {}).connect(7760, "127.0.0.1");
+    auto f = kind.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(3)) == std::future_status::ready);
+    REQUIRE(f.get() == "read");
+  }
+}
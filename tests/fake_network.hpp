@@ -0,0 +1,366 @@
+#ifndef __FAKE_NETWORK__HPP___
+#define __FAKE_NETWORK__HPP___
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/sockios.h>
+
+namespace tp {
+
+enum link_direction { TO_SERVER, TO_CLIENT };
+/**
+ * connections of the link. Unix domain sockets are served by epoll, TCP
+ * loopback takes the path of network connections, io_uring included.
+ * */
+enum link_transport { UNIX_LINK, TCP_LINK };
+
+/**
+ * connection between client and server in this process, without listening
+ * sockets. Each side gets one end of a unix domain socket pair and the link
+ * keeps the other ends, so nothing passes until the test moves it. The test
+ * decides where the receiver sees chunk boundaries, and how long the sender
+ * waits with a full buffer.
+ *
+ * The client end is given to socket::wrap and the server end to
+ * server::adopt (or wrap), they own the descriptors then.
+ * */
+class fake_link {
+  // [0] is given to the side, [1] is kept by the link
+  int _client[2];
+  int _server[2];
+  link_transport _transport;
+  std::thread _relay;
+  std::atomic<bool> _relaying;
+
+  int _from(link_direction d) const {
+    return d == TO_SERVER ? _client[1] : _server[1];
+  }
+  int _to(link_direction d) const {
+    return d == TO_SERVER ? _server[1] : _client[1];
+  }
+
+  /**
+   * bytes written in direction d and not read by the receiver yet. TCP
+   * counts them as sent once acknowledged, so they are looked for in the
+   * receive queue of the end given to the receiver too.
+   * */
+  int _unread(link_direction d) const {
+    int queued = 0, received = 0;
+    if (ioctl(_to(d), SIOCOUTQ, &queued) != 0)
+      return 0;
+    if (_transport == TCP_LINK) {
+      int receiver = (d == TO_SERVER) ? _server[0] : _client[0];
+      if (ioctl(receiver, SIOCINQ, &received) != 0)
+        received = 0;
+    }
+    return queued + received;
+  }
+
+  /**
+   * wait until the receiver read everything written in direction d
+   * */
+  bool _drained(link_direction d, std::chrono::milliseconds timeout) const {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (_unread(d) > 0) {
+      if (std::chrono::steady_clock::now() > deadline)
+        return false;
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    return true;
+  }
+
+  /**
+   * connected TCP loopback pair, like socketpair
+   * */
+  static void _tcp_pair(int ends[2]) {
+    int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    ends[0] = ends[1] = -1;
+    if ((listener >= 0) &&
+        (::bind(listener, (sockaddr *)&addr, sizeof(addr)) == 0) &&
+        (::listen(listener, 1) == 0) &&
+        (::getsockname(listener, (sockaddr *)&addr, &len) == 0)) {
+      ends[1] = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (::connect(ends[1], (sockaddr *)&addr, sizeof(addr)) == 0)
+        ends[0] = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    }
+    if (listener >= 0)
+      ::close(listener);
+    if (ends[0] < 0) {
+      if (ends[1] >= 0)
+        ::close(ends[1]);
+      throw std::runtime_error("tcp loopback pair failed");
+    }
+    // chunks are not held back waiting for acknowledgements
+    int one = 1;
+    for (int i : {0, 1})
+      setsockopt(ends[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  /**
+   * write all, waiting while the receiver has its buffer full
+   * */
+  static bool _write_all(int fd, const char *data, std::size_t size,
+                         std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (size) {
+      long n = ::send(fd, data, size, MSG_NOSIGNAL);
+      if (n > 0) {
+        data += n;
+        size -= n;
+      } else if ((n < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+        return false;
+      } else if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      } else {
+        pollfd p = {fd, POLLOUT, 0};
+        ::poll(&p, 1, 10);
+      }
+    }
+    return true;
+  }
+
+  void _run(std::chrono::milliseconds latency, std::size_t chunk);
+
+public:
+  /**
+   * buffer_size limits what a side can send before the link takes it
+   * (SO_SNDBUF), so its writes become partial and then fail with EAGAIN.
+   * Over TCP the receive buffer of the link holds more. 0 keeps the
+   * default.
+   * */
+  explicit fake_link(int buffer_size = 0,
+                     link_transport transport = UNIX_LINK)
+      : _transport(transport), _relaying(false) {
+    if (transport == TCP_LINK) {
+      _tcp_pair(_client);
+      try {
+        _tcp_pair(_server);
+      } catch (...) {
+        ::close(_client[0]);
+        ::close(_client[1]);
+        throw;
+      }
+    } else if ((::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+                             _client) != 0) ||
+               (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+                             _server) != 0)) {
+      throw std::runtime_error("socketpair failed");
+    }
+    for (int fd : {_client[1], _server[1]})
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    if (buffer_size > 0)
+      for (int fd : {_client[0], _server[0]})
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size,
+                   sizeof(buffer_size));
+  }
+  fake_link(const fake_link &) = delete;
+  fake_link &operator=(const fake_link &) = delete;
+  ~fake_link() {
+    stop();
+    ::close(_client[1]);
+    ::close(_server[1]);
+  }
+
+  /**
+   * end for the client socket
+   * */
+  int client_end() const { return _client[0]; }
+  /**
+   * end for the server
+   * */
+  int server_end() const { return _server[0]; }
+
+  /**
+   * write data as if the other side sent it in direction d. Every chunk (0
+   * is all data at once) is written after the receiver read the previous
+   * one, so it gets each chunk in a separate read. Returns when the last
+   * chunk was read, its handler may still be running.
+   *
+   * @return false when the receiver did not read it in time or is closed
+   * */
+  bool inject(link_direction d, const std::string &data, std::size_t chunk = 0,
+              std::chrono::milliseconds timeout = std::chrono::seconds(1)) {
+    if (chunk == 0)
+      chunk = std::max<std::size_t>(data.size(), 1);
+    for (std::size_t pos = 0; pos < data.size(); pos += chunk) {
+      std::size_t n = std::min(chunk, data.size() - pos);
+      if (!_write_all(_to(d), data.data() + pos, n, timeout) ||
+          !_drained(d, timeout))
+        return false;
+    }
+    return true;
+  }
+
+  /**
+   * take what was sent in direction d without passing it on. Waits until
+   * size bytes are there, the sender ended its side or the timeout.
+   * */
+  std::string take(link_direction d, std::size_t size,
+                   std::chrono::milliseconds timeout = std::chrono::seconds(1)) {
+    std::string result;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    char buf[64 * 1024];
+    while (result.size() < size) {
+      long n = ::recv(_from(d), buf, std::min(sizeof(buf), size - result.size()),
+                      0);
+      if (n > 0) {
+        result.append(buf, n);
+        continue;
+      }
+      if ((n == 0) || ((errno != EAGAIN) && (errno != EINTR)))
+        break;
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (left.count() <= 0)
+        break;
+      pollfd p = {_from(d), POLLIN, 0};
+      ::poll(&p, 1, left.count());
+    }
+    return result;
+  }
+
+  /**
+   * true when the sender in direction d shut down its side and everything
+   * it sent was taken
+   * */
+  bool ended(link_direction d) {
+    char c;
+    return ::recv(_from(d), &c, 1, MSG_PEEK) == 0;
+  }
+
+  /**
+   * move size bytes in direction d, see take and inject
+   *
+   * @return number of bytes received by the other side
+   * */
+  std::size_t forward(link_direction d, std::size_t size, std::size_t chunk = 0,
+                      std::chrono::milliseconds timeout = std::chrono::seconds(1)) {
+    auto data = take(d, size, timeout);
+    return inject(d, data, chunk, timeout) ? data.size() : 0;
+  }
+
+  /**
+   * end of stream in direction d, the receiver gets END
+   * */
+  void end(link_direction d) { ::shutdown(_to(d), SHUT_WR); }
+
+  /**
+   * forward both directions in the background, like a network. Every read
+   * is delivered after the latency, in chunks as in inject, and the end of
+   * stream is passed on. Do not move data by hand until stop.
+   * */
+  void run(std::chrono::milliseconds latency = std::chrono::milliseconds(0),
+           std::size_t chunk = 0) {
+    stop();
+    _relaying = true;
+    _relay = std::thread([this, latency, chunk]() { _run(latency, chunk); });
+  }
+
+  /**
+   * stop forwarding started by run
+   * */
+  void stop() {
+    _relaying = false;
+    if (_relay.joinable())
+      _relay.join();
+  }
+};
+
+inline void fake_link::_run(std::chrono::milliseconds latency,
+                            std::size_t chunk) {
+  using clock = std::chrono::steady_clock;
+  struct in_flight {
+    clock::time_point due;
+    std::string data; // empty is the end of stream
+  };
+  std::deque<in_flight> queues[2];
+  bool ended[2] = {false, false};
+  char buf[64 * 1024];
+  while (_relaying) {
+    auto now = clock::now();
+    int wait_ms = 10;
+    for (auto d : {TO_SERVER, TO_CLIENT}) {
+      auto &q = queues[d];
+      while (q.size() && (q.front().due <= now)) {
+        if (q.front().data.empty())
+          end(d);
+        else if (!inject(d, q.front().data, chunk))
+          return;
+        q.pop_front();
+      }
+      if (q.size())
+        wait_ms = std::min<int>(
+            wait_ms, std::chrono::duration_cast<std::chrono::milliseconds>(
+                         q.front().due - now)
+                             .count() +
+                         1);
+    }
+    pollfd p[2] = {{ended[TO_SERVER] ? -1 : _from(TO_SERVER), POLLIN, 0},
+                   {ended[TO_CLIENT] ? -1 : _from(TO_CLIENT), POLLIN, 0}};
+    if (::poll(p, 2, wait_ms) <= 0)
+      continue;
+    for (auto d : {TO_SERVER, TO_CLIENT}) {
+      if (p[d].revents == 0)
+        continue;
+      long n = ::recv(_from(d), buf, sizeof(buf), 0);
+      if (n > 0) {
+        queues[d].push_back({clock::now() + latency, std::string(buf, n)});
+      } else if ((n == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+        ended[d] = true;
+        queues[d].push_back({clock::now() + latency, ""});
+      }
+    }
+  }
+}
+
+/**
+ * blocking TCP connection to the port on 127.0.0.1, -1 when refused
+ * */
+inline int raw_connect(unsigned int port) {
+  int s = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::connect(s, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    ::close(s);
+    return -1;
+  }
+  return s;
+}
+
+/**
+ * true when f becomes true within two seconds
+ * */
+inline bool eventually(std::function<bool()> f) {
+  for (int i = 0; i < 200; i++) {
+    if (f())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+} // namespace tp
+
+#endif
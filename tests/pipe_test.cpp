@@ -0,0 +1,76 @@
+#include <tepsoc.hpp>
+
+#include "fake_network.hpp"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace tp;
+using namespace tp::net;
+
+TEST_CASE("socket pipe", "[pipe]") {
+  event_loop loop;
+  loop.start();
+  // echoes, and answers the end of stream
+  server backend(loop, [](tp::net::socket &s) {
+    s.on(DATA, [&s](std::vector<char> data) { s.write(std::move(data)); })
+        .on(END, [&s]() { s.end("bye"); });
+  });
+  backend.on(LISTENING, []() {});
+  std::mutex m;
+  std::vector<std::shared_ptr<tp::net::socket>> upstreams;
+  server proxy(loop, [&](tp::net::socket &s) {
+    auto upstream = std::make_shared<tp::net::socket>(loop);
+    // the client waits until the upstream is connected
+    s.pipe(*upstream);
+    upstream->connect(7778, "127.0.0.1");
+    std::lock_guard<std::mutex> lock(m);
+    upstreams.push_back(upstream);
+  });
+  proxy.on(LISTENING, []() {});
+
+  SECTION("data and end of stream are forwarded both ways") {
+    backend.listen(7778, "127.0.0.1");
+    proxy.listen(7779, "127.0.0.1");
+    int c = raw_connect(7779);
+    REQUIRE(c >= 0);
+    std::string sent;
+    for (int i = 0; sent.size() < 4 * 1024 * 1024; i++)
+      sent += std::to_string(i) + ",";
+    std::thread sender([&]() {
+      for (std::size_t pos = 0; pos < sent.size();) {
+        auto n = ::send(c, sent.data() + pos, sent.size() - pos, 0);
+        if (n <= 0)
+          break;
+        pos += n;
+      }
+      // the backend answers after the end of stream reaches it
+      ::shutdown(c, SHUT_WR);
+    });
+    std::string received;
+    std::vector<char> buf(64 * 1024);
+    long n;
+    while ((n = ::recv(c, buf.data(), buf.size(), 0)) > 0)
+      received.append(buf.data(), n);
+    sender.join();
+    REQUIRE(n == 0);
+    REQUIRE(received.size() == sent.size() + 3);
+    REQUIRE(received == sent + "bye");
+    ::close(c);
+  }
+  SECTION("bad arguments") {
+    event_loop other_loop;
+    tp::net::socket a(loop), b(loop), c(other_loop);
+    REQUIRE_THROWS_AS(a.pipe(a), std::invalid_argument);
+    REQUIRE_THROWS_AS(a.pipe(c), std::invalid_argument);
+    REQUIRE_NOTHROW(a.pipe(b));
+  }
+}
@@ -0,0 +1,65 @@
+#include <tepsoc_resp.hpp>
+
+#include "fake_network.hpp"
+
+#include <map>
+#include <string>
+
+#include <catch2/catch.hpp>
+
+using namespace tp;
+using namespace tp::net;
+
+TEST_CASE("RESP server", "[resp]") {
+  event_loop loop;
+  loop.start();
+  std::map<std::string, std::string> db;
+  resp_server srv(loop);
+  srv.command("get", 2,
+              [&db](const std::vector<resp_value> &args, encode_buffer &out) {
+                auto found = db.find(std::string(args[1].text));
+                if (found == db.end())
+                  resp_codec::nil(out);
+                else
+                  resp_codec::bulk(out, found->second);
+              })
+      .command("SET", 3,
+               [&db](const std::vector<resp_value> &args, encode_buffer &out) {
+                 db[std::string(args[1].text)] = args[2].text;
+                 resp_codec::simple(out, "OK");
+               });
+  fake_link link;
+  srv.get_server().adopt(link.server_end());
+
+  SECTION("pipelined commands are answered in order") {
+    REQUIRE(link.inject(TO_SERVER, "*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$2\r\nv1\r\n"
+                                   "*2\r\n$3\r\nget\r\n$1\r\nk\r\n"
+                                   "*2\r\n$3\r\nGET\r\n$1\r\nx\r\n"
+                                   "PING\r\n"));
+    std::string expected = "+OK\r\n$2\r\nv1\r\n$-1\r\n+PONG\r\n";
+    REQUIRE(link.take(TO_CLIENT, 1000, std::chrono::milliseconds(200)) ==
+            expected);
+  }
+  SECTION("command split between reads") {
+    REQUIRE(link.inject(TO_SERVER, "*2\r\n$4\r\nECHO\r\n$5\r\nhello\r\n", 3));
+    REQUIRE(link.take(TO_CLIENT, 11) == "$5\r\nhello\r\n");
+  }
+  SECTION("errors") {
+    REQUIRE(link.inject(TO_SERVER, "FOO bar\r\nGET\r\nSET a b c\r\n"));
+    REQUIRE(link.take(TO_CLIENT, 1000, std::chrono::milliseconds(200)) ==
+            "-ERR unknown command 'FOO'\r\n"
+            "-ERR wrong number of arguments for 'GET' command\r\n"
+            "-ERR wrong number of arguments for 'SET' command\r\n");
+    // the protocol error is the last reply
+    REQUIRE(link.inject(TO_SERVER, "PING\r\n*1\r\n!x\r\nPING\r\n"));
+    REQUIRE(link.take(TO_CLIENT, 1000) ==
+            "+PONG\r\n-ERR Protocol error: RESP: bad type !\r\n");
+    REQUIRE(link.ended(TO_CLIENT));
+  }
+  SECTION("quit after the replies before it") {
+    REQUIRE(link.inject(TO_SERVER, "SET a 1\r\nQUIT\r\nGET a\r\n"));
+    REQUIRE(link.take(TO_CLIENT, 1000) == "+OK\r\n+OK\r\n");
+    REQUIRE(link.ended(TO_CLIENT));
+  }
+  REQUIRE_THROWS_AS(srv.command("", 1, nullptr), std::invalid_argument);
+}
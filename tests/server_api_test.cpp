@@ -1,47 +1,29 @@
 #include <tepsoc.hpp>
 
-#include "mock_server.hpp"
+#include "fake_network.hpp"
 
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory_resource>
 #include <mutex>
 #include <thread>
 
 #include <catch2/catch.hpp>
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
 #include <unistd.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 using namespace tp;
 using namespace tp::net;
 
-auto barrier = [](int n) {
-  static std::condition_variable barrier_cv;
-  static std::mutex m;
-  static int x = 0;
-  int notif = 0;
-  {
-    std::unique_lock<std::mutex> lk(m);
-    x++;
-    if (x >= n)
-      notif = 1;
-  }
-  if (notif == 1) {
-    barrier_cv.notify_all();
-  } else {
-    std::unique_lock<std::mutex> lk(m);
-    // barrier_cv.wait(lk, [n]() { return x >= n; });
-    if (!(barrier_cv.wait_for(lk, std::chrono::milliseconds(1000),
-                              [n]() { return x >= n; })))
-      throw std::invalid_argument("BARRIER TIMED OUT!");
-    x = 0;
-  }
-};
-
 TEST_CASE("create simple server", "[server]") {
   using namespace tp::net;
   SECTION("create server") {
@@ -76,44 +58,626 @@ TEST_CASE("create simple server", "[server]") {
   }
 
   SECTION("we should be able to accept connection") {
-    bool ok = false;
-    tp::net::server srv([&](tp::net::socket &) {
-      ok = true;
-      barrier(2);
-    });
-    srv.on(LISTENING, [&ok]() {});
-    srv.listen(2212);
+    std::atomic<bool> ok(false);
+    tp::net::server srv([&ok](tp::net::socket &) { ok = true; });
+    fake_link link;
+    srv.adopt(link.server_end());
 
-    // connect to :D
     tp::net::socket client;
-    client.on(CONNECT, [&]() { client.end(); }).connect(2212, "127.0.0.1");
-
-    barrier(2);
-    REQUIRE(ok);
+    client.on(CONNECT, [&]() { client.end(); }).wrap(link.client_end());
+    REQUIRE(eventually([&ok]() { return ok.load(); }));
   }
   SECTION("we should be able to accept connection and send data") {
-
-    std::string result = "";
+    std::promise<std::string> result;
     tp::net::server srv;
-    srv.on(CONNECTION,[&](tp::net::socket_p s) {
+    srv.on(CONNECTION, [&](tp::net::socket_p s) {
       s->write("hi from server");
       s->end();
     });
-    srv.on(LISTENING, [&]() {});
-    srv.listen(7755);
+    fake_link link;
+    srv.adopt(link.server_end());
+    link.run();
 
-    // connect to :D
     tp::net::socket client;
-    client.on(CONNECT, [&]() { client.end(); })
+    client
         .on(DATA,
             [&](std::string s) {
-              result = s;
+              result.set_value(s);
               client.end();
-              barrier(2);
             })
-        .connect(7755, "127.0.0.1");
+        .wrap(link.client_end());
+    auto f = result.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+    REQUIRE(f.get() == "hi from server");
+  }
+}
+
+TEST_CASE("server admission control", "[server]") {
+  event_loop loop;
+  loop.start();
+  server srv(loop, [](tp::net::socket &s) { s.on(DATA, [](std::string) {}); });
+  srv.on(LISTENING, []() {});
+
+  SECTION("connections over the limit are dropped") {
+    admission_limits limits;
+    limits.max_connections = 2;
+    limits.policy = DROP_CONNECTIONS;
+    srv.set_limits(limits).listen(7761, "127.0.0.1");
+    int c[3];
+    for (auto &s : c)
+      s = raw_connect(7761);
+    REQUIRE(eventually([&]() { return srv.get_stats().accepted == 2; }));
+    REQUIRE(eventually(
+        [&]() { return srv.get_stats().rejected_max_connections == 1; }));
+    char buf[1];
+    REQUIRE(::recv(c[2], buf, 1, 0) <= 0);
+    REQUIRE(srv.get_stats().active == 2);
+    for (auto s : c)
+      ::close(s);
+  }
+  SECTION("accepting is paused until connection ends") {
+    admission_limits limits;
+    limits.max_connections = 1;
+    srv.set_limits(limits).listen(7762, "127.0.0.1");
+    int first = raw_connect(7762);
+    REQUIRE(eventually([&]() { return srv.get_stats().accepted == 1; }));
+    int second = raw_connect(7762);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(srv.get_stats().accepted == 1);
+    REQUIRE(srv.get_stats().pauses == 1);
+    ::close(first);
+    REQUIRE(eventually([&]() { return srv.get_stats().accepted == 2; }));
+    REQUIRE(srv.get_stats().rejected_max_connections == 0);
+    ::close(second);
+  }
+  SECTION("connections from one address are limited") {
+    admission_limits limits;
+    limits.max_connections_per_ip = 1;
+    srv.set_limits(limits).listen(7763, "127.0.0.1");
+    int first = raw_connect(7763);
+    int second = raw_connect(7763);
+    REQUIRE(eventually(
+        [&]() { return srv.get_stats().rejected_per_ip == 1; }));
+    REQUIRE(srv.get_stats().accepted == 1);
+    ::close(first);
+    ::close(second);
+    REQUIRE(eventually([&]() { return srv.get_stats().active == 0; }));
+    int third = raw_connect(7763);
+    REQUIRE(eventually([&]() { return srv.get_stats().accepted == 2; }));
+    ::close(third);
+  }
+  SECTION("accept rate is limited by token bucket") {
+    admission_limits limits;
+    limits.accept_rate = 20;
+    limits.accept_burst = 1;
+    srv.set_limits(limits).listen(7764, "127.0.0.1");
+    auto start = std::chrono::steady_clock::now();
+    int c[3];
+    for (auto &s : c)
+      s = raw_connect(7764);
+    REQUIRE(eventually([&]() { return srv.get_stats().accepted == 3; }));
+    REQUIRE(std::chrono::steady_clock::now() - start >=
+            std::chrono::milliseconds(90));
+    REQUIRE(srv.get_stats().rejected_rate == 0);
+    for (auto s : c)
+      ::close(s);
+  }
+}
+
+TEST_CASE("server broadcast", "[server]") {
+  event_loop loop;
+  loop.start();
+  std::mutex m;
+  std::vector<tp::net::socket *> connections;
+  server srv(loop, [&](tp::net::socket &s) {
+    s.on(DATA, [](std::string) {});
+    std::lock_guard<std::mutex> lock(m);
+    connections.push_back(&s);
+  });
+  srv.on(LISTENING, []() {});
+
+  SECTION("payload reaches connections accepted by the filter") {
+    srv.listen(7773, "127.0.0.1");
+    int c[3];
+    for (auto &s : c)
+      s = raw_connect(7773);
+    // accepted is counted before the connection handler runs
+    REQUIRE(eventually([&]() {
+      std::lock_guard<std::mutex> lock(m);
+      return connections.size() == 3;
+    }));
+    tp::net::socket *excluded;
+    {
+      std::lock_guard<std::mutex> lock(m);
+      excluded = connections[0];
+    }
+    auto result = srv.broadcast(
+        "update", [excluded](tp::net::socket &s) { return &s != excluded; });
+    REQUIRE(result.sent == 2);
+    REQUIRE(result.skipped == 0);
+    result = srv.broadcast("all");
+    REQUIRE(result.sent == 3);
+    int got_update = 0;
+    for (auto s : c) {
+      std::string received;
+      char buf[64];
+      while (received.find("all") == std::string::npos) {
+        auto n = ::recv(s, buf, sizeof(buf), 0);
+        REQUIRE(n > 0);
+        received.append(buf, n);
+      }
+      if (received == "updateall")
+        got_update++;
+      else
+        REQUIRE(received == "all");
+      ::close(s);
+    }
+    REQUIRE(got_update == 2);
+  }
+  SECTION("slow consumer is skipped") {
+    srv.listen(7776, "127.0.0.1");
+    int slow = raw_connect(7776);
+    REQUIRE(eventually([&]() {
+      std::lock_guard<std::mutex> lock(m);
+      return connections.size() == 1;
+    }));
+    auto payload = std::make_shared<const std::vector<char>>(64 * 1024, 'x');
+    broadcast_result result;
+    for (int i = 0; (i < 1000) && (result.skipped == 0); i++)
+      result = srv.broadcast(payload, nullptr, 256 * 1024);
+    REQUIRE(result.skipped == 1);
+    REQUIRE(srv.get_stats().broadcast_skipped == 1);
+    {
+      std::lock_guard<std::mutex> lock(m);
+      auto queued = connections[0]->get_queued_bytes();
+      REQUIRE(queued > 256 * 1024);
+      REQUIRE(queued <= 256 * 1024 + payload->size());
+    }
+    ::close(slow);
+  }
+}
+
+TEST_CASE("socket owned writes", "[server]") {
+  event_loop loop;
+  loop.start();
+  auto released = std::make_shared<std::atomic<bool>>(false);
+  std::string big(4 * 1024 * 1024, 'a');
+  server srv(loop, [&](tp::net::socket &s) {
+    s.on(DATA, [](std::string) {});
+    s.write(std::move(big));
+    s.write(std::vector<char>{'b', 'c'});
+    s.write("def", 2);
+    auto tail = std::make_shared<std::string>("tail");
+    std::shared_ptr<const void> owner(tail.get(), [tail, released](const void *) {
+      *released = true;
+    });
+    s.write(owned_buffer(std::move(owner), tail->data(), tail->size()));
+  });
+  srv.on(LISTENING, []() {}).listen(7777, "127.0.0.1");
+
+  int c = raw_connect(7777);
+  REQUIRE(eventually([&]() { return srv.get_stats().accepted == 1; }));
+  // the adopted storage is kept until it is sent
+  REQUIRE_FALSE(*released);
+  std::string received;
+  std::vector<char> buf(64 * 1024);
+  while (received.size() < 4 * 1024 * 1024 + 8) {
+    auto n = ::recv(c, buf.data(), buf.size(), 0);
+    REQUIRE(n > 0);
+    received.append(buf.data(), n);
+  }
+  REQUIRE(received.size() == 4 * 1024 * 1024 + 8);
+  REQUIRE(received.substr(4 * 1024 * 1024) == "bcdetail");
+  REQUIRE(received.find_first_not_of('a') == 4 * 1024 * 1024);
+  REQUIRE(eventually([&]() { return released->load(); }));
+  ::close(c);
+}
+
+TEST_CASE("socket half close", "[server]") {
+  event_loop loop;
+  loop.start();
+  std::atomic<int> finished(0);
+  std::atomic<bool> half_open(false);
+  std::atomic<tp::net::socket *> accepted(nullptr);
+  server srv(loop, [&](tp::net::socket &s) {
+    accepted = &s;
+    s.set_allow_half_open(half_open)
+        .on(DATA, [](std::string) {})
+        .on(END, [&s]() { s.write("late"); })
+        .on(FINISH, [&finished]() { finished++; });
+  });
+  srv.on(LISTENING, []() {});
+  auto receive_all = [](int c) {
+    std::string received;
+    char buf[64];
+    long n;
+    while ((n = ::recv(c, buf, sizeof(buf), 0)) > 0)
+      received.append(buf, n);
+    return received;
+  };
+
+  SECTION("half open connection is written until it is ended") {
+    half_open = true;
+    srv.listen(7781, "127.0.0.1");
+    int c = raw_connect(7781);
+    REQUIRE(::send(c, "x", 1, 0) == 1);
+    ::shutdown(c, SHUT_WR);
+    REQUIRE(eventually([&]() { return srv.get_stats().accepted == 1; }));
+    // the peer ended, but the connection stays open for writing
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(srv.get_stats().active == 1);
+    REQUIRE(finished == 0);
+    (*accepted).end("more");
+    REQUIRE(receive_all(c) == "latemore");
+    REQUIRE(eventually([&]() { return finished == 1; }));
+    REQUIRE(eventually([&]() { return srv.get_stats().active == 0; }));
+    ::close(c);
+  }
+  SECTION("connection is closed when the peer ends") {
+    srv.listen(7782, "127.0.0.1");
+    int c = raw_connect(7782);
+    ::shutdown(c, SHUT_WR);
+    REQUIRE(receive_all(c) == "late");
+    REQUIRE(eventually([&]() { return srv.get_stats().active == 0; }));
+    REQUIRE(finished == 0);
+    ::close(c);
+  }
+  SECTION("FINISH is emitted when the write side is shut down") {
+    srv.listen(7783, "127.0.0.1");
+    std::promise<void> done;
+    tp::net::socket client(loop);
+    client.on(CONNECT, [&client]() { client.end("bye"); })
+        .on(FINISH, [&done]() { done.set_value(); })
+        .connect(7783, "127.0.0.1");
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(5)) ==
+            std::future_status::ready);
+  }
+}
 
-    barrier(2);
-    REQUIRE(result == "hi from server");
+TEST_CASE("socket flow control", "[server]") {
+  event_loop loop;
+  loop.start();
+  std::mutex m;
+  std::string received;
+  std::atomic<bool> ended(false);
+  std::atomic<bool> without_handler(false);
+  std::atomic<tp::net::socket *> accepted(nullptr);
+  auto on_data = [&](std::string d) {
+    std::lock_guard<std::mutex> lock(m);
+    received += d;
+  };
+  server srv(loop, [&](tp::net::socket &s) {
+    if (without_handler)
+      s.set_receive_limit(64 * 1024).on(ERROR, [](std::string) {});
+    else
+      s.pause().on(DATA, on_data);
+    s.on(END, [&ended]() { ended = true; });
+    accepted = &s;
+  });
+  srv.on(LISTENING, []() {});
+  // send until the receiver stops taking data
+  auto fill = [](int c) {
+    std::string sent;
+    std::string chunk(64 * 1024, ' ');
+    for (int waits = 0; (waits < 5) && (sent.size() < 64 * 1024 * 1024);) {
+      for (std::size_t i = 0; i < chunk.size(); i++)
+        chunk[i] = 'a' + (sent.size() + i) % 26;
+      auto n = ::send(c, chunk.data(), chunk.size(), MSG_DONTWAIT);
+      if (n > 0) {
+        sent.append(chunk.data(), n);
+        waits = 0;
+      } else {
+        waits++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      }
+    }
+    return sent;
+  };
+
+  SECTION("paused connection is not read until it is resumed") {
+    srv.listen(7784, "127.0.0.1");
+    int c = raw_connect(7784);
+    REQUIRE(c >= 0);
+    REQUIRE(eventually([&]() { return accepted != nullptr; }));
+    auto sent = fill(c);
+    REQUIRE(sent.size() < 64 * 1024 * 1024);
+    {
+      std::lock_guard<std::mutex> lock(m);
+      REQUIRE(received.empty());
+    }
+    REQUIRE((*accepted).is_paused());
+    (*accepted).resume();
+    ::shutdown(c, SHUT_WR);
+    REQUIRE(eventually([&]() { return ended.load(); }));
+    std::lock_guard<std::mutex> lock(m);
+    REQUIRE(received == sent);
+    ::close(c);
+  }
+  SECTION("data without handler is kept up to the limit") {
+    without_handler = true;
+    srv.listen(7785, "127.0.0.1");
+    int c = raw_connect(7785);
+    REQUIRE(c >= 0);
+    REQUIRE(eventually([&]() { return accepted != nullptr; }));
+    auto sent = fill(c);
+    REQUIRE(sent.size() < 64 * 1024 * 1024);
+    (*accepted).on(DATA, on_data);
+    ::shutdown(c, SHUT_WR);
+    REQUIRE(eventually([&]() { return ended.load(); }));
+    std::lock_guard<std::mutex> lock(m);
+    REQUIRE(received == sent);
+    ::close(c);
+  }
+}
+
+/**
+ * counts allocations that are not returned yet
+ * */
+struct counting_resource : public std::pmr::memory_resource {
+  std::atomic<int> allocated{0};
+  std::atomic<int> outstanding{0};
+  std::atomic<int> *leaked;
+  explicit counting_resource(std::atomic<int> *leaked_) : leaked(leaked_) {}
+  ~counting_resource() { *leaked += outstanding; }
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    allocated++;
+    outstanding++;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void *p, std::size_t bytes,
+                     std::size_t alignment) override {
+    outstanding--;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+};
+
+TEST_CASE("server memory resource", "[server]") {
+  event_loop loop;
+  loop.start();
+  std::mutex m;
+  std::vector<std::weak_ptr<counting_resource>> resources;
+  std::atomic<int> leaked(0);
+  server srv(loop, [](tp::net::socket &s) {
+    s.on(DATA, [&s](std::string data) { s.write(data); });
+  });
+  srv.on(LISTENING, []() {})
+      .set_memory_resource([&]() {
+        auto r = std::make_shared<counting_resource>(&leaked);
+        std::lock_guard<std::mutex> lock(m);
+        resources.push_back(r);
+        return r;
+      })
+      .listen(7775, "127.0.0.1");
+
+  int c = raw_connect(7775);
+  REQUIRE(::send(c, "hello", 5, 0) == 5);
+  char buf[5];
+  REQUIRE(::recv(c, buf, 5, MSG_WAITALL) == 5);
+  std::weak_ptr<counting_resource> resource;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    REQUIRE(resources.size() == 1);
+    resource = resources[0];
+  }
+  if (auto r = resource.lock()) {
+    REQUIRE(r->allocated > 0);
+    REQUIRE(r->outstanding > 0);
+  } else {
+    FAIL("resource released while connected");
+  }
+  ::close(c);
+  // released in bulk with the connection
+  REQUIRE(eventually([&]() { return resource.expired(); }));
+  REQUIRE(leaked == 0);
+}
+
+TEST_CASE("server adopts connections", "[server]") {
+  event_loop loop;
+  loop.start();
+  std::atomic<int> connections(0);
+  server srv(loop, [&connections](tp::net::socket &s) {
+    connections++;
+    s.on(DATA, [&s](std::string d) { s.write("<" + d + ">"); })
+        .on(END, [&s]() { s.end("bye"); });
+  });
+  fake_link link(0, GENERATE(UNIX_LINK, TCP_LINK));
+  srv.adopt(link.server_end());
+  REQUIRE(eventually([&]() { return connections == 1; }));
+  // request split in the middle is answered twice
+  REQUIRE(link.inject(TO_SERVER, "GET /", 3));
+  REQUIRE(link.take(TO_CLIENT, 9) == "<GET>< />");
+  link.end(TO_SERVER);
+  REQUIRE(link.take(TO_CLIENT, 100) == "bye");
+  REQUIRE(link.ended(TO_CLIENT));
+  REQUIRE_THROWS_AS(srv.adopt(-1), std::invalid_argument);
+}
+
+TEST_CASE("server shared connection handlers", "[server]") {
+  event_loop loop;
+  loop.start();
+  struct counter_t {
+    int messages = 0;
+  };
+  std::atomic<int> ended(0);
+  server srv(loop, [](tp::net::socket &s) {
+    s.set_context(std::make_shared<counter_t>());
+  });
+  connection_handlers handlers;
+  handlers.data = [](tp::net::socket &s, std::string_view data) {
+    auto counter = s.get_context<counter_t>();
+    s.write(std::to_string(++counter->messages) + ":" + std::string(data));
+  };
+  handlers.end = [&ended](tp::net::socket &s) {
+    // the context is typed
+    if (s.get_context<counter_t>() && !s.get_context<int>())
+      ended++;
+    s.end("bye");
+  };
+  srv.set_connection_handlers(handlers);
+
+  SECTION("every connection has its own context") {
+    fake_link a, b;
+    srv.adopt(a.server_end());
+    srv.adopt(b.server_end());
+    REQUIRE(a.inject(TO_SERVER, "x"));
+    REQUIRE(a.take(TO_CLIENT, 3) == "1:x");
+    REQUIRE(a.inject(TO_SERVER, "y"));
+    REQUIRE(a.take(TO_CLIENT, 3) == "2:y");
+    REQUIRE(b.inject(TO_SERVER, "z"));
+    REQUIRE(b.take(TO_CLIENT, 3) == "1:z");
+    a.end(TO_SERVER);
+    REQUIRE(a.take(TO_CLIENT, 100) == "bye");
+    REQUIRE(a.ended(TO_CLIENT));
+    REQUIRE(ended == 1);
+  }
+  SECTION("handler of the socket is used instead") {
+    server own(loop, [](tp::net::socket &s) {
+      s.on(DATA, [&s](std::string data) { s.write("own:" + data); });
+    });
+    own.set_connection_handlers(handlers);
+    fake_link link;
+    own.adopt(link.server_end());
+    REQUIRE(link.inject(TO_SERVER, "x"));
+    REQUIRE(link.take(TO_CLIENT, 5) == "own:x");
+    // END is still shared
+    link.end(TO_SERVER);
+    REQUIRE(link.take(TO_CLIENT, 100) == "bye");
+  }
+}
+
+TEST_CASE("server listens on given sockets", "[server]") {
+  event_loop loop;
+  loop.start();
+  std::atomic<int> connections(0);
+  server srv(loop, [&connections](tp::net::socket &s) {
+    connections++;
+    s.end("hi");
+  });
+
+  SECTION("already listening socket is served") {
+    int l = ::socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(l, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(7788);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(::bind(l, (sockaddr *)&addr, sizeof(addr)) == 0);
+    REQUIRE(::listen(l, 16) == 0);
+    // connection waiting in the backlog before the server starts
+    int c = raw_connect(7788);
+    REQUIRE(c >= 0);
+    unsigned int port = 0;
+    std::string name;
+    srv.on(LISTENING, [&](unsigned int p, std::string n) {
+         port = p;
+         name = n;
+       })
+        .listen_fds({l});
+    REQUIRE(port == 7788);
+    REQUIRE(name == "127.0.0.1");
+    char buf[8];
+    REQUIRE(::recv(c, buf, sizeof(buf), 0) == 2);
+    ::close(c);
+    REQUIRE(connections == 1);
+  }
+  SECTION("sockets are kept open across exec only when shared") {
+    srv.on(LISTENING, []() {}).listen(7789, "127.0.0.1");
+    int l = srv.get_listening_sockets().at(0);
+    std::string exists =
+        "[ -S /proc/self/fd/" + std::to_string(l) + " ] 2>/dev/null";
+    REQUIRE(system(exists.c_str()) != 0);
+    REQUIRE(srv.share_listening_sockets() == std::to_string(l));
+    REQUIRE(system(exists.c_str()) == 0);
+  }
+  SECTION("inherited sockets are taken from the environment once") {
+    setenv("TEPSOC_LISTEN_FDS", "7,9", 1);
+    REQUIRE(server::inherited_listeners() == std::vector<int>{7, 9});
+    REQUIRE(server::inherited_listeners().empty());
+    // systemd passes descriptors from 3 to this process only
+    setenv("LISTEN_PID", std::to_string(getpid()).c_str(), 1);
+    setenv("LISTEN_FDS", "2", 1);
+    REQUIRE(server::inherited_listeners() == std::vector<int>{3, 4});
+    setenv("LISTEN_PID", std::to_string(getpid() + 1).c_str(), 1);
+    setenv("LISTEN_FDS", "2", 1);
+    REQUIRE(server::inherited_listeners().empty());
+    REQUIRE(getenv("LISTEN_FDS") == nullptr);
+  }
+  SECTION("other descriptors are rejected") {
+    int s = ::socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE_THROWS_AS(srv.listen_fds({s}), std::invalid_argument);
+    REQUIRE_THROWS_AS(srv.listen_fds({-1}), std::invalid_argument);
+    ::close(s);
+    REQUIRE(srv.get_listening_sockets().empty());
+  }
+}
+
+TEST_CASE("server hands connections to the next process", "[server]") {
+  event_loop loop;
+  loop.start();
+  // replies count the requests on the connection, the next process continues
+  // from the count given in the handoff state
+  std::map<tp::net::socket *, int> counts;
+  server srv(loop, [&counts](tp::net::socket &s) {
+    s.on(DATA, [&s, &counts](std::string d) {
+      s.write("old" + std::to_string(++counts[&s]) + d);
+      // the next request waits for the handoff
+      s.pause();
+    });
+  });
+  srv.on(LISTENING, []() {}).listen(7794, "127.0.0.1");
+  int c = raw_connect(7794);
+  REQUIRE(c >= 0);
+  struct timeval tv = {5, 0};
+  setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  auto request = [c](std::string r) {
+    char buf[64];
+    ::send(c, r.data(), r.size(), MSG_NOSIGNAL);
+    long n = ::recv(c, buf, sizeof(buf), 0);
+    return std::string(buf, std::max(n, 0L));
+  };
+  REQUIRE(request("a") == "old1a");
+  ::send(c, "b", 1, MSG_NOSIGNAL);
+
+  pid_t child = fork();
+  if (child == 0) {
+    // the client end is not ours, the client closes it. New loop, the
+    // threads of the parent are not in this process.
+    ::close(c);
+    event_loop next_loop;
+    next_loop.start();
+    server next(next_loop, [](tp::net::socket &s) {
+      auto count = std::make_shared<int>(std::stoi(s.get_handoff_state()));
+      s.on(DATA, [&s, count](std::string d) {
+        s.write("new" + std::to_string(++*count) + d);
+      });
+    });
+    bool ok = next.take_over("@tepsoc_hand_over_test") == 1;
+    // serve until the client leaves
+    ok = ok && eventually([&]() { return next.get_stats().accepted == 1; });
+    for (int i = 0; ok && (i < 500) && next.get_stats().active; i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    _exit((ok && (next.get_stats().active == 0)) ? 0 : 1);
   }
+  REQUIRE(child > 0);
+  REQUIRE(srv.hand_over("@tepsoc_hand_over_test",
+                        [&counts](tp::net::socket &s) {
+                          return std::to_string(counts[&s]);
+                        }) == 1);
+  REQUIRE(srv.get_listening_sockets().empty());
+  REQUIRE(eventually([&]() { return srv.get_stats().active == 0; }));
+  // the request sent during the handoff is answered by the next process
+  char buf[64];
+  long n = ::recv(c, buf, sizeof(buf), 0);
+  REQUIRE(std::string(buf, std::max(n, 0L)) == "new2b");
+  REQUIRE(request("c") == "new3c");
+  ::close(c);
+  int status = -1;
+  REQUIRE(waitpid(child, &status, 0) == child);
+  REQUIRE(WIFEXITED(status));
+  REQUIRE(WEXITSTATUS(status) == 0);
 }
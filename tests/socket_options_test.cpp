@@ -0,0 +1,108 @@
+#include <tepsoc.hpp>
+
+#include <chrono>
+#include <future>
+#include <string>
+
+#include <catch2/catch.hpp>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+using namespace tp::net;
+
+static int get_option(int fd, int level, int name) {
+  int v = -1;
+  socklen_t len = sizeof(v);
+  if (getsockopt(fd, level, name, &v, &len) == -1)
+    return -1;
+  return v;
+}
+
+TEST_CASE("socket options", "[options]") {
+  event_loop loop;
+  loop.start();
+  socket_options options;
+  options.no_delay = true;
+  options.receive_buffer = 65536;
+  options.keep_alive = true;
+  options.keep_idle = 30;
+  options.keep_interval = 5;
+  options.keep_count = 3;
+  options.not_sent_lowat = 16384;
+
+  SECTION("options are applied to listening and accepted sockets") {
+    std::promise<int> accepted;
+    server srv(loop, [&accepted](tp::net::socket &s) {
+      s.on(DATA, [](std::string) {});
+      accepted.set_value(s.get_wrapped_socket());
+    });
+    socket_options listening = options;
+    listening.defer_accept = 1;
+    srv.set_options(listening).listen(7765, "127.0.0.1");
+    REQUIRE(srv.get_listening_sockets().size() == 1);
+    int l = srv.get_listening_sockets()[0];
+    REQUIRE(get_option(l, IPPROTO_TCP, TCP_DEFER_ACCEPT) > 0);
+
+    tp::net::socket client(loop);
+    // deferred accept waits for data
+    client.on(CONNECT, [&client]() { client.write("x"); })
+        .on(DATA, [](std::string) {})
+        .connect(7765, "127.0.0.1");
+    auto f = accepted.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    int fd = f.get();
+    REQUIRE(get_option(fd, IPPROTO_TCP, TCP_NODELAY) == 1);
+    // kernel doubles the buffer size for bookkeeping
+    REQUIRE(get_option(fd, SOL_SOCKET, SO_RCVBUF) >= 65536);
+    REQUIRE(get_option(fd, SOL_SOCKET, SO_KEEPALIVE) == 1);
+    REQUIRE(get_option(fd, IPPROTO_TCP, TCP_KEEPIDLE) == 30);
+    REQUIRE(get_option(fd, IPPROTO_TCP, TCP_KEEPINTVL) == 5);
+    REQUIRE(get_option(fd, IPPROTO_TCP, TCP_KEEPCNT) == 3);
+    REQUIRE(get_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT) == 16384);
+  }
+  SECTION("options are applied to connecting and connected sockets") {
+    server srv(loop,
+               [](tp::net::socket &s) { s.on(DATA, [](std::string) {}); });
+    srv.listen(7766, "127.0.0.1");
+    std::promise<int> connected;
+    tp::net::socket client(loop);
+    client.set_options(options)
+        .on(CONNECT,
+            [&]() { connected.set_value(client.get_wrapped_socket()); })
+        .on(DATA, [](std::string) {})
+        .connect(7766, "127.0.0.1");
+    auto f = connected.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    int fd = f.get();
+    REQUIRE(get_option(fd, IPPROTO_TCP, TCP_NODELAY) == 1);
+    REQUIRE(get_option(fd, SOL_SOCKET, SO_RCVBUF) >= 65536);
+    REQUIRE(get_option(fd, IPPROTO_TCP, TCP_KEEPIDLE) == 30);
+
+    socket_options changed;
+    changed.no_delay = false;
+    changed.send_buffer = 32768;
+    client.set_options(changed);
+    REQUIRE(get_option(fd, IPPROTO_TCP, TCP_NODELAY) == 0);
+    REQUIRE(get_option(fd, SOL_SOCKET, SO_SNDBUF) >= 32768);
+  }
+  SECTION("failed option is reported as error") {
+    server srv(loop,
+               [](tp::net::socket &s) { s.on(DATA, [](std::string) {}); });
+    srv.listen(7767, "127.0.0.1");
+    std::string error;
+    tp::net::socket client(loop);
+    std::promise<void> connected;
+    socket_options bad;
+    bad.keep_idle = -1;
+    client.on(ERROR, [&error](std::string e) { error = e; })
+        .on(CONNECT, [&]() { connected.set_value(); })
+        .on(DATA, [](std::string) {})
+        .set_options(bad)
+        .connect(7767, "127.0.0.1");
+    REQUIRE(connected.get_future().wait_for(std::chrono::seconds(5)) ==
+            std::future_status::ready);
+    REQUIRE(error.find("TCP_KEEPIDLE") != std::string::npos);
+  }
+}
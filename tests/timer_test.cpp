@@ -0,0 +1,103 @@
+#include <tepsoc_timer.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+using namespace tp::net;
+
+static void run_until(timer_wheel &wheel, std::uint64_t t) {
+  for (std::uint64_t now = wheel.now() + 1; now <= t; now++) {
+    wheel.advance(now);
+    while (auto cb = wheel.pop_expired())
+      (*cb)();
+  }
+}
+
+TEST_CASE("timer wheel", "[timer]") {
+  timer_wheel wheel;
+  std::vector<std::string> fired;
+
+  SECTION("timers expire in order of their deadlines") {
+    wheel.add(30, 0, [&]() { fired.push_back("c"); });
+    wheel.add(10, 0, [&]() { fired.push_back("a"); });
+    wheel.add(20, 0, [&]() { fired.push_back("b"); });
+    REQUIRE(wheel.ticks_to_next() == 10);
+    run_until(wheel, 15);
+    REQUIRE(fired == std::vector<std::string>{"a"});
+    run_until(wheel, 40);
+    REQUIRE(fired == std::vector<std::string>{"a", "b", "c"});
+    REQUIRE(wheel.size() == 0);
+    REQUIRE(wheel.ticks_to_next() == -1);
+  }
+  SECTION("cancelled timer does not fire") {
+    auto id = wheel.add(10, 0, [&]() { fired.push_back("a"); });
+    REQUIRE(wheel.cancel(id));
+    REQUIRE_FALSE(wheel.cancel(id));
+    run_until(wheel, 20);
+    REQUIRE(fired.empty());
+  }
+  SECTION("restarted timer fires at the new deadline") {
+    auto id = wheel.add(10, 0, [&]() { fired.push_back("a"); });
+    run_until(wheel, 5);
+    REQUIRE(wheel.restart(id, 10));
+    run_until(wheel, 14);
+    REQUIRE(fired.empty());
+    run_until(wheel, 15);
+    REQUIRE(fired == std::vector<std::string>{"a"});
+  }
+  SECTION("interval timer is armed again") {
+    auto id = wheel.add(3, 3, [&]() { fired.push_back("i"); });
+    run_until(wheel, 10);
+    REQUIRE(fired.size() == 3);
+    wheel.cancel(id);
+    run_until(wheel, 20);
+    REQUIRE(fired.size() == 3);
+  }
+  SECTION("long timers are cascaded to lower levels") {
+    wheel.add(70000, 0, [&]() { fired.push_back("long"); });
+    wheel.add(300, 0, [&]() { fired.push_back("short"); });
+    wheel.advance(69999);
+    while (auto cb = wheel.pop_expired())
+      (*cb)();
+    REQUIRE(fired == std::vector<std::string>{"short"});
+    REQUIRE(wheel.ticks_to_next() == 1);
+    wheel.advance(70000);
+    while (auto cb = wheel.pop_expired())
+      (*cb)();
+    REQUIRE(fired == std::vector<std::string>{"short", "long"});
+  }
+  SECTION("timers beyond the last level are kept") {
+    std::uint64_t far = (1ull << 33) + 5;
+    wheel.add(far, 0, [&]() { fired.push_back("far"); });
+    wheel.advance(far - 1);
+    REQUIRE(wheel.pop_expired() == nullptr);
+    wheel.advance(far);
+    auto cb = wheel.pop_expired();
+    REQUIRE(cb != nullptr);
+    (*cb)();
+    REQUIRE(fired == std::vector<std::string>{"far"});
+  }
+  SECTION("timers fire at their deadlines when time jumps") {
+    std::mt19937 rng(7);
+    std::vector<std::uint64_t> late;
+    for (int i = 0; i < 2000; i++) {
+      std::uint64_t delay = 1 + rng() % (1u << (1 + rng() % 24));
+      std::uint64_t deadline = delay;
+      wheel.add(delay, 0, [&, deadline]() {
+        if (wheel.now() != deadline)
+          late.push_back(deadline);
+      });
+    }
+    while (wheel.size()) {
+      auto ticks = wheel.ticks_to_next();
+      REQUIRE(ticks > 0);
+      wheel.advance(wheel.now() + ticks);
+      while (auto cb = wheel.pop_expired())
+        (*cb)();
+    }
+    REQUIRE(late.empty());
+  }
+}
@@ -0,0 +1,208 @@
+#ifdef TEPSOC_TLS
+
+#include <tepsoc.hpp>
+#include <tepsoc_tls.hpp>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace tp::net;
+
+/**
+ * self signed certificate for localhost and 127.0.0.1 in temporary files
+ * */
+struct test_certificate {
+  std::string certificate_file;
+  std::string private_key_file;
+
+  test_certificate() {
+    EVP_PKEY *key = EVP_EC_gen("P-256");
+    X509 *cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               (const unsigned char *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509V3_CTX ctx;
+    X509V3_set_ctx_nodb(&ctx);
+    X509V3_set_ctx(&ctx, cert, cert, nullptr, nullptr, 0);
+    for (auto [nid, value] :
+         {std::pair<int, const char *>{NID_subject_alt_name,
+                                       "DNS:localhost,IP:127.0.0.1"},
+          {NID_basic_constraints, "critical,CA:TRUE"}}) {
+      X509_EXTENSION *ext = X509V3_EXT_conf_nid(nullptr, &ctx, nid, value);
+      X509_add_ext(cert, ext, -1);
+      X509_EXTENSION_free(ext);
+    }
+    X509_sign(cert, key, EVP_sha256());
+
+    char cert_name[] = "/tmp/tepsoc_cert_XXXXXX";
+    char key_name[] = "/tmp/tepsoc_key_XXXXXX";
+    FILE *f = fdopen(mkstemp(cert_name), "w");
+    PEM_write_X509(f, cert);
+    fclose(f);
+    f = fdopen(mkstemp(key_name), "w");
+    PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr);
+    fclose(f);
+    certificate_file = cert_name;
+    private_key_file = key_name;
+    X509_free(cert);
+    EVP_PKEY_free(key);
+  }
+  ~test_certificate() {
+    ::unlink(certificate_file.c_str());
+    ::unlink(private_key_file.c_str());
+  }
+};
+
+/**
+ * connect, send data and wait for the echo
+ *
+ * @return received data or error
+ * */
+static std::string tls_echo(event_loop &loop, tls_context_p client_tls,
+                            unsigned int port, const std::string &data,
+                            tls_info &info) {
+  std::promise<std::string> result;
+  auto received = std::make_shared<std::string>();
+  tp::net::socket client(loop);
+  client.use_tls(client_tls, "localhost")
+      .on(ERROR, [&result](std::string err) { result.set_value(err); })
+      .on(CONNECT,
+          [&client, &info, data]() {
+            info = client.get_tls_info();
+            client.write(data);
+          })
+      .on(DATA,
+          [&client, &result, received, data](std::string d) {
+            *received += d;
+            if (received->size() == data.size()) {
+              // session tickets are processed with the data
+              result.set_value(*received);
+            }
+          })
+      .connect(port, "127.0.0.1");
+  auto f = result.get_future();
+  if (f.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+    return "timeout";
+  return f.get();
+}
+
+TEST_CASE("tls connections", "[tls]") {
+  event_loop loop;
+  loop.start();
+  test_certificate certificate;
+  tls_config server_config;
+  server_config.certificate_file = certificate.certificate_file;
+  server_config.private_key_file = certificate.private_key_file;
+  server_config.alpn = {"h2", "http/1.1"};
+  auto server_tls = tls_context::create_server(server_config);
+  tls_info server_info;
+  server srv(loop, [&server_info](tp::net::socket &s) {
+    server_info = s.get_tls_info();
+    s.on(DATA, [&s](std::string data) { s.write(data); });
+  });
+  srv.on(LISTENING, []() {}).use_tls(server_tls).listen(7774, "127.0.0.1");
+
+  tls_config client_config;
+  client_config.ca_file = certificate.certificate_file;
+  client_config.alpn = {"http/1.1"};
+
+  SECTION("data is echoed after handshake") {
+    auto client_tls = tls_context::create_client(client_config);
+    tls_info info;
+    std::string data(1000000, 'x');
+    for (std::size_t i = 0; i < data.size(); i += 997)
+      data[i] = 'a' + i % 26;
+    REQUIRE(tls_echo(loop, client_tls, 7774, data, info) == data);
+    REQUIRE(info.established);
+    REQUIRE(info.alpn == "http/1.1");
+    REQUIRE(!info.resumed);
+    REQUIRE(server_info.established);
+    REQUIRE(server_info.alpn == "http/1.1");
+  }
+  SECTION("the second connection resumes the session") {
+    auto client_tls = tls_context::create_client(client_config);
+    tls_info info;
+    REQUIRE(tls_echo(loop, client_tls, 7774, "first", info) == "first");
+    REQUIRE(!info.resumed);
+    REQUIRE(tls_echo(loop, client_tls, 7774, "second", info) == "second");
+    REQUIRE(info.resumed);
+    REQUIRE(server_info.resumed);
+  }
+  SECTION("untrusted certificate fails the handshake") {
+    client_config.ca_file = "";
+    auto client_tls = tls_context::create_client(client_config);
+    tls_info info;
+    auto err = tls_echo(loop, client_tls, 7774, "x", info);
+    REQUIRE(err.find("tls handshake") != std::string::npos);
+    REQUIRE(!info.established);
+  }
+  SECTION("wrong server name fails the handshake") {
+    auto client_tls = tls_context::create_client(client_config);
+    std::promise<std::string> result;
+    tp::net::socket client(loop);
+    client.use_tls(client_tls, "example.com")
+        .on(ERROR, [&result](std::string err) { result.set_value(err); })
+        .on(CONNECT, [&result]() { result.set_value("connected"); })
+        .connect(7774, "127.0.0.1");
+    auto f = result.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    REQUIRE(f.get().find("tls handshake") != std::string::npos);
+  }
+  SECTION("plain connection is piped to tls connection") {
+    auto client_tls = tls_context::create_client(client_config);
+    std::vector<std::shared_ptr<tp::net::socket>> upstreams;
+    server proxy(loop, [&](tp::net::socket &s) {
+      auto upstream = std::make_shared<tp::net::socket>(loop);
+      upstream->use_tls(client_tls, "localhost");
+      s.pipe(*upstream);
+      upstream->connect(7774, "127.0.0.1");
+      upstreams.push_back(upstream);
+    });
+    proxy.on(LISTENING, []() {}).listen(7780, "127.0.0.1");
+    std::string data(1000000, 'p');
+    std::promise<std::string> result;
+    auto received = std::make_shared<std::string>();
+    tp::net::socket client(loop);
+    client.on(CONNECT, [&client, data]() { client.write(data); })
+        .on(DATA,
+            [&result, received, data](std::string d) {
+              *received += d;
+              if (received->size() == data.size())
+                result.set_value(*received);
+            })
+        .connect(7780, "127.0.0.1");
+    auto f = result.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    REQUIRE(f.get() == data);
+  }
+  SECTION("contexts check their arguments") {
+    REQUIRE_THROWS_AS(tls_context::create_server(tls_config()),
+                      std::invalid_argument);
+    tls_config bad;
+    bad.certificate_file = "/nonexistent.pem";
+    REQUIRE_THROWS_AS(tls_context::create_client(bad), std::invalid_argument);
+    tp::net::socket s(loop);
+    REQUIRE_THROWS_AS(s.use_tls(server_tls), std::invalid_argument);
+  }
+}
+
+#endif
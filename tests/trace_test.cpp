@@ -0,0 +1,55 @@
+#include <tepsoc.hpp>
+#include <tepsoc_trace.hpp>
+
+#include "fake_network.hpp"
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <catch2/catch.hpp>
+
+using namespace tp;
+using namespace tp::net;
+
+static std::string chrome_trace() {
+  std::ostringstream out;
+  write_chrome_trace(out);
+  return out.str();
+}
+
+TEST_CASE("hot path trace", "[trace]") {
+  event_loop loop;
+  loop.start();
+  server srv(loop, [](tp::net::socket &s) {
+    s.on(DATA, [&s](std::string d) { s.write(d); });
+  });
+  clear_trace();
+  fake_link link;
+  srv.adopt(link.server_end());
+  REQUIRE(link.inject(TO_SERVER, "ping"));
+  REQUIRE(link.take(TO_CLIENT, 4) == "ping");
+  auto json = chrome_trace();
+  REQUIRE(json.rfind("{\"traceEvents\":[", 0) == 0);
+#ifdef TEPSOC_TRACE
+  REQUIRE(trace_enabled());
+  // the span is recorded when the handler returns
+  for (int i = 0; (i < 100) && (json.find("handler.data") == std::string::npos);
+       i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    json = chrome_trace();
+  }
+  for (auto name : {"loop.wait", "loop.posted", "server.connection",
+                    "handler.connection", "socket.recv", "socket.callbacks",
+                    "handler.data", "socket.send"})
+    REQUIRE(json.find(std::string("\"name\":\"") + name + "\"") !=
+            std::string::npos);
+  REQUIRE(json.find("\"ph\":\"X\"") != std::string::npos);
+  clear_trace();
+  REQUIRE(chrome_trace().find("handler.data") == std::string::npos);
+#else
+  REQUIRE(!trace_enabled());
+  REQUIRE(json.find("\"ph\"") == std::string::npos);
+#endif
+}
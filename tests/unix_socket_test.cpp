@@ -0,0 +1,152 @@
+#include <tepsoc.hpp>
+
+#include <chrono>
+#include <future>
+#include <string>
+
+#include <catch2/catch.hpp>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace tp::net;
+
+static std::string echo_unix(event_loop &loop, const std::string &path) {
+  server srv(loop, [](tp::net::socket &s) {
+    s.on(DATA, [&s](std::string data) { s.write(data); });
+  });
+  std::string listening;
+  srv.on(LISTENING, [&listening](unsigned int port, std::string addr) {
+    listening = std::to_string(port) + addr;
+  });
+  srv.listen_unix(path);
+  if (listening != "0" + path)
+    return "bad LISTENING: " + listening;
+
+  std::promise<std::string> result;
+  auto received = std::make_shared<std::string>();
+  tp::net::socket client(loop);
+  client.on(CONNECT, [&client]() { client.write(std::string(10000, 'u')); })
+      .on(DATA,
+          [&client, received](std::string data) {
+            *received += data;
+            if (received->size() == 10000)
+              client.end();
+          })
+      .on(END, [&result, received]() { result.set_value(*received); })
+      .connect_unix(path);
+  auto f = result.get_future();
+  if (f.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+    return "timeout";
+  return f.get();
+}
+
+TEST_CASE("unix domain sockets", "[unix]") {
+  event_loop loop;
+  loop.start();
+  std::string path = "/tmp/tepsoc_test_" + std::to_string(getpid()) + ".sock";
+
+  SECTION("echo over unix socket file") {
+    REQUIRE(echo_unix(loop, path) == std::string(10000, 'u'));
+    struct stat st;
+    REQUIRE(::stat(path.c_str(), &st) == -1);
+  }
+  SECTION("echo over abstract unix socket") {
+    REQUIRE(echo_unix(loop, "@tepsoc_test_" + std::to_string(getpid())) ==
+            std::string(10000, 'u'));
+  }
+  SECTION("file descriptors are passed after the data queued before them") {
+    const std::size_t before = 4 * 1024 * 1024;
+    std::promise<std::size_t> passed_at;
+    auto received = std::make_shared<std::size_t>(0);
+    server srv(loop, [&passed_at, received](tp::net::socket &s) {
+      s.on(DATA, [received](std::vector<char> data) {
+         *received += data.size();
+       }).on(FDS, [&passed_at, received](std::vector<int> fds) {
+        for (int fd : fds) {
+          if (::write(fd, "hello", 5) != 5)
+            break;
+          ::close(fd);
+        }
+        passed_at.set_value(*received);
+      });
+    });
+    srv.on(LISTENING, []() {});
+    srv.listen_unix(path);
+
+    int p[2];
+    REQUIRE(::pipe(p) == 0);
+    tp::net::socket client(loop);
+    client.on(DATA, [](std::string) {})
+        .on(CONNECT,
+            [&]() {
+              client.write(std::vector<char>(before, 'f'));
+              client.send_fds({p[1]}, "!");
+              ::close(p[1]);
+            })
+        .connect_unix(path);
+    auto f = passed_at.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    // the descriptor comes with the read that has the first byte after the
+    // queued data
+    auto at = f.get();
+    REQUIRE(at <= before);
+    REQUIRE(at + 4096 > before);
+    char buf[8] = {};
+    REQUIRE(::read(p[0], buf, sizeof(buf)) == 5);
+    REQUIRE(std::string(buf) == "hello");
+    ::close(p[0]);
+  }
+  SECTION("each queued message carries its own descriptors") {
+    const std::size_t before = 4 * 1024 * 1024;
+    std::promise<void> both;
+    auto received = std::make_shared<std::size_t>(0);
+    auto passed = std::make_shared<int>(0);
+    server srv(loop, [&both, received, passed](tp::net::socket &s) {
+      s.on(DATA, [received](std::vector<char> data) {
+         *received += data.size();
+       }).on(FDS, [&both, received, passed](std::vector<int> fds) {
+        // tells where in the stream the descriptor came
+        auto at = std::to_string(*received);
+        for (int fd : fds) {
+          if (::write(fd, at.data(), at.size()) != (long)at.size())
+            break;
+          ::close(fd);
+        }
+        if (++*passed == 2)
+          both.set_value();
+      });
+    });
+    srv.on(LISTENING, []() {});
+    srv.listen_unix(path);
+
+    int a[2], b[2];
+    REQUIRE(::pipe(a) == 0);
+    REQUIRE(::pipe(b) == 0);
+    tp::net::socket client(loop);
+    client.on(DATA, [](std::string) {})
+        .on(CONNECT,
+            [&]() {
+              client.write(std::vector<char>(before, 'f'));
+              client.send_fds({a[1]}, "aaaaaaaaaa");
+              client.send_fds({b[1]}, "bbbbbbbbbb");
+              ::close(a[1]);
+              ::close(b[1]);
+            })
+        .connect_unix(path);
+    auto f = both.get_future();
+    REQUIRE(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    auto position = [](int fd) {
+      char buf[32] = {};
+      long n = ::read(fd, buf, sizeof(buf) - 1);
+      ::close(fd);
+      return (n > 0) ? std::stoul(std::string(buf, n)) : 0ul;
+    };
+    // the read that ends with "aaaaaaaaaa" brings its descriptor, and the
+    // next one starts with "bbbbbbbbbb"
+    auto at_a = position(a[0]);
+    REQUIRE(at_a <= before);
+    REQUIRE(at_a + 4096 > before);
+    REQUIRE(position(b[0]) == before + 10);
+  }
+}
@@ -0,0 +1,306 @@
+#include <tepsoc_ws.hpp>
+
+#include "fake_network.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+using namespace tp;
+using namespace tp::net;
+
+static const std::string upgrade_request =
+    "GET /chat?room=1 HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: keep-alive, Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+static const std::string upgrade_response =
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+    "\r\n";
+
+/**
+ * frame as sent by a client, masked
+ * */
+static std::string client_frame(ws_opcode opcode, std::string_view payload,
+                                bool fin = true) {
+  ws_frame frame;
+  frame.opcode = opcode;
+  frame.fin = fin;
+  frame.masked = true;
+  unsigned char key[4] = {0x37, 0xfa, 0x21, 0x3d};
+  std::memcpy(frame.mask, key, 4);
+  frame.payload = payload;
+  encode_buffer out;
+  ws_frame_codec().encode(frame, out);
+  return std::string(out.data(), out.size());
+}
+
+/**
+ * frame as sent by the server, not masked
+ * */
+static std::string server_frame(ws_opcode opcode, std::string_view payload) {
+  ws_frame frame;
+  frame.opcode = opcode;
+  frame.payload = payload;
+  encode_buffer out;
+  ws_frame_codec().encode(frame, out);
+  return std::string(out.data(), out.size());
+}
+
+static std::string close_frame(int code) {
+  return server_frame(WS_CLOSE, std::string{(char)(code >> 8), (char)code});
+}
+
+TEST_CASE("websocket masking", "[websocket]") {
+  const unsigned char key[4] = {0x12, 0x34, 0x56, 0x78};
+  std::vector<char> src(300), dst(304), expected(300);
+  for (std::size_t i = 0; i < src.size(); i++)
+    src[i] = (char)(i * 7 + 3);
+  // every tail length, key phase and misalignment of the vector code
+  for (std::size_t size : {0, 1, 3, 4, 7, 15, 16, 17, 31, 32, 33, 63, 64, 65,
+                           100, 127, 128, 129, 255, 299})
+    for (std::size_t offset = 0; offset < 4; offset++)
+      for (std::size_t align = 0; align < 4; align++) {
+        for (std::size_t i = 0; i < size; i++)
+          expected[i] = src[i] ^ key[(offset + i) & 3];
+        websocket_mask(dst.data() + align, src.data(), size, key, offset);
+        REQUIRE(std::equal(expected.begin(), expected.begin() + size,
+                           dst.begin() + align));
+        // in place, masking twice gives the data back
+        websocket_mask(dst.data() + align, dst.data() + align, size, key,
+                       offset);
+        REQUIRE(std::equal(src.begin(), src.begin() + size,
+                           dst.begin() + align));
+      }
+  std::string name = websocket_mask_implementation();
+  REQUIRE((name == "avx2" || name == "sse2" || name == "scalar"));
+}
+
+TEST_CASE("websocket frames", "[websocket]") {
+  SECTION("accept key from RFC 6455") {
+    REQUIRE(websocket_accept_key("dGhlIHNhbXBsZSBub25jZQ==") ==
+            "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+  }
+  SECTION("lengths of the three sizes") {
+    for (std::size_t size : {0, 125, 126, 65535, 65536, 100000}) {
+      std::string payload(size, 'x');
+      std::string data = client_frame(WS_BINARY, payload);
+      ws_frame frame;
+      REQUIRE(ws_frame_codec().decode(data.data(), data.size() - 1, frame) ==
+              0);
+      REQUIRE(ws_frame_codec().decode(data.data(), data.size(), frame) ==
+              data.size());
+      REQUIRE(frame.fin);
+      REQUIRE(frame.masked);
+      REQUIRE(frame.opcode == WS_BINARY);
+      std::string plain(frame.payload.size(), '\0');
+      websocket_mask(plain.data(), frame.payload.data(), plain.size(),
+                     frame.mask);
+      REQUIRE(plain == payload);
+    }
+  }
+  SECTION("frames split between reads") {
+    std::string data = client_frame(WS_TEXT, "hel", false) +
+                       client_frame(WS_CONTINUATION, std::string(300, 'o'));
+    decoder<ws_frame_codec> in;
+    std::vector<std::size_t> sizes;
+    for (char c : data)
+      in.feed(&c, 1, [&](ws_frame &f) { sizes.push_back(f.payload.size()); });
+    REQUIRE(sizes == std::vector<std::size_t>{3, 300});
+    REQUIRE(in.pending() == 0);
+  }
+  SECTION("too long frame") {
+    ws_frame_codec codec;
+    codec.max_payload = 100;
+    std::string data = client_frame(WS_TEXT, std::string(101, 'a'));
+    ws_frame frame;
+    REQUIRE_THROWS_AS(codec.decode(data.data(), data.size(), frame),
+                      ws_frame_too_big);
+  }
+}
+
+TEST_CASE("websocket server", "[websocket]") {
+  event_loop loop;
+  loop.start();
+  std::promise<int> closed;
+  std::atomic<int> connections(0);
+  std::string path;
+  websocket_server srv(loop, [&](websocket &ws) {
+    connections++;
+    path = ws.get_path() + " " + ws.get_header("host");
+    ws.on_message([&ws](ws_opcode opcode, std::string_view data) {
+        ws.send(opcode, data);
+      }).on_close([&closed](int code, std::string_view) {
+      closed.set_value(code);
+    });
+  });
+  srv.set_max_message(1000);
+  fake_link link;
+  srv.get_server().adopt(link.server_end());
+  auto closed_code = [&closed]() {
+    auto f = closed.get_future();
+    return f.wait_for(std::chrono::seconds(2)) == std::future_status::ready
+               ? f.get()
+               : -1;
+  };
+
+  SECTION("handshake and echo") {
+    // the first frame comes with the request
+    REQUIRE(link.inject(TO_SERVER,
+                        upgrade_request + client_frame(WS_TEXT, "hello"), 7));
+    std::string expected = upgrade_response + server_frame(WS_TEXT, "hello");
+    REQUIRE(link.take(TO_CLIENT, expected.size()) == expected);
+    REQUIRE(path == "/chat?room=1 example.com");
+    REQUIRE(srv.size() == 1);
+    std::string binary("\x00\xff", 2);
+    REQUIRE(link.inject(TO_SERVER, client_frame(WS_BINARY, binary)));
+    REQUIRE(link.take(TO_CLIENT, 4) == server_frame(WS_BINARY, binary));
+  }
+  SECTION("fragmented message with ping between the fragments") {
+    REQUIRE(link.inject(TO_SERVER, upgrade_request));
+    REQUIRE(link.take(TO_CLIENT, upgrade_response.size()) == upgrade_response);
+    REQUIRE(link.inject(TO_SERVER, client_frame(WS_TEXT, "frag", false) +
+                                       client_frame(WS_PING, "p") +
+                                       client_frame(WS_CONTINUATION, "mented",
+                                                    false) +
+                                       client_frame(WS_CONTINUATION, "!")));
+    std::string expected =
+        server_frame(WS_PONG, "p") + server_frame(WS_TEXT, "fragmented!");
+    REQUIRE(link.take(TO_CLIENT, expected.size()) == expected);
+  }
+  SECTION("closing handshake started by the client") {
+    REQUIRE(link.inject(TO_SERVER, upgrade_request));
+    REQUIRE(link.take(TO_CLIENT, upgrade_response.size()) == upgrade_response);
+    REQUIRE(link.inject(TO_SERVER, client_frame(WS_CLOSE, "\x03\xe8"
+                                                          "bye")));
+    REQUIRE(link.take(TO_CLIENT, 100) == close_frame(1000));
+    REQUIRE(link.ended(TO_CLIENT));
+    REQUIRE(closed_code() == 1000);
+    REQUIRE(srv.size() == 0);
+  }
+  SECTION("protocol errors close the connection") {
+    REQUIRE(link.inject(TO_SERVER, upgrade_request));
+    REQUIRE(link.take(TO_CLIENT, upgrade_response.size()) == upgrade_response);
+    int expected_code = 0;
+    SECTION("unmasked frame") {
+      expected_code = 1002;
+      REQUIRE(link.inject(TO_SERVER, server_frame(WS_TEXT, "x")));
+    }
+    SECTION("text that is not UTF-8") {
+      expected_code = 1007;
+      REQUIRE(link.inject(TO_SERVER, client_frame(WS_TEXT, "\xc3\x28")));
+    }
+    SECTION("message longer than the limit") {
+      expected_code = 1009;
+      REQUIRE(link.inject(TO_SERVER,
+                          client_frame(WS_TEXT, std::string(600, 'a'), false) +
+                              client_frame(WS_CONTINUATION,
+                                           std::string(600, 'a'))));
+    }
+    SECTION("continuation without message") {
+      expected_code = 1002;
+      REQUIRE(link.inject(TO_SERVER, client_frame(WS_CONTINUATION, "x")));
+    }
+    // close frame with the status and a reason
+    std::string reply = link.take(TO_CLIENT, 1000);
+    REQUIRE(reply.size() > 4);
+    REQUIRE((unsigned char)reply[0] == 0x88);
+    REQUIRE((((unsigned char)reply[2] << 8) | (unsigned char)reply[3]) ==
+            expected_code);
+    REQUIRE(link.ended(TO_CLIENT));
+    REQUIRE(closed_code() == expected_code);
+  }
+  SECTION("requests that are not upgrades") {
+    SECTION("plain GET") {
+      REQUIRE(link.inject(TO_SERVER, "GET / HTTP/1.1\r\nHost: a\r\n\r\n"));
+      REQUIRE(link.take(TO_CLIENT, 1000).substr(0, 12) == "HTTP/1.1 400");
+    }
+    SECTION("other version") {
+      std::string request = upgrade_request;
+      request.replace(request.find("Version: 13"), 11, "Version: 8");
+      REQUIRE(link.inject(TO_SERVER, request));
+      std::string response = link.take(TO_CLIENT, 1000);
+      REQUIRE(response.substr(0, 12) == "HTTP/1.1 426");
+      REQUIRE(response.find("Sec-WebSocket-Version: 13\r\n") !=
+              std::string::npos);
+    }
+    REQUIRE(link.ended(TO_CLIENT));
+    REQUIRE(connections == 0);
+  }
+}
+
+TEST_CASE("websocket broadcast", "[websocket]") {
+  event_loop loop;
+  loop.start();
+  websocket *accepted[3];
+  std::atomic<int> count(0);
+  websocket_server srv(loop, [&](websocket &ws) { accepted[count++] = &ws; });
+  fake_link a, b, c;
+  for (auto l : {&a, &b, &c}) {
+    srv.get_server().adopt(l->server_end());
+    REQUIRE(l->inject(TO_SERVER, upgrade_request));
+    REQUIRE(l->take(TO_CLIENT, upgrade_response.size()) == upgrade_response);
+  }
+  REQUIRE(srv.size() == 3);
+  // the handler runs after the response is written
+  while (count < 3)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  SECTION("one frame to every websocket") {
+    std::string news(1000, 'n');
+    REQUIRE(srv.broadcast(WS_TEXT, news).sent == 3);
+    for (auto l : {&a, &b, &c})
+      REQUIRE(l->take(TO_CLIENT, 1004) == server_frame(WS_TEXT, news));
+  }
+  SECTION("filter and closed websockets") {
+    REQUIRE(c.inject(TO_SERVER, client_frame(WS_CLOSE, "")));
+    REQUIRE(c.take(TO_CLIENT, 2) == server_frame(WS_CLOSE, ""));
+    websocket *first = accepted[0];
+    REQUIRE(srv.broadcast(WS_BINARY, "x", [first](websocket &ws) {
+      return &ws != first;
+    }).sent == 1);
+    REQUIRE(b.take(TO_CLIENT, 3) == server_frame(WS_BINARY, "x"));
+    REQUIRE(a.take(TO_CLIENT, 3, std::chrono::milliseconds(50)) == "");
+  }
+  SECTION("no frame follows the close frame") {
+    std::atomic<bool> started(false);
+    std::thread sender([&srv, &started]() {
+      for (int i = 0; i < 2000; i++) {
+        srv.broadcast(WS_TEXT, "x");
+        started = true;
+      }
+    });
+    while (!started)
+      std::this_thread::yield();
+    accepted[0]->close(1000);
+    sender.join();
+    REQUIRE(!accepted[0]->is_open());
+    std::string sent =
+        a.take(TO_CLIENT, 100000, std::chrono::milliseconds(200));
+    std::string x = server_frame(WS_TEXT, "x");
+    // only whole data frames before the close frame
+    std::string expected;
+    while (expected.size() + 4 < sent.size())
+      expected += x;
+    REQUIRE(sent == expected + close_frame(1000));
+    for (auto l : {&b, &c})
+      REQUIRE(l->take(TO_CLIENT, 2000 * x.size()).size() == 2000 * x.size());
+  }
+  SECTION("shared payload written after its header") {
+    auto payload = std::make_shared<const std::vector<char>>(70000, 'p');
+    accepted[1]->send(WS_BINARY, payload);
+    REQUIRE(b.take(TO_CLIENT, 70010) ==
+            server_frame(WS_BINARY, std::string(70000, 'p')));
+  }
+}